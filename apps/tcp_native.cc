@@ -1,16 +1,88 @@
 #include "bidirectional_stream_copy.hh"
+#include "eventloop_group.hh"
 
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <span>
 
 using namespace std;
 
 void show_usage( const char* argv0 )
 {
-  cerr << "Usage: " << argv0 << " [-l] <host> <port>\n\n"
-       << "  -l specifies listen mode; <host>:<port> is the listening address.\n";
+  cerr << "Usage: " << argv0 << " [-l | -s] <host> <port>\n\n"
+       << "  -l specifies listen mode; <host>:<port> is the listening address.\n"
+       << "  -s specifies echo-server mode: like -l, but serving any number of connections (echoing what\n"
+       << "     each one sends) from one event loop per CPU, with the loops' load reported every 10 seconds.\n";
+}
+
+// echo a connection's bytes back to it, on the loop that accepted it
+void echo_connection( EventLoop& loop, TCPSocket connection )
+{
+  static constexpr size_t max_pending = 65536;
+
+  struct Connection
+  {
+    TCPSocket socket;
+    string pending {};
+    optional<EventLoop::RuleHandle> writer {};
+  };
+
+  // each loop has its own thread, so a thread_local holds that loop's categories
+  thread_local const size_t read_category = loop.add_category( "echo read" );
+  thread_local const size_t write_category = loop.add_category( "echo write" );
+
+  auto conn = make_shared<Connection>( Connection { move( connection ) } );
+  conn->socket.set_blocking( false );
+
+  conn->writer = loop.add_rule(
+    write_category,
+    conn->socket,
+    Direction::Out,
+    [conn] {
+      conn->pending.erase( 0, conn->socket.write( conn->pending ) );
+      if ( conn->pending.empty() and conn->socket.eof() ) {
+        conn->socket.shutdown( SHUT_WR );
+        conn->writer->cancel();
+      }
+    },
+    [conn] { return not conn->pending.empty(); } );
+
+  loop.add_rule(
+    read_category,
+    conn->socket,
+    Direction::In,
+    [conn] {
+      string buffer;
+      conn->socket.read( buffer );
+      conn->pending += buffer;
+      if ( conn->pending.empty() and conn->socket.eof() ) {
+        conn->socket.shutdown( SHUT_WR );
+        conn->writer->cancel();
+      }
+    },
+    [conn] { return conn->pending.size() < max_pending; } );
+}
+
+void serve( const Address& address )
+{
+  EventLoopGroup group;
+  group.listen( address, echo_connection );
+
+  // report the load from the first loop
+  EventLoop& reporter = group.loop( 0 );
+  function<void()> report = [&] {
+    group.dump_load( cerr );
+    reporter.add_timer( chrono::steady_clock::now() + 10s, report );
+  };
+  reporter.add_timer( chrono::steady_clock::now() + 10s, report );
+
+  cerr << "DEBUG: Serving on " << address.to_string() << " with " << group.size() << " event loops...\n";
+  group.start();
+  group.join();
 }
 
 int main( int argc, char** argv )
@@ -29,6 +101,15 @@ int main( int argc, char** argv )
       return EXIT_FAILURE;
     }
 
+    if ( strncmp( "-s", args[1], 3 ) == 0 ) {
+      if ( argc < 4 ) {
+        show_usage( args[0] );
+        return EXIT_FAILURE;
+      }
+      serve( { args[2], args[3] } );
+      return EXIT_SUCCESS;
+    }
+
     // in client mode, connect; in server mode, accept exactly one connection
     auto socket = [&] {
       if ( server_mode ) {
@@ -31,6 +31,11 @@ ttest(reassembler_dup)
 ttest(reassembler_holes)
 ttest(reassembler_overlapping)
 ttest(reassembler_win)
+ttest(reassembler_sack)
+ttest(reassembler_lazy)
+ttest(reassembler_expire)
+
+ttest(fragment_reassembler)
 
 ttest(wrapping_integers_cmp)
 ttest(wrapping_integers_wrap)
@@ -58,6 +63,16 @@ ttest(net_interface)
 
 ttest(router)
 
+ttest(eventloop)
+ttest(timer_wheel)
+ttest(inline_function)
+ttest(slot_map)
+ttest(eventloop_group)
+ttest(eventloop_coro)
+ttest(tracer)
+ttest(buffer_pool)
+ttest(file_transfer)
+
 ttest(no_skip)
 
 add_custom_target (check0 COMMAND ${CMAKE_CTEST_COMMAND} --output-on-failure --stop-on-failure --timeout 15 -R 'webget|^byte_stream_|^no_skip')
@@ -92,3 +107,11 @@ set_tests_properties(${compile_name_opt} PROPERTIES FIXTURES_SETUP compile_opt)
 
 stest(byte_stream_speed_test)
 stest(reassembler_speed_test)
+stest(reassembler_replay_speed_test)
+stest(eventloop_speed_test)
+stest(eventloop_throughput_speed_test)
+stest(eventloop_latency_speed_test)
+stest(eventloop_scaling_speed_test)
+stest(file_server_speed_test)
+set_property(TEST eventloop_scaling_speed_test PROPERTY TIMEOUT 120) # (up to 100k socketpairs per backend)
+stest(timer_wheel_speed_test)
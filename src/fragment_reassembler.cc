@@ -0,0 +1,262 @@
+#include "fragment_reassembler.hh"
+
+#include "random.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+FragmentReassembler::FragmentReassembler( size_t max_datagrams,
+                                          Clock::duration timeout,
+                                          size_t max_buffer_bytes )
+  : timeout_( timeout )
+  , max_blocks_( max_buffer_bytes / kBlockSize )
+  , entries_( max_datagrams )
+  , slots_( bit_ceil( 2 * max( max_datagrams, size_t { 1 } ) ), kNone )
+  , seed_( get_random_engine()() )
+{
+  if ( max_datagrams == 0 or max_datagrams >= kNone ) {
+    throw out_of_range( "FragmentReassembler: bad max_datagrams" );
+  }
+
+  if ( max_blocks_ < kBlocksPerDatagram ) {
+    throw out_of_range( "FragmentReassembler: buffer budget cannot hold one datagram" );
+  }
+
+  free_entries_.reserve( max_datagrams );
+  for ( size_t i = max_datagrams; i > 0; --i ) {
+    free_entries_.push_back( static_cast<uint32_t>( i - 1 ) );
+  }
+}
+
+uint64_t FragmentReassembler::hash( const FragmentKey& key ) const
+{
+  // splitmix64 finalizer over the packed key, salted so that collisions can't be chosen remotely
+  uint64_t x = ( static_cast<uint64_t>( key.source ) << 24 ) ^ ( static_cast<uint64_t>( key.id ) << 8 )
+               ^ key.protocol ^ seed_;
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL; // NOLINT(*-magic-numbers)
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL; // NOLINT(*-magic-numbers)
+  x ^= x >> 31;
+  return x;
+}
+
+// the slot holding `key`, or else the empty slot where it would go
+size_t FragmentReassembler::find_slot( const FragmentKey& key, uint64_t key_hash ) const
+{
+  const size_t mask = slots_.size() - 1;
+  for ( size_t slot = key_hash & mask;; slot = ( slot + 1 ) & mask ) {
+    if ( slots_[slot] == kNone or entries_[slots_[slot]].key == key ) {
+      return slot;
+    }
+  }
+}
+
+uint32_t FragmentReassembler::create( const FragmentKey& key,
+                                      uint64_t key_hash,
+                                      size_t slot,
+                                      Clock::time_point now )
+{
+  const uint32_t index = free_entries_.back();
+  free_entries_.pop_back();
+
+  Partial& partial = entries_[index];
+  partial.key = key;
+  partial.hash = key_hash;
+  partial.first_arrival = now;
+  partial.older = newest_;
+  partial.newer = kNone;
+  if ( newest_ != kNone ) {
+    entries_[newest_].newer = index;
+  } else {
+    oldest_ = index;
+  }
+  newest_ = index;
+
+  slots_[slot] = index;
+  ++datagrams_pending_;
+  return index;
+}
+
+void FragmentReassembler::drop( uint32_t index )
+{
+  Partial& partial = entries_[index];
+
+  for ( auto& block : partial.blocks ) {
+    if ( block ) {
+      blocks_.deallocate( exchange( block, nullptr ) );
+      --blocks_in_use_;
+    }
+  }
+  partial.received.fill( 0 );
+  partial.units_received = 0;
+  partial.max_end = 0;
+  partial.total_length.reset();
+
+  // unlink from the arrival-order list
+  if ( partial.older != kNone ) {
+    entries_[partial.older].newer = partial.newer;
+  } else {
+    oldest_ = partial.newer;
+  }
+  if ( partial.newer != kNone ) {
+    entries_[partial.newer].older = partial.older;
+  } else {
+    newest_ = partial.older;
+  }
+
+  // remove from the hash table, shifting later members of the probe sequence back into the gap
+  const size_t mask = slots_.size() - 1;
+  size_t gap = find_slot( partial.key, partial.hash );
+  for ( size_t slot = ( gap + 1 ) & mask; slots_[slot] != kNone; slot = ( slot + 1 ) & mask ) {
+    const size_t home = entries_[slots_[slot]].hash & mask;
+    const bool movable = ( slot > gap ) ? ( home <= gap or home > slot ) : ( home <= gap and home > slot );
+    if ( movable ) {
+      slots_[gap] = slots_[slot];
+      gap = slot;
+    }
+  }
+  slots_[gap] = kNone;
+
+  free_entries_.push_back( index );
+  --datagrams_pending_;
+}
+
+// copy the payload into the partial's blocks, evicting older partial datagrams if the pool is full
+bool FragmentReassembler::copy_in( Partial& partial, uint64_t offset, string_view payload )
+{
+  const size_t first_block = offset / kBlockSize;
+  const size_t end_block
+    = payload.empty() ? first_block : ( offset + payload.size() + kBlockSize - 1 ) / kBlockSize;
+
+  size_t needed = 0;
+  for ( size_t b = first_block; b < end_block; ++b ) {
+    needed += partial.blocks.at( b ) == nullptr;
+  }
+
+  const auto self = static_cast<uint32_t>( &partial - entries_.data() );
+  while ( blocks_in_use_ + needed > max_blocks_ ) {
+    const uint32_t victim = ( oldest_ == self ) ? entries_[oldest_].newer : oldest_;
+    if ( victim == kNone ) {
+      return false;
+    }
+    drop( victim );
+    ++stats_.evicted;
+  }
+
+  while ( not payload.empty() ) {
+    char*& block = partial.blocks.at( offset / kBlockSize );
+    if ( not block ) {
+      block = static_cast<char*>( blocks_.allocate() );
+      ++blocks_in_use_;
+    }
+    const size_t len = min( payload.size(), kBlockSize - offset % kBlockSize );
+    memcpy( block + offset % kBlockSize, payload.data(), len );
+    payload.remove_prefix( len );
+    offset += len;
+  }
+  return true;
+}
+
+string FragmentReassembler::assemble( const Partial& partial ) const
+{
+  string datagram;
+  datagram.resize( partial.total_length.value() );
+  for ( size_t offset = 0; offset < datagram.size(); offset += kBlockSize ) {
+    memcpy( datagram.data() + offset,
+            partial.blocks.at( offset / kBlockSize ),
+            min( kBlockSize, datagram.size() - offset ) );
+  }
+  return datagram;
+}
+
+optional<string> FragmentReassembler::insert( const FragmentKey& key,
+                                              uint64_t offset,
+                                              string_view payload,
+                                              bool more_fragments,
+                                              Clock::time_point now )
+{
+  const uint64_t end = offset + payload.size();
+
+  // malformed: only the final fragment may be empty or end off an 8-byte boundary
+  if ( offset % kUnitSize or end > kMaxDatagramSize
+       or ( more_fragments and ( payload.empty() or payload.size() % kUnitSize ) ) ) {
+    ++stats_.rejected;
+    return nullopt;
+  }
+
+  const uint64_t key_hash = hash( key );
+  size_t slot = find_slot( key, key_hash );
+
+  // an unfragmented datagram needs no state at all
+  if ( slots_[slot] == kNone and offset == 0 and not more_fragments ) {
+    ++stats_.completed;
+    return string { payload };
+  }
+
+  if ( slots_[slot] == kNone ) {
+    if ( free_entries_.empty() ) {
+      drop( oldest_ );
+      ++stats_.evicted;
+      slot = find_slot( key, key_hash );
+    }
+    create( key, key_hash, slot, now );
+  }
+
+  const uint32_t index = slots_[slot];
+  Partial& partial = entries_[index];
+
+  // inconsistent: a second, different end of the datagram, or bytes past its end
+  const bool past_end = partial.total_length.has_value() and end > *partial.total_length;
+  const bool new_end
+    = not more_fragments
+      and ( partial.max_end > end or ( partial.total_length.has_value() and *partial.total_length != end ) );
+  if ( past_end or new_end or not copy_in( partial, offset, payload ) ) {
+    drop( index );
+    ++stats_.rejected;
+    return nullopt;
+  }
+
+  partial.max_end = max( partial.max_end, end );
+  if ( not more_fragments ) {
+    partial.total_length = end;
+  }
+
+  // mark the 8-byte units this fragment covers, counting the ones seen for the first time
+  const uint64_t units_end = ( end + kUnitSize - 1 ) / kUnitSize;
+  for ( uint64_t unit = offset / kUnitSize; unit < units_end; ) {
+    const uint64_t bit = unit % 64;
+    const uint64_t count = min<uint64_t>( 64 - bit, units_end - unit );
+    const uint64_t mask = ( count == 64 ? ~uint64_t {} : ( ( uint64_t { 1 } << count ) - 1 ) ) << bit;
+    uint64_t& word = partial.received.at( unit / 64 );
+    partial.units_received += popcount( mask & ~word );
+    word |= mask;
+    unit += count;
+  }
+
+  if ( partial.total_length.has_value()
+       and partial.units_received == ( *partial.total_length + kUnitSize - 1 ) / kUnitSize ) {
+    string datagram = assemble( partial );
+    drop( index );
+    ++stats_.completed;
+    return datagram;
+  }
+
+  return nullopt;
+}
+
+size_t FragmentReassembler::expire( Clock::time_point now )
+{
+  size_t count = 0;
+  while ( oldest_ != kNone and now - entries_[oldest_].first_arrival >= timeout_ ) {
+    drop( oldest_ );
+    ++count;
+  }
+  stats_.expired += count;
+  return count;
+}
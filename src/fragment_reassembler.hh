@@ -0,0 +1,119 @@
+#pragma once
+
+#include "segment_arena.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Identifies the datagram a fragment belongs to (as in IPv4: source address, identification, protocol).
+struct FragmentKey
+{
+  uint32_t source {};
+  uint16_t id {};
+  uint8_t protocol {};
+
+  bool operator==( const FragmentKey& other ) const = default;
+};
+
+/*
+ * Reassembles fragmented datagrams, holding many partial datagrams at once.
+ *
+ * All state is bounded up front, so that a flood of fragments cannot exhaust memory or CPU:
+ *   - partial datagrams live in a fixed table of `max_datagrams` entries, found through an
+ *     open-addressing hash table (with a per-instance random seed);
+ *   - fragment bytes are copied into fixed-size blocks from a shared pool of at most
+ *     `max_buffer_bytes`;
+ *   - a partial datagram is dropped `timeout` after its first fragment arrived, and when the
+ *     table or the pool is full, the oldest partial datagram is evicted to make room.
+ * Each fragment costs O(1) table work plus time proportional to its length.
+ */
+class FragmentReassembler
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr size_t kMaxDatagramSize = 65535;
+  static constexpr size_t kBlockSize = 2048;
+  static constexpr size_t kUnitSize = 8; // fragment offsets are multiples of 8 bytes
+
+  FragmentReassembler( size_t max_datagrams, Clock::duration timeout, size_t max_buffer_bytes = 4194304 );
+
+  /*
+   * Add a fragment of the datagram identified by `key`.
+   *   `offset`: the byte offset of `payload` within the datagram (a multiple of 8)
+   *   `more_fragments`: false only for the final fragment
+   *   `now`: the arrival time
+   *
+   * Returns the whole datagram payload once every fragment has arrived. Malformed fragments
+   * are dropped; a fragment that disagrees with what is known of the datagram's length drops
+   * the whole partial datagram.
+   */
+  std::optional<std::string> insert( const FragmentKey& key,
+                                     uint64_t offset,
+                                     std::string_view payload,
+                                     bool more_fragments,
+                                     Clock::time_point now );
+
+  // Drop every partial datagram whose first fragment arrived at least `timeout` before `now`.
+  // Returns how many were dropped; the cost is proportional to that number.
+  size_t expire( Clock::time_point now );
+
+  size_t datagrams_pending() const { return datagrams_pending_; }
+  size_t bytes_buffered() const { return blocks_in_use_ * kBlockSize; }
+
+  struct Stats
+  {
+    uint64_t completed {}; // datagrams reassembled
+    uint64_t expired {};   // partial datagrams dropped by expire()
+    uint64_t evicted {};   // partial datagrams dropped to make room
+    uint64_t rejected {};  // fragments dropped as malformed or inconsistent
+  };
+
+  const Stats& stats() const { return stats_; }
+
+private:
+  static constexpr size_t kBlocksPerDatagram = ( kMaxDatagramSize + kBlockSize - 1 ) / kBlockSize;
+  static constexpr size_t kUnitsPerDatagram = ( kMaxDatagramSize + kUnitSize - 1 ) / kUnitSize;
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  struct Partial
+  {
+    FragmentKey key {};
+    uint64_t hash {};
+    Clock::time_point first_arrival {};
+    uint32_t older { kNone }; // arrival-order list links
+    uint32_t newer { kNone };
+    uint64_t units_received {};
+    uint64_t max_end {}; // one past the last byte of any fragment so far
+    std::optional<uint64_t> total_length {};
+    std::array<char*, kBlocksPerDatagram> blocks {};
+    std::array<uint64_t, ( kUnitsPerDatagram + 63 ) / 64> received {}; // one bit per 8-byte unit
+  };
+
+  Clock::duration timeout_;
+  size_t max_blocks_;
+  BlockPool blocks_ { kBlockSize };
+  size_t blocks_in_use_ {};
+
+  std::vector<Partial> entries_;
+  std::vector<uint32_t> free_entries_ {};
+  std::vector<uint32_t> slots_; // hash table of entry indices (kNone when empty), linear probing
+  uint64_t seed_;
+
+  uint32_t oldest_ { kNone };
+  uint32_t newest_ { kNone };
+  size_t datagrams_pending_ {};
+  Stats stats_ {};
+
+  uint64_t hash( const FragmentKey& key ) const;
+  size_t find_slot( const FragmentKey& key, uint64_t key_hash ) const;
+  uint32_t create( const FragmentKey& key, uint64_t key_hash, size_t slot, Clock::time_point now );
+  void drop( uint32_t index );
+  bool copy_in( Partial& partial, uint64_t offset, std::string_view payload );
+  std::string assemble( const Partial& partial ) const;
+};
@@ -1,89 +1,257 @@
 #include "reassembler.hh"
 #include "debug.hh"
+#include "reassembler_trace.hh"
+#include <algorithm>
 #include <iterator>
-#include <fstream>
-#include <vector>
-#include <iostream>
 using namespace std;
 
+// Members are assigned in declaration order, so a defaulted assignment would replace node_pool_ (freeing
+// the old pool) before pending_ handed its old nodes back to that pool. The nodes go back first.
+Reassembler& Reassembler::operator=( Reassembler&& other )
+{
+  if ( this == &other ) {
+    return *this;
+  }
+
+  pending_.clear();
+  staged_.clear();
+  output_ = std::move( other.output_ );
+  pending_ = std::move( other.pending_ ); // (takes other's allocator, which draws from other's pool)
+  node_pool_ = std::move( other.node_pool_ );
+  staged_ = std::move( other.staged_ );
+  oldest_ = exchange( other.oldest_, nullptr );
+  newest_ = exchange( other.newest_, nullptr );
+  arena_ = std::move( other.arena_ );
+  next_byte_ = other.next_byte_;
+  last_index_ = other.last_index_;
+  is_last_received_ = other.is_last_received_;
+  lazy_merge_ = other.lazy_merge_;
+  latest_arrival_ = other.latest_arrival_;
+  recorder_ = other.recorder_;
+  return *this;
+}
+
 void Reassembler::insert( uint64_t first_index, string data, bool is_last_substring )
 {
+  insert_segment( first_index, data, is_last_substring, nullopt );
+}
+
+void Reassembler::insert( uint64_t first_index, string data, bool is_last_substring, Clock::time_point arrival )
+{
+  insert_segment( first_index, data, is_last_substring, arrival );
+}
+
+void Reassembler::insert_segment( uint64_t first_index,
+                                  string& data,
+                                  bool is_last_substring,
+                                  optional<Clock::time_point> arrival )
+{
+  if ( recorder_ ) {
+    recorder_->record( first_index, data, is_last_substring );
+  }
+
   //keep track of if the last string received and the last expected index
   if(is_last_substring){
     is_last_received_ = true;
     last_index_ = first_index + data.size();
   }
 
-  //if the ending index of the current string is smaller than the next expected byte, we can discard this string
-  if(first_index + data.size() < next_byte_){
+  //1. check the boundary and only keep the part of data inside [next_byte_, next_byte_ + available capacity)
+  const uint64_t window_end = next_byte_ + output_.writer().available_capacity();
+  const uint64_t first = std::max( next_byte_, first_index );
+  const uint64_t last = std::min( window_end, first_index + data.size() );
+
+  if ( first < last ) {
+    if ( first == next_byte_ ) {
+      //2a. the data continues the stream: trim it in place (no copy), append any stored bytes
+      //    it now joins up with, and hand everything to the stream in one push
+      data.resize( last - first_index );
+      data.erase( 0, first - first_index );
+      next_byte_ = last;
+      coalesce();
+      flush_into( data );
+      output_.writer().push( std::move( data ) );
+    } else {
+      // out of order: note when the bytes arrived (never earlier than anything stored before)
+      latest_arrival_ = std::max( latest_arrival_, arrival ? *arrival : Clock::now() );
+      const string_view bytes = string_view( data ).substr( first - first_index, last - first );
+      if ( lazy_merge_ ) {
+        //2b. lazy: copy the bytes and just note the extent for later
+        arena_.write( first, bytes );
+        staged_.push_back( { first, last, latest_arrival_ } );
+        if ( staged_.size() >= kMaxStagedRanges ) {
+          coalesce();
+        }
+      } else {
+        //2c. eager: copy the bytes into the arena and merge the range right away
+        store( first, bytes, latest_arrival_ );
+      }
+    }
+  }
+
+  if ( is_last_received_ && next_byte_ >= last_index_) {
+    output_.writer().close();
+  }
+}
+
+uint64_t Reassembler::expire( Clock::time_point now, Clock::duration max_age )
+{
+  coalesce();
+
+  uint64_t dropped = 0;
+  while ( oldest_ && now - oldest_->second.arrival >= max_age ) {
+    const auto it = pending_.find( oldest_->first );
+
+    // give back the pages of the range that no neighbouring range shares
+    const uint64_t lower = ( it == pending_.begin() ) ? 0 : std::prev( it )->second.last;
+    const uint64_t upper = ( std::next( it ) == pending_.end() ) ? UINT64_MAX : std::next( it )->first;
+    arena_.release_range( it->first, it->second.last, lower, upper );
+
+    dropped += it->second.last - it->first;
+    erase( it );
+  }
+  return dropped;
+}
+
+// the stored range containing `index`, or else the first one after it
+Reassembler::PendingMap::const_iterator Reassembler::first_range_ending_after( uint64_t index ) const
+{
+  auto it = pending_.upper_bound( index );
+  if ( it != pending_.begin() && std::prev( it )->second.last > index ) {
+    --it;
+  }
+  return it;
+}
+
+void Reassembler::store( uint64_t first_index, string_view data, Clock::time_point arrival )
+{
+  const uint64_t first = first_index;
+  const uint64_t last = first_index + data.size();
+
+  // skip the copy if a stored range already holds all of [first, last)
+  auto it = pending_.upper_bound( first );
+  if ( it != pending_.begin() && std::prev( it )->first <= first && std::prev( it )->second.last >= last ) {
     return;
   }
 
-  //1. check the boundary and only leave the valid parts of data
-  uint64_t last_valid_index = next_byte_ + output_.writer().available_capacity() - 1;
-  uint64_t new_start = std::max(next_byte_,first_index);
-  uint64_t new_end = std::min(last_valid_index,first_index+data.size()-1);
+  arena_.write( first_index, data );
+  add_range( first, last, arrival );
+}
 
-  data = data.substr(new_start-first_index,new_end-new_start+1);
+// append a node to the arrival-order list, after `older` (or at the front if it is null)
+void Reassembler::link_after( Node* node, Node* older ) const
+{
+  Node* newer = older ? older->second.newer : oldest_;
+  node->second.older = older;
+  node->second.newer = newer;
+  ( older ? older->second.newer : oldest_ ) = node;
+  ( newer ? newer->second.older : newest_ ) = node;
+}
 
+void Reassembler::unlink( Node* node ) const
+{
+  Extent& extent = node->second;
+  ( extent.older ? extent.older->second.newer : oldest_ ) = extent.newer;
+  ( extent.newer ? extent.newer->second.older : newest_ ) = extent.older;
+}
+
+Reassembler::PendingMap::iterator Reassembler::erase( PendingMap::iterator it ) const
+{
+  unlink( &*it );
+  return pending_.erase( it );
+}
 
-  //2. merge the data into the stream
-  auto it = m.lower_bound(new_start);
-  //merge current data with overlaping data whose start_index is larger or equal to first_index
-  for(auto cur = it; cur != m.end(); ){
-    if(cur->first <= new_end){
-      //It's possible that the end of the cur is smaller than new_end, which may cause "new_end-cur->first+1" larger than cur->second.size().
-      //This is a subtle error and we need to compare them and use the smaller one.
-      uint64_t cut_idx = std::min<uint64_t>( new_end - cur->first + 1, cur->second.size() );
-      data += cur->second.substr( cut_idx );
-      new_end = std::max(new_end,cur->first + cur->second.size()-1);
-      cur = m.erase(cur);
+// merge [first, last) with every stored range that overlaps or touches it
+void Reassembler::add_range( uint64_t first, uint64_t last, Clock::time_point arrival ) const
+{
+  auto it = pending_.upper_bound( first );
+  if ( it != pending_.begin() && std::prev( it )->second.last >= first ) {
+    --it;
+  }
+
+  // the merged range keeps the node (and arrival-list place) of the oldest range it absorbs
+  auto oldest = pending_.end();
+  for ( auto joined = it; joined != pending_.end() && joined->first <= last; ++joined ) {
+    if ( oldest == pending_.end() || joined->second.arrival < oldest->second.arrival ) {
+      oldest = joined;
     }
-    else{
-      break;
+  }
+
+  if ( oldest == pending_.end() ) {
+    // nothing to merge with: a new range, which goes at the back of the arrival list
+    if ( newest_ ) {
+      arrival = std::max( arrival, newest_->second.arrival );
     }
+    auto added = pending_.emplace_hint( it, first, Extent { last, arrival } );
+    link_after( &*added, newest_ );
+    return;
   }
 
+  while ( it != pending_.end() && it->first <= last ) {
+    first = std::min( first, it->first );
+    last = std::max( last, it->second.last );
+    it = ( it == oldest ) ? std::next( it ) : erase( it );
+  }
 
-  // merge current data with overlaping data whose start index is smaller than first index
-  std::vector<uint64_t> to_erase;
-  it = m.lower_bound(new_start);
-  auto cur = std::make_reverse_iterator(it);
+  // re-key the surviving node in place; extracting and reinserting it keeps its address
+  auto node = pending_.extract( oldest );
+  node.key() = first;
+  node.mapped().last = last;
+  pending_.insert( it, std::move( node ) );
+}
 
-  for(; cur != m.rend(); ++cur ){
-    if ( cur->first + cur->second.size() - 1 >= new_start) {
-      //if the new data is within the cur data, then we can break
-      if(new_end <= cur->first + cur->second.size()-1){
-        data = cur->second;
-        new_start = cur->first;
-        to_erase.push_back(cur->first);
-        break;
-      }
-      uint64_t cut_size = std::max<uint64_t>(new_start - cur->first,0);
-      data = cur->second.substr( 0, cut_size ) + data;
-      new_start = std::min(new_start,cur->first);
-      to_erase.push_back(cur->first);
+// sort the staged extents, join the ones that overlap or touch, and merge each run once
+void Reassembler::coalesce() const
+{
+  if ( staged_.empty() ) {
+    return;
+  }
+
+  std::sort( staged_.begin(), staged_.end(), []( const StagedRange& a, const StagedRange& b ) {
+    return a.first < b.first;
+  } );
+
+  StagedRange run = staged_.front();
+  for ( const auto& range : staged_ ) {
+    if ( range.first > run.last ) {
+      add_range( run.first, run.last, run.arrival );
+      run = range;
     } else {
-      break;
+      run.last = std::max( run.last, range.last );
+      run.arrival = std::min( run.arrival, range.arrival );
     }
   }
+  add_range( run.first, run.last, run.arrival );
 
-  for ( auto key : to_erase ) {
-    m.erase( key );
-  }
+  staged_.clear();
+}
 
-  //add the updated data to the map
-  m[new_start] = data;
+void Reassembler::set_lazy_merge( bool lazy )
+{
+  if ( lazy ) {
+    staged_.reserve( kMaxStagedRanges );
+  } else {
+    coalesce();
+  }
+  lazy_merge_ = lazy;
+}
 
-  //3. check if the beginning of the map matches the next_byte_
-  while(!m.empty() && m.begin()->first == next_byte_){
-    output_.writer().push(m.begin()->second);
-    next_byte_ += m.begin()->second.size();
-    m.erase(m.begin());
+void Reassembler::flush_into( string& data )
+{
+  while ( !pending_.empty() && pending_.begin()->first <= next_byte_ ) {
+    const uint64_t last = pending_.begin()->second.last;
+    if ( last > next_byte_ ) {
+      arena_.read( next_byte_, last - next_byte_, data );
+      next_byte_ = last;
+    }
+    erase( pending_.begin() );
   }
 
-  if ( is_last_received_ && next_byte_ >= last_index_) {
-    output_.writer().close();
+  //3. give back the arena pages the stream has moved past (all of them, once the window drains)
+  if ( pending_.empty() ) {
+    arena_.reset( next_byte_ );
+  } else {
+    arena_.release_before( next_byte_ );
   }
 }
 
@@ -91,10 +259,38 @@ void Reassembler::insert( uint64_t first_index, string data, bool is_last_substr
 // This function is for testing only; don't add extra state to support it.
 uint64_t Reassembler::count_bytes_pending() const
 {
-  // return static_cast<uint64_t>(pending_byte_size_);
-  u_int64_t cnt = 0;
-  for(auto it = m.begin(); it != m.end(); ++it){
-    cnt += it->second.size();
+  coalesce();
+  uint64_t cnt = 0;
+  for ( const auto& [first, extent] : pending_ ) {
+    cnt += extent.last - first;
   }
   return cnt;
 }
+
+size_t Reassembler::received_ranges( span<Range> out, uint64_t from ) const
+{
+  coalesce();
+  from = std::max( from, next_byte_ );
+
+  size_t count = 0;
+  for ( auto it = first_range_ending_after( from ); it != pending_.end() && count < out.size(); ++it ) {
+    out[count++] = { std::max( it->first, from ), it->second.last };
+  }
+  return count;
+}
+
+size_t Reassembler::holes( span<Range> out, uint64_t from ) const
+{
+  coalesce();
+  from = std::max( from, next_byte_ );
+
+  size_t count = 0;
+  uint64_t hole_start = from;
+  for ( auto it = first_range_ending_after( from ); it != pending_.end() && count < out.size(); ++it ) {
+    if ( it->first > hole_start ) {
+      out[count++] = { hole_start, it->first };
+    }
+    hole_start = it->second.last;
+  }
+  return count;
+}
@@ -2,15 +2,31 @@
 
 
 #include "byte_stream.hh"
+#include "segment_arena.hh"
+#include <chrono>
+#include <functional>
 #include <map>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <vector>
+
+class TraceRecorder;
 
 class Reassembler
 {
 public:
   // Construct Reassembler to write into given ByteStream.
   explicit Reassembler( ByteStream&& output )
-    : output_( std::move( output ) ), m(), next_byte_( 0 ), pending_byte_size_(0), last_index_(0), is_last_received_(false) {}
+    : output_( std::move( output ) )
+    , node_pool_( std::make_unique<BlockPool>( kNodeBlockSize ) )
+    , pending_( PendingMap::allocator_type { node_pool_.get() } )
+    , arena_()
+    , next_byte_( 0 )
+    , last_index_( 0 )
+    , is_last_received_( false )
+  {}
 
   /*
    * Insert a new substring to be reassembled into a ByteStream.
@@ -34,10 +50,55 @@ public:
    */
   void insert( uint64_t first_index, std::string data, bool is_last_substring );
 
+  /*
+   * Expiry of stale out-of-order data. Each stored range remembers when its oldest byte
+   * arrived (read from Clock on insert, or given explicitly with the overload below; arrival
+   * times are never allowed to go backwards). `expire` drops every stored range that arrived
+   * at least `max_age` before `now` and returns the number of bytes dropped. Ranges are kept in
+   * arrival order, so the cost depends only on how many ranges are dropped, not on how many
+   * are stored. (In lazy mode, a range that is only merged some time after it arrived may be
+   * treated as having arrived as late as the newest range stored before it.)
+   */
+  using Clock = std::chrono::steady_clock;
+  void insert( uint64_t first_index, std::string data, bool is_last_substring, Clock::time_point arrival );
+  uint64_t expire( Clock::time_point now, Clock::duration max_age );
+
   // How many bytes are stored in the Reassembler itself?
   // This function is for testing only; don't add extra state to support it.
   uint64_t count_bytes_pending() const;
 
+  // A half-open range [first, last) of stream indices.
+  struct Range
+  {
+    uint64_t first;
+    uint64_t last;
+  };
+
+  /*
+   * Selective-acknowledgement queries. Each fills `out` with up to `out.size()` ranges, in
+   * increasing order, that lie at or after `from` (clamped to the next byte the Reassembler
+   * needs), and returns how many were written. Neither allocates.
+   *
+   * `received_ranges` reports bytes that are stored internally; `holes` reports the missing
+   * bytes between the next needed byte and the end of the last stored range. To page through
+   * a long list, call again with `from` set to the `last` of the final range returned.
+   */
+  size_t received_ranges( std::span<Range> out, uint64_t from = 0 ) const;
+  size_t holes( std::span<Range> out, uint64_t from = 0 ) const;
+
+  /*
+   * Lazy merging: when enabled, an out-of-order insert only copies its bytes and records its
+   * extent. Recorded extents are sorted and coalesced in one pass when the hole at the next
+   * needed byte closes, when kMaxStagedRanges have built up, or when a query needs them.
+   * This saves repeated merge work when many segments arrive out of order in a wide window.
+   */
+  void set_lazy_merge( bool lazy );
+  bool lazy_merge() const { return lazy_merge_; }
+
+  // Record every insert (before any trimming) to `recorder`, or stop recording if it is null.
+  // The recorder must outlive the Reassembler or be detached first.
+  void set_trace_recorder( TraceRecorder* recorder ) { recorder_ = recorder; }
+
   // Access output stream reader
   Reader& reader() { return output_.reader(); }
   const Reader& reader() const { return output_.reader(); }
@@ -45,11 +106,67 @@ public:
   // Access output stream writer, but const-only (can't write from outside)
   const Writer& writer() const { return output_.writer(); }
 
+  // A Reassembler can be moved, but not copied (it owns its pending storage)
+  ~Reassembler() = default;
+  Reassembler( const Reassembler& other ) = delete;
+  Reassembler& operator=( const Reassembler& other ) = delete;
+  Reassembler( Reassembler&& other ) = default;
+  Reassembler& operator=( Reassembler&& other ); // (not defaulted: see reassembler.cc)
+
 private:
+  struct Extent;
+  using Node = std::pair<const uint64_t, Extent>;
+
+  // A stored range, from its key (the first index) up to `last`. Ranges never overlap or touch.
+  struct Extent
+  {
+    uint64_t last;
+    Clock::time_point arrival; // when the range's oldest byte arrived
+    Node* older {};            // arrival-order list links
+    Node* newer {};
+  };
+
+  // an extent recorded in lazy mode but not yet merged
+  struct StagedRange
+  {
+    uint64_t first;
+    uint64_t last;
+    Clock::time_point arrival;
+  };
+
+  using PendingMap = std::map<uint64_t, Extent, std::less<>, PoolAllocator<Node>>;
+
+  // a red-black tree node is a colour word and three links, followed by the value
+  static constexpr size_t kNodeBlockSize = 4 * sizeof( void* ) + sizeof( Node );
+
+  // in lazy mode, how many extents may be recorded before they are coalesced
+  static constexpr size_t kMaxStagedRanges = 256;
+
   ByteStream output_;
-  std::map < uint64_t, std::string> m;
+  std::unique_ptr<BlockPool> node_pool_; // on the heap, so the map's allocator stays valid across moves
+  // the stored ranges are coalesced on demand by const queries in lazy mode
+  mutable PendingMap pending_;
+  mutable std::vector<StagedRange> staged_ {}; // recorded but not yet merged into pending_ (lazy mode)
+  mutable Node* oldest_ {};                    // ends of the arrival-order list of stored ranges
+  mutable Node* newest_ {};
+  SegmentArena arena_; // bytes of the stored ranges
   uint64_t next_byte_;
-  int pending_byte_size_;
   uint64_t last_index_;
   bool is_last_received_;
+  bool lazy_merge_ {};
+  Clock::time_point latest_arrival_ {};
+  TraceRecorder* recorder_ {};
+
+  void insert_segment( uint64_t first_index,
+                       std::string& data,
+                       bool is_last_substring,
+                       std::optional<Clock::time_point> arrival );
+  PendingMap::const_iterator first_range_ending_after( uint64_t index ) const;
+  void store( uint64_t first_index, std::string_view data, Clock::time_point arrival );
+  void add_range( uint64_t first, uint64_t last, Clock::time_point arrival ) const;
+  void link_after( Node* node, Node* older ) const;
+  void unlink( Node* node ) const;
+  PendingMap::iterator erase( PendingMap::iterator it ) const;
+  void coalesce() const;
+  void flush_into( std::string& data );
 };
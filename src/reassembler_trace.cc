@@ -0,0 +1,180 @@
+#include "reassembler_trace.hh"
+
+#include "exception.hh"
+
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+
+using namespace std;
+using namespace reassembler_trace;
+
+namespace {
+
+void put_varint( string& out, uint64_t value )
+{
+  while ( value >= 0x80 ) {                                       // NOLINT(*-magic-numbers)
+    out.push_back( static_cast<char>( ( value & 0x7F ) | 0x80 ) ); // NOLINT(*-magic-numbers, *-signed-bitwise)
+    value >>= 7;                                                   // NOLINT(*-magic-numbers)
+  }
+  out.push_back( static_cast<char>( value ) );
+}
+
+void put_u64( string& out, uint64_t value )
+{
+  for ( unsigned i = 0; i < 8; ++i ) {
+    out.push_back( static_cast<char>( value >> ( 8 * i ) ) );
+  }
+}
+
+uint64_t get_u64( const uint8_t* p )
+{
+  uint64_t value = 0;
+  for ( unsigned i = 0; i < 8; ++i ) {
+    value |= static_cast<uint64_t>( p[i] ) << ( 8 * i ); // NOLINT(*-pointer-arithmetic)
+  }
+  return value;
+}
+
+} // namespace
+
+uint64_t reassembler_trace::payload_hash( string_view payload )
+{
+  uint64_t hash = 0xcbf29ce484222325ULL; // NOLINT(*-magic-numbers)
+  for ( const char c : payload ) {
+    hash ^= static_cast<uint8_t>( c );
+    hash *= 0x100000001b3ULL; // NOLINT(*-magic-numbers)
+  }
+  return hash;
+}
+
+TraceRecorder::TraceRecorder( const string& filename, uint32_t flags )
+  : file_( CheckSystemCall( "open", open( filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) ) // NOLINT
+  , flags_( flags )
+{
+  buffer_.reserve( kFlushThreshold + 64 );
+  buffer_.append( kMagic );
+  for ( unsigned i = 0; i < 4; ++i ) {
+    buffer_.push_back( static_cast<char>( flags_ >> ( 8 * i ) ) );
+  }
+  buffer_.append( 4, '\0' );
+}
+
+TraceRecorder::~TraceRecorder()
+{
+  try {
+    flush();
+  } catch ( const exception& e ) {
+    // don't throw an exception from the destructor
+    cerr << "Exception flushing TraceRecorder: " << e.what() << "\n";
+  }
+}
+
+void TraceRecorder::record( uint64_t first_index, string_view data, bool is_last_substring )
+{
+  const int64_t delta = static_cast<int64_t>( first_index - previous_first_index_ );
+  put_varint( buffer_, ( static_cast<uint64_t>( delta ) << 1 ) ^ static_cast<uint64_t>( delta >> 63 ) ); // zigzag
+  put_varint( buffer_, data.size() );
+  buffer_.push_back( static_cast<char>( is_last_substring ) );
+  if ( flags_ & kHasPayloadHash ) {
+    put_u64( buffer_, payload_hash( data ) );
+  }
+
+  previous_first_index_ = first_index;
+  ++records_;
+
+  if ( buffer_.size() >= kFlushThreshold ) {
+    flush();
+  }
+}
+
+void TraceRecorder::flush()
+{
+  string_view remaining = buffer_;
+  while ( not remaining.empty() ) {
+    remaining.remove_prefix( file_.write( remaining ) );
+  }
+  buffer_.clear();
+}
+
+TraceReader::TraceReader( const string& filename )
+  : file_( CheckSystemCall( "open", open( filename.c_str(), O_RDONLY ) ) ) // NOLINT(*-vararg)
+  , size_( file_.size() )
+{
+  if ( size_ < kHeaderSize ) {
+    throw runtime_error( "trace file too short: " + filename );
+  }
+
+  void* map = mmap( nullptr, size_, PROT_READ, MAP_PRIVATE, file_.fd_num(), 0 );
+  if ( map == MAP_FAILED ) { // NOLINT(*-cstyle-cast)
+    throw unix_error { "mmap" };
+  }
+  map_ = static_cast<const uint8_t*>( map );
+  madvise( map, size_, MADV_SEQUENTIAL );
+
+  if ( string_view( reinterpret_cast<const char*>( map_ ), kMagic.size() ) != kMagic ) { // NOLINT(*-reinterpret-cast)
+    munmap( map, size_ );
+    throw runtime_error( "not a Reassembler trace: " + filename );
+  }
+
+  for ( unsigned i = 0; i < 4; ++i ) {
+    flags_ |= static_cast<uint32_t>( map_[kMagic.size() + i] ) << ( 8 * i ); // NOLINT(*-pointer-arithmetic)
+  }
+}
+
+TraceReader::~TraceReader()
+{
+  munmap( const_cast<uint8_t*>( map_ ), size_ ); // NOLINT(*-const-cast)
+}
+
+uint64_t TraceReader::read_varint()
+{
+  uint64_t value = 0;
+  for ( unsigned shift = 0; shift < 64; shift += 7 ) { // NOLINT(*-magic-numbers)
+    if ( offset_ >= size_ ) {
+      throw runtime_error( "truncated trace record" );
+    }
+    const uint8_t byte = map_[offset_++];                           // NOLINT(*-pointer-arithmetic)
+    value |= static_cast<uint64_t>( byte & 0x7F ) << shift;         // NOLINT(*-magic-numbers, *-signed-bitwise)
+    if ( not( byte & 0x80 ) ) {                                     // NOLINT(*-magic-numbers, *-signed-bitwise)
+      return value;
+    }
+  }
+  throw runtime_error( "malformed varint in trace" );
+}
+
+bool TraceReader::next( Record& record )
+{
+  if ( offset_ >= size_ ) {
+    return false;
+  }
+
+  const uint64_t zigzag = read_varint();
+  const auto delta = static_cast<int64_t>( ( zigzag >> 1 ) ^ ( ~( zigzag & 1 ) + 1 ) );
+  record.first_index = previous_first_index_ + static_cast<uint64_t>( delta );
+  record.length = read_varint();
+
+  if ( offset_ >= size_ ) {
+    throw runtime_error( "truncated trace record" );
+  }
+  record.is_last = map_[offset_++] & 1; // NOLINT(*-pointer-arithmetic)
+
+  record.payload_hash = 0;
+  if ( flags_ & kHasPayloadHash ) {
+    if ( size_ - offset_ < 8 ) {
+      throw runtime_error( "truncated trace record" );
+    }
+    record.payload_hash = get_u64( map_ + offset_ ); // NOLINT(*-pointer-arithmetic)
+    offset_ += 8;
+  }
+
+  previous_first_index_ = record.first_index;
+  return true;
+}
+
+void TraceReader::rewind()
+{
+  offset_ = kHeaderSize;
+  previous_first_index_ = 0;
+}
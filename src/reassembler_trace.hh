@@ -0,0 +1,105 @@
+#pragma once
+
+#include "file_descriptor.hh"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+ * A compact binary trace of the substrings given to a Reassembler, for profiling with real
+ * reordering patterns.
+ *
+ * Layout: a 16-byte header (the magic "MNWTRACE", then a little-endian uint32 of flags and a
+ * reserved uint32), followed by one record per insert:
+ *   - the change in first_index from the previous record, zigzag-encoded as a varint
+ *   - the substring length, as a varint
+ *   - one byte of record flags (bit 0: is_last_substring)
+ *   - if the header has kHasPayloadHash, the 64-bit FNV-1a hash of the payload (little-endian)
+ */
+namespace reassembler_trace {
+
+static constexpr std::string_view kMagic = "MNWTRACE";
+static constexpr size_t kHeaderSize = 16;
+
+enum HeaderFlags : uint32_t
+{
+  kHasPayloadHash = 1,   // every record carries a hash of its payload
+  kSyntheticPayload = 2, // the payloads followed synthetic_byte(), so replays can check the hashes
+};
+
+struct Record
+{
+  uint64_t first_index {};
+  uint64_t length {};
+  bool is_last {};
+  uint64_t payload_hash {}; // zero unless the trace has kHasPayloadHash
+};
+
+uint64_t payload_hash( std::string_view payload );
+
+// The byte at `index` of the synthetic stream used to stand in for the payloads of a trace.
+inline char synthetic_byte( uint64_t index )
+{
+  return static_cast<char>( ( index * 0x9E3779B97F4A7C15ULL ) >> 56 ); // NOLINT(*-magic-numbers)
+}
+
+} // namespace reassembler_trace
+
+// Appends one record per Reassembler::insert to a trace file.
+class TraceRecorder
+{
+public:
+  explicit TraceRecorder( const std::string& filename, uint32_t flags = reassembler_trace::kHasPayloadHash );
+  ~TraceRecorder();
+
+  void record( uint64_t first_index, std::string_view data, bool is_last_substring );
+  void flush();
+
+  uint64_t records() const { return records_; }
+
+  TraceRecorder( const TraceRecorder& other ) = delete;
+  TraceRecorder& operator=( const TraceRecorder& other ) = delete;
+  TraceRecorder( TraceRecorder&& other ) = delete;
+  TraceRecorder& operator=( TraceRecorder&& other ) = delete;
+
+private:
+  static constexpr size_t kFlushThreshold = 65536;
+
+  FileDescriptor file_;
+  uint32_t flags_;
+  std::string buffer_ {};
+  uint64_t previous_first_index_ {};
+  uint64_t records_ {};
+};
+
+// Streams the records of a trace file, which it maps into memory.
+class TraceReader
+{
+public:
+  explicit TraceReader( const std::string& filename );
+  ~TraceReader();
+
+  uint32_t flags() const { return flags_; }
+
+  // Decode the next record into `record`; returns false at the end of the trace.
+  bool next( reassembler_trace::Record& record );
+
+  // Start again from the first record.
+  void rewind();
+
+  TraceReader( const TraceReader& other ) = delete;
+  TraceReader& operator=( const TraceReader& other ) = delete;
+  TraceReader( TraceReader&& other ) = delete;
+  TraceReader& operator=( TraceReader&& other ) = delete;
+
+private:
+  FileDescriptor file_;
+  const uint8_t* map_ {};
+  size_t size_ {};
+  size_t offset_ { reassembler_trace::kHeaderSize };
+  uint32_t flags_ {};
+  uint64_t previous_first_index_ {};
+
+  uint64_t read_varint();
+};
@@ -0,0 +1,189 @@
+#include "segment_arena.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+BlockPool::BlockPool( size_t block_size, size_t blocks_per_slab )
+  : block_size_( max( ( block_size + alignof( max_align_t ) - 1 ) & ~( alignof( max_align_t ) - 1 ), // NOLINT(*-bitwise)
+                      sizeof( FreeBlock ) ) )
+  , blocks_per_slab_( max<size_t>( blocks_per_slab, 1 ) )
+{}
+
+BlockPool::BlockPool( BlockPool&& other ) noexcept
+  : block_size_( other.block_size_ )
+  , blocks_per_slab_( other.blocks_per_slab_ )
+  , slabs_( move( other.slabs_ ) )
+  , free_list_( exchange( other.free_list_, nullptr ) )
+{}
+
+BlockPool& BlockPool::operator=( BlockPool&& other ) noexcept
+{
+  if ( this != &other ) {
+    block_size_ = other.block_size_;
+    blocks_per_slab_ = other.blocks_per_slab_;
+    slabs_ = move( other.slabs_ );
+    free_list_ = exchange( other.free_list_, nullptr );
+  }
+  return *this;
+}
+
+void BlockPool::grow()
+{
+  slabs_.emplace_back( make_unique<byte[]>( block_size_ * blocks_per_slab_ ) ); // NOLINT(*-avoid-c-arrays)
+  byte* slab = slabs_.back().get();
+
+  // thread the new blocks onto the free list so that they are handed out in address order
+  for ( size_t i = blocks_per_slab_; i > 0; --i ) {
+    auto* block = reinterpret_cast<FreeBlock*>( slab + ( i - 1 ) * block_size_ ); // NOLINT(*-reinterpret-cast)
+    block->next = free_list_;
+    free_list_ = block;
+  }
+}
+
+void* BlockPool::allocate()
+{
+  if ( not free_list_ ) {
+    grow();
+  }
+
+  FreeBlock* block = free_list_;
+  free_list_ = block->next;
+  return block;
+}
+
+void BlockPool::deallocate( void* block )
+{
+  auto* free_block = static_cast<FreeBlock*>( block );
+  free_block->next = free_list_;
+  free_list_ = free_block;
+}
+
+void BlockPool::reset()
+{
+  free_list_ = nullptr;
+  for ( auto slab = slabs_.rbegin(); slab != slabs_.rend(); ++slab ) {
+    for ( size_t i = blocks_per_slab_; i > 0; --i ) {
+      auto* block = reinterpret_cast<FreeBlock*>( slab->get() + ( i - 1 ) * block_size_ ); // NOLINT(*-reinterpret-cast)
+      block->next = free_list_;
+      free_list_ = block;
+    }
+  }
+}
+
+SegmentArena::SegmentArena() : ring_( 8, nullptr ) {}
+
+char* SegmentArena::page( uint64_t page_no ) const
+{
+  if ( page_no < base_page_ or page_no - base_page_ >= ring_.size() ) {
+    return nullptr;
+  }
+  return ring_[page_no % ring_.size()];
+}
+
+void SegmentArena::grow_ring( uint64_t min_pages )
+{
+  size_t new_size = ring_.size();
+  while ( new_size < min_pages ) {
+    new_size *= 2;
+  }
+
+  vector<char*> new_ring( new_size, nullptr );
+  for ( uint64_t page_no = base_page_; page_no < base_page_ + ring_.size(); ++page_no ) {
+    new_ring[page_no % new_size] = ring_[page_no % ring_.size()];
+  }
+  ring_ = move( new_ring );
+}
+
+char* SegmentArena::page_for_write( uint64_t page_no )
+{
+  if ( page_no < base_page_ ) {
+    throw runtime_error( "SegmentArena: write before released index" );
+  }
+
+  if ( page_no - base_page_ >= ring_.size() ) {
+    grow_ring( page_no - base_page_ + 1 );
+  }
+
+  char*& slot = ring_[page_no % ring_.size()];
+  if ( not slot ) {
+    slot = static_cast<char*>( pages_.allocate() );
+    ++pages_in_use_;
+  }
+  return slot;
+}
+
+void SegmentArena::write( uint64_t first_index, string_view data )
+{
+  while ( not data.empty() ) {
+    const uint64_t offset = first_index % kPageSize;
+    const size_t len = min<uint64_t>( data.size(), kPageSize - offset );
+    memcpy( page_for_write( first_index / kPageSize ) + offset, data.data(), len );
+    data.remove_prefix( len );
+    first_index += len;
+  }
+}
+
+void SegmentArena::read( uint64_t first_index, uint64_t len, string& out ) const
+{
+  while ( len > 0 ) {
+    const uint64_t offset = first_index % kPageSize;
+    const size_t chunk = min<uint64_t>( len, kPageSize - offset );
+    const char* src = page( first_index / kPageSize );
+    if ( not src ) {
+      throw runtime_error( "SegmentArena: read of unwritten page" );
+    }
+    out.append( src + offset, chunk );
+    len -= chunk;
+    first_index += chunk;
+  }
+}
+
+void SegmentArena::release_before( uint64_t index )
+{
+  const uint64_t new_base = index / kPageSize;
+  const uint64_t stop = min( new_base, base_page_ + ring_.size() );
+  for ( uint64_t page_no = base_page_; page_no < stop; ++page_no ) {
+    char*& slot = ring_[page_no % ring_.size()];
+    if ( slot ) {
+      pages_.deallocate( exchange( slot, nullptr ) );
+      --pages_in_use_;
+    }
+  }
+  base_page_ = max( base_page_, new_base );
+}
+
+void SegmentArena::release_range( uint64_t first, uint64_t last, uint64_t lower, uint64_t upper )
+{
+  if ( first >= last ) {
+    return;
+  }
+
+  const uint64_t stop = min( ( last - 1 ) / kPageSize + 1, base_page_ + ring_.size() );
+  for ( uint64_t page_no = max( first / kPageSize, base_page_ ); page_no < stop; ++page_no ) {
+    const uint64_t page_first = page_no * kPageSize;
+    if ( page_first < lower or page_first + kPageSize > upper ) {
+      continue;
+    }
+    char*& slot = ring_[page_no % ring_.size()];
+    if ( slot ) {
+      pages_.deallocate( exchange( slot, nullptr ) );
+      --pages_in_use_;
+    }
+  }
+}
+
+void SegmentArena::reset( uint64_t index )
+{
+  // (the pages go back one at a time: nothing to do on the in-order path, where none were taken)
+  for ( auto slot = ring_.begin(); pages_in_use_ > 0 and slot != ring_.end(); ++slot ) {
+    if ( *slot ) {
+      pages_.deallocate( exchange( *slot, nullptr ) );
+      --pages_in_use_;
+    }
+  }
+  base_page_ = max( base_page_, index / kPageSize );
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A slab of fixed-size blocks, handed out from an intrusive free list.
+// The pool only calls the heap when the free list runs dry, so at steady state
+// (as many frees as allocations) it never allocates.
+class BlockPool
+{
+public:
+  explicit BlockPool( size_t block_size, size_t blocks_per_slab = 64 );
+
+  void* allocate();              // Take a block from the free list (growing the pool if it is empty)
+  void deallocate( void* block ); // Return a block to the free list
+
+  // Return every block to the free list, in address order. Outstanding blocks become invalid.
+  void reset();
+
+  size_t block_size() const { return block_size_; }
+  size_t slab_count() const { return slabs_.size(); }
+
+  ~BlockPool() = default;
+  BlockPool( const BlockPool& other ) = delete;
+  BlockPool& operator=( const BlockPool& other ) = delete;
+  BlockPool( BlockPool&& other ) noexcept;
+  BlockPool& operator=( BlockPool&& other ) noexcept;
+
+private:
+  struct FreeBlock
+  {
+    FreeBlock* next;
+  };
+
+  size_t block_size_;
+  size_t blocks_per_slab_;
+  std::vector<std::unique_ptr<std::byte[]>> slabs_ {}; // NOLINT(*-avoid-c-arrays)
+  FreeBlock* free_list_ {};
+
+  void grow();
+};
+
+// A standard allocator that draws single objects from a BlockPool (e.g. the nodes of a std::map),
+// and falls back to the heap for anything that does not fit in one block.
+template<typename T>
+class PoolAllocator
+{
+  BlockPool* pool_;
+
+  template<typename U>
+  friend class PoolAllocator;
+
+public:
+  using value_type = T;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  explicit PoolAllocator( BlockPool* pool ) : pool_( pool ) {}
+
+  template<typename U>
+  PoolAllocator( const PoolAllocator<U>& other ) : pool_( other.pool_ ) // NOLINT(*-explicit-*)
+  {}
+
+  T* allocate( size_t n )
+  {
+    if ( n == 1 and sizeof( T ) <= pool_->block_size() and alignof( T ) <= alignof( std::max_align_t ) ) {
+      return static_cast<T*>( pool_->allocate() );
+    }
+    return std::allocator<T> {}.allocate( n );
+  }
+
+  void deallocate( T* p, size_t n )
+  {
+    if ( n == 1 and sizeof( T ) <= pool_->block_size() and alignof( T ) <= alignof( std::max_align_t ) ) {
+      pool_->deallocate( p );
+      return;
+    }
+    std::allocator<T> {}.deallocate( p, n );
+  }
+
+  template<typename U>
+  bool operator==( const PoolAllocator<U>& other ) const
+  {
+    return pool_ == other.pool_;
+  }
+};
+
+// Byte storage for the not-yet-assembled part of a stream, indexed by absolute stream index.
+// The stream is cut into fixed-size pages; a page is taken from a BlockPool the first time
+// one of its bytes is written, and goes back once the stream has moved past it.
+class SegmentArena
+{
+public:
+  static constexpr size_t kPageSize = 4096;
+
+  SegmentArena();
+
+  // Copy `data` into the arena at stream index `first_index`
+  void write( uint64_t first_index, std::string_view data );
+
+  // Append `len` previously written bytes, starting at `first_index`, to `out`
+  void read( uint64_t first_index, uint64_t len, std::string& out ) const;
+
+  // Release every page that lies entirely before stream index `index`
+  void release_before( uint64_t index );
+
+  // Release the pages holding [first, last) that lie entirely within [lower, upper),
+  // i.e. that share no byte still needed outside it
+  void release_range( uint64_t first, uint64_t last, uint64_t lower, uint64_t upper );
+
+  // Release every page (e.g. when nothing is left pending), and start again at stream index `index`
+  void reset( uint64_t index );
+
+  size_t pages_in_use() const { return pages_in_use_; }
+
+private:
+  BlockPool pages_ { kPageSize, 16 };
+  std::vector<char*> ring_ {};  // page pointers, indexed by (page number) mod ring_.size()
+  uint64_t base_page_ {};       // lowest page number that may be in use
+  size_t pages_in_use_ {};
+
+  char* page( uint64_t page_no ) const;
+  char* page_for_write( uint64_t page_no );
+  void grow_ring( uint64_t min_pages );
+};
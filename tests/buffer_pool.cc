@@ -0,0 +1,136 @@
+#include "buffer_pool.hh"
+#include "expect.hh"
+#include "socket_pair.hh"
+
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// a released buffer is the next one taken, and shared buffers go back only with their last handle
+static void reuse()
+{
+  BufferPool pool { 1024 };
+  PooledBuffer a = pool.acquire();
+  expect( a.has_buffer() and a.empty() and a.capacity() == 1024, "fresh buffer" );
+  expect( pool.buffers() == BufferPool::kChunkBuffers, "pool grows a chunk at a time" );
+
+  memcpy( a.data(), "hello", 5 );
+  a.resize( 5 );
+  expect( a.view() == "hello", "contents" );
+  const char* storage = a.data();
+
+  PooledBuffer b = a;
+  expect( a.use_count() == 2 and b.data() == storage, "copies share the buffer" );
+  a.reset();
+  expect( not a.has_buffer() and b.view() == "hello", "still held by the copy" );
+  PooledBuffer c = pool.acquire();
+  expect( c.data() != storage, "a buffer in use isn't handed out" );
+  b = PooledBuffer {};
+  PooledBuffer d = pool.acquire();
+  expect( d.data() == storage and d.empty(), "released buffer reused, emptied" );
+
+  bool thrown = false;
+  try {
+    d.resize( 1025 );
+  } catch ( const out_of_range& ) {
+    thrown = true;
+  }
+  expect( thrown, "no size past the capacity" );
+
+  // many buffers at once: the pool grows, then stops growing
+  vector<PooledBuffer> held;
+  for ( int round = 0; round < 3; ++round ) {
+    for ( size_t i = 0; i < 3 * BufferPool::kChunkBuffers; ++i ) {
+      held.push_back( pool.acquire() );
+    }
+    set<const char*> distinct;
+    for ( const auto& buffer : held ) {
+      distinct.insert( buffer.data() );
+    }
+    expect( distinct.size() == held.size() and not distinct.contains( d.data() ), "each buffer taken once" );
+    held.clear();
+  }
+  expect( pool.buffers() == 4 * BufferPool::kChunkBuffers, "steady state allocates nothing" );
+}
+
+// threads take and release buffers at once; no buffer is ever held by two of them
+static void threads()
+{
+  BufferPool pool { 64 };
+  constexpr size_t kThreads = 4;
+  constexpr size_t kRounds = 20000;
+  vector<thread> workers;
+  vector<string> failures( kThreads );
+  for ( size_t t = 0; t < kThreads; ++t ) {
+    workers.emplace_back( [&pool, &failures, t] {
+      const char mark = static_cast<char>( 'a' + t );
+      for ( size_t i = 0; i < kRounds; ++i ) {
+        PooledBuffer first = pool.acquire();
+        PooledBuffer second = pool.acquire();
+        memset( first.data(), mark, first.capacity() );
+        memset( second.data(), mark, second.capacity() );
+        first.resize( first.capacity() );
+        second.resize( second.capacity() );
+        if ( first.view().find_first_not_of( mark ) != string::npos
+             or second.view().find_first_not_of( mark ) != string::npos ) {
+          failures[t] = "buffer shared between threads";
+          return;
+        }
+      }
+    } );
+  }
+  for ( auto& worker : workers ) {
+    worker.join();
+  }
+  for ( const auto& failure : failures ) {
+    expect( failure.empty(), failure );
+  }
+  expect( pool.buffers() <= 2 * BufferPool::kChunkBuffers, "pool sized to the buffers in use" );
+}
+
+// FileDescriptor::read returns pooled buffers
+static void reads()
+{
+  auto [a, b] = socket_pair();
+  const size_t buffers_before = FileDescriptor::read_buffer_pool().buffers();
+  for ( int i = 0; i < 1000; ++i ) {
+    const string message = "message " + to_string( i );
+    a.write( message );
+    const PooledBuffer buffer = b.read();
+    expect( buffer.view() == message, "read contents" );
+    expect( buffer.capacity() == FileDescriptor::read_buffer_pool().buffer_size(), "read buffer's capacity" );
+  }
+  expect( FileDescriptor::read_buffer_pool().buffers() - buffers_before <= BufferPool::kChunkBuffers,
+          "reads reuse buffers" );
+
+  expect( b.read().empty() and not b.eof(), "nothing to read" );
+  a.close();
+  expect( b.read().empty() and b.eof(), "EOF" );
+
+  BufferPool small { 4 };
+  auto [c, d] = socket_pair();
+  c.write( "abcdef" );
+  expect( d.read( small ).view() == "abcd" and d.read( small ).view() == "ef", "reads up to the capacity" );
+}
+
+int main()
+{
+  try {
+    reuse();
+    threads();
+    reads();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,1021 @@
+#include "eventloop.hh"
+#include "expect.hh"
+#include "socket_pair.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <optional>
+#include <source_location>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono_literals;
+
+static void expect_result( EventLoop::Result result,
+                           EventLoop::Result expected,
+                           const string& what,
+                           const source_location& where = source_location::current() )
+{
+  expect(
+    result == expected, what + " (wait_next_event returned " + to_string( static_cast<int>( result ) ) + ")", where );
+}
+
+static void read_and_write( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [a, b] = socket_pair();
+
+  string received;
+  string to_send = "hello";
+  loop.add_rule( "read b", b, Direction::In, [&] {
+    string buf;
+    b.read( buf );
+    received += buf;
+  } );
+  loop.add_rule(
+    "write a",
+    a,
+    Direction::Out,
+    [&] { to_send.erase( 0, a.write( to_send ) ); },
+    [&] { return not to_send.empty(); } );
+
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "write when writable" );
+  expect( to_send.empty(), "all written" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "read when readable" );
+  expect( received == "hello", "read what was written" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Timeout, "nothing ready" );
+
+  // interest can come and go
+  to_send = "again";
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "write again" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "read again" );
+  expect( received == "helloagain", "read what was written again" );
+}
+
+static void both_directions_on_one_fd( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [a, b] = socket_pair();
+
+  size_t reads = 0;
+  size_t writes = 0;
+  loop.add_rule( "read a", a, Direction::In, [&] {
+    string buf;
+    a.read( buf );
+    ++reads;
+  } );
+  loop.add_rule(
+    "write a",
+    a,
+    Direction::Out,
+    [&] {
+      a.write( "x" );
+      ++writes;
+    },
+    [&] { return writes < 3; } );
+
+  b.write( "ping" );
+  for ( int i = 0; i < 4; ++i ) {
+    expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "serve a rule on a shared fd" );
+  }
+  expect( reads == 1 and writes == 3, "both rules on the same fd are served" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Timeout, "shared fd idle" );
+}
+
+// several rules can watch the same fd in the same direction, and each of them is served
+static void rules_sharing_a_direction( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [a, b] = socket_pair();
+
+  size_t first_limit = 2;
+  size_t first_writes = 0;
+  size_t second_writes = 0;
+  string received;
+  loop.add_rule(
+    "first writer",
+    a,
+    Direction::Out,
+    [&] {
+      a.write( "1" );
+      ++first_writes;
+    },
+    [&] { return first_writes < first_limit; } );
+  auto second = loop.add_rule(
+    "second writer",
+    a,
+    Direction::Out,
+    [&] {
+      a.write( "2" );
+      ++second_writes;
+    },
+    [&] { return second_writes < 3; } );
+  loop.add_rule( "reader", b, Direction::In, [&] {
+    string buf;
+    b.read( buf );
+    received += buf;
+  } );
+
+  for ( int i = 0; i < 20 and loop.wait_next_event( 0 ) == EventLoop::Result::Success; ++i ) {}
+  expect( first_writes == 2 and second_writes == 3, "both rules on the same fd and direction are served" );
+  expect( ranges::count( received, '1' ) == 2 and ranges::count( received, '2' ) == 3, "both rules' writes read" );
+
+  // cancelling one of them leaves the other
+  second.cancel();
+  first_limit = 4;
+  for ( int i = 0; i < 20 and loop.wait_next_event( 0 ) == EventLoop::Result::Success; ++i ) {}
+  expect( first_writes == 4 and second_writes == 3, "the remaining rule is still served" );
+}
+
+// a rule's fd closed by another rule (not by its own callback), and the number reused by a new rule's fd
+static void fd_closed_elsewhere( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [a, b] = socket_pair();
+
+  bool old_served = false;
+  loop.add_rule( "old reader", b, Direction::In, [&] { old_served = true; }, EventLoop::Interest::Enabled );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Timeout, "old rule registered" );
+
+  const int old_number = b.fd_num();
+  optional<pair<LocalStreamSocket, LocalStreamSocket>> reused;
+  string received;
+  loop.add_rule(
+    "closer",
+    [&] {
+      b.close();
+      reused.emplace( socket_pair() );
+      loop.add_rule(
+        "new reader",
+        reused->first,
+        Direction::In,
+        [&] {
+          string buf;
+          reused->first.read( buf );
+          received += buf;
+        },
+        EventLoop::Interest::Enabled );
+      reused->second.write( "new" );
+    },
+    [&] { return not reused.has_value(); } );
+
+  for ( int i = 0; i < 4 and received.empty(); ++i ) {
+    expect_result( loop.wait_next_event( 100 ), EventLoop::Result::Success, "serve the rule on the reused fd" );
+  }
+  expect( reused->first.fd_num() == old_number, "fd number reused" );
+  expect( received == "new" and not old_served, "the new rule is served, and not the old one" );
+
+  // the old rule is retired, and holds nothing open: its peer sees the close
+  loop.wait_next_event( 0 );
+  string buf;
+  a.read( buf );
+  expect( a.eof(), "old fd's socket released" );
+}
+
+static void eof_and_cancel( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [a, b] = socket_pair();
+
+  bool cancelled = false;
+  loop.add_rule(
+    "read b",
+    b,
+    Direction::In,
+    [&] {
+      string buf;
+      b.read( buf );
+    },
+    [] { return true; },
+    [&] { cancelled = true; } );
+
+  a.close();
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "read the EOF" );
+  expect( b.eof(), "EOF seen" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "rule retired at EOF" );
+  expect( cancelled, "cancel callback called at EOF" );
+
+  auto [c, d] = socket_pair();
+  bool called = false;
+  auto handle = loop.add_rule( "read d", d, Direction::In, [&] { called = true; } );
+  c.write( "x" );
+  handle.cancel();
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "cancelled rule removed" );
+  expect( not called, "cancelled rule not served" );
+}
+
+static void hangup_on_write( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [a, b] = socket_pair();
+  auto [c, d] = socket_pair();
+
+  bool cancelled = false;
+  loop.add_rule(
+    "write a",
+    a,
+    Direction::Out,
+    [&] { a.write( "x" ); },
+    [] { return false; },
+    [&] { cancelled = true; } );
+  loop.add_rule( "keep the loop alive", d, Direction::In, [] {} );
+
+  b.close();
+  loop.wait_next_event( 0 );
+  expect( cancelled, "uninterested Out rule cancelled on hangup" );
+}
+
+static void regular_file( EventLoop::Backend backend )
+{
+  char name[] = "/tmp/eventloop_test_XXXXXX";
+  FileDescriptor file { CheckSystemCall( "mkstemp", mkstemp( name ) ) };
+  unlink( name );
+  file.write( "contents" );
+  CheckSystemCall( "lseek", static_cast<int>( lseek( file.fd_num(), 0, SEEK_SET ) ) );
+
+  EventLoop loop { backend };
+  string received;
+  loop.add_rule( "read file", file, Direction::In, [&] {
+    string buf;
+    file.read( buf );
+    received += buf;
+  } );
+
+  for ( int i = 0; i < 4 and loop.wait_next_event( 0 ) != EventLoop::Result::Exit; ++i ) {}
+  expect( received == "contents", "regular file read through the loop" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "file rule retired at EOF" );
+}
+
+static void batch_dispatch( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_dispatch( EventLoop::Dispatch::Batch, 2 );
+
+  auto [a1, b1] = socket_pair();
+  auto [a2, b2] = socket_pair();
+  auto [a3, b3] = socket_pair();
+  size_t reads = 0;
+  for ( auto* socket : { &b1, &b2, &b3 } ) {
+    loop.add_rule( "read", *socket, Direction::In, [&, socket] {
+      string buf;
+      socket->read( buf );
+      ++reads;
+    } );
+  }
+
+  unsigned work_left = 5;
+  unsigned non_fd_calls = 0;
+  loop.add_rule(
+    "non-fd work",
+    [&] {
+      --work_left;
+      ++non_fd_calls;
+    },
+    [&] { return work_left > 0; } );
+
+  a1.write( "x" );
+  a2.write( "x" );
+  a3.write( "x" );
+  expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "batch served" );
+  expect( reads == 3, "every ready fd rule served in one batch" );
+  expect( non_fd_calls == 2, "non-fd rule limited to max_calls_per_rule" );
+
+  expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "remaining non-fd work" );
+  expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "remaining non-fd work" );
+  expect( work_left == 0 and reads == 3, "non-fd work finished without re-serving fds" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Timeout, "batch loop idle" );
+}
+
+static void timers( EventLoop::Backend backend )
+{
+  using Clock = TimerWheel::Clock;
+  EventLoop loop { backend };
+  vector<int> fired;
+
+  // with only timers armed, the loop sleeps until the next one
+  const auto start = Clock::now();
+  loop.add_timer( start + 20ms, [&] { fired.push_back( 20 ); } );
+  auto cancelled = loop.add_timer( start + 10ms, [&] { fired.push_back( 10 ); } );
+  loop.add_timer( start + 5ms, [&] { fired.push_back( 5 ); } );
+  cancelled.cancel();
+  expect( loop.timers_pending() == 2, "two timers armed" );
+
+  expect_result( loop.wait_next_event( -1 ), EventLoop::Result::Success, "first timer" );
+  expect( fired == vector { 5 } and Clock::now() >= start + 5ms, "first timer on time" );
+  expect_result( loop.wait_next_event( 1 ), EventLoop::Result::Timeout, "wait shorter than the next timer" );
+  expect_result( loop.wait_next_event( -1 ), EventLoop::Result::Success, "second timer" );
+  expect( fired == vector { 5, 20 } and Clock::now() >= start + 20ms, "second timer on time" );
+  expect_result( loop.wait_next_event( -1 ), EventLoop::Result::Exit, "nothing left" );
+
+  // a timer cuts short a wait for an idle fd
+  auto [a, b] = socket_pair();
+  loop.add_rule( "read b", b, Direction::In, [&] {
+    string buf;
+    b.read( buf );
+  } );
+  loop.add_timer( Clock::now() + 5ms, [&] { fired.push_back( 0 ); } );
+  expect_result( loop.wait_next_event( 10000 ), EventLoop::Result::Success, "timer during fd wait" );
+  expect( fired.back() == 0, "timer fired during fd wait" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Timeout, "fd still idle" );
+}
+
+static void stats( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [a1, b1] = socket_pair();
+  auto [a2, b2] = socket_pair();
+
+  const size_t first = loop.add_category( "first reader" );
+  const size_t second = loop.add_category( "second reader" );
+  const size_t slow = loop.add_category( "slow" );
+  for ( auto [category, socket] : { pair { first, &b1 }, pair { second, &b2 } } ) {
+    loop.add_rule( category, *socket, Direction::In, [socket] {
+      string buf;
+      socket->read( buf );
+    } );
+  }
+  bool slow_pending = false;
+  loop.add_rule(
+    slow,
+    [&] {
+      this_thread::sleep_for( 2ms );
+      slow_pending = false;
+    },
+    [&] { return slow_pending; } );
+
+  // nothing is recorded until stats are enabled
+  a1.write( "x" );
+  expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "served without stats" );
+  expect( loop.category_stats( first ).callbacks == 0 and loop.poll_wait_time() == 0s, "no stats while disabled" );
+
+  loop.enable_stats();
+  a1.write( "x" );
+  a2.write( "x" );
+  expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "one of two ready" );
+  expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "the other" );
+  const auto& first_stats = loop.category_stats( first );
+  const auto& second_stats = loop.category_stats( second );
+  expect( first_stats.callbacks == 1 and second_stats.callbacks == 1, "callbacks counted" );
+  expect( first_stats.ready_not_serviced + second_stats.ready_not_serviced == 1, "ready but not serviced counted" );
+  expect( first_stats.interest_time > 0s and first_stats.callback_time > 0s, "times recorded" );
+
+  slow_pending = true;
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "slow rule" );
+  const auto& slow_stats = loop.category_stats( slow );
+  expect( slow_stats.callbacks == 1 and slow_stats.max_callback_time >= 2ms, "slow callback timed" );
+  expect( slow_stats.callback_quantile( 0.99 ) == slow_stats.max_callback_time, "quantile bounded by the max" );
+  expect( first_stats.callback_quantile( 0.5 ) <= first_stats.max_callback_time, "quantile from the histogram" );
+
+  expect_result( loop.wait_next_event( 5 ), EventLoop::Result::Timeout, "idle wait" );
+  expect( loop.poll_wait_time() >= 5ms, "wait time recorded" );
+
+  ostringstream dump;
+  loop.dump_stats_every( 1ms, dump );
+  this_thread::sleep_for( 2ms );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Timeout, "dump on the next iteration" );
+  const string text = dump.str();
+  expect( text.find( "slow" ) < text.find( "first reader" ), "dump lists the busiest category first" );
+
+  loop.dump_stats_every( 0s, dump );
+  loop.reset_stats();
+  expect( loop.category_stats( slow ).callbacks == 0 and loop.poll_wait_time() == 0s, "stats reset" );
+}
+
+// rules stay addressable through their handles, which outlive the rules (and the loop)
+static void rule_handles( EventLoop::Backend backend )
+{
+  optional<EventLoop::RuleHandle> outliving;
+  {
+    EventLoop loop { backend };
+    auto [a, b] = socket_pair();
+
+    unsigned first_calls = 0;
+    unsigned second_calls = 0;
+    auto first = loop.add_rule( "first", [&] { ++first_calls; }, [&] { return first_calls == 0; } );
+    first.cancel();
+    expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "cancelled rule retired" );
+    expect( first_calls == 0, "cancelled rule not run" );
+
+    // the retired rule's slot is reused, but its handle doesn't reach the new rule
+    auto second = loop.add_rule( "second", [&] { ++second_calls; }, [&] { return second_calls < 2; } );
+    first.cancel();
+    expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "new rule in a reused slot" );
+    expect( second_calls == 2, "stale handle didn't cancel the new rule" );
+
+    // a callback can add rules
+    string received;
+    bool added = false;
+    loop.add_rule(
+      "adder",
+      a,
+      Direction::Out,
+      [&] {
+        a.write( "x" );
+        added = true;
+        loop.add_rule( "added", b, Direction::In, [&] {
+          string buf;
+          b.read( buf );
+          received += buf;
+        } );
+      },
+      [&] { return not added; } );
+    outliving = loop.add_rule( "never", a, Direction::Out, [] {} );
+    outliving->cancel();
+    expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "adder ran" );
+    expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "added rule ran" );
+    expect( received == "x", "rule added by a callback" );
+    second.cancel();
+  }
+  outliving->cancel(); // the loop is gone; nothing happens
+}
+
+// rules whose interest is switched through their handles, rather than asked for on every iteration
+static void explicit_interest( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [a, b] = socket_pair();
+
+  string received;
+  bool cancelled = false;
+  optional<EventLoop::RuleHandle> reader;
+  reader = loop.add_rule(
+    "read b",
+    b,
+    Direction::In,
+    [&] {
+      string buf;
+      b.read( buf );
+      received += buf;
+      reader->disable();
+    },
+    EventLoop::Interest::Disabled,
+    [&] { cancelled = true; } );
+
+  a.write( "x" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "a disabled rule doesn't keep the loop going" );
+  expect( received.empty(), "disabled rule not served" );
+
+  reader->enable();
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "enabled rule served" );
+  expect( received == "x", "enabled rule read" );
+  a.write( "y" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "rule disabled itself" );
+
+  // enabling and disabling again before the loop looks changes nothing
+  reader->enable();
+  reader->disable();
+  reader->enable();
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "re-enabled rule served" );
+  expect( received == "xy", "re-enabled rule read" );
+
+  // EOF still retires the rule
+  reader->enable();
+  a.close();
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "read the EOF" );
+  reader->enable();
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "rule retired at EOF" );
+  expect( cancelled, "cancel callback called at EOF" );
+
+  // a disabled rule can be cancelled
+  auto [c, d] = socket_pair();
+  bool called = false;
+  auto idle = loop.add_rule( "idle", d, Direction::In, [&] { called = true; }, EventLoop::Interest::Disabled );
+  idle.cancel();
+  idle.enable(); // (the rule is gone)
+  c.write( "x" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "cancelled rule removed" );
+  expect( not called, "cancelled rule not served" );
+
+  // a non-fd rule runs on every iteration while enabled
+  unsigned ticks = 0;
+  optional<EventLoop::RuleHandle> ticker;
+  ticker = loop.add_rule(
+    "ticker",
+    [&] {
+      if ( ++ticks % 3 == 0 ) {
+        ticker->disable();
+      }
+    },
+    EventLoop::Interest::Enabled );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "enabled non-fd rule ran" );
+  expect( ticks == 3, "non-fd rule ran until it disabled itself" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "disabled non-fd rule skipped" );
+  ticker->enable();
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "re-enabled non-fd rule ran" );
+  expect( ticks == 6, "re-enabled non-fd rule ran" );
+  ticker->cancel();
+
+  // a rule with an interest function can't also be switched
+  auto asked = loop.add_rule( "asked", [] {}, [] { return false; } );
+  bool thrown = false;
+  try {
+    asked.enable();
+  } catch ( const runtime_error& ) {
+    thrown = true;
+  }
+  expect( thrown, "enable() refused for a rule with an interest function" );
+}
+
+// with edge-triggered waits, one report of a ready fd serves its rule until the fd is drained
+static void edge_triggered( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_trigger( EventLoop::Trigger::Edge, 4 );
+  auto [a, b] = socket_pair();
+
+  string received;
+  size_t calls = 0;
+  bool want_more = true;
+  loop.add_rule(
+    "read b in small pieces",
+    b,
+    Direction::In,
+    [&] {
+      string buf( 10, 0 );
+      b.read( buf );
+      received += buf;
+      ++calls;
+    },
+    [&] { return want_more; } );
+
+  // 30 bytes take three reads, and a fourth finds the fd drained
+  a.write( string( 30, 'x' ) );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "edge reported" );
+  expect( received.size() == 30 and calls == 4, "drained until EAGAIN (" + to_string( calls ) + " calls)" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Timeout, "no new edge" );
+
+  // over the budget, the rule is served again on the next iteration, without waiting for the kernel
+  received.clear();
+  calls = 0;
+  a.write( string( 60, 'y' ) );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "edge reported again" );
+  expect( calls == 4 and received.size() == 40, "stopped at the budget" );
+  const uint64_t kernel_calls = loop.kernel_calls();
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "left-ready rule served" );
+  expect( received.size() == 60, "rest read" );
+  if ( backend == EventLoop::Backend::Epoll ) {
+    expect( loop.kernel_calls() == kernel_calls, "no wait for a rule left ready" );
+  }
+
+  // losing interest ends a drain, and regaining it finds the fd still ready
+  received.clear();
+  a.write( string( 20, 'z' ) );
+  want_more = false;
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "uninterested rule not served" );
+  want_more = true;
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "reported once interested again" );
+  expect( received.size() == 20, "read after regaining interest" );
+
+  // a callback that ignores its ready fd is caught, as it would never be called again
+  auto [c, d] = socket_pair();
+  auto ignoring = loop.add_rule( "ignore d", d, Direction::In, [] {} );
+  c.write( "x" );
+  bool thrown = false;
+  try {
+    for ( int i = 0; i < 4; ++i ) {
+      loop.wait_next_event( 0 );
+    }
+  } catch ( const runtime_error& e ) {
+    thrown = string( e.what() ).find( "busy wait" ) != string::npos;
+  }
+  expect( thrown, "busy wait detected with edge-triggered waits" );
+  ignoring.cancel();
+
+  // back to level-triggered waits
+  loop.set_trigger( EventLoop::Trigger::Level );
+  received.clear();
+  a.write( string( 20, 'w' ) );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "level: first read" );
+  expect( received.size() == 10, "level: one read per wait" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "level: reported again" );
+  expect( received.size() == 20, "level: second read" );
+}
+
+static void busy_poll( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [a, b] = socket_pair();
+  string received;
+  loop.add_rule( "read b", b, Direction::In, [&] { b.read( received ); } );
+
+  // data arriving within the spin budget is found without blocking
+  loop.set_busy_poll( 500ms );
+  thread writer { [&a] {
+    this_thread::sleep_for( 2ms );
+    a.write( "x" );
+  } };
+  expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "woken while spinning" );
+  writer.join();
+  expect( received == "x", "read while spinning" );
+  auto stats = loop.busy_poll_stats();
+  expect( stats.spin_wakeups == 1 and stats.sleeps == 0, "one wait, ended while spinning" );
+  expect( stats.spin_time >= 1ms and stats.sleep_time == 0ms, "spun until the data came" );
+
+  // once the budget runs out, the wait blocks for the rest of the timeout
+  loop.set_busy_poll( 5ms );
+  expect_result( loop.wait_next_event( 30 ), EventLoop::Result::Timeout, "nothing arrived" );
+  stats = loop.busy_poll_stats();
+  expect( stats.sleeps == 1 and stats.spin_time >= 5ms and stats.sleep_time >= 10ms, "spun, then slept" );
+
+  // the spin never outlasts the timeout
+  loop.set_busy_poll( 10s );
+  const auto start = EventLoop::Clock::now();
+  expect_result( loop.wait_next_event( 10 ), EventLoop::Result::Timeout, "timed out while spinning" );
+  expect( EventLoop::Clock::now() - start < 1s, "spin cut short by the timeout" );
+  expect( loop.busy_poll_stats().sleeps == 1, "no sleep after a spin as long as the timeout" );
+
+  ostringstream dump;
+  loop.dump_stats( dump );
+  expect( dump.str().find( "ms spinning" ) != string::npos, "spin time in the stats" );
+  loop.reset_stats();
+  expect( loop.busy_poll_stats().spin_time == 0ms, "busy-poll stats reset" );
+
+  // SO_BUSY_POLL goes on the rules' sockets, present and future (raising it takes CAP_NET_ADMIN)
+  if ( geteuid() == 0 ) {
+    loop.set_busy_poll( 1ms, 50us );
+    auto [c, d] = socket_pair();
+    auto ignore_d = loop.add_rule( "ignore d", d, Direction::In, [] {} );
+    for ( const FileDescriptor* fd : { static_cast<FileDescriptor*>( &b ), static_cast<FileDescriptor*>( &d ) } ) {
+      int usecs = 0;
+      socklen_t length = sizeof( usecs );
+      CheckSystemCall( "getsockopt", getsockopt( fd->fd_num(), SOL_SOCKET, SO_BUSY_POLL, &usecs, &length ) );
+      expect( usecs == 50, "SO_BUSY_POLL set on the rule's socket" );
+    }
+    ignore_d.cancel();
+  }
+
+  loop.set_busy_poll( 0ms );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Timeout, "busy poll off" );
+}
+
+static void priority_classes( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  loop.set_dispatch( EventLoop::Dispatch::Batch );
+  using enum EventLoop::Priority;
+
+  // two bulk flows that are always ready, and a control rule added after them
+  auto [bulk_a_in, bulk_a] = socket_pair();
+  auto [bulk_b_in, bulk_b] = socket_pair();
+  auto [control_in, control] = socket_pair();
+  string order;
+  const auto read_some = [&]( FileDescriptor& fd, char name ) {
+    string buffer( 64, 0 );
+    fd.read( buffer );
+    order += name;
+  };
+  const size_t bulk = loop.add_category( "bulk" );
+  loop.add_rule( bulk, bulk_a, Direction::In, [&] { read_some( bulk_a, 'a' ); } );
+  loop.add_rule( bulk, bulk_b, Direction::In, [&] { read_some( bulk_b, 'b' ); } );
+  const size_t control_category = loop.add_category( "control" );
+  loop.add_rule( control_category, control, Direction::In, [&] { read_some( control, 'c' ); } );
+  bulk_a_in.write( string( 4096, 'x' ) );
+  bulk_b_in.write( string( 4096, 'x' ) );
+
+  // without classes, rules are served in the order they are found
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "bulk served" );
+  expect( order.size() == 2, "both bulk flows served" );
+
+  // the Latency class goes first, though found last
+  loop.set_priority( control_category, Latency );
+  loop.set_priority( bulk, Bulk );
+  expect( loop.priority( bulk ) == Bulk, "priority set" );
+  order.clear();
+  control_in.write( "ping" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "all served" );
+  expect( order.size() == 3 and order.front() == 'c', "control served first (" + order + ")" );
+
+  // a byte budget leaves the rest of the class for the next iteration, where it goes first
+  loop.set_class_policy( Bulk, { .weight = 1, .time_budget = {}, .byte_budget = 64 } );
+  loop.enable_stats();
+  order.clear();
+  for ( int i = 0; i < 4; ++i ) {
+    expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "bulk served within budget" );
+  }
+  expect( order == "abab" or order == "baba", "one bulk flow per iteration, in turn (" + order + ")" );
+  expect( loop.category_stats( bulk ).ready_not_serviced == 4, "left-over rules counted" );
+
+  // a time budget does the same for slow callbacks
+  loop.set_class_policy( Bulk, { .weight = 1, .time_budget = 1ns, .byte_budget = 0 } );
+  order.clear();
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "slow bulk served" );
+  expect( order.size() == 1, "one bulk flow within the time budget" );
+
+  // with one rule per iteration, the classes take turns by weight: the bulk flows aren't starved by
+  // a busy control rule
+  loop.set_dispatch( EventLoop::Dispatch::OneRule );
+  loop.set_class_policy( Latency, { .weight = 2, .time_budget = {}, .byte_budget = 0 } );
+  loop.set_class_policy( Bulk, { .weight = 1, .time_budget = {}, .byte_budget = 0 } );
+  control_in.write( string( 4096, 'x' ) );
+  order.clear();
+  for ( int i = 0; i < 30; ++i ) {
+    expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "one rule served" );
+  }
+  const auto served = [&]( char name ) { return ranges::count( order, name ); };
+  expect( served( 'c' ) == 20 and served( 'a' ) + served( 'b' ) == 10,
+          "two control turns per bulk turn (" + order + ")" );
+  expect( order.find( "ccc" ) == string::npos, "bulk served between control turns (" + order + ")" );
+
+  bool thrown = false;
+  try {
+    loop.set_class_policy( Normal, { .weight = 0, .time_budget = {}, .byte_budget = 0 } );
+  } catch ( const out_of_range& ) {
+    thrown = true;
+  }
+  expect( thrown, "zero weight refused" );
+}
+
+static void stall_watchdog()
+{
+  EventLoop loop;
+  auto [a, b] = socket_pair();
+  auto slow_for = 0ms;
+  const size_t slow = loop.add_category( "slow" );
+  loop.add_rule( slow, b, Direction::In, [&] {
+    string buffer;
+    b.read( buffer );
+    const auto until = EventLoop::Clock::now() + slow_for;
+    while ( EventLoop::Clock::now() < until ) {} // (busy, as a stuck computation would be)
+  } );
+
+  vector<EventLoop::Clock::duration> alerts;
+  loop.on_stall( [&]( const EventLoop::Stall& stall ) { alerts.push_back( stall.duration ); } );
+  loop.set_stall_budget( 10ms );
+
+  // a callback within budget is no stall; one over budget is recorded, counted and reported
+  a.write( "x" );
+  loop.wait_next_event( 1000 );
+  expect( loop.recent_stalls().empty() and alerts.empty(), "no stall within budget" );
+  slow_for = 30ms;
+  a.write( "x" );
+  loop.wait_next_event( 1000 );
+  expect( loop.recent_stalls().size() == 1 and alerts.size() == 1, "stall recorded and reported" );
+  const EventLoop::Stall& stall = loop.recent_stalls().back();
+  expect( stall.category_id == slow and stall.duration >= 30ms, "stall's category and duration" );
+  expect( stall.backtrace.empty(), "no backtrace unless asked for" );
+  expect( loop.category_stats( slow ).stalls == 1, "stall counted, with stats disabled" );
+  ostringstream dump;
+  loop.dump_stats( dump );
+  expect( dump.str().find( "stalls" ) != string::npos, "stalls in the stats table" );
+
+  // the watchdog thread samples the stack while the callback is over budget
+  loop.set_stall_budget( 10ms, true );
+  a.write( "x" );
+  loop.wait_next_event( 1000 );
+  expect( loop.recent_stalls().size() == 2, "second stall" );
+  expect( not loop.recent_stalls().back().backtrace.empty(), "backtrace sampled" );
+  slow_for = 0ms;
+  a.write( "x" );
+  loop.wait_next_event( 1000 );
+  expect( loop.recent_stalls().size() == 2, "no stall once fast again" );
+
+  // only the last few are kept
+  slow_for = 2ms;
+  loop.set_stall_budget( 1ms );
+  for ( size_t i = 0; i < EventLoop::kRecentStalls + 2; ++i ) {
+    a.write( "x" );
+    loop.wait_next_event( 1000 );
+  }
+  expect( loop.recent_stalls().size() == EventLoop::kRecentStalls, "recent stalls bounded" );
+  expect( alerts.size() == EventLoop::kRecentStalls + 4, "every stall reported" );
+  loop.set_stall_budget( 0ms );
+}
+
+// signals and child exits arrive through fd rules, and a child rule ends once the child is reaped
+static void process_rules( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  SignalFD signals { SIGUSR1, SIGHUP };
+  vector<int> received;
+  auto signal_rule = loop.add_signal_rule(
+    loop.add_category( "signals" ), signals, [&]( const signalfd_siginfo& info ) {
+      received.push_back( static_cast<int>( info.ssi_signo ) );
+    } );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Timeout, "signal rule waits" );
+  raise( SIGUSR1 );
+  raise( SIGHUP );
+  expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "signals delivered" );
+  sort( received.begin(), received.end() );
+  expect( received == vector<int> { SIGHUP, SIGUSR1 }, "both signals read, by the loop's one rule" );
+
+  const size_t children = loop.add_category( "children" );
+  vector<siginfo_t> exits;
+  const auto record_exit = [&]( const siginfo_t& status ) { exits.push_back( status ); };
+
+  const pid_t exiting = CheckSystemCall( "fork", fork() );
+  if ( exiting == 0 ) {
+    _exit( 3 );
+  }
+  PidFD exiting_fd { exiting };
+  loop.add_child_rule( children, exiting_fd, record_exit );
+
+  const pid_t waiting = CheckSystemCall( "fork", fork() );
+  if ( waiting == 0 ) {
+    pause();
+    _exit( 0 );
+  }
+  PidFD waiting_fd { waiting };
+  loop.add_child_rule( children, waiting_fd, record_exit );
+
+  while ( exits.empty() ) {
+    expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "first child's exit" );
+  }
+  expect( exits.at( 0 ).si_pid == exiting and exits.at( 0 ).si_code == CLD_EXITED and exits.at( 0 ).si_status == 3,
+          "exit status" );
+
+  waiting_fd.send_signal( SIGKILL );
+  while ( exits.size() < 2 ) {
+    expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "second child's exit" );
+  }
+  expect( exits.at( 1 ).si_pid == waiting and exits.at( 1 ).si_code == CLD_KILLED
+            and exits.at( 1 ).si_status == SIGKILL,
+          "killed child's status" );
+
+  // the child rules have ended; cancelling the signal rule lets the loop exit
+  signal_rule.cancel();
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "loop exits" );
+  expect( exits.size() == 2 and received.size() == 2, "nothing more" );
+
+  // the child rules ended without closing the caller's pidfds
+  expect( not exiting_fd.closed() and not waiting_fd.closed(), "pidfds left open" );
+  waiting_fd.close();
+  bool thrown = false;
+  try {
+    waiting_fd.send_signal( SIGKILL );
+  } catch ( const runtime_error& ) {
+    thrown = true;
+  }
+  expect( thrown, "no signal through a closed pidfd" );
+}
+
+// tasks posted from other threads run on the loop's thread, in order, and wake it from the kernel
+static void posting( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+
+  // a burst posted before the loop looks is one wake-up and one batch
+  vector<int> order;
+  for ( int i = 0; i < 100; ++i ) {
+    loop.post( [&order, i] { order.push_back( i ); } );
+  }
+  expect( loop.post_wakeups() == 1, "burst coalesced into one wake-up" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "posted tasks run" );
+  expect( order.size() == 100, "whole burst run in one batch" );
+  for ( int i = 0; i < 100; ++i ) {
+    expect( order[i] == i, "posted tasks run oldest first" );
+  }
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Exit, "nothing posted keeps the loop" );
+
+  // a task that throws leaves the rest of its batch for the next iteration
+  order.clear();
+  loop.post( [&] { order.push_back( 0 ); } );
+  loop.post( [] { throw runtime_error( "task failed" ); } );
+  loop.post( [&] { order.push_back( 2 ); } );
+  bool threw = false;
+  try {
+    loop.wait_next_event( 0 );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  expect( threw and order == vector<int> { 0 }, "task exception propagates" );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Success, "rest of the batch runs" );
+  expect( order == vector<int> { 0, 2 }, "rest of the batch run after the exception" );
+
+  // producers on other threads wake a loop blocked in the kernel
+  auto [a, b] = socket_pair();
+  loop.add_rule( "keep-alive", b, Direction::In, [&] {
+    string buf;
+    b.read( buf );
+  } );
+
+  constexpr int producers = 4;
+  constexpr int tasks_per_producer = 2000;
+  vector<int> next_expected( producers );
+  int run = 0;
+  bool in_order = true;
+  vector<thread> threads;
+  for ( int p = 0; p < producers; ++p ) {
+    threads.emplace_back( [&, p] {
+      for ( int i = 0; i < tasks_per_producer; ++i ) {
+        loop.post( [&, p, i] {
+          in_order &= next_expected[p] == i;
+          next_expected[p] = i + 1;
+          ++run;
+        } );
+      }
+    } );
+  }
+  while ( run < producers * tasks_per_producer ) {
+    expect( loop.wait_next_event( 10000 ) != EventLoop::Result::Timeout, "woken by a post" );
+  }
+  for ( auto& t : threads ) {
+    t.join();
+  }
+  expect( in_order, "each producer's tasks run in the order posted" );
+}
+
+static void async_io()
+{
+  EventLoop loop { EventLoop::Backend::IoUring };
+  auto [a, b] = socket_pair();
+
+  // a read submitted before any data arrives waits for it
+  string received;
+  b.async_read( loop, [&]( string_view data ) { received += data; } );
+  expect_result( loop.wait_next_event( 0 ), EventLoop::Result::Timeout, "async read waits for data" );
+
+  size_t written = 0;
+  a.async_write( loop, "hello", [&]( size_t n ) { written += n; } );
+  for ( int i = 0; i < 4 and received.empty(); ++i ) {
+    expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "async I/O completes" );
+  }
+  expect( written == 5, "async write completed" );
+  expect( received == "hello", "async read got the bytes written" );
+  expect( b.read_count() == 1 and a.write_count() == 1, "async I/O counted" );
+
+  // larger than a registered buffer
+  const string big( 100000, 'x' );
+  written = 0;
+  a.async_write( loop, big, [&]( size_t n ) { written += n; } );
+  expect_result( loop.wait_next_event( 1000 ), EventLoop::Result::Success, "big async write completes" );
+  expect( written > 0, "big async write wrote something" );
+
+  // EOF
+  a.close();
+  bool got_eof = false;
+  const auto drain = [&]( const auto& self ) -> void {
+    b.async_read( loop, [&, self]( string_view data ) {
+      if ( data.empty() ) {
+        got_eof = true;
+      } else {
+        self( self );
+      }
+    } );
+  };
+  drain( drain );
+  while ( loop.wait_next_event( 1000 ) != EventLoop::Result::Exit ) {}
+  expect( got_eof and b.eof(), "async read reports EOF" );
+
+  // async I/O needs io_uring
+  EventLoop poll_loop;
+  bool threw = false;
+  try {
+    b.async_read( poll_loop, []( string_view ) {} );
+  } catch ( const runtime_error& ) {
+    threw = true;
+  }
+  expect( threw, "async read refused without io_uring" );
+}
+
+int main()
+{
+  try {
+    for ( const auto backend :
+          { EventLoop::Backend::Poll, EventLoop::Backend::Epoll, EventLoop::Backend::IoUring } ) {
+      read_and_write( backend );
+      both_directions_on_one_fd( backend );
+      rules_sharing_a_direction( backend );
+      fd_closed_elsewhere( backend );
+      eof_and_cancel( backend );
+      hangup_on_write( backend );
+      regular_file( backend );
+      batch_dispatch( backend );
+      timers( backend );
+      rule_handles( backend );
+      explicit_interest( backend );
+      stats( backend );
+      posting( backend );
+      busy_poll( backend );
+      priority_classes( backend );
+      process_rules( backend );
+    }
+    edge_triggered( EventLoop::Backend::Epoll );
+    edge_triggered( EventLoop::Backend::IoUring );
+    bool thrown = false;
+    try {
+      EventLoop loop { EventLoop::Backend::Poll };
+      loop.set_trigger( EventLoop::Trigger::Edge );
+    } catch ( const runtime_error& ) {
+      thrown = true;
+    }
+    expect( thrown, "no edge-triggered waits with poll" );
+    async_io();
+    stall_watchdog();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
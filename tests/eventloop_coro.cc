@@ -0,0 +1,214 @@
+#include "eventloop.hh"
+#include "expect.hh"
+#include "socket_pair.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+using namespace std::chrono_literals;
+
+// count heap allocations, to check that a coroutine's steady state costs none
+static size_t allocations = 0; // NOLINT(*-avoid-non-const-global-variables)
+
+void* operator new( size_t size )
+{
+  ++allocations;
+  if ( void* p = malloc( size ) ) { // NOLINT(*-no-malloc)
+    return p;
+  }
+  throw bad_alloc();
+}
+
+void operator delete( void* p ) noexcept
+{
+  free( p ); // NOLINT(*-no-malloc)
+}
+
+void operator delete( void* p, size_t /* size */ ) noexcept
+{
+  free( p ); // NOLINT(*-no-malloc)
+}
+
+// echo everything read from `socket` back to it, until EOF
+static Task<> echo( LocalStreamSocket& socket, size_t& rounds )
+{
+  string buffer;
+  while ( co_await socket.read_some( buffer ) > 0 ) {
+    string_view pending = buffer;
+    while ( not pending.empty() ) {
+      const size_t written = co_await socket.write_some( pending );
+      if ( written == 0 ) {
+        co_return;
+      }
+      pending.remove_prefix( written );
+    }
+    ++rounds;
+  }
+}
+
+static void echo_pipeline( EventLoop::Backend backend, EventLoop::Trigger trigger = EventLoop::Trigger::Level )
+{
+  EventLoop loop { backend };
+  loop.set_trigger( trigger );
+  auto [client, server] = socket_pair();
+
+  size_t rounds = 0;
+  loop.spawn( echo( server, rounds ) );
+  expect( rounds == 0, "nothing to echo yet" );
+
+  string reply;
+  reply.reserve( 64 );
+  // (failure messages are only built on failure, so as not to count their allocations)
+  const auto round_trip = [&] {
+    client.write( "ping" );
+    while ( true ) {
+      if ( loop.wait_next_event( 1000 ) != EventLoop::Result::Success ) {
+        expect( false, "echo coroutine resumed" );
+      }
+      reply.resize( 64 );
+      client.read( reply );
+      if ( not reply.empty() ) {
+        break;
+      }
+    }
+    if ( reply != "ping" ) {
+      expect( false, "echoed \"" + reply + "\"" );
+    }
+  };
+
+  // after warming up, the steady state allocates nothing
+  for ( int i = 0; i < 10; ++i ) {
+    round_trip();
+  }
+  const size_t allocations_before = allocations;
+  for ( int i = 0; i < 1000; ++i ) {
+    round_trip();
+  }
+  const size_t steady_allocations = allocations - allocations_before;
+  expect( steady_allocations == 0, to_string( steady_allocations ) + " allocations in the steady state" );
+  expect( rounds == 1010, "every round echoed" );
+
+  // EOF ends the coroutine, which releases the fd, and the loop runs out of rules
+  client.shutdown( SHUT_WR );
+  EventLoop::Result result {};
+  for ( int i = 0; i < 4 and result != EventLoop::Result::Exit; ++i ) {
+    result = loop.wait_next_event( 1000 );
+  }
+  expect( result == EventLoop::Result::Exit, "loop exits once the coroutine has finished" );
+}
+
+static Task<int> answer( EventLoop& loop )
+{
+  co_await loop.sleep( 1ms );
+  co_return 42;
+}
+
+static Task<int> failing( EventLoop& loop )
+{
+  co_await loop.sleep( 1ms );
+  throw runtime_error( "child failed" );
+}
+
+static Task<> parent( EventLoop& loop, string& log )
+{
+  const auto start = EventLoop::Clock::now();
+  co_await loop.sleep( 20ms );
+  log += EventLoop::Clock::now() - start >= 20ms ? "slept " : "woke early ";
+
+  log += to_string( co_await answer( loop ) ) + " ";
+  try {
+    co_await failing( loop );
+  } catch ( const runtime_error& e ) {
+    log += e.what();
+  }
+}
+
+static Task<> throwing( EventLoop& loop )
+{
+  co_await loop.sleep( 1ms );
+  throw runtime_error( "spawned task failed" );
+}
+
+static void nested_tasks( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+
+  string log;
+  loop.spawn( parent( loop, log ) );
+  while ( loop.wait_next_event( 1000 ) != EventLoop::Result::Exit ) {}
+  expect( log == "slept 42 child failed", "nested tasks: " + log );
+
+  // an exception escaping a spawned task comes out of the loop
+  loop.spawn( throwing( loop ) );
+  bool thrown = false;
+  try {
+    while ( loop.wait_next_event( 1000 ) != EventLoop::Result::Exit ) {}
+  } catch ( const runtime_error& e ) {
+    thrown = string( e.what() ) == "spawned task failed";
+  }
+  expect( thrown, "spawned task's exception rethrown by wait_next_event" );
+}
+
+static Task<> wait_readable( EventLoop& loop, FileDescriptor& fd, bool& result )
+{
+  result = co_await loop.readable( fd );
+}
+
+static void readiness( EventLoop::Backend backend )
+{
+  EventLoop loop { backend };
+  auto [a, b] = socket_pair();
+
+  bool first = false;
+  bool second = false;
+  loop.spawn( wait_readable( loop, b, first ) );
+
+  // only one coroutine at a time may wait on an fd in each direction
+  bool thrown = false;
+  try {
+    loop.spawn( wait_readable( loop, b, second ) );
+    loop.wait_next_event( 0 );
+  } catch ( const runtime_error& ) {
+    thrown = true;
+  }
+  expect( thrown, "second waiter refused" );
+
+  a.write( "x" );
+  expect( loop.wait_next_event( 1000 ) == EventLoop::Result::Success, "readable" );
+  expect( first, "resumed with true once readable" );
+
+  // once the fd is at EOF, it will never be readable: the wait ends with false
+  string buffer;
+  b.read( buffer );
+  a.close();
+  b.read( buffer );
+  expect( b.eof(), "peer closed" );
+  loop.spawn( wait_readable( loop, b, first ) );
+  expect( loop.wait_next_event( 1000 ) == EventLoop::Result::Exit, "rule retired at EOF" );
+  expect( not first, "resumed with false at EOF" );
+}
+
+int main()
+{
+  try {
+    for ( const auto backend :
+          { EventLoop::Backend::Poll, EventLoop::Backend::Epoll, EventLoop::Backend::IoUring } ) {
+      echo_pipeline( backend );
+      nested_tasks( backend );
+      readiness( backend );
+    }
+    echo_pipeline( EventLoop::Backend::Epoll, EventLoop::Trigger::Edge );
+    echo_pipeline( EventLoop::Backend::IoUring, EventLoop::Trigger::Edge );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,114 @@
+#include "eventloop_group.hh"
+#include "expect.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// echo each connection's bytes back to it, from the loop that accepted it
+static void echo( EventLoop& loop, TCPSocket connection )
+{
+  struct Echo
+  {
+    TCPSocket socket;
+    string pending {};
+  };
+
+  auto state = make_shared<Echo>( Echo { move( connection ) } );
+  state->socket.set_blocking( false );
+  loop.add_rule( "echo", state->socket, Direction::In, [state] {
+    string buffer;
+    state->socket.read( buffer );
+    state->pending += buffer;
+    state->pending.erase( 0, state->socket.write( state->pending ) );
+  } );
+}
+
+static void sharded_echo( EventLoop::Backend backend )
+{
+  constexpr size_t loops = 3;
+  constexpr size_t clients = 24;
+
+  EventLoopGroup group { loops, backend };
+  expect( group.size() == loops, "one loop per thread asked for" );
+  const Address address = group.listen( Address { "127.0.0.1" }, echo );
+  expect( address.port() != 0, "listening on an ephemeral port" );
+  group.start();
+
+  vector<TCPSocket> sockets( clients );
+  for ( size_t i = 0; i < clients; ++i ) {
+    sockets[i].connect( address );
+    sockets[i].write( "hello " + to_string( i ) );
+  }
+
+  for ( size_t i = 0; i < clients; ++i ) {
+    const string expected = "hello " + to_string( i );
+    string received;
+    while ( received.size() < expected.size() ) {
+      string buffer;
+      sockets[i].read( buffer );
+      expect( not sockets[i].eof(), "connection stays open" );
+      received += buffer;
+    }
+    expect( received == expected, "echoed \"" + received + "\" for \"" + expected + "\"" );
+  }
+
+  const auto loads = group.load();
+  uint64_t accepted = 0;
+  for ( const auto& load : loads ) {
+    accepted += load.connections;
+    expect( load.cpu >= 0, "loop thread pinned to a CPU" );
+  }
+  expect( loads.size() == loops, "load reported per loop" );
+  expect( accepted == clients, "every connection accepted once (got " + to_string( accepted ) + ")" );
+
+  ostringstream table;
+  group.dump_load( table );
+  expect( table.str().find( "connections" ) != string::npos, "load table written" );
+
+  group.stop();
+  group.join();
+}
+
+static void exception_stops_group()
+{
+  EventLoopGroup group { 2, EventLoop::Backend::Epoll, false };
+  const Address address = group.listen( Address { "127.0.0.1" }, []( EventLoop&, TCPSocket ) {
+    throw runtime_error( "handler failed" );
+  } );
+  group.start();
+
+  TCPSocket client;
+  client.connect( address );
+
+  bool thrown = false;
+  try {
+    group.join();
+  } catch ( const runtime_error& e ) {
+    thrown = string( e.what() ) == "handler failed";
+  }
+  expect( thrown, "join() rethrows the loop thread's exception" );
+  expect( group.load().at( 0 ).cpu == -1, "threads left unpinned when asked" );
+}
+
+int main()
+{
+  try {
+    sharded_echo( EventLoop::Backend::Poll );
+    sharded_echo( EventLoop::Backend::Epoll );
+    sharded_echo( EventLoop::Backend::IoUring );
+    exception_stops_group();
+  } catch ( const exception& e ) {
+    cerr << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
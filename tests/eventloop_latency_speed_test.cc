@@ -0,0 +1,119 @@
+#include "eventloop.hh"
+#include "socket_pair.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+static constexpr size_t kRoundTrips = 2000;
+static constexpr size_t kWarmup = 100;
+
+// Bounce one byte between two threads, each with its own EventLoop, and time each round trip
+static void speed_test( fstream& debug_output,
+                        EventLoop::Backend backend,
+                        string_view label,
+                        EventLoop::Clock::duration spin_budget )
+{
+  auto [client, server] = socket_pair();
+
+  // the echoing side, until the client hangs up
+  thread echo_thread { [&server, backend, spin_budget] {
+    EventLoop loop { backend };
+    loop.set_busy_poll( spin_budget );
+    string buffer;
+    loop.add_rule( "echo", server, Direction::In, [&] {
+      buffer.resize( 64 );
+      server.read( buffer );
+      server.write( buffer );
+    } );
+    while ( loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {}
+  } };
+
+  EventLoop loop { backend };
+  loop.set_busy_poll( spin_budget );
+  string reply;
+  bool replied = false;
+  loop.add_rule( "pong", client, Direction::In, [&] {
+    reply.resize( 64 );
+    client.read( reply );
+    replied = not reply.empty();
+  } );
+
+  vector<EventLoop::Clock::duration> round_trips;
+  round_trips.reserve( kRoundTrips );
+  for ( size_t i = 0; i < kWarmup + kRoundTrips; ++i ) {
+    if ( i == kWarmup ) {
+      loop.reset_stats();
+    }
+    const auto start = EventLoop::Clock::now();
+    replied = false;
+    client.write( "x" );
+    while ( not replied ) {
+      loop.wait_next_event( 1000 );
+    }
+    if ( i >= kWarmup ) {
+      round_trips.push_back( EventLoop::Clock::now() - start );
+    }
+  }
+  const EventLoop::BusyPollStats busy_poll = loop.busy_poll_stats();
+
+  client.shutdown( SHUT_WR );
+  echo_thread.join();
+
+  ranges::sort( round_trips );
+  const auto quantile_us = [&]( double p ) {
+    const auto index = static_cast<size_t>( p * static_cast<double>( round_trips.size() - 1 ) );
+    return duration<double, micro>( round_trips.at( index ) ).count();
+  };
+
+  cout << "EventLoop ping-pong " << label << " p50 " << fixed << setprecision( 1 ) << quantile_us( 0.5 )
+       << " us, p99 " << quantile_us( 0.99 ) << " us";
+  if ( spin_budget > EventLoop::Clock::duration::zero() ) {
+    cout << " (client spent " << setprecision( 1 ) << duration<double, milli>( busy_poll.spin_time ).count()
+         << " ms spinning, " << duration<double, milli>( busy_poll.sleep_time ).count() << " ms sleeping; "
+         << busy_poll.spin_wakeups << " waits ended while spinning, " << busy_poll.sleeps << " slept)";
+  }
+  cout << ".\n";
+
+  debug_output << "        EventLoop ping-pong " << label << fixed << setprecision( 1 ) << setw( 8 )
+               << quantile_us( 0.5 ) << " us p50, " << setw( 8 ) << quantile_us( 0.99 ) << " us p99\n";
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  if ( thread::hardware_concurrency() < 2 ) {
+    cout << "(With a single CPU, the two spinning threads take turns, so busy polling can only add latency.)\n";
+  }
+
+  constexpr auto spin_budget = microseconds { 200 };
+  for ( const auto& [backend, name] : { pair { EventLoop::Backend::Poll, "(poll,     " },
+                                        pair { EventLoop::Backend::Epoll, "(epoll,    " },
+                                        pair { EventLoop::Backend::IoUring, "(io_uring, " } } ) {
+    speed_test( debug_output, backend, string { name } + "blocking):  ", EventLoop::Clock::duration::zero() );
+    speed_test( debug_output, backend, string { name } + "busy poll): ", spin_budget );
+  }
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
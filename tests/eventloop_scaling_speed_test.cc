@@ -0,0 +1,245 @@
+#include "eventloop.hh"
+#include "socket_pair.hh"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+// How wait_next_event scales: for each backend, N registered socketpairs (1 to 100k) of which a fraction
+// is active. Every round writes a byte to each active pair and runs the loop (with Dispatch::Batch) until
+// all of them are delivered. Reports events per second of dispatch, the latency of each wait_next_event
+// call, and the loop thread's CPU time per event, as a table and as JSON (to the path given as the first
+// argument, or else to stdout), so that runs can be compared over time.
+
+static constexpr array<size_t, 6> kRegisteredPairs { 1, 10, 100, 1000, 10000, 100000 };
+static constexpr array<double, 3> kActiveFractions { 0.01, 0.1, 1.0 };
+static constexpr auto kMeasureTime = milliseconds { 50 }; // per configuration, after a warm-up round
+static constexpr size_t kMinRounds = 3;
+
+struct Result
+{
+  string_view backend {};
+  size_t registered_pairs {};
+  size_t active_pairs {};
+  double active_fraction {};
+  size_t rounds {};
+  uint64_t events {};
+  uint64_t waits {};
+  double events_per_second {};
+  double dispatch_p50_us {};
+  double dispatch_p99_us {};
+  double cpu_ns_per_event {};
+};
+
+static string_view backend_name( EventLoop::Backend backend )
+{
+  switch ( backend ) {
+    case EventLoop::Backend::Poll:
+      return "poll";
+    case EventLoop::Backend::Epoll:
+      return "epoll";
+    case EventLoop::Backend::IoUring:
+      break;
+  }
+  return "io_uring";
+}
+
+static nanoseconds thread_cpu_time()
+{
+  timespec now {};
+  CheckSystemCall( "clock_gettime", clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now ) );
+  return seconds { now.tv_sec } + nanoseconds { now.tv_nsec };
+}
+
+// Room for `pairs` socketpairs: raise the limit on open files (the hard limit too, when allowed).
+static size_t make_room_for( size_t pairs )
+{
+  rlimit limit {};
+  CheckSystemCall( "getrlimit", getrlimit( RLIMIT_NOFILE, &limit ) );
+  const rlim_t wanted = 2 * pairs + 64;
+  if ( limit.rlim_max < wanted ) {
+    limit.rlim_cur = limit.rlim_max = wanted;
+    setrlimit( RLIMIT_NOFILE, &limit ); // (without privilege this fails, and the sweep stops short)
+  }
+  return ( raise_open_file_limit() - 64 ) / 2;
+}
+
+// Run one configuration on a fresh loop over the first `registered` pairs, every `stride`-th of them active.
+static Result measure( EventLoop::Backend backend,
+                       vector<pair<LocalStreamSocket, LocalStreamSocket>>& pairs,
+                       size_t registered,
+                       double fraction )
+{
+  const size_t active = max<size_t>( 1, static_cast<size_t>( fraction * static_cast<double>( registered ) ) );
+  const size_t stride = registered / active;
+
+  EventLoop loop { backend };
+  loop.set_dispatch( EventLoop::Dispatch::Batch );
+  const size_t category = loop.add_category( "pair" );
+  uint64_t delivered = 0;
+  string buffer;
+  for ( size_t i = 0; i < registered; ++i ) {
+    auto& socket = pairs[i].second;
+    loop.add_rule( category, socket, Direction::In, [&socket, &delivered, &buffer] {
+      socket.read( buffer );
+      delivered += buffer.size();
+    } );
+  }
+
+  vector<uint64_t> latencies_ns;
+  nanoseconds cpu_time {};
+  nanoseconds dispatch_time {};
+  size_t rounds = 0;
+
+  // round 0 warms up (e.g. the kernel's wait queues), and isn't counted
+  for ( size_t round = 0; round <= kMinRounds or dispatch_time < kMeasureTime; ++round ) {
+    for ( size_t i = 0; i < active; ++i ) {
+      pairs[i * stride].first.write( "x" );
+    }
+
+    const uint64_t expected = delivered + active;
+    const nanoseconds cpu_start = thread_cpu_time();
+    while ( delivered < expected ) {
+      const auto start = steady_clock::now();
+      if ( loop.wait_next_event( 1000 ) != EventLoop::Result::Success ) {
+        throw runtime_error( "EventLoop did not deliver an active pair's event" );
+      }
+      const auto latency = duration_cast<nanoseconds>( steady_clock::now() - start );
+      if ( round > 0 ) {
+        latencies_ns.push_back( latency.count() );
+        dispatch_time += latency;
+      }
+    }
+    if ( round > 0 ) {
+      cpu_time += thread_cpu_time() - cpu_start;
+      ++rounds;
+    }
+  }
+
+  sort( latencies_ns.begin(), latencies_ns.end() );
+  const auto percentile_us = [&]( double p ) {
+    const size_t index = static_cast<size_t>( p * static_cast<double>( latencies_ns.size() - 1 ) );
+    return static_cast<double>( latencies_ns.at( index ) ) / 1000.0;
+  };
+
+  const uint64_t events = rounds * active;
+  return { backend_name( backend ),
+           registered,
+           active,
+           fraction,
+           rounds,
+           events,
+           latencies_ns.size(),
+           static_cast<double>( events ) / duration<double>( dispatch_time ).count(),
+           percentile_us( 0.5 ),
+           percentile_us( 0.99 ),
+           static_cast<double>( cpu_time.count() ) / static_cast<double>( events ) };
+}
+
+static string to_json( const vector<Result>& results, size_t max_pairs )
+{
+  ostringstream out;
+  out << fixed << setprecision( 3 );
+  out << R"({"benchmark":"eventloop_scaling","dispatch":"batch","max_registered_pairs":)" << max_pairs
+      << R"(,"results":[)";
+  for ( size_t i = 0; i < results.size(); ++i ) {
+    const Result& r = results[i];
+    out << ( i == 0 ? "\n" : ",\n" );
+    out << R"({"backend":")" << r.backend << R"(","registered_pairs":)" << r.registered_pairs
+        << R"(,"active_pairs":)" << r.active_pairs << R"(,"active_fraction":)" << r.active_fraction
+        << R"(,"rounds":)" << r.rounds << R"(,"events":)" << r.events << R"(,"waits":)" << r.waits
+        << R"(,"events_per_second":)" << r.events_per_second << R"(,"dispatch_p50_us":)" << r.dispatch_p50_us
+        << R"(,"dispatch_p99_us":)" << r.dispatch_p99_us << R"(,"cpu_ns_per_event":)" << r.cpu_ns_per_event
+        << "}";
+  }
+  out << "\n]}\n";
+  return out.str();
+}
+
+void program_body( const string& json_path )
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  const size_t max_pairs = min( kRegisteredPairs.back(), make_room_for( kRegisteredPairs.back() ) );
+  vector<pair<LocalStreamSocket, LocalStreamSocket>> pairs;
+  pairs.reserve( max_pairs );
+
+  vector<Result> results;
+  for ( size_t registered : kRegisteredPairs ) {
+    if ( registered > max_pairs ) {
+      // the open file limit stops the sweep short: measure as many pairs as it allows, and stop
+      cout << "EventLoop scaling: the open file limit allows " << max_pairs << " of " << registered
+           << " socketpairs.\n";
+      if ( pairs.size() == max_pairs ) {
+        break;
+      }
+      registered = max_pairs;
+    }
+    while ( pairs.size() < registered ) {
+      pairs.push_back( socket_pair() );
+    }
+
+    for ( const auto backend : { EventLoop::Backend::Poll, EventLoop::Backend::Epoll, EventLoop::Backend::IoUring } ) {
+      size_t last_active = 0;
+      for ( const double fraction : kActiveFractions ) {
+        const size_t active = max<size_t>( 1, static_cast<size_t>( fraction * static_cast<double>( registered ) ) );
+        if ( active == last_active ) {
+          continue; // (a small N has the same active count for several fractions)
+        }
+        last_active = active;
+
+        const Result& r = results.emplace_back( measure( backend, pairs, registered, fraction ) );
+        cout << "EventLoop " << setw( 8 ) << left << r.backend << right << " " << setw( 6 ) << registered
+             << " pairs, " << setw( 6 ) << active << " active: " << fixed << setprecision( 0 ) << setw( 10 )
+             << r.events_per_second << " events/s, dispatch p50 " << setprecision( 1 ) << setw( 8 )
+             << r.dispatch_p50_us << " us, p99 " << setw( 8 ) << r.dispatch_p99_us << " us, "
+             << setprecision( 0 ) << setw( 6 ) << r.cpu_ns_per_event << " ns CPU/event\n";
+        debug_output << "        EventLoop scaling " << r.backend << " " << registered << "/" << active << ": "
+                     << fixed << setprecision( 0 ) << r.cpu_ns_per_event << " ns CPU/event\n";
+      }
+    }
+  }
+
+  const string json = to_json( results, max_pairs );
+  if ( json_path.empty() ) {
+    cout << json;
+  } else {
+    ofstream { json_path } << json;
+  }
+}
+
+int main( int argc, char* argv[] )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+
+    auto args = span( argv, argc );
+    if ( argc > 2 ) {
+      cerr << "Usage: " << args.front() << " [results.json]\n";
+      return EXIT_FAILURE;
+    }
+    program_body( argc == 2 ? args[1] : "" );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,259 @@
+#include "eventloop.hh"
+#include "socket_pair.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+// One active socketpair among many idle ones: every iteration writes a byte to the active pair and
+// waits for the loop to deliver it. Returns the number of events dispatched per second. The idle rules
+// have an interest function (asked on every iteration), or else explicit interest (see EventLoop::Interest).
+static double speed_test( fstream& debug_output,
+                          EventLoop::Backend backend,
+                          string_view label,
+                          size_t idle_pairs,
+                          bool explicit_interest = false )
+{
+  EventLoop loop { backend };
+
+  const size_t idle_category = loop.add_category( "idle" );
+  vector<pair<LocalStreamSocket, LocalStreamSocket>> idle;
+  idle.reserve( idle_pairs );
+  for ( size_t i = 0; i < idle_pairs; ++i ) {
+    idle.push_back( socket_pair() );
+    auto& socket = idle.back().second;
+    const auto read_idle = [&socket] {
+      string buf;
+      socket.read( buf );
+    };
+    if ( explicit_interest ) {
+      loop.add_rule( idle_category, socket, Direction::In, read_idle, EventLoop::Interest::Enabled );
+    } else {
+      loop.add_rule( idle_category, socket, Direction::In, read_idle );
+    }
+  }
+
+  auto [sender, receiver] = socket_pair();
+  size_t delivered = 0;
+  loop.add_rule( "active", receiver, Direction::In, [&] {
+    string buf;
+    receiver.read( buf );
+    delivered += buf.size();
+  } );
+
+  // run for a fixed time rather than a fixed count, since the backends differ so much
+  constexpr auto run_time = milliseconds { 500 };
+  size_t iterations = 0;
+  const auto start_time = steady_clock::now();
+  auto stop_time = start_time;
+  while ( stop_time - start_time < run_time ) {
+    sender.write( "x" );
+    if ( loop.wait_next_event( 1000 ) != EventLoop::Result::Success ) {
+      throw runtime_error( "EventLoop did not deliver the active pair's event" );
+    }
+    ++iterations;
+    if ( iterations % 16 == 0 ) {
+      stop_time = steady_clock::now();
+    }
+  }
+  stop_time = steady_clock::now();
+
+  if ( delivered != iterations ) {
+    throw runtime_error( "EventLoop delivered " + to_string( delivered ) + " bytes, expected "
+                         + to_string( iterations ) );
+  }
+
+  const double seconds = duration_cast<duration<double>>( stop_time - start_time ).count();
+  const double events_per_second = static_cast<double>( iterations ) / seconds;
+  const double us_per_event = 1e6 / events_per_second;
+
+  const string_view idle_kind = explicit_interest ? " idle socketpairs (explicit interest)" : " idle socketpairs";
+  cout << "EventLoop " << label << " with " << idle_pairs << idle_kind << " and one active pair reached " << fixed
+       << setprecision( 0 ) << events_per_second << " events/s (" << setprecision( 2 ) << us_per_event
+       << " us per event).\n";
+
+  debug_output << "        EventLoop dispatch " << label << " (" << setw( 5 ) << idle_pairs
+               << ( explicit_interest ? " idle, explicit): " : " idle): " ) << fixed << setprecision( 2 )
+               << setw( 8 ) << us_per_event << " us/event\n";
+
+  return events_per_second;
+}
+
+// Many busy socketpairs: every round writes a byte to each pair, and the loop runs until all of them
+// are delivered. Reports events per second and the loop's syscalls per event.
+static void busy_test( fstream& debug_output,
+                       EventLoop::Backend backend,
+                       EventLoop::Dispatch dispatch,
+                       string_view label,
+                       size_t busy_pairs,
+                       bool with_stats = false )
+{
+  EventLoop loop { backend };
+  loop.set_dispatch( dispatch );
+  loop.enable_stats( with_stats );
+
+  const size_t category = loop.add_category( "busy" );
+  vector<pair<LocalStreamSocket, LocalStreamSocket>> pairs;
+  pairs.reserve( busy_pairs );
+  size_t delivered = 0;
+  for ( size_t i = 0; i < busy_pairs; ++i ) {
+    pairs.push_back( socket_pair() );
+    auto& socket = pairs.back().second;
+    loop.add_rule( category, socket, Direction::In, [&socket, &delivered] {
+      string buf;
+      socket.read( buf );
+      delivered += buf.size();
+    } );
+  }
+
+  constexpr size_t rounds = 20;
+  const auto start_time = steady_clock::now();
+  for ( size_t round = 1; round <= rounds; ++round ) {
+    for ( auto& [sender, receiver] : pairs ) {
+      sender.write( "x" );
+    }
+    while ( delivered < round * busy_pairs ) {
+      if ( loop.wait_next_event( 1000 ) != EventLoop::Result::Success ) {
+        throw runtime_error( "EventLoop did not deliver a busy pair's event" );
+      }
+    }
+  }
+  const auto stop_time = steady_clock::now();
+
+  const double events = static_cast<double>( rounds * busy_pairs );
+  const double seconds = duration_cast<duration<double>>( stop_time - start_time ).count();
+  const double syscalls_per_event = static_cast<double>( loop.kernel_calls() ) / events;
+
+  cout << "EventLoop " << label << " with " << busy_pairs << " busy socketpairs reached " << fixed
+       << setprecision( 0 ) << events / seconds << " events/s (" << setprecision( 3 ) << syscalls_per_event
+       << " loop syscalls per event).\n";
+
+  debug_output << "        EventLoop busy " << label << ": " << fixed << setprecision( 2 ) << setw( 8 )
+               << 1e6 * seconds / events << " us/event, " << setprecision( 3 ) << syscalls_per_event
+               << " syscalls/event\n";
+
+  if ( with_stats ) {
+    loop.dump_stats( cout );
+  }
+}
+
+// Another thread posts tasks to a loop blocked in the kernel: first one at a time, timing each from
+// post() to the task running, then in a burst, to see the wake-ups coalesce.
+static void post_test( fstream& debug_output, EventLoop::Backend backend, string_view label )
+{
+  EventLoop loop { backend };
+  auto [a, b] = socket_pair();
+  loop.add_rule( "keep-alive", b, Direction::In, [&] {
+    string buf;
+    b.read( buf );
+  } );
+
+  constexpr size_t pings = 5000;
+  constexpr size_t burst = 200000;
+  vector<uint64_t> latencies_ns;
+  latencies_ns.reserve( pings );
+  atomic<size_t> run = 0;
+  uint64_t wakeups_before_burst = 0;
+  auto burst_start = steady_clock::now();
+
+  thread producer { [&] {
+    for ( size_t i = 0; i < pings; ++i ) {
+      const auto posted = steady_clock::now();
+      loop.post( [&, posted] {
+        latencies_ns.push_back( duration_cast<nanoseconds>( steady_clock::now() - posted ).count() );
+        run.fetch_add( 1, memory_order_release );
+      } );
+      while ( run.load( memory_order_acquire ) <= i ) {
+        this_thread::yield();
+      }
+    }
+    wakeups_before_burst = loop.post_wakeups();
+    burst_start = steady_clock::now();
+    for ( size_t i = 0; i < burst; ++i ) {
+      loop.post( [&] { run.fetch_add( 1, memory_order_relaxed ); } );
+    }
+  } };
+
+  while ( run.load( memory_order_relaxed ) < pings + burst ) {
+    if ( loop.wait_next_event( 1000 ) == EventLoop::Result::Timeout ) {
+      producer.join();
+      throw runtime_error( "EventLoop was not woken by post()" );
+    }
+  }
+  const auto burst_stop = steady_clock::now();
+  producer.join();
+  const uint64_t burst_wakeups = loop.post_wakeups() - wakeups_before_burst;
+
+  sort( latencies_ns.begin(), latencies_ns.end() );
+  const auto percentile = [&]( double p ) {
+    return latencies_ns.at( static_cast<size_t>( p * static_cast<double>( latencies_ns.size() - 1 ) ) );
+  };
+  const double burst_seconds = duration_cast<duration<double>>( burst_stop - burst_start ).count();
+
+  cout << "EventLoop " << label << " post() wake-up latency p50=" << fixed << setprecision( 2 )
+       << static_cast<double>( percentile( 0.5 ) ) / 1000.0 << " us, p99="
+       << static_cast<double>( percentile( 0.99 ) ) / 1000.0 << " us; a burst of " << burst << " posts ran at "
+       << setprecision( 0 ) << static_cast<double>( burst ) / burst_seconds << " tasks/s with " << burst_wakeups
+       << " wake-ups.\n";
+
+  debug_output << "        EventLoop post " << label << ": p50 " << fixed << setprecision( 1 )
+               << static_cast<double>( percentile( 0.5 ) ) / 1000.0 << " us, p99 "
+               << static_cast<double>( percentile( 0.99 ) ) / 1000.0 << " us\n";
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  // each idle pair holds two descriptors; leave some headroom under the limit
+  const size_t fd_limit = raise_open_file_limit();
+  const size_t idle_pairs = min<size_t>( 10000, ( fd_limit - 64 ) / 2 );
+
+  speed_test( debug_output, EventLoop::Backend::Poll, "poll ", 0 );
+  speed_test( debug_output, EventLoop::Backend::Epoll, "epoll", 0 );
+  const double poll_rate = speed_test( debug_output, EventLoop::Backend::Poll, "poll ", idle_pairs );
+  const double epoll_rate = speed_test( debug_output, EventLoop::Backend::Epoll, "epoll", idle_pairs );
+
+  if ( epoll_rate < poll_rate ) {
+    throw runtime_error( "epoll backend was slower than poll with many idle fds" );
+  }
+
+  // with explicit interest, the idle rules cost nothing per iteration
+  speed_test( debug_output, EventLoop::Backend::Poll, "poll ", idle_pairs, true );
+  speed_test( debug_output, EventLoop::Backend::Epoll, "epoll", idle_pairs, true );
+  speed_test( debug_output, EventLoop::Backend::IoUring, "io_uring", idle_pairs, true );
+
+  using enum EventLoop::Dispatch;
+  busy_test( debug_output, EventLoop::Backend::Poll, OneRule, "poll, one rule per wait", 1000 );
+  busy_test( debug_output, EventLoop::Backend::Poll, Batch, "poll, batch dispatch   ", 1000 );
+  busy_test( debug_output, EventLoop::Backend::Epoll, OneRule, "epoll, one rule per wait", 1000 );
+  busy_test( debug_output, EventLoop::Backend::Epoll, Batch, "epoll, batch dispatch   ", 1000 );
+  busy_test( debug_output, EventLoop::Backend::Epoll, Batch, "epoll, batch with stats ", 1000, true );
+
+  post_test( debug_output, EventLoop::Backend::Poll, "poll " );
+  post_test( debug_output, EventLoop::Backend::Epoll, "epoll" );
+  post_test( debug_output, EventLoop::Backend::IoUring, "io_uring" );
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
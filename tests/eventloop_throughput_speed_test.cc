@@ -0,0 +1,163 @@
+#include "eventloop.hh"
+#include "socket.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string_view>
+
+using namespace std;
+using namespace std::chrono;
+
+static constexpr size_t kChunkSize = 16384;
+
+struct Connection
+{
+  TCPSocket client {};
+  TCPSocket server {};
+};
+
+// a TCP connection over the loopback interface
+static Connection connect_loopback()
+{
+  TCPSocket listener;
+  listener.set_reuseaddr();
+  listener.bind( Address { "127.0.0.1" } );
+  listener.listen();
+
+  Connection connection;
+  connection.client.connect( listener.local_address() );
+  connection.server = listener.accept();
+  connection.client.set_blocking( false );
+  connection.server.set_blocking( false );
+  return connection;
+}
+
+// Move `data` from client to server with readiness rules and FileDescriptor::read/write
+static uint64_t transfer_with_rules( EventLoop& loop, Connection& c, string_view data )
+{
+  size_t sent = 0;
+  size_t received = 0;
+  string buffer;
+
+  loop.add_rule(
+    "write",
+    c.client,
+    Direction::Out,
+    [&] { sent += c.client.write( data.substr( sent, kChunkSize ) ); },
+    [&] { return sent < data.size(); } );
+
+  loop.add_rule( "read", c.server, Direction::In, [&] {
+    buffer.resize( kChunkSize );
+    c.server.read( buffer );
+    if ( data.substr( received, buffer.size() ) != buffer ) {
+      throw runtime_error( "Mismatch between data written and read" );
+    }
+    received += buffer.size();
+  } );
+
+  while ( received < data.size() ) {
+    loop.wait_next_event( 1000 );
+  }
+
+  return loop.kernel_calls() + c.client.write_count() + c.server.read_count();
+}
+
+// Move `data` from client to server with completion-based async_write/async_read
+static uint64_t transfer_async( EventLoop& loop, Connection& c, string_view data )
+{
+  size_t sent = 0;
+  size_t received = 0;
+
+  const auto write_next = [&]( const auto& self ) -> void {
+    c.client.async_write( loop, string { data.substr( sent, kChunkSize ) }, [&, self]( size_t n ) {
+      sent += n;
+      if ( sent < data.size() ) {
+        self( self );
+      }
+    } );
+  };
+
+  const auto read_next = [&]( const auto& self ) -> void {
+    c.server.async_read( loop, [&, self]( string_view chunk ) {
+      if ( data.substr( received, chunk.size() ) != chunk ) {
+        throw runtime_error( "Mismatch between data written and read" );
+      }
+      received += chunk.size();
+      if ( received < data.size() ) {
+        self( self );
+      }
+    } );
+  };
+
+  write_next( write_next );
+  read_next( read_next );
+  while ( received < data.size() ) {
+    loop.wait_next_event( 1000 );
+  }
+
+  return loop.kernel_calls();
+}
+
+// (io_uring uses async_read/async_write, unless edge-triggered)
+static void speed_test( fstream& debug_output,
+                        EventLoop::Backend backend,
+                        string_view label,
+                        const string& data,
+                        EventLoop::Trigger trigger = EventLoop::Trigger::Level )
+{
+  EventLoop loop { backend };
+  loop.set_trigger( trigger );
+  Connection connection = connect_loopback();
+
+  const bool async = backend == EventLoop::Backend::IoUring and trigger == EventLoop::Trigger::Level;
+  const auto start_time = steady_clock::now();
+  const uint64_t syscalls
+    = async ? transfer_async( loop, connection, data ) : transfer_with_rules( loop, connection, data );
+  const auto stop_time = steady_clock::now();
+
+  const double seconds = duration_cast<duration<double>>( stop_time - start_time ).count();
+  const double gigabits_per_second = 8.0 * static_cast<double>( data.size() ) / seconds / 1e9;
+  const double syscalls_per_byte = static_cast<double>( syscalls ) / static_cast<double>( data.size() );
+
+  cout << "EventLoop loopback transfer " << label << " reached " << fixed << setprecision( 2 )
+       << gigabits_per_second << " Gbit/s with " << syscalls << " syscalls (" << scientific << setprecision( 2 )
+       << syscalls_per_byte << " syscalls/byte, " << fixed << setprecision( 0 )
+       << static_cast<double>( data.size() ) / static_cast<double>( syscalls ) << " bytes/syscall).\n";
+
+  debug_output << "        EventLoop loopback " << label << fixed << setprecision( 2 ) << setw( 6 )
+               << gigabits_per_second << " Gbit/s, " << scientific << setprecision( 2 ) << syscalls_per_byte
+               << " syscalls/byte\n";
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  string data( size_t { 128 } << 20, 0 );
+  for ( size_t i = 0; i < data.size(); ++i ) {
+    data[i] = static_cast<char>( i * 131 % 251 );
+  }
+
+  speed_test( debug_output, EventLoop::Backend::Poll, "(poll):     ", data );
+  speed_test( debug_output, EventLoop::Backend::Epoll, "(epoll):    ", data );
+  speed_test( debug_output, EventLoop::Backend::IoUring, "(io_uring): ", data );
+  using enum EventLoop::Trigger;
+  speed_test( debug_output, EventLoop::Backend::Epoll, "(epoll, edge-triggered):    ", data, Edge );
+  speed_test( debug_output, EventLoop::Backend::IoUring, "(io_uring, edge-triggered): ", data, Edge );
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
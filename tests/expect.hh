@@ -0,0 +1,17 @@
+#pragma once
+
+#include <source_location>
+#include <stdexcept>
+#include <string>
+
+// Fail the test (by throwing) unless `condition` holds. `what` names what was expected; the message
+// gives the file and line of the call.
+inline void expect( bool condition,
+                    const std::string& what,
+                    const std::source_location& where = std::source_location::current() )
+{
+  if ( not condition ) {
+    throw std::runtime_error( std::string { where.file_name() } + ":" + std::to_string( where.line() )
+                              + ": test failed: " + what );
+  }
+}
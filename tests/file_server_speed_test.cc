@@ -0,0 +1,238 @@
+#include "eventloop.hh"
+#include "exception.hh"
+#include "socket.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+using namespace std::chrono;
+
+// A webget-style local file server: a client thread GETs a file over loopback TCP, and a server on an
+// EventLoop sends it, either copying it through userspace (read and write), or with sendfile, or by
+// splicing it through a pipe. Reports the server thread's CPU time per gigabyte sent.
+
+static constexpr size_t kFileSize = size_t { 64 } << 20;
+static constexpr size_t kRequests = 8;
+static constexpr size_t kChunkSize = 65536;  // (copy) the read buffer
+static constexpr size_t kPipeSize = 1 << 20; // (splice)
+
+enum class Mode : uint8_t
+{
+  Copy,
+  Sendfile,
+  Splice
+};
+
+struct Connection
+{
+  TCPSocket client {};
+  TCPSocket server {};
+};
+
+// a TCP connection over the loopback interface
+static Connection connect_loopback()
+{
+  TCPSocket listener;
+  listener.set_reuseaddr();
+  listener.bind( Address { "127.0.0.1" } );
+  listener.listen();
+
+  Connection connection;
+  connection.client.connect( listener.local_address() );
+  connection.server = listener.accept();
+  connection.server.set_blocking( false );
+  return connection;
+}
+
+static nanoseconds thread_cpu_time()
+{
+  timespec now {};
+  CheckSystemCall( "clock_gettime", clock_gettime( CLOCK_THREAD_CPUTIME_ID, &now ) );
+  return seconds { now.tv_sec } + nanoseconds { now.tv_nsec };
+}
+
+// GET the file kRequests times (blocking), and check the lengths
+static void run_client( TCPSocket& socket )
+{
+  BufferPool pool { 1 << 20 };
+  for ( size_t i = 0; i < kRequests; ++i ) {
+    socket.write( "GET /file HTTP/1.1\r\nHost: localhost\r\n\r\n" );
+
+    string header;
+    size_t body_received = 0;
+    while ( header.find( "\r\n\r\n" ) == string::npos ) {
+      const PooledBuffer buffer = socket.read( pool );
+      if ( buffer.empty() ) {
+        throw runtime_error( "client: connection closed during the header" );
+      }
+      header += buffer.view();
+    }
+    const size_t header_end = header.find( "\r\n\r\n" ) + 4;
+    body_received = header.size() - header_end;
+    const size_t length_at = header.find( "Content-Length: " );
+    const size_t body_size = stoul( header.substr( length_at + 16 ) );
+
+    while ( body_received < body_size ) {
+      const PooledBuffer buffer = socket.read( pool );
+      if ( buffer.empty() ) {
+        throw runtime_error( "client: connection closed during the body" );
+      }
+      body_received += buffer.size();
+    }
+    if ( body_received != body_size ) {
+      throw runtime_error( "client: body longer than its Content-Length" );
+    }
+  }
+}
+
+// returns the server thread's CPU-seconds per GB
+static double speed_test( fstream& debug_output, Mode mode, string_view label, FileDescriptor& file )
+{
+  Connection c = connect_loopback();
+  EventLoop loop { EventLoop::Backend::Epoll };
+
+  auto [pipe_out, pipe_in] = FileDescriptor::make_pipe();
+  fcntl( pipe_in.fd_num(), F_SETPIPE_SZ, kPipeSize ); // NOLINT(*-vararg) (best effort)
+
+  string request;
+  size_t requests_pending = 0;
+  size_t responses_done = 0;
+  string header;
+  size_t header_sent = 0;
+  size_t body_left = 0;
+  string chunk;          // (copy) read from the file, not yet written
+  size_t chunk_sent = 0; // (copy)
+  size_t in_pipe = 0;    // (splice) spliced from the file, not yet to the socket
+
+  const auto responding = [&] { return header_sent < header.size() or body_left > 0; };
+
+  loop.add_rule( "request", c.server, Direction::In, [&] {
+    string buffer;
+    c.server.read( buffer );
+    request += buffer;
+    for ( size_t end = request.find( "\r\n\r\n" ); end != string::npos; end = request.find( "\r\n\r\n" ) ) {
+      request.erase( 0, end + 4 );
+      ++requests_pending;
+    }
+  } );
+
+  loop.add_rule(
+    "response",
+    c.server,
+    Direction::Out,
+    [&] {
+      if ( not responding() ) {
+        --requests_pending;
+        header = "HTTP/1.1 200 OK\r\nContent-Length: " + to_string( kFileSize ) + "\r\n\r\n";
+        header_sent = 0;
+        body_left = kFileSize;
+        CheckSystemCall( "lseek", static_cast<int>( lseek( file.fd_num(), 0, SEEK_SET ) ) );
+      }
+      if ( header_sent < header.size() ) {
+        header_sent += c.server.write( string_view { header }.substr( header_sent ) );
+        return;
+      }
+
+      size_t sent = 0;
+      switch ( mode ) {
+        case Mode::Copy:
+          if ( chunk_sent == chunk.size() ) {
+            chunk.resize( min( kChunkSize, body_left ) );
+            file.read( chunk );
+            chunk_sent = 0;
+          }
+          sent = c.server.write( string_view { chunk }.substr( chunk_sent ) );
+          chunk_sent += sent;
+          break;
+        case Mode::Sendfile:
+          sent = file.sendfile_to( c.server, body_left );
+          break;
+        case Mode::Splice:
+          if ( in_pipe == 0 ) {
+            in_pipe = file.splice_to( pipe_in, min( kPipeSize, body_left ) );
+          }
+          sent = pipe_out.splice_to( c.server, in_pipe );
+          in_pipe -= sent;
+          break;
+      }
+      body_left -= sent;
+      if ( body_left == 0 ) {
+        ++responses_done;
+      }
+    },
+    [&] { return responding() or requests_pending > 0; } );
+
+  const auto start_time = steady_clock::now();
+  const nanoseconds start_cpu = thread_cpu_time();
+  thread client { [&] { run_client( c.client ); } };
+  while ( responses_done < kRequests ) {
+    if ( loop.wait_next_event( 1000 ) == EventLoop::Result::Exit ) {
+      break;
+    }
+  }
+  const nanoseconds server_cpu = thread_cpu_time() - start_cpu;
+  client.join();
+  const auto stop_time = steady_clock::now();
+
+  const double gigabytes = static_cast<double>( kRequests * kFileSize ) / 1e9;
+  const double seconds = duration_cast<duration<double>>( stop_time - start_time ).count();
+  const double cpu_seconds = duration_cast<duration<double>>( server_cpu ).count();
+
+  cout << "File server " << label << " sent " << fixed << setprecision( 2 ) << gigabytes << " GB at "
+       << gigabytes / seconds << " GB/s, with " << setprecision( 3 ) << cpu_seconds / gigabytes
+       << " CPU-seconds per GB on the server's thread.\n";
+
+  debug_output << "        File server " << label << fixed << setprecision( 3 ) << setw( 7 )
+               << cpu_seconds / gigabytes << " CPU-s/GB, " << setprecision( 2 ) << gigabytes / seconds
+               << " GB/s\n";
+
+  return cpu_seconds / gigabytes;
+}
+
+void program_body()
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  string path = "/tmp/minnow_file_server_XXXXXX";
+  FileDescriptor file { CheckSystemCall( "mkstemp", mkstemp( path.data() ) ) };
+  CheckSystemCall( "unlink", unlink( path.c_str() ) );
+  string data( kFileSize, 0 );
+  for ( size_t i = 0; i < data.size(); ++i ) {
+    data[i] = static_cast<char>( i * 131 % 251 );
+  }
+  for ( size_t written = 0; written < data.size(); ) {
+    written += file.write( string_view { data }.substr( written ) );
+  }
+
+  const double copy_cpu = speed_test( debug_output, Mode::Copy, "(read/write):", file );
+  const double sendfile_cpu = speed_test( debug_output, Mode::Sendfile, "(sendfile):  ", file );
+  speed_test( debug_output, Mode::Splice, "(splice):    ", file );
+
+  if ( sendfile_cpu > copy_cpu ) {
+    throw runtime_error( "sendfile took more CPU per GB than copying through userspace" );
+  }
+}
+
+int main()
+{
+  try {
+    program_body();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
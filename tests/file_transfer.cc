@@ -0,0 +1,134 @@
+#include "eventloop.hh"
+#include "expect.hh"
+#include "socket_pair.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+// a temporary file holding `contents` (already unlinked), at offset 0
+static FileDescriptor temp_file( const string& contents )
+{
+  string path = "/tmp/minnow_file_transfer_XXXXXX";
+  FileDescriptor file { CheckSystemCall( "mkstemp", mkstemp( path.data() ) ) };
+  CheckSystemCall( "unlink", unlink( path.c_str() ) );
+  expect( file.write( contents ) == contents.size(), "temp file written" );
+  CheckSystemCall( "lseek", static_cast<int>( lseek( file.fd_num(), 0, SEEK_SET ) ) );
+  return file;
+}
+
+static string drain( FileDescriptor& fd )
+{
+  string all;
+  string buffer;
+  do {
+    buffer.clear();
+    fd.read( buffer );
+    all += buffer;
+  } while ( not buffer.empty() );
+  return all;
+}
+
+static string pattern( size_t size )
+{
+  string data( size, 0 );
+  for ( size_t i = 0; i < size; ++i ) {
+    data[i] = static_cast<char>( 'a' + i % 26 );
+  }
+  return data;
+}
+
+static void sendfile_partial_progress()
+{
+  const string data = pattern( 4 << 20 ); // more than a socket buffer holds
+  FileDescriptor file = temp_file( data );
+  auto [a, b] = socket_pair();
+
+  // a full non-blocking socket takes what it can, then nothing, with no error
+  size_t sent = 0;
+  while ( const size_t moved = file.sendfile_to( a, data.size() - sent ) ) {
+    sent += moved;
+  }
+  expect( sent > 0 and sent < data.size() and not file.eof(), "partial progress, then nothing" );
+  expect( a.bytes_written() == sent and file.bytes_read() == sent, "bytes counted on both fds" );
+
+  string received = drain( b );
+  while ( sent < data.size() ) {
+    sent += file.sendfile_to( a, data.size() - sent );
+    received += drain( b );
+  }
+  expect( received == data, "file contents, in order" );
+  expect( file.sendfile_to( a, 1 ) == 0 and file.eof(), "EOF at the end of the file" );
+}
+
+static void splice_and_tee()
+{
+  auto [a, b] = socket_pair();
+  auto [pipe_out, pipe_in] = FileDescriptor::make_pipe();
+  auto [copy_out, copy_in] = FileDescriptor::make_pipe();
+
+  // socket -> pipe; tee the pipe to another pipe; pipe -> socket
+  a.write( "hello, pipes" );
+  expect( b.splice_to( pipe_in, 100 ) == 12, "socket spliced into pipe" );
+  expect( b.splice_to( pipe_in, 100 ) == 0 and not b.eof(), "empty socket: nothing, not EOF" );
+  expect( pipe_out.tee_to( copy_in, 5 ) == 5, "tee'd a prefix" );
+  expect( drain( copy_out ) == "hello", "tee copies" );
+  expect( pipe_out.splice_to( b, 100 ) == 12, "pipe spliced into socket" );
+  expect( drain( a ) == "hello, pipes", "tee doesn't consume" );
+
+  // a file spliced through a pipe
+  FileDescriptor file = temp_file( "file contents" );
+  expect( file.splice_to( pipe_in, 100 ) == 13 and pipe_out.splice_to( a, 100 ) == 13, "file -> pipe -> socket" );
+  expect( drain( b ) == "file contents", "file contents arrive" );
+
+  pipe_in.close();
+  expect( pipe_out.splice_to( a, 100 ) == 0 and pipe_out.eof(), "EOF once the pipe's writers close" );
+}
+
+// a rule on a socket serves a file with sendfile, as far as the socket takes it each time
+static void served_by_rule( EventLoop::Backend backend )
+{
+  const string data = pattern( 3 << 20 );
+  FileDescriptor file = temp_file( data );
+  auto [a, b] = socket_pair();
+  EventLoop loop { backend };
+
+  size_t sent = 0;
+  string received;
+  loop.add_rule(
+    "sendfile", a, Direction::Out, [&] { sent += file.sendfile_to( a, data.size() - sent ); },
+    [&] { return sent < data.size(); } );
+  loop.add_rule( "receive", b, Direction::In, [&] {
+    string buffer;
+    b.read( buffer );
+    received += buffer;
+  } );
+
+  while ( received.size() < data.size() ) {
+    expect( loop.wait_next_event( 1000 ) == EventLoop::Result::Success, "loop serves the transfer" );
+  }
+  expect( received == data and a.write_count() > 1, "file served over several turns of the loop" );
+}
+
+int main()
+{
+  try {
+    sendfile_partial_progress();
+    splice_and_tee();
+    for ( const auto backend :
+          { EventLoop::Backend::Poll, EventLoop::Backend::Epoll, EventLoop::Backend::IoUring } ) {
+      served_by_rule( backend );
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,304 @@
+#include "common.hh"
+#include "fragment_reassembler.hh"
+#include "random.hh"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+class FragmentReassemblerTestHarness : public TestHarness<FragmentReassembler>
+{
+public:
+  FragmentReassemblerTestHarness( std::string test_name,
+                                  size_t max_datagrams,
+                                  milliseconds timeout,
+                                  size_t max_buffer_bytes = 4194304 )
+    : TestHarness( move( test_name ),
+                   "max_datagrams=" + to_string( max_datagrams ) + ", timeout=" + to_string( timeout.count() )
+                     + "ms, max_buffer_bytes=" + to_string( max_buffer_bytes ),
+                   FragmentReassembler { max_datagrams, timeout, max_buffer_bytes } )
+  {}
+};
+
+static FragmentReassembler::Clock::time_point at_ms( uint64_t ms )
+{
+  return FragmentReassembler::Clock::time_point {} + milliseconds { ms };
+}
+
+struct InsertFragment : public Action<FragmentReassembler>
+{
+  FragmentKey key_;
+  uint64_t offset_;
+  string payload_;
+  bool more_fragments_ { true };
+  uint64_t now_ms_ {};
+  optional<string> expected_ {};
+
+  InsertFragment( FragmentKey key, uint64_t offset, string payload )
+    : key_( key ), offset_( offset ), payload_( move( payload ) )
+  {}
+
+  InsertFragment& last()
+  {
+    more_fragments_ = false;
+    return *this;
+  }
+
+  InsertFragment& at( uint64_t now_ms )
+  {
+    now_ms_ = now_ms;
+    return *this;
+  }
+
+  InsertFragment& completes( string datagram )
+  {
+    expected_ = move( datagram );
+    return *this;
+  }
+
+  string description() const override
+  {
+    return "insert fragment \"" + pretty_print( payload_ ) + "\" @ offset " + to_string( offset_ ) + " of id "
+           + to_string( key_.id ) + ( more_fragments_ ? "" : " [last fragment]" ) + " at t="
+           + to_string( now_ms_ ) + "ms";
+  }
+
+  void execute( FragmentReassembler& fr ) const override
+  {
+    const auto result = fr.insert( key_, offset_, payload_, more_fragments_, at_ms( now_ms_ ) );
+    if ( result != expected_ ) {
+      const auto str = []( const optional<string>& x ) { return x ? "\"" + pretty_print( *x ) + "\"" : "none"; };
+      throw ExpectationViolation { "should have had insert() return " + str( expected_ ) + ", but instead it was "
+                                   + str( result ) };
+    }
+  }
+};
+
+struct Expire : public Action<FragmentReassembler>
+{
+  uint64_t now_ms_;
+  size_t expected_;
+
+  Expire( uint64_t now_ms, size_t expected ) : now_ms_( now_ms ), expected_( expected ) {}
+  string description() const override { return "expire at t=" + to_string( now_ms_ ) + "ms"; }
+
+  void execute( FragmentReassembler& fr ) const override
+  {
+    const size_t dropped = fr.expire( at_ms( now_ms_ ) );
+    if ( dropped != expected_ ) {
+      throw ExpectationViolation { "number expired", expected_, dropped };
+    }
+  }
+};
+
+struct DatagramsPending : public ExpectNumber<FragmentReassembler, size_t>
+{
+  using ExpectNumber::ExpectNumber;
+  string name() const override { return "datagrams_pending"; }
+  size_t value( const FragmentReassembler& fr ) const override { return fr.datagrams_pending(); }
+};
+
+struct BytesBuffered : public ExpectNumber<FragmentReassembler, size_t>
+{
+  using ExpectNumber::ExpectNumber;
+  string name() const override { return "bytes_buffered"; }
+  size_t value( const FragmentReassembler& fr ) const override { return fr.bytes_buffered(); }
+};
+
+struct Evicted : public ExpectNumber<FragmentReassembler, uint64_t>
+{
+  using ExpectNumber::ExpectNumber;
+  string name() const override { return "stats().evicted"; }
+  uint64_t value( const FragmentReassembler& fr ) const override { return fr.stats().evicted; }
+};
+
+struct Rejected : public ExpectNumber<FragmentReassembler, uint64_t>
+{
+  using ExpectNumber::ExpectNumber;
+  string name() const override { return "stats().rejected"; }
+  uint64_t value( const FragmentReassembler& fr ) const override { return fr.stats().rejected; }
+};
+
+int main()
+{
+  try {
+    const FragmentKey a { 0x0a000001, 1, 17 };
+    const FragmentKey b { 0x0a000001, 2, 17 };
+    const FragmentKey c { 0x0a000002, 1, 17 };
+    const FragmentKey d { 0x0a000001, 1, 6 };
+
+    {
+      FragmentReassemblerTestHarness test { "unfragmented", 4, 1000ms };
+
+      test.execute( InsertFragment { a, 0, "hello" }.last().completes( "hello" ) );
+      test.execute( DatagramsPending { 0 } );
+    }
+
+    {
+      FragmentReassemblerTestHarness test { "in order and out of order", 4, 1000ms };
+
+      test.execute( InsertFragment { a, 0, "abcdefgh" } );
+      test.execute( InsertFragment { a, 8, "ijk" }.last().completes( "abcdefghijk" ) );
+
+      test.execute( InsertFragment { a, 16, "qrs" }.last() );
+      test.execute( InsertFragment { a, 0, "abcdefgh" } );
+      test.execute( DatagramsPending { 1 } );
+      test.execute( InsertFragment { a, 8, "ijklmnop" }.completes( "abcdefghijklmnopqrs" ) );
+      test.execute( DatagramsPending { 0 } );
+      test.execute( BytesBuffered { 0 } );
+    }
+
+    {
+      FragmentReassemblerTestHarness test { "keys kept apart", 4, 1000ms };
+
+      test.execute( InsertFragment { a, 8, "AAAA" }.last() );
+      test.execute( InsertFragment { b, 8, "BBBB" }.last() );
+      test.execute( InsertFragment { c, 8, "CCCC" }.last() );
+      test.execute( InsertFragment { d, 8, "DDDD" }.last() );
+      test.execute( DatagramsPending { 4 } );
+      test.execute( InsertFragment { c, 0, "cccccccc" }.completes( "ccccccccCCCC" ) );
+      test.execute( InsertFragment { a, 0, "aaaaaaaa" }.completes( "aaaaaaaaAAAA" ) );
+      test.execute( InsertFragment { d, 0, "dddddddd" }.completes( "ddddddddDDDD" ) );
+      test.execute( InsertFragment { b, 0, "bbbbbbbb" }.completes( "bbbbbbbbBBBB" ) );
+      test.execute( DatagramsPending { 0 } );
+    }
+
+    {
+      FragmentReassemblerTestHarness test { "overlap and duplicates", 4, 1000ms };
+
+      test.execute( InsertFragment { a, 0, "abcdefghijklmnop" } );
+      test.execute( InsertFragment { a, 8, "ijklmnop" } );
+      test.execute( InsertFragment { a, 0, "abcdefgh" } );
+      test.execute( InsertFragment { a, 16, "q" }.last().completes( "abcdefghijklmnopq" ) );
+    }
+
+    {
+      FragmentReassemblerTestHarness test { "malformed and inconsistent", 4, 1000ms };
+
+      test.execute( InsertFragment { a, 3, "abcdefgh" } );
+      test.execute( InsertFragment { a, 0, "abc" } );
+      test.execute( InsertFragment { a, 65528, "0123456789" }.last() );
+      test.execute( Rejected { 3 } );
+      test.execute( DatagramsPending { 0 } );
+
+      test.execute( InsertFragment { a, 8, "ijkl" }.last() );
+      test.execute( InsertFragment { a, 16, "qrst" }.last() );
+      test.execute( Rejected { 4 } );
+      test.execute( DatagramsPending { 0 } );
+
+      test.execute( InsertFragment { a, 16, "qrstuvwx" } );
+      test.execute( InsertFragment { a, 8, "ijkl" }.last() );
+      test.execute( Rejected { 5 } );
+      test.execute( DatagramsPending { 0 } );
+    }
+
+    {
+      FragmentReassemblerTestHarness test { "expiry", 4, 1000ms };
+
+      test.execute( InsertFragment { a, 8, "AAAA" }.last().at( 0 ) );
+      test.execute( InsertFragment { b, 8, "BBBB" }.last().at( 500 ) );
+      test.execute( Expire { 999, 0 } );
+      test.execute( Expire { 1000, 1 } );
+      test.execute( DatagramsPending { 1 } );
+      test.execute( InsertFragment { a, 0, "aaaaaaaa" }.at( 1000 ) );
+      test.execute( Expire { 1499, 0 } );
+      test.execute( Expire { 1500, 1 } );
+      test.execute( Expire { 2000, 1 } );
+      test.execute( DatagramsPending { 0 } );
+      test.execute( BytesBuffered { 0 } );
+    }
+
+    {
+      FragmentReassemblerTestHarness test { "table full evicts oldest", 2, 1000ms };
+
+      test.execute( InsertFragment { a, 8, "AAAA" }.last() );
+      test.execute( InsertFragment { b, 8, "BBBB" }.last() );
+      test.execute( InsertFragment { c, 8, "CCCC" }.last() );
+      test.execute( Evicted { 1 } );
+      test.execute( DatagramsPending { 2 } );
+      test.execute( InsertFragment { a, 0, "aaaaaaaa" } );
+      test.execute( Evicted { 2 } );
+      test.execute( InsertFragment { c, 0, "cccccccc" }.completes( "ccccccccCCCC" ) );
+    }
+
+    {
+      FragmentReassemblerTestHarness test { "buffer budget evicts oldest", 8, 1000ms, 65536 };
+
+      test.execute( InsertFragment { a, 0, string( 32768, 'a' ) } );
+      test.execute( InsertFragment { b, 0, string( 32768, 'b' ) } );
+      test.execute( BytesBuffered { 65536 } );
+      test.execute( InsertFragment { c, 0, string( 2048, 'c' ) } );
+      test.execute( Evicted { 1 } );
+      test.execute( DatagramsPending { 2 } );
+      test.execute( BytesBuffered { 32768 + 2048 } );
+    }
+
+    // a flood of partial datagrams never holds more than the table and buffer bounds
+    {
+      FragmentReassemblerTestHarness test { "flood", 64, 1000ms, 262144 };
+      auto rd = get_random_engine();
+      for ( unsigned i = 0; i < 10000; ++i ) {
+        const FragmentKey key { static_cast<uint32_t>( rd() ), static_cast<uint16_t>( rd() ), 17 };
+        test.execute( InsertFragment { key, 8 * ( rd() % 4096 ), string( 1480, 'x' ) }.at( i ) );
+      }
+      test.execute( DatagramsPending { 64 } );
+      test.execute( Expire { 10999, 64 } );
+      test.execute( BytesBuffered { 0 } );
+    }
+
+    // random fragmentation and arrival order of many interleaved datagrams
+    {
+      FragmentReassemblerTestHarness test { "interleaved", 256, 1000ms, 1 << 24 };
+      auto rd = get_random_engine();
+
+      struct Fragment
+      {
+        FragmentKey key;
+        uint64_t offset;
+        string payload;
+        bool last;
+      };
+      vector<Fragment> fragments;
+      vector<string> datagrams;
+      for ( uint16_t id = 0; id < 200; ++id ) {
+        string datagram( 1 + rd() % 20000, 0 );
+        generate( datagram.begin(), datagram.end(), [&] { return rd(); } );
+        for ( uint64_t offset = 0; offset < datagram.size(); ) {
+          const uint64_t len = min<uint64_t>( 8 * ( 1 + rd() % 185 ), datagram.size() - offset );
+          fragments.push_back(
+            { { 42, id, 17 }, offset, datagram.substr( offset, len ), offset + len == datagram.size() } );
+          offset += len;
+        }
+        datagrams.push_back( move( datagram ) );
+      }
+      shuffle( fragments.begin(), fragments.end(), rd );
+
+      vector<bool> completed( datagrams.size() );
+      for ( size_t i = 0; i < fragments.size(); ++i ) {
+        const auto& f = fragments[i];
+        const bool done = none_of( fragments.begin() + static_cast<ptrdiff_t>( i ) + 1,
+                                   fragments.end(),
+                                   [&]( const Fragment& g ) { return g.key == f.key; } );
+        InsertFragment insert { f.key, f.offset, f.payload };
+        if ( f.last ) {
+          insert.last();
+        }
+        if ( done ) {
+          insert.completes( datagrams.at( f.key.id ) );
+        }
+        test.execute( insert );
+      }
+      test.execute( DatagramsPending { 0 } );
+      test.execute( BytesBuffered { 0 } );
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+#include "expect.hh"
+#include "inline_function.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// count heap allocations, to check that typical callables are stored inline
+static size_t allocations = 0; // NOLINT(*-avoid-non-const-global-variables)
+
+void* operator new( size_t size )
+{
+  ++allocations;
+  if ( void* p = malloc( size ) ) { // NOLINT(*-no-malloc)
+    return p;
+  }
+  throw bad_alloc();
+}
+
+void operator delete( void* p ) noexcept
+{
+  free( p ); // NOLINT(*-no-malloc)
+}
+
+void operator delete( void* p, size_t /* size */ ) noexcept
+{
+  free( p ); // NOLINT(*-no-malloc)
+}
+
+static int free_function( int x )
+{
+  return x * 2;
+}
+
+static void inline_storage()
+{
+  int a = 0;
+  int b = 0;
+  int c = 0;
+  int d = 0;
+
+  const size_t before = allocations;
+  InlineFunction<void()> by_reference = [&] {
+    ++a;
+    ++b;
+    ++c;
+    ++d;
+  };
+  InlineFunction<int( int )> by_value = [a, b, &c]( int x ) { return x + a + b + c; };
+  InlineFunction<int( int )> pointer = free_function;
+  InlineFunction<bool()> captureless = [] { return true; };
+  by_reference();
+  InlineFunction<void()> moved = move( by_reference );
+  moved();
+  const bool no_allocations = allocations == before; // (before expect's message allocates)
+  expect( no_allocations, "small callables stored inline" );
+  expect( not by_reference and moved and a == 2 and d == 2, "moved-from is empty; moved-to calls" );
+  expect( by_value( 1 ) == 3 and pointer( 4 ) == 8 and captureless(), "calls with arguments and results" );
+
+  // a std::function fits too (its own target may or may not allocate)
+  const function<int( int )> std_function = [&]( int x ) { return x + a; };
+  const size_t before_wrap = allocations;
+  InlineFunction<int( int )> wrapped = std_function;
+  const bool wrapped_inline = allocations == before_wrap;
+  expect( wrapped_inline and wrapped( 1 ) == 3, "std::function stored inline" );
+
+  InlineFunction<int( int )> empty = function<int( int )> {};
+  expect( not empty, "an empty std::function makes an empty InlineFunction" );
+  bool threw = false;
+  try {
+    empty( 0 );
+  } catch ( const bad_function_call& ) {
+    threw = true;
+  }
+  expect( threw, "calling an empty InlineFunction throws" );
+}
+
+// large or move-only captures work, falling back to the heap when they don't fit
+static void heap_storage()
+{
+  auto owned = make_unique<string>( 100, 'x' );
+  InlineFunction<size_t()> move_only = [p = move( owned )] { return p->size(); };
+  expect( move_only() == 100, "move-only capture" );
+
+  const string big( 100, 'y' );
+  const size_t before = allocations;
+  InlineFunction<size_t()> large = [big, big2 = big] { return big.size() + big2.size(); };
+  const bool allocated = allocations > before;
+  expect( allocated, "large capture on the heap" );
+  InlineFunction<size_t()> moved = move( large );
+  expect( moved() == 200 and not large, "large capture moves" );
+
+  // the target is destroyed with the InlineFunction
+  auto shared = make_shared<int>( 1 );
+  {
+    InlineFunction<int()> holder = [shared] { return *shared; };
+    expect( shared.use_count() == 2 and holder() == 1, "capture held" );
+    holder = nullptr;
+    expect( shared.use_count() == 1, "assigning nullptr destroys the target" );
+  }
+}
+
+int main()
+{
+  try {
+    inline_storage();
+    heap_storage();
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
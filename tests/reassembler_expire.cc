@@ -0,0 +1,137 @@
+#include "byte_stream_test_harness.hh"
+#include "reassembler_test_harness.hh"
+
+#include <chrono>
+#include <exception>
+#include <iostream>
+
+using namespace std;
+using namespace std::chrono;
+
+static Reassembler::Clock::time_point at_ms( int64_t ms )
+{
+  return Reassembler::Clock::time_point {} + milliseconds { ms };
+}
+
+struct Expire : public Action<Reassembler>
+{
+  int64_t now_ms_;
+  int64_t max_age_ms_;
+  uint64_t dropped_;
+
+  Expire( int64_t now_ms, int64_t max_age_ms, uint64_t dropped )
+    : now_ms_( now_ms ), max_age_ms_( max_age_ms ), dropped_( dropped )
+  {}
+
+  std::string description() const override
+  {
+    return "expire( t=" + to_string( now_ms_ ) + " ms, max_age=" + to_string( max_age_ms_ )
+           + " ms ) drops " + to_string( dropped_ ) + " bytes";
+  }
+
+  void execute( Reassembler& r ) const override
+  {
+    const uint64_t dropped = r.expire( at_ms( now_ms_ ), milliseconds { max_age_ms_ } );
+    if ( dropped != dropped_ ) {
+      throw ExpectationViolation { "bytes dropped by expire", dropped_, dropped };
+    }
+  }
+};
+
+int main()
+{
+  try {
+    {
+      ReassemblerTestHarness test { "expire oldest first", 65000 };
+
+      test.execute( Insert { "b", 1 }.at( at_ms( 0 ) ) );
+      test.execute( Insert { "de", 3 }.at( at_ms( 10 ) ) );
+      test.execute( Insert { "hij", 7 }.at( at_ms( 20 ) ) );
+
+      test.execute( Expire( 5, 10, 0 ) );
+      test.execute( Expire( 10, 10, 1 ) );
+      test.execute( BytesPending( 5 ) );
+      test.execute( ReceivedRanges { { { 3, 5 }, { 7, 10 } } } );
+
+      test.execute( Expire( 100, 10, 5 ) );
+      test.execute( BytesPending( 0 ) );
+      test.execute( Holes { {} } );
+
+      test.execute( Insert { "abcdefghij", 0 } );
+      test.execute( ReadAll( "abcdefghij" ) );
+    }
+
+    {
+      ReassemblerTestHarness test { "expire keeps the age of the oldest byte", 65000 };
+
+      test.execute( Insert { "c", 2 }.at( at_ms( 0 ) ) );
+      test.execute( Insert { "d", 3 }.at( at_ms( 50 ) ) );
+      test.execute( Insert { "g", 6 }.at( at_ms( 60 ) ) );
+      test.execute( ReceivedRanges { { { 2, 4 }, { 6, 7 } } } );
+
+      // the merged [2, 4) dates from its first byte, so it goes before [6, 7)
+      test.execute( Expire( 100, 100, 2 ) );
+      test.execute( ReceivedRanges { { { 6, 7 } } } );
+      test.execute( Expire( 160, 100, 1 ) );
+      test.execute( BytesPending( 0 ) );
+    }
+
+    {
+      ReassemblerTestHarness test { "expire leaves the stream usable", 65000 };
+
+      test.execute( Insert { "ab", 0 } );
+      test.execute( Insert { "ef", 4 }.at( at_ms( 0 ) ) );
+      test.execute( Insert { "ijkl", 8 }.is_last().at( at_ms( 30 ) ) );
+      test.execute( Expire( 20, 20, 2 ) );
+      test.execute( BytesPending( 4 ) );
+
+      test.execute( Insert { "cdefgh", 2 } );
+      test.execute( ReadAll( "abcdefghijkl" ) );
+      test.execute( IsFinished { true } );
+    }
+
+    {
+      ReassemblerTestHarness test { "expire across arena pages", 1 << 20 };
+
+      // ranges that share a page with a live neighbour must keep their bytes readable
+      const string a( 5000, 'a' );
+      const string b( 9000, 'b' );
+      const string c( 3000, 'c' );
+      test.execute( Insert { a, 1000 }.at( at_ms( 0 ) ) );
+      test.execute( Insert { b, 7000 }.at( at_ms( 1 ) ) );
+      test.execute( Insert { c, 17000 }.at( at_ms( 2 ) ) );
+      test.execute( Expire( 2, 1, 5000 + 9000 ) );
+      test.execute( BytesPending( 3000 ) );
+
+      test.execute( Insert { string( 17000, 'x' ), 0 } );
+      test.execute( ReadAll( string( 17000, 'x' ) + c ) );
+    }
+
+    {
+      ReassemblerTestHarness test { "arrival times never go backwards", 65000 };
+
+      test.execute( Insert { "b", 1 }.at( at_ms( 100 ) ) );
+      test.execute( Insert { "d", 3 }.at( at_ms( 50 ) ) );
+      test.execute( Expire( 149, 50, 0 ) );
+      test.execute( Expire( 150, 50, 2 ) );
+    }
+
+    {
+      ReassemblerTestHarness test { "expire in lazy mode", 65000 };
+
+      test.execute( SetLazyMerge { true } );
+      test.execute( Insert { "b", 1 }.at( at_ms( 0 ) ) );
+      test.execute( Insert { "c", 2 }.at( at_ms( 5 ) ) );
+      test.execute( Insert { "f", 5 }.at( at_ms( 10 ) ) );
+      test.execute( Expire( 10, 10, 2 ) );
+      test.execute( ReceivedRanges { { { 5, 6 } } } );
+      test.execute( Insert { "abcde", 0 } );
+      test.execute( ReadAll( "abcdef" ) );
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -6,6 +6,20 @@
 
 using namespace std;
 
+// move the Reassembler over another that holds pending data, and back again
+struct MoveAway : public Action<Reassembler>
+{
+  std::string description() const override { return "move-assigned away and back"; }
+
+  void execute( Reassembler& r ) const override
+  {
+    Reassembler other { ByteStream { 16 } };
+    other.insert( 5, "xyz", false );
+    other = std::move( r );
+    r = std::move( other );
+  }
+};
+
 int main()
 {
   try {
@@ -130,6 +144,25 @@ int main()
       test.execute( ReadAll( "" ) );
       test.execute( IsFinished { true } );
     }
+
+    {
+      ReassemblerTestHarness test { "holes across a move", 65000 };
+
+      test.execute( Insert { "b", 1 } );
+      test.execute( Insert { "d", 3 } );
+      test.execute( MoveAway {} );
+      test.execute( BytesPending( 2 ) );
+      test.execute( BytesPushed( 0 ) );
+
+      test.execute( Insert { "a", 0 } );
+      test.execute( BytesPushed( 2 ) );
+      test.execute( ReadAll( "ab" ) );
+
+      test.execute( Insert { "c", 2 } );
+      test.execute( Insert { "", 4 }.is_last() );
+      test.execute( ReadAll( "cd" ) );
+      test.execute( IsFinished { true } );
+    }
   } catch ( const exception& e ) {
     cerr << "Exception: " << e.what() << "\n";
     return EXIT_FAILURE;
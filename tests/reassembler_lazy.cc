@@ -0,0 +1,88 @@
+#include "byte_stream_test_harness.hh"
+#include "random.hh"
+#include "reassembler_test_harness.hh"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <tuple>
+#include <vector>
+
+using namespace std;
+
+static constexpr size_t NREPS = 32;
+static constexpr size_t NSEGS = 512;
+static constexpr size_t MAX_SEG_LEN = 256;
+
+int main()
+{
+  try {
+    {
+      ReassemblerTestHarness test { "lazy holes", 65000 };
+
+      test.execute( SetLazyMerge { true } );
+      test.execute( Insert { "b", 1 } );
+      test.execute( Insert { "d", 3 } );
+      test.execute( Insert { "c", 2 } );
+      test.execute( BytesPending( 3 ) );
+      test.execute( ReceivedRanges { { { 1, 4 } } } );
+
+      test.execute( Insert { "a", 0 } );
+      test.execute( BytesPushed( 4 ) );
+      test.execute( ReadAll( "abcd" ) );
+      test.execute( BytesPending( 0 ) );
+    }
+
+    {
+      ReassemblerTestHarness test { "lazy switched off with staged extents", 65000 };
+
+      test.execute( SetLazyMerge { true } );
+      test.execute( Insert { "cd", 2 } );
+      test.execute( Insert { "ef", 4 }.is_last() );
+      test.execute( SetLazyMerge { false } );
+      test.execute( BytesPending( 4 ) );
+      test.execute( Insert { "ab", 0 } );
+      test.execute( ReadAll( "abcdef" ) );
+      test.execute( IsFinished { true } );
+    }
+
+    // lazy and eager Reassemblers must agree after every insert
+    auto rd = get_random_engine();
+    for ( unsigned rep_no = 0; rep_no < NREPS; ++rep_no ) {
+      const size_t capacity = NSEGS * MAX_SEG_LEN / ( 1 + rep_no % 4 );
+      ReassemblerTestHarness lazy { "lazy matches eager " + to_string( rep_no ), capacity };
+      Reassembler eager { ByteStream { capacity } };
+      lazy.execute( SetLazyMerge { true } );
+
+      vector<tuple<size_t, size_t>> seq_size;
+      size_t offset = 0;
+      for ( unsigned i = 0; i < NSEGS; ++i ) {
+        const size_t size = 1 + ( rd() % ( MAX_SEG_LEN - 1 ) );
+        const size_t offs = min( offset, 1 + ( static_cast<size_t>( rd() ) % 127 ) );
+        seq_size.emplace_back( offset - offs, size + offs );
+        offset += size;
+      }
+      shuffle( seq_size.begin(), seq_size.end(), rd );
+
+      string d( offset, 0 );
+      generate( d.begin(), d.end(), [&] { return rd(); } );
+
+      for ( auto [off, sz] : seq_size ) {
+        const bool last = off + sz == offset;
+        eager.insert( off, d.substr( off, sz ), last );
+        lazy.execute( Insert { d.substr( off, sz ), off }.is_last( last ) );
+        lazy.execute( BytesPushed( eager.writer().bytes_pushed() ) );
+        lazy.execute( BytesPending( eager.count_bytes_pending() ) );
+      }
+
+      array<Reassembler::Range, 64> ranges {};
+      const size_t n = eager.received_ranges( ranges );
+      lazy.execute( ReceivedRanges { { ranges.begin(), ranges.begin() + static_cast<ptrdiff_t>( n ) } } );
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
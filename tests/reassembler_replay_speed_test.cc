@@ -0,0 +1,201 @@
+#include "exception.hh"
+#include "reassembler.hh"
+#include "reassembler_trace.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <span>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace reassembler_trace;
+
+// Anything that can stand in for the Reassembler in a replay
+template<class T>
+concept ReassemblerLike = requires( T r, uint64_t first_index, string data, bool is_last ) {
+  r.insert( first_index, move( data ), is_last );
+  { r.reader() } -> std::same_as<Reader&>;
+};
+
+static string synthetic_payload( uint64_t first_index, uint64_t length )
+{
+  string payload( length, 0 );
+  for ( uint64_t i = 0; i < length; ++i ) {
+    payload[i] = synthetic_byte( first_index + i );
+  }
+  return payload;
+}
+
+// Record a trace of a stream sent as MSS-sized segments over a path that reorders them:
+// each segment is delayed by a random number of slots, about 1% are lost and retransmitted
+// a window later, and about 1% are duplicated.
+static void record_synthetic_trace( const string& filename, size_t num_segments, uint64_t capacity, size_t seed )
+{
+  constexpr uint64_t mss = 1460;
+  constexpr double max_delay = 24;
+  constexpr double retransmit_delay = 64;
+
+  default_random_engine rd { seed };
+  uniform_real_distribution<double> jitter { 0, max_delay };
+  bernoulli_distribution lost { 0.01 };
+  bernoulli_distribution duplicated { 0.01 };
+
+  vector<pair<double, size_t>> arrivals; // (arrival time, segment number)
+  for ( size_t i = 0; i < num_segments; ++i ) {
+    const double sent = static_cast<double>( i );
+    if ( lost( rd ) ) {
+      arrivals.emplace_back( sent + retransmit_delay + jitter( rd ), i );
+      continue;
+    }
+    arrivals.emplace_back( sent + jitter( rd ), i );
+    if ( duplicated( rd ) ) {
+      arrivals.emplace_back( sent + jitter( rd ), i );
+    }
+  }
+  sort( arrivals.begin(), arrivals.end() );
+
+  TraceRecorder recorder { filename, kHasPayloadHash | kSyntheticPayload };
+  Reassembler reassembler { ByteStream { capacity } };
+  reassembler.set_trace_recorder( &recorder );
+
+  const uint64_t stream_length = num_segments * mss;
+  for ( const auto& [time, segment_no] : arrivals ) {
+    const uint64_t first_index = segment_no * mss;
+    reassembler.insert(
+      first_index, synthetic_payload( first_index, mss ), first_index + mss >= stream_length );
+    reassembler.reader().pop( reassembler.reader().bytes_buffered() );
+  }
+
+  if ( not reassembler.reader().is_finished() ) {
+    throw runtime_error( "synthetic trace does not reassemble into a finished stream" );
+  }
+}
+
+template<ReassemblerLike ReassemblerT>
+static void replay( TraceReader& trace, ReassemblerT& reassembler, string_view label, fstream& debug_output )
+{
+  const bool synthetic = trace.flags() & kSyntheticPayload;
+  const bool check_hashes = synthetic and ( trace.flags() & kHasPayloadHash );
+
+  vector<uint64_t> latencies_ns;
+  uint64_t bytes_inserted = 0;
+  uint64_t bytes_checked = 0;
+
+  trace.rewind();
+  Record record;
+  while ( trace.next( record ) ) {
+    string payload = synthetic_payload( record.first_index, record.length );
+    if ( check_hashes and payload_hash( payload ) != record.payload_hash ) {
+      throw runtime_error( "payload hash mismatch at index " + to_string( record.first_index ) );
+    }
+
+    const auto start_time = steady_clock::now();
+    reassembler.insert( record.first_index, move( payload ), record.is_last );
+    const auto stop_time = steady_clock::now();
+
+    latencies_ns.push_back( duration_cast<nanoseconds>( stop_time - start_time ).count() );
+    bytes_inserted += record.length;
+
+    // drain the output, checking it against the synthetic stream when the trace used it
+    while ( reassembler.reader().bytes_buffered() ) {
+      const auto view = reassembler.reader().peek();
+      if ( synthetic ) {
+        for ( const char c : view ) {
+          if ( c != synthetic_byte( bytes_checked++ ) ) {
+            throw runtime_error( "Mismatch between data inserted and read" );
+          }
+        }
+      }
+      reassembler.reader().pop( view.size() );
+    }
+  }
+
+  if ( latencies_ns.empty() ) {
+    throw runtime_error( "empty trace" );
+  }
+
+  if ( synthetic and not reassembler.reader().is_finished() ) {
+    throw runtime_error( "Reassembler did not close ByteStream when finished" );
+  }
+
+  uint64_t total_ns = 0;
+  for ( const auto ns : latencies_ns ) {
+    total_ns += ns;
+  }
+  sort( latencies_ns.begin(), latencies_ns.end() );
+  const auto percentile = [&]( double p ) {
+    return latencies_ns.at( static_cast<size_t>( p * static_cast<double>( latencies_ns.size() - 1 ) ) );
+  };
+
+  const double gigabits_per_second = 8.0 * static_cast<double>( bytes_inserted ) / static_cast<double>( total_ns );
+
+  cout << "Replay of " << latencies_ns.size() << " inserts " << label << " reached " << fixed << setprecision( 2 )
+       << gigabits_per_second << " Gbit/s; insert latency p50=" << percentile( 0.5 )
+       << " ns, p90=" << percentile( 0.9 ) << " ns, p99=" << percentile( 0.99 )
+       << " ns, max=" << latencies_ns.back() << " ns"
+       << ( reassembler.reader().is_finished() ? "" : " (stream did not finish)" ) << ".\n";
+
+  debug_output << "        Reassembler replay " << label << fixed << setprecision( 2 ) << setw( 5 )
+               << gigabits_per_second << " Gbit/s, p99 " << percentile( 0.99 ) << " ns\n";
+}
+
+static void replay_all( const string& filename, uint64_t capacity, fstream& debug_output )
+{
+  TraceReader trace { filename };
+
+  Reassembler eager { ByteStream { capacity } };
+  replay( trace, eager, "(eager merge): ", debug_output );
+
+  Reassembler lazy { ByteStream { capacity } };
+  lazy.set_lazy_merge( true );
+  replay( trace, lazy, "(lazy merge):  ", debug_output );
+}
+
+void program_body( span<char*> args )
+{
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  // replay a trace given on the command line, or else record and replay a synthetic one
+  if ( args.size() >= 2 ) {
+    const uint64_t capacity = args.size() >= 3 ? stoull( args[2] ) : 1048576;
+    replay_all( args[1], capacity, debug_output );
+    return;
+  }
+
+  string filename = "/tmp/reassembler_trace_XXXXXX";
+  const int fd = CheckSystemCall( "mkstemp", mkstemp( filename.data() ) );
+  ::close( fd );
+
+  try {
+    record_synthetic_trace( filename, 20000, 1048576, 3591 );
+    replay_all( filename, 1048576, debug_output );
+  } catch ( ... ) {
+    unlink( filename.c_str() );
+    throw;
+  }
+  unlink( filename.c_str() );
+}
+
+int main( int argc, char** argv )
+{
+  try {
+    if ( argc <= 0 ) {
+      abort(); // For sticklers: don't try to access argv[0] if argc <= 0.
+    }
+    program_body( span( argv, argc ) );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
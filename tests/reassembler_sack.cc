@@ -0,0 +1,72 @@
+#include "byte_stream_test_harness.hh"
+#include "reassembler_test_harness.hh"
+
+#include <exception>
+#include <iostream>
+
+using namespace std;
+
+int main()
+{
+  try {
+    {
+      ReassemblerTestHarness test { "sack empty", 65000 };
+
+      test.execute( ReceivedRanges { {} } );
+      test.execute( Holes { {} } );
+
+      test.execute( Insert { "abc", 0 } );
+      test.execute( ReceivedRanges { {} } );
+      test.execute( Holes { {} } );
+    }
+
+    {
+      ReassemblerTestHarness test { "sack holes", 65000 };
+
+      test.execute( Insert { "b", 1 } );
+      test.execute( Insert { "de", 3 } );
+      test.execute( Insert { "h", 7 } );
+
+      test.execute( ReceivedRanges { { { 1, 2 }, { 3, 5 }, { 7, 8 } } } );
+      test.execute( Holes { { { 0, 1 }, { 2, 3 }, { 5, 7 } } } );
+
+      test.execute( Insert { "a", 0 } );
+      test.execute( ReadAll( "ab" ) );
+      test.execute( ReceivedRanges { { { 3, 5 }, { 7, 8 } } } );
+      test.execute( Holes { { { 2, 3 }, { 5, 7 } } } );
+    }
+
+    {
+      ReassemblerTestHarness test { "sack adjacent ranges", 65000 };
+
+      test.execute( Insert { "b", 1 } );
+      test.execute( Insert { "c", 2 } );
+      test.execute( Insert { "de", 3 } );
+
+      test.execute( ReceivedRanges { { { 1, 5 } } } );
+      test.execute( Holes { { { 0, 1 } } } );
+    }
+
+    {
+      ReassemblerTestHarness test { "sack paging", 65000 };
+
+      test.execute( Insert { "b", 1 } );
+      test.execute( Insert { "d", 3 } );
+      test.execute( Insert { "fg", 5 } );
+      test.execute( Insert { "j", 9 } );
+
+      test.execute( ReceivedRanges { { { 3, 4 }, { 5, 7 }, { 9, 10 } } }.from( 2 ) );
+      test.execute( ReceivedRanges { { { 6, 7 }, { 9, 10 } } }.from( 6 ) );
+      test.execute( ReceivedRanges { {} }.from( 10 ) );
+      test.execute( Holes { { { 2, 3 }, { 4, 5 }, { 7, 9 } } }.from( 2 ) );
+      test.execute( Holes { { { 7, 9 } } }.from( 6 ) );
+      test.execute( Holes { { { 8, 9 } } }.from( 8 ) );
+      test.execute( Holes { {} }.from( 10 ) );
+    }
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -2,21 +2,54 @@
 
 #include <chrono>
 #include <cstddef>
+#include <cstdlib>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <new>
 #include <queue>
 #include <random>
 #include <tuple>
+#include <utility>
+#include <vector>
 
 using namespace std;
 using namespace std::chrono;
 
+// Allocation-counting hook: every global operator new is counted while `counting_allocations` is set.
+namespace {
+bool counting_allocations = false;
+size_t allocation_count = 0;
+}
+
+// (kept out of line so the compiler does not pair malloc/free with the new-expressions they serve)
+[[gnu::noinline]] void* operator new( size_t size )
+{
+  if ( counting_allocations ) {
+    ++allocation_count;
+  }
+  if ( void* p = malloc( size ? size : 1 ) ) { // NOLINT(*-no-malloc, *-owning-memory)
+    return p;
+  }
+  throw bad_alloc {};
+}
+
+[[gnu::noinline]] void operator delete( void* p ) noexcept
+{
+  free( p ); // NOLINT(*-no-malloc, *-owning-memory)
+}
+
+[[gnu::noinline]] void operator delete( void* p, size_t /*unused*/ ) noexcept
+{
+  free( p ); // NOLINT(*-no-malloc, *-owning-memory)
+}
+
 void speed_test( const size_t num_chunks,  // NOLINT(bugprone-easily-swappable-parameters)
                  const size_t chunk_size,  // NOLINT(bugprone-easily-swappable-parameters)
                  const size_t overlap,     // NOLINT(bugprone-easily-swappable-parameters)
                  const size_t capacity,    // NOLINT(bugprone-easily-swappable-parameters)
                  const size_t random_seed, // NOLINT(bugprone-easily-swappable-parameters)
+                 const bool lazy_merge,
                  string_view scenario )
 {
   // Generate the data to be written
@@ -47,14 +80,26 @@ void speed_test( const size_t num_chunks,  // NOLINT(bugprone-easily-swappable-p
   }
 
   Reassembler reassembler { ByteStream { capacity } };
+  reassembler.set_lazy_merge( lazy_merge );
 
   string output_data;
   output_data.reserve( data.size() );
 
+  size_t out_of_order_inserts = 0;
+  size_t out_of_order_allocations = 0;
+
   const auto start_time = steady_clock::now();
   while ( not split_data.empty() ) {
     auto& next = split_data.front();
+    const uint64_t pushed_before = reassembler.writer().bytes_pushed();
+    const size_t allocations_before = allocation_count;
+    counting_allocations = true;
     reassembler.insert( get<uint64_t>( next ), move( get<string>( next ) ), get<bool>( next ) );
+    counting_allocations = false;
+    if ( reassembler.writer().bytes_pushed() == pushed_before ) {
+      ++out_of_order_inserts;
+      out_of_order_allocations += allocation_count - allocations_before;
+    }
     split_data.pop();
 
     while ( reassembler.reader().bytes_buffered() ) {
@@ -81,21 +126,117 @@ void speed_test( const size_t num_chunks,  // NOLINT(bugprone-easily-swappable-p
   fstream debug_output;
   debug_output.open( "/dev/tty" );
 
-  cout << "Reassembler to ByteStream with capacity=" << capacity << " reached " << fixed << setprecision( 2 )
-       << gigabits_per_second << " Gbit/s.\n";
+  cout << "Reassembler to ByteStream with capacity=" << capacity << ( lazy_merge ? " (lazy merge)" : "" )
+       << " reached " << fixed << setprecision( 2 ) << gigabits_per_second << " Gbit/s.\n";
 
   debug_output << "        Reassembler throughput " << scenario << fixed << setprecision( 2 ) << setw( 5 )
                << gigabits_per_second << " Gbit/s\n";
 
+  // the pools warm up during the first window; after that, out-of-order inserts should not allocate
+  const double allocations_per_insert
+    = static_cast<double>( out_of_order_allocations ) / static_cast<double>( max<size_t>( out_of_order_inserts, 1 ) );
+  cout << "Reassembler made " << out_of_order_allocations << " heap allocations over " << out_of_order_inserts
+       << " out-of-order inserts (" << setprecision( 3 ) << allocations_per_insert << " per insert).\n";
+
+  if ( allocations_per_insert > 0.01 ) {
+    throw runtime_error( "Reassembler allocated memory on the out-of-order insert path." );
+  }
+
   if ( gigabits_per_second < 0.1 ) {
     throw runtime_error( "Reassembler did not meet minimum speed of 0.1 Gbit/s." );
   }
 }
 
+// A long in-order stream of 1 KB segments, with one segment arriving ahead of its turn every 100 MiB.
+// The arena must keep up with the stream after each of them, rather than slowing with the stream index.
+void long_stream_test( const size_t total_size, const size_t capacity )
+{
+  constexpr size_t kSegmentSize = 1024;
+  constexpr size_t kOutOfOrderEvery = size_t { 100 } << 20;
+  constexpr size_t kOutOfOrderAhead = 8 * kSegmentSize;
+
+  const string block = [] {
+    default_random_engine rd { 4441 };
+    uniform_int_distribution<char> ud;
+    string ret;
+    for ( size_t i = 0; i < kSegmentSize; ++i ) {
+      ret += ud( rd );
+    }
+    return ret;
+  }();
+
+  Reassembler reassembler { ByteStream { capacity } };
+  bool mismatch = false;
+  size_t out_of_order_inserts = 0;
+
+  // the time taken by each stretch of the stream between out-of-order segments
+  vector<duration<double>> stretch_times;
+
+  const auto start_time = steady_clock::now();
+  auto stretch_start = start_time;
+  for ( uint64_t index = 0; index < total_size; index += kSegmentSize ) {
+    if ( index % kOutOfOrderEvery == 0 and index + kOutOfOrderAhead < total_size ) {
+      if ( index > 0 ) {
+        const auto now = steady_clock::now();
+        stretch_times.emplace_back( now - exchange( stretch_start, now ) );
+      }
+      reassembler.insert( index + kOutOfOrderAhead, block, false );
+      ++out_of_order_inserts;
+    }
+    reassembler.insert( index, block, index + kSegmentSize >= total_size );
+
+    while ( reassembler.reader().bytes_buffered() ) {
+      const string_view piece = reassembler.reader().peek();
+      for ( size_t at = 0; at < piece.size(); ) {
+        const size_t offset = ( reassembler.reader().bytes_popped() + at ) % kSegmentSize;
+        const size_t len = min( kSegmentSize - offset, piece.size() - at );
+        mismatch = mismatch or piece.substr( at, len ) != string_view { block }.substr( offset, len );
+        at += len;
+      }
+      reassembler.reader().pop( piece.size() );
+    }
+  }
+  const auto stop_time = steady_clock::now();
+  stretch_times.emplace_back( stop_time - stretch_start );
+
+  if ( not reassembler.reader().is_finished() or reassembler.reader().bytes_popped() != total_size ) {
+    throw runtime_error( "Reassembler did not deliver the whole long stream" );
+  }
+  if ( mismatch ) {
+    throw runtime_error( "Mismatch between data written and read (long stream)" );
+  }
+
+  auto test_duration = duration_cast<duration<double>>( stop_time - start_time );
+  auto gigabits_per_second = 8 * static_cast<double>( total_size ) / test_duration.count() / 1e9;
+
+  fstream debug_output;
+  debug_output.open( "/dev/tty" );
+
+  cout << "Reassembler long stream of " << ( total_size >> 20 ) << " MiB (" << out_of_order_inserts
+       << " out-of-order segments) reached " << fixed << setprecision( 2 ) << gigabits_per_second << " Gbit/s.\n";
+
+  debug_output << "        Reassembler throughput (long stream): " << fixed << setprecision( 2 ) << setw( 5 )
+               << gigabits_per_second << " Gbit/s\n";
+
+  if ( gigabits_per_second < 0.1 ) {
+    throw runtime_error( "Reassembler did not meet minimum speed of 0.1 Gbit/s on a long stream." );
+  }
+
+  // (the last stretch may be short; compare the first full stretch with the last full one)
+  const double slowdown = stretch_times.at( stretch_times.size() - 2 ) / stretch_times.front();
+  cout << "Reassembler took " << setprecision( 2 ) << slowdown
+       << "x as long over the last full 100 MiB of the long stream as over the first.\n";
+  if ( slowdown > 4 ) {
+    throw runtime_error( "Reassembler slowed down as the long stream went on." );
+  }
+}
+
 void program_body()
 {
-  speed_test( 1000, 1500, 1500, 32768, 1370, "(no overlap):  " );
-  speed_test( 1000, 1500, 150, 32768, 6163, "(10x overlap): " );
+  speed_test( 1000, 1500, 1500, 32768, 1370, false, "(no overlap):  " );
+  speed_test( 1000, 1500, 150, 32768, 6163, false, "(10x overlap): " );
+  speed_test( 1000, 1500, 150, 32768, 6163, true, "(10x, lazy):   " );
+  long_stream_test( size_t { 500 } << 20, 32768 );
 }
 
 int main()
@@ -4,8 +4,11 @@
 #include "helpers.hh"
 #include "reassembler.hh"
 
+#include <array>
+#include <optional>
 #include <sstream>
 #include <utility>
+#include <vector>
 
 template<std::derived_from<TestStep<ByteStream>> T>
 struct ReassemblerTestStep : public TestStep<Reassembler>
@@ -47,11 +50,79 @@ struct BytesPending : public ExpectNumber<Reassembler, uint64_t>
   uint64_t value( const Reassembler& r ) const override { return r.count_bytes_pending(); }
 };
 
+template<size_t ( Reassembler::*Query )( std::span<Reassembler::Range>, uint64_t ) const>
+struct ExpectRanges : public Expectation<Reassembler>
+{
+  std::vector<Reassembler::Range> ranges_;
+  uint64_t from_ {};
+
+  explicit ExpectRanges( std::vector<Reassembler::Range> ranges ) : ranges_( std::move( ranges ) ) {}
+
+  ExpectRanges& from( uint64_t index )
+  {
+    from_ = index;
+    return *this;
+  }
+
+  virtual std::string name() const = 0;
+
+  static std::string to_str( std::span<const Reassembler::Range> ranges )
+  {
+    std::ostringstream ss;
+    ss << "{";
+    for ( const auto& [first, last] : ranges ) {
+      ss << " [" << first << ", " << last << ")";
+    }
+    ss << " }";
+    return ss.str();
+  }
+
+  std::string description() const override
+  {
+    return name() + "( from=" + std::to_string( from_ ) + " ) = " + to_str( ranges_ );
+  }
+
+  void execute( const Reassembler& r ) const override
+  {
+    // ask for one more range than expected, so that extra ranges are caught
+    std::array<Reassembler::Range, 64> buf {};
+    const size_t n = ( r.*Query )( std::span { buf }.first( std::min( buf.size(), ranges_.size() + 1 ) ), from_ );
+    const std::string expected = to_str( ranges_ );
+    const std::string actual = to_str( std::span { buf }.first( n ) );
+    if ( expected != actual ) {
+      throw ExpectationViolation { "should have had " + name() + " = " + expected + ", but instead it was "
+                                   + actual };
+    }
+  }
+};
+
+struct ReceivedRanges : public ExpectRanges<&Reassembler::received_ranges>
+{
+  using ExpectRanges::ExpectRanges;
+  std::string name() const override { return "received_ranges"; }
+};
+
+struct Holes : public ExpectRanges<&Reassembler::holes>
+{
+  using ExpectRanges::ExpectRanges;
+  std::string name() const override { return "holes"; }
+};
+
+struct SetLazyMerge : public Action<Reassembler>
+{
+  bool lazy_;
+
+  explicit SetLazyMerge( bool lazy ) : lazy_( lazy ) {}
+  std::string description() const override { return "set_lazy_merge( " + std::to_string( lazy_ ) + " )"; }
+  void execute( Reassembler& r ) const override { r.set_lazy_merge( lazy_ ); }
+};
+
 struct Insert : public Action<Reassembler>
 {
   std::string data_;
   uint64_t first_index_;
   bool is_last_substring_ {};
+  std::optional<Reassembler::Clock::time_point> arrival_ {};
 
   Insert( std::string data, uint64_t first_index ) : data_( move( data ) ), first_index_( first_index ) {}
 
@@ -61,6 +132,12 @@ struct Insert : public Action<Reassembler>
     return *this;
   }
 
+  Insert& at( Reassembler::Clock::time_point arrival )
+  {
+    arrival_ = arrival;
+    return *this;
+  }
+
   std::string description() const override
   {
     std::ostringstream ss;
@@ -68,8 +145,18 @@ struct Insert : public Action<Reassembler>
     if ( is_last_substring_ ) {
       ss << " [last substring]";
     }
+    if ( arrival_ ) {
+      ss << " at t=" << arrival_->time_since_epoch().count();
+    }
     return ss.str();
   }
 
-  void execute( Reassembler& r ) const override { r.insert( first_index_, data_, is_last_substring_ ); }
+  void execute( Reassembler& r ) const override
+  {
+    if ( arrival_ ) {
+      r.insert( first_index_, data_, is_last_substring_, *arrival_ );
+    } else {
+      r.insert( first_index_, data_, is_last_substring_ );
+    }
+  }
 };
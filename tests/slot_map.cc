@@ -0,0 +1,58 @@
+#include "expect.hh"
+#include "slot_map.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+int main()
+{
+  try {
+    SlotMap<string, 4> map;
+    const auto a = map.emplace( "a" );
+    const auto b = map.emplace( "b" );
+    string* a_ptr = map.find( a );
+    expect( a_ptr and *a_ptr == "a" and *map.find( b ) == "b" and map.size() == 2, "find" );
+
+    // values don't move as the map grows
+    for ( int i = 0; i < 100; ++i ) {
+      map.emplace( to_string( i ) );
+    }
+    expect( map.find( a ) == a_ptr and map.size() == 102, "stable addresses" );
+
+    // an erased value's key refers to nothing, even once its slot is reused
+    expect( map.erase( a ) and not map.erase( a ) and not map.find( a ), "erase" );
+    const auto c = map.emplace( "c" );
+    expect( c.index == a.index and not map.find( a ) and *map.find( c ) == "c", "stale key after reuse" );
+    expect( not map.find( SlotKey {} ), "default key refers to nothing" );
+
+    // walking by slot sees every value
+    size_t seen = 0;
+    map.erase( b );
+    for ( size_t slot = 0; slot < map.slots(); ++slot ) {
+      if ( string* value = map.at( slot ) ) {
+        expect( map.find( map.key_at( slot ) ) == value, "key_at" );
+        ++seen;
+      }
+    }
+    expect( seen == map.size() and seen == 101, "walk" );
+
+    // values are destroyed when erased
+    SlotMap<shared_ptr<int>> owners;
+    auto shared = make_shared<int>( 0 );
+    const auto key = owners.emplace( shared );
+    expect( shared.use_count() == 2, "held" );
+    owners.erase( key );
+    expect( shared.use_count() == 1 and owners.empty(), "destroyed on erase" );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
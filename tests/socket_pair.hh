@@ -0,0 +1,29 @@
+#pragma once
+
+#include "exception.hh"
+#include "socket.hh"
+
+#include <algorithm>
+#include <array>
+#include <sys/resource.h>
+#include <utility>
+
+// A connected, non-blocking pair of Unix-domain stream sockets
+inline std::pair<LocalStreamSocket, LocalStreamSocket> socket_pair()
+{
+  std::array<int, 2> fds {};
+  CheckSystemCall( "socketpair", ::socketpair( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds.data() ) );
+  return { LocalStreamSocket { FileDescriptor { fds[0] } }, LocalStreamSocket { FileDescriptor { fds[1] } } };
+}
+
+// Raise the soft limit on open files as far as the hard limit allows, and return the new limit
+inline size_t raise_open_file_limit()
+{
+  rlimit limit {};
+  CheckSystemCall( "getrlimit", getrlimit( RLIMIT_NOFILE, &limit ) );
+  if ( limit.rlim_cur < limit.rlim_max ) {
+    limit.rlim_cur = limit.rlim_max;
+    CheckSystemCall( "setrlimit", setrlimit( RLIMIT_NOFILE, &limit ) );
+  }
+  return limit.rlim_cur;
+}
@@ -0,0 +1,189 @@
+#include "expect.hh"
+#include "timer_wheel.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+using Clock = TimerWheel::Clock;
+
+static void basics( Clock::time_point start )
+{
+  TimerWheel wheel { start };
+  vector<int> fired;
+
+  wheel.add( start + 5ms, [&] { fired.push_back( 5 ); } );
+  wheel.add( start + 2ms, [&] { fired.push_back( 2 ); } );
+  const auto cancelled = wheel.add( start + 3ms, [&] { fired.push_back( 3 ); } );
+  wheel.add( start + 2ms + 500us, [&] { fired.push_back( 25 ); } ); // rounds up to 3ms
+  expect( wheel.size() == 4, "four timers armed" );
+
+  expect( wheel.time_until_next( start ) <= 2ms, "next deadline no later than 2ms" );
+  expect( wheel.expire( start + 1ms ) == 0, "nothing due at 1ms" );
+  expect( wheel.cancel( cancelled ), "cancel an armed timer" );
+  expect( not wheel.cancel( cancelled ), "cancel is idempotent" );
+
+  expect( wheel.expire( start + 2ms + 400us ) == 1 and fired == vector { 2 }, "2ms timer fires" );
+  expect( wheel.expire( start + 2ms + 600us ) == 0, "a timer never fires early" );
+  expect( wheel.expire( start + 10ms ) == 2 and fired == vector { 2, 25, 5 }, "the rest fire in order" );
+  expect( wheel.empty() and not wheel.time_until_next( start + 10ms ).has_value(), "nothing left" );
+
+  // a deadline in the past is due at once
+  wheel.add( start, [&] { fired.push_back( 0 ); } );
+  expect( wheel.time_until_next( start + 10ms ) == Clock::duration::zero(), "past deadline is due" );
+  expect( wheel.expire( start + 10ms ) == 1 and fired.back() == 0, "past deadline fires" );
+}
+
+// timers across every level of the wheel, and past it, fire at the right time and in order
+static void far_deadlines( Clock::time_point start )
+{
+  TimerWheel wheel { start };
+  const vector<Clock::duration> delays { 255ms, 256ms, 257ms, 65535ms, 65536ms, 70000ms, hours { 5 }, hours { 1000 },
+                                         hours { 24 * 60 }, hours { 24 * 300 } };
+  vector<size_t> fired;
+  for ( size_t i = 0; i < delays.size(); ++i ) {
+    wheel.add( start + delays[i], [&fired, i] { fired.push_back( i ); } );
+  }
+
+  for ( size_t i = 0; i < delays.size(); ++i ) {
+    expect( wheel.expire( start + delays[i] - 1ms ) == 0, "timer " + to_string( i ) + " not early" );
+    const auto until = wheel.time_until_next( start + delays[i] - 1ms );
+    expect( until.has_value() and *until <= 1ms, "timeout bounded by timer " + to_string( i ) );
+    expect( wheel.expire( start + delays[i] ) == 1 and fired.back() == i, "timer " + to_string( i ) + " on time" );
+  }
+
+  // a long jump fires everything at once, in deadline order
+  fired.clear();
+  for ( size_t i = delays.size(); i > 0; --i ) {
+    wheel.add( start + hours { 24 * 301 } + delays[i - 1], [&fired, i] { fired.push_back( i - 1 ); } );
+  }
+  expect( wheel.expire( start + hours { 24 * 700 } ) == delays.size(), "long jump fires everything" );
+  for ( size_t i = 0; i < delays.size(); ++i ) {
+    expect( fired.at( i ) == i, "long jump in deadline order" );
+  }
+}
+
+// callbacks may arm and cancel timers, and handles stay safe after their timer is gone
+static void reentrancy( Clock::time_point start )
+{
+  TimerWheel wheel { start };
+  unsigned ran = 0;
+
+  TimerWheel::TimerId victim {};
+  wheel.add( start + 1ms, [&] {
+    ++ran;
+    expect( wheel.cancel( victim ), "cancel from a callback" );
+    wheel.add( start, [&] { ++ran; } ); // already due, so runs on the next call
+  } );
+  victim = wheel.add( start + 1ms, [&] { throw runtime_error( "cancelled timer ran" ); } );
+
+  expect( wheel.expire( start + 1ms ) == 1 and ran == 1, "one runs, one cancelled" );
+  expect( wheel.expire( start + 1ms ) == 1 and ran == 2, "timer armed by a callback" );
+
+  // the slot of a fired timer is reused, but its old handle doesn't cancel the new timer
+  const auto old = wheel.add( start + 2ms, [] {} );
+  wheel.expire( start + 2ms );
+  const auto reused = wheel.add( start + 3ms, [&] { ++ran; } );
+  expect( reused.index == old.index, "slot reused" );
+  expect( not wheel.cancel( old ), "stale handle refused" );
+  expect( wheel.expire( start + 3ms ) == 1 and ran == 3, "new timer unaffected" );
+}
+
+// a callback that throws leaves the other due timers armed, to be run (or cancelled) later
+static void throwing_callbacks( Clock::time_point start )
+{
+  TimerWheel wheel { start };
+  vector<int> fired;
+  const auto expire_throws = [&]( Clock::time_point now ) {
+    try {
+      wheel.expire( now );
+    } catch ( const runtime_error& ) {
+      return true;
+    }
+    return false;
+  };
+
+  // timers armed already due
+  wheel.add( start, [] { throw runtime_error( "due timer" ); } );
+  wheel.add( start, [&] { fired.push_back( 1 ); } );
+  const auto due = wheel.add( start, [&] { fired.push_back( 2 ); } );
+  expect( expire_throws( start ) and fired.empty(), "the exception escapes expire" );
+  expect( wheel.size() == 2 and wheel.time_until_next( start ) == 0ms, "the rest stay armed, and due" );
+  expect( wheel.cancel( due ), "a timer left over can be cancelled" );
+  expect( wheel.expire( start ) == 1 and fired == vector { 1 } and wheel.empty(), "the rest run next time" );
+
+  // timers in a slot of the wheel
+  wheel.add( start + 2ms, [] { throw runtime_error( "slot timer" ); } );
+  const auto slotted = wheel.add( start + 2ms, [&] { fired.push_back( 3 ); } );
+  wheel.add( start + 2ms, [&] { fired.push_back( 4 ); } );
+  expect( expire_throws( start + 2ms ) and wheel.size() == 2, "the slot's other timers stay armed" );
+  expect( wheel.cancel( slotted ), "a slot timer left over can be cancelled" );
+  expect( wheel.expire( start + 2ms ) == 1 and fired == vector { 1, 4 } and wheel.empty(), "and the rest run" );
+}
+
+// against a simple model, with random arms, cancels and clock steps
+static void random_model( Clock::time_point start )
+{
+  TimerWheel wheel { start };
+  minstd_rand rng { 1234 };
+
+  struct Expected
+  {
+    Clock::time_point deadline;
+    TimerWheel::TimerId id;
+    bool done;
+  };
+  vector<Expected> timers;
+  Clock::time_point now = start;
+
+  for ( unsigned step = 0; step < 5000; ++step ) {
+    const unsigned choice = rng() % 8;
+    if ( choice < 4 ) {
+      const auto delay = microseconds { rng() % ( ( rng() % 2 ) ? 2'000'000 : 200'000'000'000 ) };
+      const size_t i = timers.size();
+      timers.push_back( { now + delay, {}, false } );
+      timers.back().id = wheel.add( now + delay, [&timers, &now, i] {
+        expect( not timers[i].done and timers[i].deadline <= now, "model: fires once, not early" );
+        timers[i].done = true;
+      } );
+    } else if ( choice < 5 and not timers.empty() ) {
+      auto& t = timers[rng() % timers.size()];
+      expect( wheel.cancel( t.id ) == not t.done, "model: cancel iff pending" );
+      t.done = true;
+    } else {
+      now += microseconds { rng() % ( ( rng() % 16 ) ? 3'000'000 : 2'000'000'000'000 ) };
+      wheel.expire( now );
+      const auto overdue = [&]( const Expected& t ) { return not t.done and t.deadline + TimerWheel::kTick <= now; };
+      expect( none_of( timers.begin(), timers.end(), overdue ), "model: no late timers" );
+      const auto pending = count_if( timers.begin(), timers.end(), []( const Expected& t ) { return not t.done; } );
+      expect( static_cast<size_t>( pending ) == wheel.size(), "model: size" );
+    }
+  }
+}
+
+int main()
+{
+  try {
+    // a start that isn't on a tick boundary of the clock's epoch
+    const Clock::time_point start = Clock::now();
+    basics( start );
+    far_deadlines( start );
+    reentrancy( start );
+    throwing_callbacks( start );
+    random_model( start );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
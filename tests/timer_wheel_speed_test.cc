@@ -0,0 +1,135 @@
+#include "eventloop.hh"
+#include "timer_wheel.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+using Clock = TimerWheel::Clock;
+
+static double ns_per( Clock::duration elapsed, size_t count )
+{
+  return static_cast<double>( duration_cast<nanoseconds>( elapsed ).count() ) / static_cast<double>( count );
+}
+
+// Arm `count` timers spread over a minute, cancel and re-arm a quarter of them (as a transport
+// does when its retransmission timer is restarted), then step a simulated clock through the minute
+// a millisecond at a time. Returns the cost per timer of the whole lifecycle.
+static double wheel_test( fstream& debug_output, size_t count )
+{
+  const Clock::time_point start = Clock::now();
+  TimerWheel wheel { start };
+  minstd_rand rng { 5489 };
+  constexpr uint64_t span_us = 60'000'000;
+
+  size_t fired = 0;
+  vector<TimerWheel::TimerId> ids;
+  ids.reserve( count );
+
+  const auto arm_start = Clock::now();
+  for ( size_t i = 0; i < count; ++i ) {
+    ids.push_back( wheel.add( start + microseconds { rng() % span_us }, [&fired] { ++fired; } ) );
+  }
+  const auto cancel_start = Clock::now();
+  for ( size_t i = 0; i < count; i += 4 ) {
+    if ( not wheel.cancel( ids[i] ) ) {
+      throw runtime_error( "could not cancel an armed timer" );
+    }
+    ids[i] = wheel.add( start + microseconds { rng() % span_us }, [&fired] { ++fired; } );
+  }
+  const auto expire_start = Clock::now();
+  size_t ticks = 0;
+  for ( auto now = start; not wheel.empty(); now += 1ms, ++ticks ) {
+    wheel.expire( now );
+  }
+  const auto stop = Clock::now();
+
+  if ( fired != count ) {
+    throw runtime_error( "fired " + to_string( fired ) + " timers, expected " + to_string( count ) );
+  }
+
+  const double arm_ns = ns_per( cancel_start - arm_start, count );
+  const double rearm_ns = ns_per( expire_start - cancel_start, ( count + 3 ) / 4 );
+  const double expire_ns = ns_per( stop - expire_start, count );
+  const double total_ns = ns_per( stop - arm_start, count );
+
+  cout << "TimerWheel with " << count << " timers: arm " << fixed << setprecision( 1 ) << arm_ns
+       << " ns, cancel+re-arm " << rearm_ns << " ns, expire " << expire_ns << " ns per timer (" << ticks
+       << " ticks); " << total_ns << " ns per timer in all.\n";
+
+  debug_output << "        TimerWheel (" << setw( 7 ) << count << " timers): " << fixed << setprecision( 1 )
+               << setw( 6 ) << total_ns << " ns/timer\n";
+
+  return total_ns;
+}
+
+// A million timers due over half a second of real time, run by an EventLoop with nothing else to
+// wait for: the loop sleeps until each deadline, and fires every timer within a tick of it.
+static void eventloop_test( fstream& debug_output, size_t count )
+{
+  EventLoop loop;
+  minstd_rand rng { 5489 };
+
+  Clock::duration latest {};
+  size_t fired = 0;
+  const auto start = Clock::now() + 1s; // leaving time to arm them all
+  for ( size_t i = 0; i < count; ++i ) {
+    const auto deadline = start + microseconds { rng() % 500'000 };
+    loop.add_timer( deadline, [&, deadline] {
+      latest = max( latest, Clock::now() - deadline );
+      ++fired;
+    } );
+  }
+
+  if ( Clock::now() > start ) {
+    throw runtime_error( "arming the timers took too long" );
+  }
+
+  size_t iterations = 0;
+  while ( loop.wait_next_event( -1 ) != EventLoop::Result::Exit ) {
+    ++iterations;
+  }
+
+  if ( fired != count ) {
+    throw runtime_error( "EventLoop fired " + to_string( fired ) + " timers, expected " + to_string( count ) );
+  }
+
+  const double latest_ms = duration_cast<duration<double, milli>>( latest ).count();
+  cout << "EventLoop ran " << count << " timers in " << iterations << " iterations (" << loop.kernel_calls()
+       << " syscalls); the latest fired " << fixed << setprecision( 2 ) << latest_ms << " ms after its deadline.\n";
+
+  debug_output << "        EventLoop timers (" << count << "): " << fixed << setprecision( 2 ) << latest_ms
+               << " ms max lateness\n";
+}
+
+int main()
+{
+  try {
+    fstream debug_output;
+    debug_output.open( "/dev/tty" );
+
+    const double small = wheel_test( debug_output, 10'000 );
+    const double large = wheel_test( debug_output, 1'000'000 );
+
+    // the cost per timer shouldn't depend on how many there are (beyond cache effects)
+    if ( large > 10 * small ) {
+      throw runtime_error( "TimerWheel cost per timer grew from " + to_string( small ) + " ns to "
+                           + to_string( large ) + " ns" );
+    }
+
+    eventloop_test( debug_output, 1'000'000 );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
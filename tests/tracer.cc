@@ -0,0 +1,102 @@
+#include "eventloop.hh"
+#include "expect.hh"
+#include "socket_pair.hh"
+#include "tracer.hh"
+
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <pthread.h>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+using namespace std::chrono_literals;
+
+static size_t count( const string& haystack, const string& needle )
+{
+  size_t found = 0;
+  for ( size_t pos = haystack.find( needle ); pos != string::npos; pos = haystack.find( needle, pos + 1 ) ) {
+    ++found;
+  }
+  return found;
+}
+
+// serve `rounds` pings on a loop of its own
+static void ping( size_t rounds )
+{
+  EventLoop loop { EventLoop::Backend::Epoll };
+  auto [a, b] = socket_pair();
+  string buffer;
+  loop.add_rule( "ping \"quoted\"", b, Direction::In, [&] { b.read( buffer ); } );
+  loop.add_timer( EventLoop::Clock::now(), [] {} );
+  for ( size_t i = 0; i < rounds; ++i ) {
+    a.write( "x" );
+    loop.wait_next_event( 1000 );
+  }
+}
+
+int main()
+{
+  try {
+    const string path = "/tmp/minnow_trace_" + to_string( getpid() ) + ".json";
+    expect( not Tracer::enabled(), "disabled until started" );
+    ping( 3 ); // (not traced)
+
+    Tracer::start( path );
+    expect( Tracer::enabled(), "enabled once started" );
+    bool thrown = false;
+    try {
+      Tracer::start( path );
+    } catch ( const runtime_error& ) {
+      thrown = true;
+    }
+    expect( thrown, "one trace at a time" );
+
+    // spans from two threads, each with a ring of its own
+    ping( 5 );
+    thread worker { [] {
+      pthread_setname_np( pthread_self(), "ping worker" );
+      ping( 7 );
+    } };
+    worker.join();
+    this_thread::sleep_for( 20ms ); // (the worker's ring is flushed, and forgotten, in the background)
+    Tracer::stop();
+    expect( not Tracer::enabled(), "disabled once stopped" );
+    ping( 3 ); // (not traced)
+    Tracer::stop();
+
+    ifstream file { path };
+    stringstream contents;
+    contents << file.rdbuf();
+    const string trace = contents.str();
+    unlink( path.c_str() );
+
+    expect( trace.starts_with( R"({"displayTimeUnit":"ns","traceEvents":[)" ), "trace header" );
+    expect( trace.ends_with( "\n]}\n" ), "trace finished" );
+    expect( count( trace, R"("name":"ping \"quoted\"","cat":"callback")" ) == 12, "a span per callback, named" );
+    expect( count( trace, R"("name":"timers","cat":"callback")" ) == 2, "a span for the timers that fired" );
+    expect( count( trace, R"("name":"wait_next_event","cat":"dispatch")" ) == 12, "a span per dispatch" );
+    expect( count( trace, R"("name":"epoll_wait","cat":"wait")" ) >= 12, "spans for the waits" );
+    expect( count( trace, R"("ph":"X")" ) == count( trace, R"("dur":)" ), "complete events have durations" );
+    expect( count( trace, R"("name":"thread_name","ph":"M")" ) == 2, "each thread named" );
+    expect( trace.find( R"("args":{"name":"ping worker"})" ) != string::npos, "the worker's name" );
+
+    set<string> tids;
+    for ( size_t pos = trace.find( R"("tid":)" ); pos != string::npos; pos = trace.find( R"("tid":)", pos + 1 ) ) {
+      tids.insert( trace.substr( pos, trace.find_first_of( ",}", pos ) - pos ) );
+    }
+    expect( tids.size() == 2, "a timeline per thread" );
+    expect( Tracer::dropped() == 0, "nothing dropped" );
+  } catch ( const exception& e ) {
+    cerr << "Exception: " << e.what() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
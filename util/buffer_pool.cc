@@ -0,0 +1,157 @@
+#include "buffer_pool.hh"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+constexpr uint64_t kIndexMask = 0xffff'ffff;
+
+// a new free-list head: the tag advances on every change, so a head that was popped and pushed back
+// between a pop's load and its compare-exchange doesn't look unchanged
+uint64_t next_head( const uint64_t head, const uint32_t top )
+{
+  return ( ( ( head >> 32U ) + 1 ) << 32U ) | top;
+}
+
+} // namespace
+
+BufferPool::BufferPool( const size_t buffer_size ) : buffer_size_( buffer_size )
+{
+  if ( buffer_size == 0 ) {
+    throw invalid_argument( "BufferPool: buffers must have a size" );
+  }
+}
+
+BufferPool::~BufferPool()
+{
+  for ( auto& chunk : chunks_ ) {
+    delete[] chunk.load( memory_order_relaxed ); // NOLINT(*-owning-memory)
+  }
+}
+
+BufferPool::Buffer& BufferPool::at( const uint32_t index ) const
+{
+  return chunks_[index / kChunkBuffers].load( memory_order_acquire )[index % kChunkBuffers];
+}
+
+BufferPool::Buffer* BufferPool::pop()
+{
+  uint64_t head = free_head_.load( memory_order_acquire );
+  while ( ( head & kIndexMask ) != 0 ) {
+    Buffer& top = at( static_cast<uint32_t>( head & kIndexMask ) - 1 );
+    // (if another thread takes `top` meanwhile, this reads a stale link, but the exchange then fails)
+    const uint32_t next = top.next.load( memory_order_relaxed );
+    if ( free_head_.compare_exchange_weak( head, next_head( head, next ), memory_order_acquire ) ) {
+      return &top;
+    }
+  }
+  return nullptr;
+}
+
+void BufferPool::push( Buffer& buffer )
+{
+  uint64_t head = free_head_.load( memory_order_relaxed );
+  do {
+    buffer.next.store( static_cast<uint32_t>( head & kIndexMask ), memory_order_relaxed );
+  } while ( not free_head_.compare_exchange_weak(
+    head, next_head( head, buffer.index + 1 ), memory_order_release, memory_order_relaxed ) );
+}
+
+// add a chunk of buffers, keeping one for the caller (or, once the pool is full, make a buffer of its own)
+BufferPool::Buffer* BufferPool::grow()
+{
+  const lock_guard lock { grow_mutex_ };
+  if ( Buffer* buffer = pop() ) {
+    return buffer; // (another thread grew the pool)
+  }
+
+  const uint32_t first = created_.load( memory_order_relaxed );
+  if ( first / kChunkBuffers == kMaxChunks ) {
+    auto* buffer = new Buffer; // NOLINT(*-owning-memory)
+    buffer->storage = make_unique_for_overwrite<char[]>( buffer_size_ ); // NOLINT(*-avoid-c-arrays)
+    buffer->capacity = buffer_size_;
+    return buffer;
+  }
+
+  auto* chunk = new Buffer[kChunkBuffers]; // NOLINT(*-owning-memory)
+  for ( uint32_t i = 0; i < kChunkBuffers; ++i ) {
+    chunk[i].storage = make_unique_for_overwrite<char[]>( buffer_size_ ); // NOLINT(*-avoid-c-arrays)
+    chunk[i].capacity = buffer_size_;
+    chunk[i].index = first + i;
+    chunk[i].pool = this;
+  }
+  chunks_[first / kChunkBuffers].store( chunk, memory_order_release );
+  created_.store( first + kChunkBuffers, memory_order_relaxed );
+
+  for ( uint32_t i = 1; i < kChunkBuffers; ++i ) {
+    push( chunk[i] );
+  }
+  return chunk;
+}
+
+PooledBuffer BufferPool::acquire()
+{
+  Buffer* buffer = pop();
+  if ( not buffer ) {
+    buffer = grow();
+  }
+  buffer->size = 0;
+  buffer->references.store( 1, memory_order_relaxed );
+  return PooledBuffer { buffer };
+}
+
+void BufferPool::release( Buffer& buffer )
+{
+  if ( buffer.references.fetch_sub( 1, memory_order_acq_rel ) != 1 ) {
+    return;
+  }
+  if ( buffer.pool ) {
+    buffer.pool->push( buffer );
+  } else {
+    delete &buffer; // NOLINT(*-owning-memory)
+  }
+}
+
+PooledBuffer::PooledBuffer( const PooledBuffer& other ) : buffer_( other.buffer_ )
+{
+  if ( buffer_ ) {
+    buffer_->references.fetch_add( 1, memory_order_relaxed );
+  }
+}
+
+PooledBuffer& PooledBuffer::operator=( const PooledBuffer& other )
+{
+  if ( this != &other ) {
+    PooledBuffer copy { other };
+    *this = move( copy );
+  }
+  return *this;
+}
+
+PooledBuffer& PooledBuffer::operator=( PooledBuffer&& other ) noexcept
+{
+  if ( this != &other ) {
+    reset();
+    buffer_ = exchange( other.buffer_, nullptr );
+  }
+  return *this;
+}
+
+void PooledBuffer::reset()
+{
+  if ( buffer_ ) {
+    BufferPool::release( *exchange( buffer_, nullptr ) );
+  }
+}
+
+void PooledBuffer::resize( const size_t size )
+{
+  if ( size > capacity() ) {
+    throw out_of_range( "PooledBuffer: size " + to_string( size ) + " past capacity " + to_string( capacity() ) );
+  }
+  if ( buffer_ ) {
+    buffer_->size = size;
+  }
+}
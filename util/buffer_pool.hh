@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+class PooledBuffer;
+
+// Fixed-size buffers, reused rather than freed: a buffer whose last handle is released goes back on a
+// free list, so that once the pool has grown to the number of buffers in use at once, taking a buffer
+// costs no allocation. The storage is never zero-filled (it is written before it is read).
+//
+// The free list is lock-free (a stack of buffer indices, tagged against ABA), so buffers may be taken
+// and released on any thread. Only growing the pool, a chunk of buffers at a time, takes a lock.
+// The pool must outlive its buffers.
+class BufferPool
+{
+public:
+  static constexpr size_t kChunkBuffers = 64;
+  static constexpr size_t kMaxChunks = 1024;
+
+  explicit BufferPool( size_t buffer_size );
+  ~BufferPool();
+
+  BufferPool( const BufferPool& other ) = delete;
+  BufferPool& operator=( const BufferPool& other ) = delete;
+  BufferPool( BufferPool&& other ) = delete;
+  BufferPool& operator=( BufferPool&& other ) = delete;
+
+  // Take a buffer (of size zero, and capacity buffer_size()). Past kMaxChunks chunks, a buffer is
+  // allocated that is freed when released.
+  PooledBuffer acquire();
+
+  size_t buffer_size() const { return buffer_size_; }
+
+  // The number of buffers the pool has made
+  size_t buffers() const { return created_.load( std::memory_order_relaxed ); }
+
+  struct Buffer
+  {
+    std::unique_ptr<char[]> storage {}; // NOLINT(*-avoid-c-arrays)
+    size_t size {};
+    size_t capacity {};
+    std::atomic<uint32_t> references {};
+    std::atomic<uint32_t> next {}; // (on the free list) the next buffer's index + 1, or zero
+    uint32_t index {};
+    BufferPool* pool {}; // null for a buffer from outside the pool
+  };
+
+private:
+  size_t buffer_size_;
+  std::array<std::atomic<Buffer*>, kMaxChunks> chunks_ {};
+  std::atomic<uint32_t> created_ {};
+  std::atomic<uint64_t> free_head_ {}; // a tag (high 32 bits), and the index + 1 of the top buffer, or zero
+  std::mutex grow_mutex_ {};
+
+  Buffer& at( uint32_t index ) const;
+  Buffer* pop();
+  void push( Buffer& buffer );
+  Buffer* grow();
+
+  friend class PooledBuffer;
+  static void release( Buffer& buffer );
+};
+
+// A reference-counted handle on a buffer from a BufferPool: copies share the buffer, which goes back to
+// the pool when the last of them is destroyed. Reads as a std::string_view of its first size() bytes.
+class PooledBuffer
+{
+  BufferPool::Buffer* buffer_ {};
+
+  friend class BufferPool;
+  explicit PooledBuffer( BufferPool::Buffer* buffer ) : buffer_( buffer ) {}
+
+public:
+  PooledBuffer() = default;
+  ~PooledBuffer() { reset(); }
+
+  PooledBuffer( const PooledBuffer& other );
+  PooledBuffer& operator=( const PooledBuffer& other );
+  PooledBuffer( PooledBuffer&& other ) noexcept : buffer_( std::exchange( other.buffer_, nullptr ) ) {}
+  PooledBuffer& operator=( PooledBuffer&& other ) noexcept;
+
+  // Let go of the buffer (returning it to the pool, if this was the last handle)
+  void reset();
+
+  bool has_buffer() const { return buffer_; }
+  char* data() { return buffer_ ? buffer_->storage.get() : nullptr; }
+  const char* data() const { return buffer_ ? buffer_->storage.get() : nullptr; }
+  size_t size() const { return buffer_ ? buffer_->size : 0; }
+  size_t capacity() const { return buffer_ ? buffer_->capacity : 0; }
+  bool empty() const { return size() == 0; }
+
+  // Set the size (at most the capacity); bytes past the old size are whatever the buffer held
+  void resize( size_t size );
+
+  std::string_view view() const { return { data(), size() }; }
+  operator std::string_view() const { return view(); } // NOLINT(*-explicit-*)
+
+  // A copy of the contents, e.g. for a Ref<std::string> that must own them
+  std::string str() const { return std::string { view() }; }
+
+  // The number of handles sharing the buffer
+  uint32_t use_count() const { return buffer_ ? buffer_->references.load( std::memory_order_relaxed ) : 0; }
+};
@@ -1,12 +1,48 @@
 #include "eventloop.hh"
+#include "eventloop_uring.hh"
 #include "exception.hh"
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstring>
 #include <iostream>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
 using namespace std;
 
+// epoll reports readiness with the same bits as poll
+static_assert( EPOLLIN == POLLIN and EPOLLOUT == POLLOUT and EPOLLERR == POLLERR and EPOLLHUP == POLLHUP );
+
+EventLoop::EventLoop( const Backend backend )
+  : _rules( make_shared<Rules>() )
+  , _backend( backend )
+  , _uring( backend == Backend::IoUring ? make_unique<UringState>() : nullptr )
+  , _post_wakeup( CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) ) // NOLINT(*-signed-bitwise)
+  , _wait_trace_name( Tracer::intern( backend == Backend::Epoll     ? "epoll_wait"
+                                      : backend == Backend::IoUring ? "io_uring_enter"
+                                                                    : "poll" ) )
+  , _dispatch_trace_name( Tracer::intern( "wait_next_event" ) )
+  , _timers_trace_name( Tracer::intern( "timers" ) )
+{
+  _rule_categories.reserve( 64 );
+
+  // the wake-up rule for post(), which alone doesn't keep the loop going
+  BasicRule wakeup_rule { add_category( "posted tasks" ), [] { return true; }, [this] { run_posted(); } };
+  const SlotKey wakeup
+    = add_fd_rule( FDRule { move( wakeup_rule ), _post_wakeup.duplicate(), Direction::In, [] {}, [] {} } );
+  _rules->fd.find( wakeup )->background = true;
+
+  if ( _backend == Backend::Epoll ) {
+    _epoll_fd.emplace( CheckSystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) ) );
+    _epoll_events.resize( 256 );
+  }
+}
+
+EventLoop::~EventLoop() = default;
+
 unsigned int EventLoop::FDRule::service_count() const
 {
   return direction == Direction::In ? fd.read_count() : fd.write_count();
@@ -18,7 +54,7 @@ size_t EventLoop::add_category( const string& name )
     throw runtime_error( "maximum categories reached" );
   }
 
-  _rule_categories.push_back( { name } );
+  _rule_categories.push_back( { .name = name, .trace_name = Tracer::intern( name ) } );
   return _rule_categories.size() - 1;
 }
 
@@ -26,6 +62,14 @@ EventLoop::BasicRule::BasicRule( size_t s_category_id, InterestT s_interest, Cal
   : category_id( s_category_id ), interest( move( s_interest ) ), callback( move( s_callback ) )
 {}
 
+EventLoop::BasicRule::BasicRule( size_t s_category_id, Interest s_interest, CallbackT s_callback )
+  : category_id( s_category_id )
+  , interest()
+  , callback( move( s_callback ) )
+  , explicit_interest( true )
+  , enabled( s_interest == Interest::Enabled )
+{}
+
 EventLoop::FDRule::FDRule( BasicRule&& base,
                            FileDescriptor&& s_fd,
                            Direction s_direction,
@@ -41,59 +85,327 @@ EventLoop::FDRule::FDRule( BasicRule&& base,
 EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
                                            FileDescriptor& fd,
                                            Direction direction,
-                                           const CallbackT& callback,
-                                           const InterestT& interest,
-                                           const CallbackT& cancel, // NOLINT(*-easily-swappable-*)
-                                           const CallbackT& error )
+                                           CallbackT callback,
+                                           InterestT interest,
+                                           CallbackT cancel, // NOLINT(*-easily-swappable-*)
+                                           CallbackT error )
+{
+  if ( category_id >= _rule_categories.size() ) {
+    throw out_of_range( "bad category_id" );
+  }
+
+  const SlotKey key = add_fd_rule( FDRule { BasicRule { category_id, move( interest ), move( callback ) },
+                                            fd.duplicate(),
+                                            direction,
+                                            move( cancel ),
+                                            move( error ) } );
+
+  return { _rules, key, true };
+}
+
+EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id, CallbackT callback, InterestT interest )
+{
+  if ( category_id >= _rule_categories.size() ) {
+    throw out_of_range( "bad category_id" );
+  }
+
+  return { _rules, add_non_fd_rule( BasicRule { category_id, move( interest ), move( callback ) } ), false };
+}
+
+EventLoop::RuleHandle EventLoop::add_rule( size_t category_id,
+                                           FileDescriptor& fd,
+                                           Direction direction,
+                                           CallbackT callback,
+                                           Interest interest,
+                                           CallbackT cancel, // NOLINT(*-easily-swappable-*)
+                                           CallbackT error )
+{
+  if ( category_id >= _rule_categories.size() ) {
+    throw out_of_range( "bad category_id" );
+  }
+
+  const SlotKey key = add_fd_rule( FDRule { BasicRule { category_id, interest, move( callback ) },
+                                            fd.duplicate(),
+                                            direction,
+                                            move( cancel ),
+                                            move( error ) } );
+
+  return { _rules, key, true };
+}
+
+EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id, CallbackT callback, Interest interest )
 {
   if ( category_id >= _rule_categories.size() ) {
     throw out_of_range( "bad category_id" );
   }
 
-  _fd_rules.emplace_back( make_shared<FDRule>(
-    BasicRule { category_id, interest, callback }, fd.duplicate(), direction, cancel, error ) );
+  return { _rules, add_non_fd_rule( BasicRule { category_id, interest, move( callback ) } ), false };
+}
 
-  return RuleHandle { _fd_rules.back() };
+EventLoop::RuleHandle EventLoop::add_signal_rule( const size_t category_id,
+                                                  SignalFD& signals,
+                                                  SignalCallbackT callback )
+{
+  return add_rule(
+    category_id,
+    signals,
+    Direction::In,
+    [signalfd = signals.duplicate(), callback = move( callback )]() mutable {
+      while ( const optional<signalfd_siginfo> info = signalfd.read_signal() ) {
+        callback( *info );
+      }
+    },
+    Interest::Enabled );
 }
 
-EventLoop::RuleHandle EventLoop::add_rule( const size_t category_id,
-                                           const CallbackT& callback,
-                                           const InterestT& interest )
+// the pidfd stays readable once the child is reaped, so the rule cancels itself to end (the pidfd is
+// shared with the caller's, so closing it isn't the rule's to do)
+EventLoop::RuleHandle EventLoop::add_child_rule( const size_t category_id, PidFD& child, ChildCallbackT callback )
 {
   if ( category_id >= _rule_categories.size() ) {
     throw out_of_range( "bad category_id" );
   }
 
-  _non_fd_rules.emplace_back( make_shared<BasicRule>( category_id, interest, callback ) );
+  // (the callback is set once the rule is added, so that it can hold the rule's handle)
+  const SlotKey key = add_fd_rule(
+    FDRule { BasicRule { category_id, Interest::Enabled, [] {} }, child.duplicate(), Direction::In, [] {}, [] {} } );
+  RuleHandle handle { _rules, key, true };
+  _rules->fd.find( key )->callback
+    = [handle, pidfd = child.duplicate(), callback = move( callback )]() mutable {
+        if ( const optional<siginfo_t> status = pidfd.try_wait() ) {
+          handle.cancel();
+          callback( *status );
+        }
+      };
+  return handle;
+}
 
-  return RuleHandle { _non_fd_rules.back() };
+// a new explicit-interest rule is looked at once; a rule with an interest function, on every iteration
+SlotKey EventLoop::add_fd_rule( FDRule&& rule )
+{
+  const SlotKey key = _rules->fd.emplace( move( rule ) );
+  FDRule& added = *_rules->fd.find( key );
+  added.key = key;
+  if ( added.explicit_interest ) {
+    added.queued = true;
+    _rules->fd_changed.push_back( key );
+  } else if ( _backend != Backend::Poll ) {
+    _rules->fd_walked.push_back( key );
+  }
+  if ( _backend == Backend::IoUring ) {
+    uring_track( added );
+  }
+  if ( _socket_busy_poll > chrono::microseconds::zero() ) {
+    set_socket_busy_poll( added );
+  }
+  return key;
+}
+
+SlotKey EventLoop::add_non_fd_rule( BasicRule&& rule )
+{
+  const SlotKey key = _rules->non_fd.emplace( move( rule ) );
+  BasicRule& added = *_rules->non_fd.find( key );
+  added.key = key;
+  if ( not added.explicit_interest or added.enabled ) {
+    added.queued = true;
+    _rules->non_fd_walked.push_back( key );
+  }
+  return key;
+}
+
+void EventLoop::Rules::set_enabled( const SlotKey key, const bool fd_rule, const bool enabled )
+{
+  BasicRule* rule = fd_rule ? fd.find( key ) : non_fd.find( key );
+  if ( not rule ) {
+    return;
+  }
+  if ( not rule->explicit_interest ) {
+    throw runtime_error( "EventLoop: enabling or disabling a rule that has an interest function" );
+  }
+  if ( rule->enabled == enabled ) {
+    return;
+  }
+
+  rule->enabled = enabled;
+  // a non-fd rule only needs to be put back on the list when enabled (the loop drops it once disabled)
+  if ( not rule->queued and ( fd_rule or enabled ) ) {
+    rule->queued = true;
+    ( fd_rule ? fd_changed : non_fd_walked ).push_back( key );
+  }
+}
+
+void EventLoop::Rules::cancel( const SlotKey key, const bool fd_rule )
+{
+  BasicRule* rule = fd_rule ? fd.find( key ) : non_fd.find( key );
+  if ( not rule ) {
+    return;
+  }
+
+  rule->cancel_requested = true;
+  // rules with an interest function are looked at anyway
+  if ( rule->explicit_interest and not rule->queued ) {
+    rule->queued = true;
+    ( fd_rule ? fd_changed : non_fd_walked ).push_back( key );
+  }
 }
 
 void EventLoop::RuleHandle::cancel()
 {
-  const shared_ptr<BasicRule> rule_shared_ptr = rule_weak_ptr_.lock();
-  if ( rule_shared_ptr ) {
-    rule_shared_ptr->cancel_requested = true;
+  const shared_ptr<Rules> rules = rules_.lock();
+  if ( rules ) {
+    rules->cancel( key_, fd_rule_ );
+  }
+}
+
+void EventLoop::RuleHandle::set_enabled( const bool enabled )
+{
+  const shared_ptr<Rules> rules = rules_.lock();
+  if ( rules ) {
+    rules->set_enabled( key_, fd_rule_, enabled );
+  }
+}
+
+// take the explicit-interest fd rules that changed, to look at them (false if there are none)
+bool EventLoop::take_changed_rules()
+{
+  _changed_rules.clear();
+  _changed_rules.swap( _rules->fd_changed );
+  for ( const SlotKey key : _changed_rules ) {
+    if ( FDRule* rule = _rules->fd.find( key ) ) {
+      rule->queued = false;
+    }
   }
+  return not _changed_rules.empty();
+}
+
+// whether the rule is interested, as far as the kernel was last told, and still
+bool EventLoop::interested_now( const FDRule& rule )
+{
+  return rule.registered_interest and ( not rule.explicit_interest or rule.enabled );
+}
+
+// (epoll, io_uring) whether the rule is one of the explicit-interest rules the kernel watches on the
+// loop's behalf, which keep it from exiting without being looked at
+bool EventLoop::counts_as_interested( const FDRule& rule ) const
+{
+  return rule.explicit_interest and rule.registered_interest and keeps_loop_alive( rule );
+}
+
+EventLoop::TimerHandle EventLoop::add_timer( const TimerWheel::Clock::time_point deadline, CallbackT callback )
+{
+  return { _timers, _timers.add( deadline, move( callback ) ) };
+}
+
+void EventLoop::TimerHandle::cancel()
+{
+  wheel_->cancel( id_ );
+}
+
+void EventLoop::post( CallbackT task )
+{
+  if ( not task ) {
+    throw invalid_argument( "EventLoop: empty task posted" );
+  }
+
+  // a queue that wasn't empty already has a wake-up on its way
+  if ( _posted.push( move( task ) ) ) {
+    const uint64_t one = 1;
+    CheckSystemCall( "write", ::write( _post_wakeup.fd_num(), &one, sizeof( one ) ) );
+    _post_wakeups.fetch_add( 1, memory_order_relaxed );
+  }
+}
+
+bool EventLoop::keeps_loop_alive( const FDRule& rule ) const
+{
+  return not rule.background or not _posted.empty() or not _posted_batch.empty();
+}
+
+void EventLoop::run_posted()
+{
+  // reset the eventfd before taking the tasks, so that a post() after the take wakes the loop again
+  string count( sizeof( uint64_t ), 0 );
+  _post_wakeup.read( count );
+
+  const auto run_batch = [&] {
+    while ( auto task = _posted_batch.pop() ) {
+      try {
+        ( *task )();
+      } catch ( ... ) {
+        // come back for the rest of the batch, if any
+        if ( not _posted_batch.empty() ) {
+          const uint64_t one = 1;
+          CheckSystemCall( "write", ::write( _post_wakeup.fd_num(), &one, sizeof( one ) ) );
+        }
+        throw;
+      }
+    }
+  };
+
+  // first the rest of any batch cut short by a throwing task, then everything posted since
+  run_batch();
+  _posted_batch = _posted.take_all();
+  run_batch();
 }
 
 // NOLINTBEGIN(*-cognitive-complexity)
 // NOLINTBEGIN(*-signed-bitwise)
 EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
 {
-  // first, handle the non-file-descriptor-related rules
+  const Tracer::Span dispatch_span { Tracer::Kind::Dispatch, _dispatch_trace_name };
+
+  if ( _stats_dump_interval > Clock::duration::zero() and Clock::now() >= _next_stats_dump ) {
+    dump_stats( *_stats_dump_output );
+    _next_stats_dump = Clock::now() + _stats_dump_interval;
+  }
+
+  // first, run the timers that have come due
+  const bool timers_fired = expire_timers() > 0;
+  if ( timers_fired and _dispatch == Dispatch::OneRule ) {
+    return Result::Success;
+  }
+
+  // next, handle the non-file-descriptor-related rules
+  // (only those with an interest function, or enabled: disabled ones drop off the list as it is walked)
+  bool served_non_fd_rule = timers_fired;
   {
-    for ( auto it = _non_fd_rules.begin(); it != _non_fd_rules.end(); ) {
-      auto& this_rule = **it;
+    auto& non_fd_rules = _rules->non_fd;
+    auto& walked = _rules->non_fd_walked;
+    size_t kept = 0;
+    const auto drop_from_walk = [&]( size_t end ) {
+      walked.erase( walked.begin() + static_cast<ptrdiff_t>( kept ), walked.begin() + static_cast<ptrdiff_t>( end ) );
+    };
+
+    for ( size_t i = 0; i < walked.size(); ++i ) {
+      const SlotKey key = walked[i];
+      BasicRule* rule = non_fd_rules.find( key );
+      if ( not rule ) {
+        continue;
+      }
+      auto& this_rule = *rule;
       bool rule_fired = false;
 
       if ( this_rule.cancel_requested ) {
-        it = _non_fd_rules.erase( it );
+        non_fd_rules.erase( key );
+        continue;
+      }
+
+      if ( this_rule.explicit_interest and not this_rule.enabled ) {
+        this_rule.queued = false;
+        continue;
+      }
+      walked[kept++] = key;
+
+      if ( _dispatch == Dispatch::Batch ) {
+        // serve every interested rule, each a bounded number of times
+        for ( unsigned calls = 0; calls < _max_calls_per_rule and check_interest( this_rule ); ++calls ) {
+          served_non_fd_rule = true;
+          run_callback( this_rule );
+        }
         continue;
       }
 
       uint8_t iterations = 0;
-      while ( this_rule.interest() ) {
+      while ( check_interest( this_rule ) ) {
         if ( iterations++ >= 128 ) {
           throw runtime_error( "EventLoop: busy wait detected: rule \""
                                + _rule_categories.at( this_rule.category_id ).name + "\" is still interested after "
@@ -101,56 +413,508 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
         }
 
         rule_fired = true;
-        this_rule.callback();
+        run_callback( this_rule );
       }
 
       if ( rule_fired ) {
+        drop_from_walk( i + 1 );
         return Result::Success; /* only serve one rule on each iteration */
       }
+    }
+    drop_from_walk( walked.size() );
+  }
+
+  // in a batch, don't block in the kernel if there was already work to do, nor past the next timer
+  int fd_timeout_ms = served_non_fd_rule ? 0 : timeout_ms;
+  const auto until_timer = _timers.time_until_next( TimerWheel::Clock::now() );
+  if ( until_timer.has_value() ) {
+    const int64_t until_ms = ceil<chrono::milliseconds>( *until_timer ).count();
+    const auto timer_ms = static_cast<int>( min<int64_t>( until_ms, INT_MAX ) );
+    fd_timeout_ms = fd_timeout_ms < 0 ? timer_ms : min( fd_timeout_ms, timer_ms );
+  }
+
+  Result result = fd_timeout_ms != 0 and _spin_budget > Clock::duration::zero() ? busy_wait_fds( fd_timeout_ms )
+                                                                               : wait_fds( fd_timeout_ms );
+
+  // with no fds to wait for, the loop still lives as long as a timer is armed
+  if ( result == Result::Exit and not _timers.empty() ) {
+    if ( fd_timeout_ms != 0 ) {
+      ++_kernel_calls;
+      const auto wait_start = wait_started();
+      CheckSystemCall( "poll", ::poll( nullptr, 0, fd_timeout_ms ) );
+      wait_finished( wait_start );
+    }
+    result = Result::Timeout;
+  }
+
+  if ( result != Result::Exit and expire_timers() > 0 ) {
+    result = Result::Success;
+  }
+
+  return served_non_fd_rule ? Result::Success : result;
+}
+
+// run the timers that have come due (traced as one span, if any did)
+size_t EventLoop::expire_timers()
+{
+  const auto start = Tracer::enabled() ? Clock::now() : Clock::time_point {};
+  const size_t fired = _timers.expire( TimerWheel::Clock::now() );
+  if ( fired > 0 and start != Clock::time_point {} ) {
+    Tracer::record( Tracer::Kind::Callback, _timers_trace_name, start, Clock::now() );
+  }
+  return fired;
+}
+
+EventLoop::Result EventLoop::wait_fds( const int timeout_ms )
+{
+  switch ( _backend ) {
+    case Backend::Epoll:
+      return wait_epoll( timeout_ms );
+    case Backend::IoUring:
+      return wait_uring( timeout_ms );
+    case Backend::Poll:
+      break;
+  }
+  return wait_poll( timeout_ms );
+}
+
+// spin with non-blocking waits until something is ready or the budget runs out, then block for
+// what is left of the timeout
+EventLoop::Result EventLoop::busy_wait_fds( const int timeout_ms )
+{
+  const auto start = Clock::now();
+  auto spin_until = start + _spin_budget;
+  if ( timeout_ms > 0 ) {
+    spin_until = min( spin_until, start + chrono::milliseconds { timeout_ms } );
+  }
+
+  Result result {};
+  auto now = start;
+  do {
+    result = wait_fds( 0 );
+    now = Clock::now();
+  } while ( result == Result::Timeout and now < spin_until );
+  _busy_poll_stats.spin_time += now - start;
 
-      ++it;
+  if ( result != Result::Timeout ) {
+    _busy_poll_stats.spin_wakeups += result == Result::Success ? 1 : 0;
+    return result;
+  }
+
+  int remaining_ms = timeout_ms;
+  if ( timeout_ms > 0 ) {
+    remaining_ms -= static_cast<int>( chrono::duration_cast<chrono::milliseconds>( now - start ).count() );
+    if ( remaining_ms <= 0 ) {
+      return Result::Timeout;
     }
   }
 
-  // now the file-descriptor-related rules. poll any "interested" file descriptors
-  vector<pollfd> pollfds {};
-  pollfds.reserve( _fd_rules.size() );
+  ++_busy_poll_stats.sleeps;
+  result = wait_fds( remaining_ms );
+  _busy_poll_stats.sleep_time += Clock::now() - now;
+  return result;
+}
+
+void EventLoop::set_busy_poll( const Clock::duration spin_budget, const chrono::microseconds socket_busy_poll )
+{
+  if ( spin_budget < Clock::duration::zero() or socket_busy_poll < chrono::microseconds::zero()
+       or socket_busy_poll.count() > INT_MAX ) {
+    throw out_of_range( "EventLoop: bad busy-poll budget" );
+  }
+  _spin_budget = spin_budget;
+
+  if ( socket_busy_poll != _socket_busy_poll ) {
+    _socket_busy_poll = socket_busy_poll;
+    for ( size_t i = 0; i < _rules->fd.slots(); ++i ) {
+      if ( const FDRule* rule = _rules->fd.at( i ) ) {
+        set_socket_busy_poll( *rule );
+      }
+    }
+  }
+}
+
+// (fds that aren't sockets are left alone)
+void EventLoop::set_socket_busy_poll( const FDRule& rule ) const
+{
+  const auto usecs = static_cast<int>( _socket_busy_poll.count() );
+  if ( setsockopt( rule.fd.fd_num(), SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof( usecs ) ) < 0 and errno != ENOTSOCK ) {
+    throw unix_error( "setsockopt(SO_BUSY_POLL)" );
+  }
+}
+
+void EventLoop::set_dispatch( const Dispatch dispatch, const unsigned max_calls_per_rule )
+{
+  if ( max_calls_per_rule == 0 ) {
+    throw out_of_range( "EventLoop: max_calls_per_rule must be positive" );
+  }
+  _dispatch = dispatch;
+  _max_calls_per_rule = max_calls_per_rule;
+}
+
+void EventLoop::set_priority( const size_t category_id, const Priority priority )
+{
+  _rule_categories.at( category_id ).priority = priority;
+  _prioritized |= priority != Priority::Normal;
+}
+
+void EventLoop::set_class_policy( const Priority priority, const ClassPolicy& policy )
+{
+  if ( policy.weight == 0 or policy.time_budget < Clock::duration::zero() ) {
+    throw out_of_range( "EventLoop: a priority class needs a positive weight and a nonnegative budget" );
+  }
+  _class_policies.at( static_cast<size_t>( priority ) ) = policy;
+  _prioritized = true;
+}
+
+void EventLoop::set_trigger( const Trigger trigger, const unsigned drain_budget )
+{
+  if ( drain_budget == 0 ) {
+    throw out_of_range( "EventLoop: drain_budget must be positive" );
+  }
+  if ( trigger == Trigger::Edge and _backend == Backend::Poll ) {
+    throw runtime_error( "EventLoop: edge-triggered waits need the epoll or io_uring backend" );
+  }
+  _drain_budget = drain_budget;
+  if ( trigger == _trigger ) {
+    return;
+  }
+  _trigger = trigger;
+
+  // register the fds again, in the new mode
+  for ( size_t slot = 0; slot < _rules->fd.slots(); ++slot ) {
+    FDRule* rule = _rules->fd.at( slot );
+    if ( not rule or not rule->registered ) {
+      continue;
+    }
+    if ( _backend == Backend::Epoll ) {
+      epoll_register( *rule ); // (the events asked for now differ by EPOLLET)
+    } else {
+      _uring->remove_poll( *rule ); // (a new request is made once this one is gone)
+    }
+  }
+
+  // a level-triggered wait finds the fds that were left ready
+  if ( trigger == Trigger::Level ) {
+    for ( const SlotKey key : _edge_ready ) {
+      if ( FDRule* rule = _rules->fd.find( key ) ) {
+        rule->edge_ready = false;
+      }
+    }
+    _edge_ready.clear();
+  }
+}
+
+void EventLoop::queue_changed( FDRule& rule )
+{
+  if ( rule.explicit_interest and not rule.queued ) {
+    rule.queued = true;
+    _rules->fd_changed.push_back( rule.key );
+  }
+}
+
+// (edge-triggered) the kernel won't report the rule's fd again until there is more to do, so serve
+// the rule until its callback stops making progress
+void EventLoop::drain_fd_rule( FDRule& rule )
+{
+  for ( unsigned calls = 1;; ++calls ) {
+    const auto count_before = rule.service_count();
+    run_callback( rule );
+
+    const bool finished
+      = rule.cancel_requested or rule.fd.closed() or ( rule.direction == Direction::In and rule.fd.eof() );
+    if ( finished or not check_interest( rule ) ) {
+      return;
+    }
+
+    if ( count_before == rule.service_count() ) {
+      // normally the fd has been drained; but a callback that ignores a ready fd would now never be
+      // called again (where level-triggered waits would spin)
+      if ( calls == 1 ) {
+        const auto events = static_cast<int16_t>( rule.direction == Direction::In ? POLLIN : POLLOUT );
+        pollfd ready { rule.fd.fd_num(), events, 0 };
+        if ( CheckSystemCall( "poll", ::poll( &ready, 1, 0 ) ) > 0 and ( ready.revents & ready.events ) ) {
+          throw runtime_error( "EventLoop: busy wait detected: rule \""
+                               + _rule_categories.at( rule.category_id ).name
+                               + "\" did not read/write its ready fd and is still interested" );
+        }
+      }
+      return;
+    }
+
+    if ( calls == _drain_budget ) {
+      defer_edge_ready( rule );
+      return;
+    }
+  }
+}
+
+// (edge-triggered) serve the rule on a later iteration without waiting for the kernel
+void EventLoop::defer_edge_ready( FDRule& rule )
+{
+  if ( not rule.edge_ready ) {
+    rule.edge_ready = true;
+    _edge_ready.push_back( rule.key );
+  }
+}
+
+// (edge-triggered) serve the rules left ready, or queue them when prioritized; returns whether any was
+// served (with Dispatch::OneRule, just one)
+bool EventLoop::serve_edge_ready()
+{
+  _edge_ready_taken.clear();
+  _edge_ready_taken.swap( _edge_ready );
+
+  bool served = false;
+  for ( const SlotKey key : _edge_ready_taken ) {
+    FDRule* rule = _rules->fd.find( key );
+    if ( not rule ) {
+      continue;
+    }
+    rule->edge_ready = false;
+    if ( rule->cancel_requested or not interested_now( *rule ) ) {
+      continue; // (if it becomes interested again, the kernel reports the fd anew)
+    }
+    if ( served and _dispatch == Dispatch::OneRule ) {
+      defer_edge_ready( *rule );
+      continue;
+    }
+
+    const auto events = static_cast<int16_t>( rule->direction == Direction::In ? POLLIN : POLLOUT );
+    if ( _prioritized ) {
+      queue_ready( *rule, events, events ); // (served along with the rules the kernel reports)
+      continue;
+    }
+    if ( service_fd_rule( *rule, events, events ) == FDOutcome::Served ) {
+      served = true;
+    }
+  }
+  return served;
+}
+
+// look at one fd rule's poll result (`events` is what was asked for), and run its callback if it is ready
+EventLoop::FDOutcome EventLoop::service_fd_rule( FDRule& rule, const int16_t events, const int16_t revents )
+{
+  const auto poll_error = static_cast<bool>( revents & ( POLLERR | POLLNVAL ) );
+  if ( poll_error ) {
+    /* see if fd is a socket */
+    int socket_error = 0;
+    socklen_t optlen = sizeof( socket_error );
+    const int ret = getsockopt( rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
+    if ( ret == -1 and errno == ENOTSOCK ) {
+      cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( rule.category_id ).name
+           << "\"\n";
+    } else if ( ret == -1 ) {
+      throw unix_error( "getsockopt" );
+    } else if ( optlen != sizeof( socket_error ) ) {
+      throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
+    } else if ( socket_error ) {
+      cerr << "error on polled socket for rule \"" << _rule_categories.at( rule.category_id ).name
+           << "\": " << strerror( socket_error ) << "\n";
+    }
+
+    rule.error();
+    rule.cancel();
+    return FDOutcome::Cancelled;
+  }
+
+  const auto poll_ready = static_cast<bool>( revents & events );
+  const auto poll_hup = static_cast<bool>( revents & POLLHUP );
+  if ( poll_hup && ( ( events && !poll_ready ) or ( rule.direction == Direction::Out ) ) ) {
+    // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
+    //   - if it was POLLIN and nothing is readable, no more will ever be readable
+    //   - if it was POLLOUT, it will not be writable again
+    // additionally, consider FD defunct if rule will only query for Direction::Out
+    rule.cancel();
+    return FDOutcome::Cancelled;
+  }
+
+  if ( poll_ready and _trigger == Trigger::Edge ) {
+    drain_fd_rule( rule );
+  } else if ( poll_ready ) {
+    // we only want to call callback if revents includes the event we asked for
+    const auto count_before = rule.service_count();
+    run_callback( rule );
+
+    if ( count_before == rule.service_count() and ( not rule.fd.closed() ) and check_interest( rule ) ) {
+      throw runtime_error( "EventLoop: busy wait detected: rule \"" + _rule_categories.at( rule.category_id ).name
+                           + "\" did not read/write fd and is still interested" );
+    }
+  }
+
+  if ( poll_ready ) {
+    // an explicit-interest rule isn't looked at again unless it changes, so see that it is retired
+    if ( ( rule.direction == Direction::In and rule.fd.eof() ) or rule.fd.closed() ) {
+      queue_changed( rule );
+    }
+    return FDOutcome::Served;
+  }
+
+  return FDOutcome::Idle;
+}
+
+// serve a ready rule, for any backend: a rule cancelled by its poll result is removed on the next pass
+EventLoop::FDOutcome EventLoop::serve_ready_rule( FDRule& rule, const int16_t events, const int16_t revents )
+{
+  const FDOutcome outcome = service_fd_rule( rule, events, revents );
+  if ( outcome == FDOutcome::Cancelled ) {
+    if ( _backend == Backend::Epoll ) {
+      epoll_unregister( rule );
+    }
+    rule.cancel_requested = true; // (already cancelled)
+    queue_changed( rule );
+  }
+  return outcome;
+}
+
+// (prioritized) leave a ready rule for serve_prioritized
+void EventLoop::queue_ready( const FDRule& rule, const int16_t events, const int16_t revents )
+{
+  const auto priority = static_cast<size_t>( _rule_categories[rule.category_id].priority );
+  _class_ready.at( priority ).push_back( { rule.key, events, revents } );
+}
+
+bool EventLoop::ready_queued() const
+{
+  return ranges::any_of( _class_ready, []( const auto& ready ) { return not ready.empty(); } );
+}
+
+// (prioritized) serve the queued ready rules by weighted round-robin between the classes, within each
+// class's budgets for this iteration; the rules left over are served on a later one. Returns whether
+// anything happened (a rule was served or cancelled).
+bool EventLoop::serve_prioritized()
+{
+  array<size_t, kPriorityClasses> next {}; // the next ready rule of each class
+  array<Clock::duration, kPriorityClasses> time_spent {};
+  array<uint64_t, kPriorityClasses> bytes_spent {};
+
+  // a class that left rules over last time starts with them, so that its rules share its budget
+  for ( size_t priority = 0; priority < kPriorityClasses; ++priority ) {
+    SlotKey& resume = _class_resume.at( priority );
+    if ( resume.index != SlotKey {}.index ) {
+      auto& ready = _class_ready.at( priority );
+      const auto first = ranges::find_if( ready, [&]( const ReadyRule& entry ) {
+        return entry.key.index == resume.index and entry.key.generation == resume.generation;
+      } );
+      ranges::rotate( ready, first );
+      resume = {};
+    }
+  }
+
+  const auto within_budget = [&]( size_t priority ) {
+    const ClassPolicy& policy = _class_policies.at( priority );
+    return ( policy.time_budget == Clock::duration::zero() or time_spent.at( priority ) < policy.time_budget )
+           and ( policy.byte_budget == 0 or bytes_spent.at( priority ) < policy.byte_budget );
+  };
+
+  bool happened = false;
+  bool served = false;
+  for ( size_t idle_classes = 0; idle_classes < kPriorityClasses; ) {
+    const size_t priority = _round_robin_class;
+    const auto& ready = _class_ready.at( priority );
+    const bool can_serve = next.at( priority ) < ready.size() and within_budget( priority );
+
+    if ( can_serve and _round_robin_served < _class_policies.at( priority ).weight ) {
+      const ReadyRule entry = ready[next.at( priority )++];
+      FDRule* rule = _rules->fd.find( entry.key );
+      if ( not rule or rule->cancel_requested ) {
+        continue;
+      }
+
+      const ClassPolicy& policy = _class_policies.at( priority );
+      const auto start = policy.time_budget > Clock::duration::zero() ? Clock::now() : Clock::time_point {};
+      const uint64_t bytes_before = rule->fd.bytes_read() + rule->fd.bytes_written();
+      const FDOutcome outcome = serve_ready_rule( *rule, entry.events, entry.revents );
+      if ( policy.time_budget > Clock::duration::zero() ) {
+        time_spent.at( priority ) += Clock::now() - start;
+      }
+      bytes_spent.at( priority ) += rule->fd.bytes_read() + rule->fd.bytes_written() - bytes_before;
+
+      served |= outcome == FDOutcome::Served;
+      happened |= outcome != FDOutcome::Idle;
+      ++_round_robin_served;
+      idle_classes = 0;
+      if ( served and _dispatch == Dispatch::OneRule ) {
+        break; // (the class keeps the rest of its turn for the next iteration)
+      }
+      continue;
+    }
+
+    // the class's turn is over: on to the next
+    idle_classes += can_serve ? 0 : 1;
+    _round_robin_class = ( priority + 1 ) % kPriorityClasses;
+    _round_robin_served = 0;
+  }
+
+  // the rules left over are found ready again by a later wait, except with edge-triggered waits
+  for ( size_t priority = 0; priority < kPriorityClasses; ++priority ) {
+    auto& ready = _class_ready.at( priority );
+    for ( size_t i = next.at( priority ); i < ready.size(); ++i ) {
+      FDRule* rule = _rules->fd.find( ready[i].key );
+      if ( rule and not rule->cancel_requested ) {
+        if ( _class_resume.at( priority ).index == SlotKey {}.index ) {
+          _class_resume.at( priority ) = ready[i].key;
+        }
+        not_serviced( *rule );
+        if ( _trigger == Trigger::Edge ) {
+          defer_edge_ready( *rule );
+        }
+      }
+    }
+    ready.clear();
+  }
+
+  return happened;
+}
+
+EventLoop::Result EventLoop::wait_poll( const int timeout_ms )
+{
+  // poll any "interested" file descriptors
+  auto& fd_rules = _rules->fd;
+  _pollfds.clear();
+  _polled_rules.clear();
   bool something_to_poll = false;
 
+  // poll(2) is handed every fd anyway, so the walk below looks at the changed rules too
+  take_changed_rules();
+
   // set up the pollfd for each rule
-  for ( auto it = _fd_rules.begin(); it != _fd_rules.end(); ) { // NOTE: it gets erased or incremented in loop body
-    auto& this_rule = **it;
+  for ( size_t slot = 0; slot < fd_rules.slots(); ++slot ) {
+    FDRule* rule = fd_rules.at( slot );
+    if ( not rule ) {
+      continue;
+    }
+    auto& this_rule = *rule;
 
     if ( this_rule.cancel_requested ) {
       //      this_rule.cancel();
       //      if rule is cancelled externally, no need to call the cancellation callback
       //      this makes it easier to cancel rules and delete captured objects right away
-      it = _fd_rules.erase( it );
+      fd_rules.erase_at( slot );
       continue;
     }
 
     if ( this_rule.direction == Direction::In && this_rule.fd.eof() ) {
       // no more reading on this rule, it's reached eof
       this_rule.cancel();
-      it = _fd_rules.erase( it );
+      fd_rules.erase_at( slot );
       continue;
     }
 
     if ( this_rule.fd.closed() ) {
       this_rule.cancel();
-      it = _fd_rules.erase( it );
+      fd_rules.erase_at( slot );
       continue;
     }
 
-    if ( this_rule.interest() ) {
-      pollfds.push_back( { this_rule.fd.fd_num(),
-                           static_cast<int16_t>( this_rule.direction == Direction::In ? POLLIN : POLLOUT ),
-                           0 } );
-      something_to_poll = true;
+    if ( check_interest( this_rule ) ) {
+      _pollfds.push_back( { this_rule.fd.fd_num(),
+                            static_cast<int16_t>( this_rule.direction == Direction::In ? POLLIN : POLLOUT ),
+                            0 } );
+      something_to_poll |= keeps_loop_alive( this_rule );
     } else {
-      pollfds.push_back( { this_rule.fd.fd_num(), 0, 0 } ); // placeholder --- we still want errors
+      _pollfds.push_back( { this_rule.fd.fd_num(), 0, 0 } ); // placeholder --- we still want errors
     }
-    ++it;
+    _polled_rules.push_back( fd_rules.key_at( slot ) );
   }
 
   // quit if there is nothing left to poll
@@ -159,66 +923,339 @@ EventLoop::Result EventLoop::wait_next_event( const int timeout_ms )
   }
 
   // call poll -- wait until one of the fds satisfies one of the rules (writeable/readable)
-  if ( 0 == CheckSystemCall( "poll", ::poll( pollfds.data(), pollfds.size(), timeout_ms ) ) ) {
+  ++_kernel_calls;
+  const auto wait_start = wait_started();
+  const int ready = CheckSystemCall( "poll", ::poll( _pollfds.data(), _pollfds.size(), timeout_ms ) );
+  wait_finished( wait_start );
+  if ( ready == 0 ) {
     return Result::Timeout;
   }
 
   // go through the poll results
-  for ( auto [it, idx] = make_pair( _fd_rules.begin(), static_cast<size_t>( 0 ) ); it != _fd_rules.end(); ++idx ) {
-    const auto& this_pollfd = pollfds.at( idx );
-    auto& this_rule = **it;
-
-    const auto poll_error = static_cast<bool>( this_pollfd.revents & ( POLLERR | POLLNVAL ) );
-    if ( poll_error ) {
-      /* see if fd is a socket */
-      int socket_error = 0;
-      socklen_t optlen = sizeof( socket_error );
-      const int ret = getsockopt( this_rule.fd.fd_num(), SOL_SOCKET, SO_ERROR, &socket_error, &optlen );
-      if ( ret == -1 and errno == ENOTSOCK ) {
-        cerr << "error on polled file descriptor for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\"\n";
-      } else if ( ret == -1 ) {
-        throw unix_error( "getsockopt" );
-      } else if ( optlen != sizeof( socket_error ) ) {
-        throw runtime_error( "unexpected length from getsockopt: " + to_string( optlen ) );
-      } else if ( socket_error ) {
-        cerr << "error on polled socket for rule \"" << _rule_categories.at( this_rule.category_id ).name
-             << "\": " << strerror( socket_error ) << "\n";
-      }
-
-      this_rule.error();
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
+  for ( size_t idx = 0; idx < _pollfds.size(); ++idx ) {
+    const auto& this_pollfd = _pollfds[idx];
+    FDRule* rule = fd_rules.find( _polled_rules[idx] );
+    if ( not rule or this_pollfd.revents == 0 ) {
       continue;
     }
-
-    const auto poll_ready = static_cast<bool>( this_pollfd.revents & this_pollfd.events );
-    const auto poll_hup = static_cast<bool>( this_pollfd.revents & POLLHUP );
-    if ( poll_hup && ( ( this_pollfd.events && !poll_ready ) or ( this_rule.direction == Direction::Out ) ) ) {
-      // if we asked for the status, and the _only_ condition was a hangup, this FD is defunct:
-      //   - if it was POLLIN and nothing is readable, no more will ever be readable
-      //   - if it was POLLOUT, it will not be writable again
-      // additionally, consider FD defunct if rule will only query for Direction::Out
-      this_rule.cancel();
-      it = _fd_rules.erase( it );
+    if ( _prioritized ) {
+      queue_ready( *rule, this_pollfd.events, this_pollfd.revents );
       continue;
     }
 
-    if ( poll_ready ) {
-      // we only want to call callback if revents includes the event we asked for
-      const auto count_before = this_rule.service_count();
-      this_rule.callback();
+    switch ( service_fd_rule( *rule, this_pollfd.events, this_pollfd.revents ) ) {
+      case FDOutcome::Cancelled:
+        fd_rules.erase( _polled_rules[idx] );
+        break;
+      case FDOutcome::Served:
+        if ( _dispatch == Dispatch::OneRule ) {
+          if ( _stats_enabled ) {
+            for ( size_t later = idx + 1; later < _pollfds.size(); ++later ) {
+              const FDRule* other = fd_rules.find( _polled_rules[later] );
+              if ( other and ( _pollfds[later].revents & _pollfds[later].events ) ) {
+                not_serviced( *other );
+              }
+            }
+          }
+          return Result::Success; /* only serve one rule on each iteration */
+        }
+        break;
+      case FDOutcome::Idle:
+        break;
+    }
+  }
+
+  if ( _prioritized ) {
+    serve_prioritized();
+  }
+  return Result::Success;
+}
 
-      if ( count_before == this_rule.service_count() and ( not this_rule.fd.closed() ) and this_rule.interest() ) {
-        throw runtime_error( "EventLoop: busy wait detected: rule \""
-                             + _rule_categories.at( this_rule.category_id ).name
-                             + "\" did not read/write fd and is still interested" );
+// add the rule to the epoll set (or update the interest it registered)
+void EventLoop::epoll_register( FDRule& rule )
+{
+  if ( rule.always_ready ) {
+    return;
+  }
+
+  const int fd_num = rule.fd.fd_num();
+  auto [it, added] = _epoll_registrations.try_emplace( fd_num );
+  auto& registration = it->second;
+
+  // a rule whose fd was closed outside its callback isn't retired until the loop looks at it again, and
+  // leaves its registration behind meanwhile (the kernel dropped the fd with the close): if the number
+  // has been reused, retire those rules and register the fd anew
+  if ( not added ) {
+    size_t kept = 0;
+    for ( FDRule* other : registration.rules ) {
+      if ( other != &rule and other->fd.closed() ) {
+        other->registered = false;
+        queue_changed( *other );
+      } else {
+        registration.rules[kept++] = other;
+      }
+    }
+    if ( kept < registration.rules.size() ) {
+      registration.rules.resize( kept );
+      registration.events = 0;
+      added = true;
+    }
+  }
+
+  if ( ranges::find( registration.rules, &rule ) == registration.rules.end() ) {
+    registration.rules.push_back( &rule );
+  }
+  rule.registered = true;
+
+  uint32_t events = 0;
+  for ( const FDRule* r : registration.rules ) {
+    if ( r and r->registered_interest ) {
+      events |= ( r->direction == Direction::In ) ? EPOLLIN : EPOLLOUT;
+    }
+  }
+  if ( events and _trigger == Trigger::Edge ) {
+    events |= EPOLLET;
+  }
+
+  if ( not added and events == registration.events ) {
+    return;
+  }
+
+  epoll_event event {};
+  event.events = events;
+  event.data.fd = fd_num;
+  ++_kernel_calls;
+  if ( 0 == epoll_ctl( _epoll_fd->fd_num(), added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd_num, &event ) ) {
+    registration.events = events;
+    return;
+  }
+
+  if ( added and errno == EPERM ) {
+    // poll(2) always reports regular files (and the like) as ready, but epoll refuses them
+    _epoll_registrations.erase( it );
+    rule.always_ready = true;
+    ++_always_ready_rules;
+    return;
+  }
+
+  throw unix_error( "epoll_ctl" );
+}
+
+// take the rule out of the epoll set (the fd may already have been closed)
+void EventLoop::epoll_unregister( FDRule& rule )
+{
+  if ( not rule.registered ) {
+    return;
+  }
+  rule.registered = false;
+
+  const int fd_num = rule.fd.fd_num();
+  const auto it = _epoll_registrations.find( fd_num );
+  if ( it == _epoll_registrations.end() ) {
+    return;
+  }
+
+  auto& registration = it->second;
+  if ( const auto found = ranges::find( registration.rules, &rule ); found != registration.rules.end() ) {
+    registration.rules.erase( found );
+  }
+
+  if ( registration.rules.empty() ) {
+    ++_kernel_calls;
+    epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_DEL, fd_num, nullptr );
+    _epoll_registrations.erase( it );
+    return;
+  }
+
+  epoll_event event {};
+  event.events = 0;
+  for ( const FDRule* r : registration.rules ) {
+    if ( r and r->registered_interest ) {
+      event.events |= ( r->direction == Direction::In ) ? EPOLLIN : EPOLLOUT;
+    }
+  }
+  if ( event.events and _trigger == Trigger::Edge ) {
+    event.events |= EPOLLET;
+  }
+  event.data.fd = fd_num;
+  if ( event.events != registration.events ) {
+    ++_kernel_calls;
+    if ( 0 == epoll_ctl( _epoll_fd->fd_num(), EPOLL_CTL_MOD, fd_num, &event ) ) {
+      registration.events = event.events;
+    }
+  }
+}
+
+// retire the rule if it is finished, or else pass any change in its interest on to the kernel
+// (returns whether the rule is still there)
+bool EventLoop::epoll_sync( FDRule& rule, const SlotKey key )
+{
+  if ( rule.cancel_requested or ( rule.direction == Direction::In && rule.fd.eof() ) or rule.fd.closed() ) {
+    if ( not rule.cancel_requested ) {
+      rule.cancel();
+    }
+    epoll_unregister( rule );
+    _explicit_interested -= counts_as_interested( rule ) ? 1 : 0;
+    _always_ready_rules -= rule.always_ready ? 1 : 0;
+    _rules->fd.erase( key );
+    return false;
+  }
+
+  const bool interested = check_interest( rule );
+  if ( not rule.registered or interested != rule.registered_interest ) {
+    _explicit_interested -= counts_as_interested( rule ) ? 1 : 0;
+    rule.registered_interest = interested;
+    epoll_register( rule );
+    _explicit_interested += counts_as_interested( rule ) ? 1 : 0;
+  }
+  return true;
+}
+
+EventLoop::Result EventLoop::wait_epoll( const int timeout_ms )
+{
+  bool something_to_poll = false;
+
+  // retire finished rules, and pass any change in interest on to the kernel: for every rule with an
+  // interest function, and for the explicit-interest rules that changed
+  auto& fd_rules = _rules->fd;
+  auto& walked = _rules->fd_walked;
+  size_t kept = 0;
+  for ( size_t i = 0; i < walked.size(); ++i ) {
+    const SlotKey key = walked[i];
+    FDRule* rule = fd_rules.find( key );
+    if ( rule and epoll_sync( *rule, key ) ) {
+      walked[kept++] = key;
+      something_to_poll |= rule->registered_interest and keeps_loop_alive( *rule );
+    }
+  }
+  walked.resize( kept );
+
+  while ( take_changed_rules() ) {
+    for ( const SlotKey key : _changed_rules ) {
+      if ( FDRule* rule = fd_rules.find( key ) ) {
+        epoll_sync( *rule, key );
+      }
+    }
+  }
+  something_to_poll |= _explicit_interested > 0;
+
+  // quit if there is nothing left to poll
+  if ( not something_to_poll ) {
+    return Result::Exit;
+  }
+
+  const auto handle = [&]( FDRule& rule, const int16_t revents ) {
+    if ( rule.cancel_requested ) {
+      return FDOutcome::Idle;
+    }
+    const auto events
+      = static_cast<int16_t>( interested_now( rule ) ? ( rule.direction == Direction::In ? POLLIN : POLLOUT ) : 0 );
+    if ( _prioritized ) {
+      queue_ready( rule, events, revents );
+      return FDOutcome::Idle;
+    }
+    return serve_ready_rule( rule, events, revents );
+  };
+
+  // fds that can't be polled are served first, as poll(2) would find them ready straight away
+  bool something_always_ready = false;
+  if ( _always_ready_rules > 0 ) {
+    for ( size_t slot = 0; slot < fd_rules.slots(); ++slot ) {
+      FDRule* rule = fd_rules.at( slot );
+      if ( not rule or not rule->always_ready or not interested_now( *rule ) ) {
+        continue;
       }
+      something_always_ready = true;
+      if ( handle( *rule, rule->direction == Direction::In ? POLLIN : POLLOUT ) == FDOutcome::Served
+           and _dispatch == Dispatch::OneRule ) {
+        return Result::Success; /* only serve one rule on each iteration */
+      }
+    }
+  }
 
-      return Result::Success; /* only serve one rule on each iteration */
+  // (edge-triggered) so are the rules left ready, as the kernel won't report them again
+  if ( not _edge_ready.empty() ) {
+    if ( serve_edge_ready() ) {
+      if ( _dispatch == Dispatch::OneRule ) {
+        return Result::Success;
+      }
+      something_always_ready = true;
     }
+  }
+
+  // wait until one of the fds satisfies one of the rules (writeable/readable)
+  ++_kernel_calls;
+  const auto wait_start = wait_started();
+  const int ready = CheckSystemCall( "epoll_wait",
+                                     epoll_wait( _epoll_fd->fd_num(),
+                                                 _epoll_events.data(),
+                                                 static_cast<int>( _epoll_events.size() ),
+                                                 something_always_ready or not _edge_ready.empty() or ready_queued()
+                                                   ? 0
+                                                   : timeout_ms ) );
+  wait_finished( wait_start );
+  if ( ready == 0 and _prioritized ) {
+    return serve_prioritized() or something_always_ready ? Result::Success : Result::Timeout;
+  }
+  if ( ready == 0 ) {
+    return something_always_ready ? Result::Success : Result::Timeout;
+  }
+
+  // a ready rule left for a later iteration: count it (for the stats), and with edge-triggered waits,
+  // remember it
+  const auto leave_ready_rule = [&]( FDRule& rule, const uint32_t events ) {
+    const uint32_t wanted = ( rule.direction == Direction::In ) ? EPOLLIN : EPOLLOUT;
+    if ( interested_now( rule ) and ( events & wanted ) ) {
+      not_serviced( rule );
+      if ( _trigger == Trigger::Edge ) {
+        defer_edge_ready( rule ); // it won't be reported again
+      }
+    }
+  };
+
+  // leave the rest of the `event`-th event's rules, from the `first`-th, and those of the events after it
+  const auto leave_for_later = [&]( size_t event, const size_t first ) {
+    for ( size_t i = first; i < _epoll_serving.size(); ++i ) {
+      leave_ready_rule( *_epoll_serving[i], _epoll_events[event].events );
+    }
+    for ( ++event; event < static_cast<size_t>( ready ); ++event ) {
+      const auto registration = _epoll_registrations.find( _epoll_events[event].data.fd );
+      if ( registration == _epoll_registrations.end() ) {
+        continue;
+      }
+      for ( FDRule* rule : registration->second.rules ) {
+        leave_ready_rule( *rule, _epoll_events[event].events );
+      }
+    }
+  };
+
+  for ( size_t event = 0; event < static_cast<size_t>( ready ); ++event ) {
+    const auto registration = _epoll_registrations.find( _epoll_events[event].data.fd );
+    if ( registration == _epoll_registrations.end() ) {
+      continue;
+    }
+
+    const auto revents
+      = static_cast<int16_t>( _epoll_events[event].events & ( EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP ) );
+    // (copied: cancelling a rule takes it out of the registration, or drops the registration)
+    _epoll_serving.assign( registration->second.rules.begin(), registration->second.rules.end() );
+    for ( size_t i = 0; i < _epoll_serving.size(); ++i ) {
+      if ( handle( *_epoll_serving[i], revents ) == FDOutcome::Served and _dispatch == Dispatch::OneRule ) {
+        if ( _stats_enabled or _trigger == Trigger::Edge ) {
+          leave_for_later( event, i + 1 );
+        }
+        return Result::Success; /* only serve one rule on each iteration */
+      }
+    }
+  }
+
+  // a full batch may mean more are ready: make room for them next time
+  if ( static_cast<size_t>( ready ) == _epoll_events.size() ) {
+    _epoll_events.resize( _epoll_events.size() * 2 );
+  }
 
-    ++it; // if we got here, it means we didn't call _fd_rules.erase()
+  if ( _prioritized ) {
+    serve_prioritized();
   }
 
   return Result::Success;
@@ -1,11 +1,33 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <deque>
 #include <functional>
-#include <list>
+#include <iosfwd>
 #include <memory>
+#include <optional>
 #include <poll.h>
+#include <stdexcept>
+#include <string_view>
+#include <sys/epoll.h>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #include "file_descriptor.hh"
+#include "inline_function.hh"
+#include "mpsc_queue.hh"
+#include "process_fd.hh"
+#include "slot_map.hh"
+#include "stall_watchdog.hh"
+#include "task.hh"
+#include "timer_wheel.hh"
+#include "tracer.hh"
+
+class IoUring;
 
 //! Waits for events on file descriptors and executes corresponding callbacks.
 class EventLoop
@@ -18,13 +40,116 @@ public:
     Out // Callback will be triggered when Rule::fd is writable.
   };
 
+  //! The kernel interface used to wait for the rules' file descriptors.
+  enum class Backend : uint8_t
+  {
+    Poll, //!< [poll(2)](\ref man2::poll) on every interested fd, gathered afresh on each iteration
+    Epoll, //!< [epoll(7)](\ref man7::epoll): registrations persist, and only ready fds are visited
+    IoUring //!< [io_uring(7)](\ref man7::io_uring): fd rules become poll requests, and the loop can also
+            //!< run completion-based reads and writes (FileDescriptor::async_read/async_write)
+  };
+
+  //! The starting interest of a rule whose interest is set through its RuleHandle (RuleHandle::enable
+  //! and disable) rather than by an interest function that the loop calls on every iteration.
+  enum class Interest : uint8_t
+  {
+    Enabled,
+    Disabled
+  };
+
+  //! How many ready rules each call to wait_next_event serves.
+  enum class Dispatch : uint8_t
+  {
+    OneRule, //!< the first ready rule found, then return
+    Batch    //!< every ready rule: each fd rule found ready by one poll is served once, and each
+             //!< interested non-fd rule up to `max_calls_per_rule` times
+  };
+
+  using Clock = std::chrono::steady_clock;
+
+  //! A category's priority class (see EventLoop::set_priority).
+  enum class Priority : uint8_t
+  {
+    Latency, //!< e.g. control-plane traffic, which must not wait behind bulk transfers
+    Normal,  //!< the default
+    Bulk     //!< e.g. a bulk transfer that is always ready
+  };
+  static constexpr size_t kPriorityClasses = 3;
+
+  //! How a priority class shares the loop with the others (see EventLoop::set_class_policy).
+  struct ClassPolicy
+  {
+    unsigned weight { 1 };          //!< ready rules served per turn of the weighted round-robin
+    Clock::duration time_budget {}; //!< callback time per iteration, beyond which the class's other ready
+                                    //!< rules wait for the next iteration (zero for no limit)
+    uint64_t byte_budget {};        //!< the same for bytes read and written by the rules' fds (zero for no limit)
+  };
+
+  //! When the kernel reports a rule's fd (see EventLoop::set_trigger).
+  enum class Trigger : uint8_t
+  {
+    Level, //!< whenever it is ready: each report serves the rule once, and an fd still ready is reported again
+    Edge   //!< (epoll and io_uring) when it becomes ready: each report serves the rule until its callback makes
+           //!< no progress (e.g. a read finds the fd drained, at EAGAIN), up to a budget of calls
+  };
+
+  //! Called when an async read or write completes, with the result of the system call (the number of
+  //! bytes transferred, or -errno) and, for a read, the bytes read (valid only during the call).
+  using CompletionT = std::function<void( int result, std::string_view data )>;
+
+  //! A category's profile, collected while stats are enabled (see EventLoop::enable_stats).
+  struct CategoryStats
+  {
+    static constexpr size_t kHistogramBuckets = 32;
+
+    uint64_t callbacks {};                 //!< callbacks run
+    Clock::duration callback_time {};      //!< total time spent in them
+    Clock::duration max_callback_time {};  //!< the longest one
+    Clock::duration interest_time {};      //!< total time spent evaluating the rules' interest
+    uint64_t ready_not_serviced {};        //!< times a rule's fd was reported ready but left for a later
+                                           //!< iteration (with Dispatch::OneRule)
+    uint64_t stalls {};                    //!< callbacks over the stall budget (counted whenever there is
+                                           //!< one, even with stats disabled; see EventLoop::set_stall_budget)
+    std::array<uint64_t, kHistogramBuckets> callback_histogram {}; //!< callbacks by duration: bucket i
+                                                                   //!< counts those under 2^(i+1) ns
+
+    //! An upper bound on the `p`-th quantile (0 to 1) of callback time, from the histogram.
+    Clock::duration callback_quantile( double p ) const;
+  };
+
+  //! A callback that ran over the stall budget (see EventLoop::set_stall_budget).
+  struct Stall
+  {
+    size_t category_id {};
+    Clock::time_point started {};
+    Clock::duration duration {};
+    std::vector<std::string> backtrace {}; //!< the stack sampled while it ran (if asked for), one frame per line,
+                                           //!< from the watchdog's signal handler down
+  };
+  static constexpr size_t kRecentStalls = 16; //!< stalls kept (see EventLoop::recent_stalls)
+
+  //! Where the waits for fds went in busy-poll mode (see EventLoop::set_busy_poll).
+  struct BusyPollStats
+  {
+    Clock::duration spin_time {};  //!< spent spinning, checking the fds without blocking
+    Clock::duration sleep_time {}; //!< spent blocked in the kernel, after a spin found nothing ready
+    uint64_t spin_wakeups {};      //!< waits that ended while spinning, with something ready
+    uint64_t sleeps {};            //!< waits that had to block once the spin budget ran out
+  };
+
 private:
-  using CallbackT = std::function<void( void )>;
-  using InterestT = std::function<bool( void )>;
+  //! Rule callbacks are stored inline in the rule (see InlineFunction), so typical lambdas cost no allocation.
+  using CallbackT = InlineFunction<void( void )>;
+  using InterestT = InlineFunction<bool( void )>;
+  using SignalCallbackT = InlineFunction<void( const signalfd_siginfo& )>;
+  using ChildCallbackT = InlineFunction<void( const siginfo_t& )>;
 
   struct RuleCategory
   {
     std::string name;
+    CategoryStats stats {};
+    Priority priority { Priority::Normal };
+    uint32_t trace_name {}; //!< the name interned with the Tracer
   };
 
   struct BasicRule
@@ -33,16 +158,30 @@ private:
     InterestT interest;
     CallbackT callback;
     bool cancel_requested {};
+    bool explicit_interest {}; //!< interest is set through the RuleHandle; `interest` is never called
+    bool enabled {};           //!< (explicit interest) whether the rule is interested
+    bool queued {};            //!< on one of the loop's lists of rules to look at (see Rules)
+    SlotKey key {};            //!< the rule's own key
 
     BasicRule( size_t s_category_id, InterestT s_interest, CallbackT s_callback );
+    BasicRule( size_t s_category_id, Interest s_interest, CallbackT s_callback );
   };
 
   struct FDRule : public BasicRule
   {
     FileDescriptor fd;   //!< FileDescriptor to monitor for activity.
     Direction direction; //!< Direction::In for reading from fd, Direction::Out for writing to fd.
-    CallbackT cancel;    //!< A callback that is called when the rule is cancelled (e.g. on EOF or hangup)
-    CallbackT error;     //!< A callback that is called when the fd has an error before cancellation
+
+    bool registered {};          //!< (epoll) the fd is in the epoll set; (io_uring) a poll request is in flight
+    bool registered_interest {}; //!< (epoll, io_uring) the interest last given to the kernel
+    bool always_ready {};        //!< (epoll) the fd can't be polled (e.g. a regular file), so is always ready
+    bool poll_removing {};       //!< (io_uring) the in-flight poll request is being cancelled
+    bool background {};          //!< doesn't keep the loop from exiting (the wake-up rule for post, while idle)
+    bool edge_ready {};          //!< (edge-triggered) left ready, on the list to serve without waiting
+    uint32_t poll_operation {};  //!< (io_uring) the in-flight poll request
+
+    CallbackT cancel; //!< A callback that is called when the rule is cancelled (e.g. on EOF or hangup)
+    CallbackT error;  //!< A callback that is called when the fd has an error before cancellation
 
     FDRule( BasicRule&& base, FileDescriptor&& s_fd, Direction s_direction, CallbackT s_cancel, CallbackT s_error );
 
@@ -51,12 +190,132 @@ private:
     unsigned int service_count() const;
   };
 
+  //! The rules, in slot maps (contiguous, with stable addresses). RuleHandles share ownership of the
+  //! maps, so that a handle can outlive the loop.
+  //! \details A rule with an interest function has to be asked on every iteration. A rule with explicit
+  //! interest is only looked at when it changes: enabling, disabling or cancelling it puts it on a
+  //! list for the loop's next iteration, and otherwise the loop leaves it to the kernel (epoll and
+  //! io_uring) or, if it is a non-fd rule, skips it while disabled. Idle rules then cost nothing per
+  //! iteration. (The poll backend still hands every fd to poll(2), but asks no interest functions.)
+  struct Rules
+  {
+    SlotMap<FDRule> fd {};
+    SlotMap<BasicRule> non_fd {};
+
+    std::vector<SlotKey> fd_walked {};     //!< (epoll, io_uring) fd rules with an interest function
+    std::vector<SlotKey> fd_changed {};    //!< fd rules with explicit interest, changed since the loop last looked
+    std::vector<SlotKey> non_fd_walked {}; //!< non-fd rules with an interest function, or enabled, in the order run
+
+    void set_enabled( SlotKey key, bool fd_rule, bool enabled );
+    void cancel( SlotKey key, bool fd_rule );
+  };
+
   std::vector<RuleCategory> _rule_categories {};
-  std::list<std::shared_ptr<FDRule>> _fd_rules {};
-  std::list<std::shared_ptr<BasicRule>> _non_fd_rules {};
+  std::shared_ptr<Rules> _rules;
+
+  //! What became of an fd rule after looking at its poll result
+  enum class FDOutcome : uint8_t
+  {
+    Idle,     //!< nothing to do
+    Served,   //!< the callback ran
+    Cancelled //!< the rule was cancelled (after calling its cancel callback) and should be removed
+  };
+
+  //! The fd's rules in the epoll set (any number, in either Direction), and the events they currently ask for.
+  struct EpollRegistration
+  {
+    std::vector<FDRule*> rules {};
+    uint32_t events {};
+  };
+
+  Backend _backend;
+  std::vector<pollfd> _pollfds {};        //!< (poll) the fds polled in this iteration
+  std::vector<SlotKey> _polled_rules {};  //!< (poll) the rule that asked for each of them
+  std::vector<SlotKey> _changed_rules {}; //!< the fd rules taken from Rules::fd_changed, being looked at
+  size_t _explicit_interested {};         //!< (epoll, io_uring) explicit-interest fd rules the kernel watches
+  size_t _always_ready_rules {};          //!< (epoll) rules whose fd can't be polled
+  std::optional<FileDescriptor> _epoll_fd {};
+  std::unordered_map<int, EpollRegistration> _epoll_registrations {};
+  std::vector<epoll_event> _epoll_events {};
+  std::vector<FDRule*> _epoll_serving {}; //!< (epoll) the rules of the fd being served, copied from its registration
+
+  struct UringState; //!< the ring, the registered buffers and the operations in flight
+  std::unique_ptr<UringState> _uring;
+
+  //! A coroutine suspended until an fd is ready. The waiter (and its rule) lasts as long as
+  //! coroutines keep awaiting the fd in that direction, so a read loop doesn't churn registrations.
+  struct FDWaiter
+  {
+    int fd_num;
+    Direction direction;
+    SlotKey rule {};
+    std::coroutine_handle<> handle {};
+    bool* ready {}; //!< where to put the result of the wait
+  };
+
+  SlotMap<FDWaiter> _fd_waiters {};
+  std::vector<std::array<SlotKey, 2>> _fd_waiter_keys {}; //!< by fd number and Direction
+  std::optional<size_t> _coroutine_category {};
+
+  MPSCQueue<CallbackT> _posted {};               //!< tasks from post(), not yet taken by the loop
+  MPSCQueue<CallbackT>::Batch _posted_batch {}; //!< tasks taken, not yet run
+  FileDescriptor _post_wakeup;                   //!< an eventfd, written by post() to wake the loop
+  std::atomic<uint64_t> _post_wakeups {};
+
+  uint64_t _kernel_calls {};
+
+  TimerWheel _timers {};
+
+  Dispatch _dispatch { Dispatch::OneRule };
+  unsigned _max_calls_per_rule { 1 };
+
+  Trigger _trigger { Trigger::Level };
+  unsigned _drain_budget { 16 };
+  std::vector<SlotKey> _edge_ready {};      //!< rules whose fds are still ready, though the kernel won't say so
+  std::vector<SlotKey> _edge_ready_taken {}; //!< the rules taken from _edge_ready, being served
+
+  Clock::duration _spin_budget {};                 //!< (busy poll) how long to spin before blocking
+  std::chrono::microseconds _socket_busy_poll {}; //!< (busy poll) SO_BUSY_POLL for the rules' sockets
+  BusyPollStats _busy_poll_stats {};
+
+  //! A ready fd rule, waiting to be served by priority class (see EventLoop::set_priority).
+  struct ReadyRule
+  {
+    SlotKey key;
+    int16_t events;
+    int16_t revents;
+  };
+
+  bool _prioritized {}; //!< ready fd rules are served by priority class, not in the order found
+  std::array<ClassPolicy, kPriorityClasses> _class_policies { { { 4, {}, 0 }, { 2, {}, 0 }, { 1, {}, 0 } } };
+  std::array<std::vector<ReadyRule>, kPriorityClasses> _class_ready {}; //!< the ready rules, by class
+  std::array<SlotKey, kPriorityClasses> _class_resume {}; //!< the first rule each class left over, to start with
+  size_t _round_robin_class {};                           //!< the class whose turn it is
+  unsigned _round_robin_served {};                        //!< rules it has served this turn
+
+  uint32_t _wait_trace_name;     //!< the Tracer's name for waits in the kernel
+  uint32_t _dispatch_trace_name; //!< ... for calls to wait_next_event
+  uint32_t _timers_trace_name;   //!< ... for running the timers that came due
+
+  Clock::duration _stall_budget {};
+  std::unique_ptr<StallWatchdog> _stall_watchdog {}; //!< (when sampling backtraces)
+  std::deque<Stall> _recent_stalls {};
+  std::function<void( const Stall& )> _stall_handler {};
+
+  bool _stats_enabled {};
+  Clock::duration _poll_wait_time {};
+  Clock::duration _stats_dump_interval {};
+  Clock::time_point _next_stats_dump {};
+  std::ostream* _stats_dump_output {};
 
 public:
-  EventLoop() { _rule_categories.reserve( 64 ); }
+  explicit EventLoop( Backend backend = Backend::Poll );
+  ~EventLoop();
+
+  EventLoop( const EventLoop& other ) = delete;
+  EventLoop& operator=( const EventLoop& other ) = delete;
+  EventLoop( EventLoop&& other ) = delete;
+  EventLoop& operator=( EventLoop&& other ) = delete;
 
   //! Returned by each call to EventLoop::wait_next_event.
   enum class Result : uint8_t
@@ -71,37 +330,319 @@ public:
 
   class RuleHandle
   {
-    std::weak_ptr<BasicRule> rule_weak_ptr_;
+    std::weak_ptr<Rules> rules_;
+    SlotKey key_;
+    bool fd_rule_;
 
   public:
-    template<class RuleType>
-    explicit RuleHandle( const std::shared_ptr<RuleType> x ) : rule_weak_ptr_( x )
+    RuleHandle( const std::shared_ptr<Rules>& rules, SlotKey key, bool fd_rule )
+      : rules_( rules ), key_( key ), fd_rule_( fd_rule )
     {}
 
     void cancel();
+
+    //! Start (or stop) a rule added with explicit Interest from being served. Cheap: the loop looks
+    //! at the rule once, on its next iteration, and not again until the next change.
+    void enable() { set_enabled( true ); }
+    void disable() { set_enabled( false ); }
+    void set_enabled( bool enabled );
   };
 
   RuleHandle add_rule(
     size_t category_id,
     FileDescriptor& fd,
     Direction direction,
-    const CallbackT& callback,
-    const InterestT& interest = [] { return true; },
-    const CallbackT& cancel = [] {},
-    const CallbackT& error = [] {} );
+    CallbackT callback,
+    InterestT interest = [] { return true; },
+    CallbackT cancel = [] {},
+    CallbackT error = [] {} );
+
+  RuleHandle add_rule( size_t category_id, CallbackT callback, InterestT interest = [] { return true; } );
+
+  //! Add a rule whose interest is set through its RuleHandle (see EventLoop::Interest). A non-fd rule's
+  //! callback runs on every iteration while it is enabled.
+  RuleHandle add_rule( size_t category_id,
+                       FileDescriptor& fd,
+                       Direction direction,
+                       CallbackT callback,
+                       Interest interest,
+                       CallbackT cancel = [] {},
+                       CallbackT error = [] {} );
+
+  RuleHandle add_rule( size_t category_id, CallbackT callback, Interest interest );
+
+  //! Call `callback` with each signal that `signals` reads, from an fd rule served like any other: a
+  //! SIGTERM that starts a graceful drain, or a SIGHUP that reloads, needs no signal handler or self-pipe,
+  //! and costs the loop nothing until it comes. The rule keeps the loop from exiting until cancelled.
+  RuleHandle add_signal_rule( size_t category_id, SignalFD& signals, SignalCallbackT callback );
+
+  //! Once `child` exits, reap it and call `callback` with its status (see PidFD::try_wait). The rule then
+  //! ends (leaving `child` open), after keeping the loop from exiting while the child ran.
+  RuleHandle add_child_rule( size_t category_id, PidFD& child, ChildCallbackT callback );
+
+  //! Identifies a timer armed with add_timer.
+  class TimerHandle
+  {
+    TimerWheel* wheel_;
+    TimerWheel::TimerId id_;
+
+  public:
+    TimerHandle( TimerWheel& wheel, TimerWheel::TimerId id ) : wheel_( &wheel ), id_( id ) {}
+
+    //! Disarm the timer (if it hasn't fired). The EventLoop must still exist.
+    void cancel();
+
+    TimerHandle( const TimerHandle& other ) = default;
+    TimerHandle& operator=( const TimerHandle& other ) = default;
+    TimerHandle( TimerHandle&& other ) = default;
+    TimerHandle& operator=( TimerHandle&& other ) = default;
+    ~TimerHandle() = default;
+  };
+
+  //! Run `callback` once, from the first wait_next_event after `deadline` (to the millisecond).
+  //! Arming and cancelling a timer take constant time, and the loop never blocks past the
+  //! next deadline.
+  TimerHandle add_timer( TimerWheel::Clock::time_point deadline, CallbackT callback );
+
+  //! The number of timers armed.
+  size_t timers_pending() const { return _timers.size(); }
+
+  //! Run `task` on the loop's thread, from a later wait_next_event. Unlike everything else here, this
+  //! may be called from any thread: tasks go on a lock-free queue, and an eventfd wakes the loop if it
+  //! is waiting in the kernel. The loop runs everything posted so far in one batch, oldest first, and
+  //! only the first post() after a batch is taken writes the eventfd.
+  //! \note Tasks waiting to run keep the loop from returning Result::Exit, but the ability to post doesn't:
+  //! a task posted after the loop has exited never runs.
+  void post( CallbackT task );
+
+  //! The number of times post() has written the eventfd to wake the loop.
+  uint64_t post_wakeups() const { return _post_wakeups.load( std::memory_order_relaxed ); }
+
+  //! What a coroutine awaits to wait for an fd: `co_await loop.readable( fd )`. Resumes, straight
+  //! from the loop's dispatch, with true once the fd is ready, or with false if it never will be
+  //! (EOF, hangup or error).
+  class FDAwaiter
+  {
+    EventLoop* loop_;
+    FileDescriptor* fd_;
+    Direction direction_;
+    bool ready_ {};
+
+  public:
+    //! With no loop, the awaiter uses the loop of the Task awaiting it (see EventLoop::spawn).
+    FDAwaiter( EventLoop* loop, FileDescriptor& fd, Direction direction )
+      : loop_( loop ), fd_( &fd ), direction_( direction )
+    {}
+
+    bool await_ready() const noexcept { return false; }
+
+    template<typename Promise>
+    void await_suspend( std::coroutine_handle<Promise> handle )
+    {
+      if constexpr ( std::is_base_of_v<task_detail::PromiseBase, Promise> ) {
+        if ( not loop_ ) {
+          loop_ = handle.promise().loop;
+        }
+      }
+      if ( not loop_ ) {
+        throw std::runtime_error( "EventLoop: awaiting an fd outside a spawned Task" );
+      }
+      loop_->await_fd( *fd_, direction_, handle, ready_ );
+    }
+
+    bool await_resume() const noexcept { return ready_; }
+
+    FDAwaiter( const FDAwaiter& other ) = default;
+    FDAwaiter& operator=( const FDAwaiter& other ) = default;
+    FDAwaiter( FDAwaiter&& other ) = default;
+    FDAwaiter& operator=( FDAwaiter&& other ) = default;
+    ~FDAwaiter() = default;
+  };
+
+  //! What a coroutine awaits to sleep: `co_await loop.sleep( 10ms )` (see add_timer).
+  class SleepAwaiter
+  {
+    EventLoop* loop_;
+    Clock::duration duration_;
+
+  public:
+    SleepAwaiter( EventLoop& loop, Clock::duration duration ) : loop_( &loop ), duration_( duration ) {}
+
+    bool await_ready() const noexcept { return duration_ <= Clock::duration::zero(); }
+    void await_suspend( std::coroutine_handle<> handle )
+    {
+      loop_->add_timer( Clock::now() + duration_, [handle] { handle.resume(); } );
+    }
+    void await_resume() const noexcept {}
+
+    SleepAwaiter( const SleepAwaiter& other ) = default;
+    SleepAwaiter& operator=( const SleepAwaiter& other ) = default;
+    SleepAwaiter( SleepAwaiter&& other ) = default;
+    SleepAwaiter& operator=( SleepAwaiter&& other ) = default;
+    ~SleepAwaiter() = default;
+  };
 
-  RuleHandle
-  add_rule( size_t category_id, const CallbackT& callback, const InterestT& interest = [] { return true; } );
+  FDAwaiter readable( FileDescriptor& fd ) { return { this, fd, Direction::In }; }
+  FDAwaiter writable( FileDescriptor& fd ) { return { this, fd, Direction::Out }; }
+  SleepAwaiter sleep( Clock::duration duration ) { return { *this, duration }; }
 
-  //! Calls [poll(2)](\ref man2::poll) and then executes callback for each ready fd.
+  //! Start `task` now, and let it run on this loop until it finishes (it frees itself). Tasks it
+  //! awaits run on this loop too. An exception that escapes the task is rethrown from a later
+  //! wait_next_event.
+  void spawn( Task<> task );
+
+  //! Waits for the rules' fds (with the loop's Backend) and then executes the callback of a ready
+  //! rule (or of every ready rule, with Dispatch::Batch). Timers that have come due are run first.
   Result wait_next_event( int timeout_ms );
 
+  Backend backend() const { return _backend; }
+
+  //! Choose between serving one ready rule per wait_next_event (the default) and serving every
+  //! ready rule in one pass. In a batch, no rule is served more than `max_calls_per_rule` times,
+  //! so one busy rule cannot hold up the rest.
+  void set_dispatch( Dispatch dispatch, unsigned max_calls_per_rule = 1 );
+  Dispatch dispatch() const { return _dispatch; }
+
+  //! Choose between level-triggered waits (the default) and edge-triggered ones (EPOLLET, or
+  //! multishot poll requests with io_uring), which save a wait (and a wake-up) for each read of
+  //! a busy fd. An edge-triggered rule is served until its callback stops making progress: a read
+  //! or write that would block (EAGAIN) doesn't count as one, so the callback must keep reading or
+  //! writing for as long as it is interested. After `drain_budget` calls in a row, a rule that
+  //! could go on is left for the next iteration, so that one busy fd cannot hold up the rest.
+  //! \note Throws with the poll backend. Coroutines awaiting an fd may be resumed once more at the
+  //! end of a drain, and find it not ready after all.
+  void set_trigger( Trigger trigger, unsigned drain_budget = 16 );
+  Trigger trigger() const { return _trigger; }
+
+  //! Spin before blocking, for latency-critical fds: while waiting for fds, check them without
+  //! blocking, over and over, for up to `spin_budget`, and only then block in the kernel for the rest
+  //! of the timeout. This saves the wake-up latency of a blocking wait (tens of microseconds) at the
+  //! cost of a busy CPU. A nonzero `socket_busy_poll` also sets SO_BUSY_POLL on the rules' sockets, so
+  //! the kernel polls the device queue for that long on a read that would block. A zero budget (the
+  //! default) never spins.
+  //! \note Raising SO_BUSY_POLL above net.core.busy_read needs CAP_NET_ADMIN.
+  void set_busy_poll( Clock::duration spin_budget,
+                      std::chrono::microseconds socket_busy_poll = std::chrono::microseconds::zero() );
+  Clock::duration busy_poll_budget() const { return _spin_budget; }
+
+  //! How long busy-poll waits spent spinning and sleeping (reset by reset_stats).
+  const BusyPollStats& busy_poll_stats() const { return _busy_poll_stats; }
+
+  //! Put a category's fd rules in a priority class. Once any category has a class other than Normal
+  //! (or any class has a policy set), the ready fd rules found by each wait are served by weighted
+  //! round-robin between the classes, rather than in the order the kernel lists them: each turn, a
+  //! class serves up to its weight in ready rules, Latency first. A class that has spent its time
+  //! or byte budget for the iteration leaves its other ready rules for the next one, so an
+  //! always-ready bulk rule can't hold up the rest for long. The turn carries over from one
+  //! wait_next_event to the next, so with Dispatch::OneRule the classes also take turns.
+  void set_priority( size_t category_id, Priority priority );
+  Priority priority( size_t category_id ) const { return _rule_categories.at( category_id ).priority; }
+
+  //! Set a priority class's weight and budgets (by default, weights of 4, 2 and 1 and no budgets).
+  void set_class_policy( Priority priority, const ClassPolicy& policy );
+  const ClassPolicy& class_policy( Priority priority ) const
+  {
+    return _class_policies.at( static_cast<size_t>( priority ) );
+  }
+
+  //! Queue a read from (or a write to) `fd`; the completion runs from a later wait_next_event.
+  //! Reads go into buffers registered with the kernel, and writes are copied into one when it
+  //! fits. Everything queued in one iteration is submitted with a single system call.
+  //! \details Requires the io_uring backend. Usually called through FileDescriptor::async_read/async_write.
+  void submit_read( const FileDescriptor& fd, CompletionT completion );
+  void submit_write( const FileDescriptor& fd, std::string data, CompletionT completion );
+
+  //! The number of system calls the loop has made to wait for events
+  //! (poll, epoll_ctl and epoll_wait, or io_uring_enter).
+  uint64_t kernel_calls() const { return _kernel_calls; }
+
+  //! Start (or stop) timing every callback, interest evaluation and wait in the kernel, per
+  //! category. While disabled, the loop reads no clocks for them.
+  void enable_stats( bool enable = true ) { _stats_enabled = enable; }
+  bool stats_enabled() const { return _stats_enabled; }
+
+  const CategoryStats& category_stats( size_t category_id ) const { return _rule_categories.at( category_id ).stats; }
+  const std::string& category_name( size_t category_id ) const { return _rule_categories.at( category_id ).name; }
+  size_t category_count() const { return _rule_categories.size(); }
+
+  //! Watch for stalls: time every rule callback (with the vDSO clock, so no system calls), and record
+  //! those that run over `budget` (see recent_stalls, on_stall and CategoryStats::stalls). One slow
+  //! callback holds up every other rule of the loop. With `sample_backtraces`, a StallWatchdog thread
+  //! also samples the stack of a callback while it is over budget. A zero budget stops watching.
+  void set_stall_budget( Clock::duration budget, bool sample_backtraces = false );
+  Clock::duration stall_budget() const { return _stall_budget; }
+
+  //! Call `handler` (on the loop's thread) after each callback that ran over the stall budget, e.g. to alert.
+  void on_stall( std::function<void( const Stall& )> handler ) { _stall_handler = std::move( handler ); }
+
+  //! The last few stalls, oldest first.
+  const std::deque<Stall>& recent_stalls() const { return _recent_stalls; }
+
+  //! (While a Tracer is writing a trace, the loop also records each call to wait_next_event, each wait in
+  //! the kernel and each callback, named after its category, to the trace.)
+
+  //! Total time spent blocked in the kernel waiting for events (while stats were enabled).
+  Clock::duration poll_wait_time() const { return _poll_wait_time; }
+
+  void reset_stats();
+
+  //! Write a table of the categories' stats, busiest first.
+  void dump_stats( std::ostream& out ) const;
+
+  //! Also dump the stats to `out` every `interval` (checked on each wait_next_event, so an idle loop
+  //! dumps when it next wakes). A zero interval stops the dumps. Enables stats.
+  void dump_stats_every( Clock::duration interval, std::ostream& out );
+
   // convenience function to add category and rule at the same time
   template<typename... Targs>
   auto add_rule( const std::string& name, Targs&&... Fargs )
   {
     return add_rule( add_category( name ), std::forward<Targs>( Fargs )... );
   }
+
+private:
+  bool check_interest( BasicRule& rule );
+  void run_callback( BasicRule& rule );
+  Clock::time_point wait_started() const
+  {
+    return _stats_enabled or Tracer::enabled() ? Clock::now() : Clock::time_point {};
+  }
+  void wait_finished( Clock::time_point started );
+  void not_serviced( const BasicRule& rule );
+  void run_posted();
+  size_t expire_timers();
+  void check_stall( const BasicRule& rule, Clock::time_point start, Clock::time_point end );
+  bool keeps_loop_alive( const FDRule& rule ) const;
+  void await_fd( FileDescriptor& fd, Direction direction, std::coroutine_handle<> handle, bool& ready );
+  void resume_fd_waiter( SlotKey key, bool ready );
+  void release_fd_waiter( SlotKey key );
+
+  SlotKey add_fd_rule( FDRule&& rule );
+  SlotKey add_non_fd_rule( BasicRule&& rule );
+  bool take_changed_rules();
+  static bool interested_now( const FDRule& rule );
+  bool counts_as_interested( const FDRule& rule ) const;
+  bool epoll_sync( FDRule& rule, SlotKey key );
+  void queue_changed( FDRule& rule );
+  void drain_fd_rule( FDRule& rule );
+  void defer_edge_ready( FDRule& rule );
+  bool serve_edge_ready();
+
+  FDOutcome service_fd_rule( FDRule& rule, int16_t events, int16_t revents );
+  FDOutcome serve_ready_rule( FDRule& rule, int16_t events, int16_t revents );
+  void queue_ready( const FDRule& rule, int16_t events, int16_t revents );
+  bool ready_queued() const;
+  bool serve_prioritized();
+  Result wait_fds( int timeout_ms );
+  Result busy_wait_fds( int timeout_ms );
+  void set_socket_busy_poll( const FDRule& rule ) const;
+  Result wait_poll( int timeout_ms );
+  Result wait_epoll( int timeout_ms );
+  void epoll_register( FDRule& rule );
+  void epoll_unregister( FDRule& rule );
+  Result wait_uring( int timeout_ms );
+  void uring_track( FDRule& rule );
+  void uring_untrack( const FDRule& rule );
 };
 
 using Direction = EventLoop::Direction;
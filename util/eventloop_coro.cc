@@ -0,0 +1,90 @@
+#include "eventloop.hh"
+
+using namespace std;
+
+void EventLoop::spawn( Task<> task )
+{
+  const auto handle = task.release();
+  handle.promise().loop = this;
+  handle.promise().detached = true;
+  handle.resume();
+}
+
+void EventLoop::await_fd( FileDescriptor& fd, Direction direction, coroutine_handle<> handle, bool& ready )
+{
+  const auto fd_num = static_cast<size_t>( fd.fd_num() );
+  if ( fd_num >= _fd_waiter_keys.size() ) {
+    _fd_waiter_keys.resize( fd_num + 1 );
+  }
+  SlotKey& key = _fd_waiter_keys[fd_num].at( static_cast<size_t>( direction ) );
+
+  FDWaiter* waiter = _fd_waiters.find( key );
+  if ( waiter and waiter->handle ) {
+    throw runtime_error( "EventLoop: two coroutines awaiting the same fd and direction" );
+  }
+
+  if ( not waiter ) {
+    if ( not _coroutine_category ) {
+      _coroutine_category = add_category( "coroutines" );
+    }
+
+    key = _fd_waiters.emplace( fd.fd_num(), direction );
+    waiter = _fd_waiters.find( key );
+    const SlotKey waiter_key = key;
+    BasicRule base {
+      *_coroutine_category, Interest::Enabled, [this, waiter_key] { resume_fd_waiter( waiter_key, true ); } };
+    waiter->rule = add_fd_rule( FDRule {
+      move( base ),
+      fd.duplicate(),
+      direction,
+      [this, waiter_key] { resume_fd_waiter( waiter_key, false ); }, // EOF or hangup
+      [] {} } );
+  } else {
+    _rules->set_enabled( waiter->rule, true, true );
+  }
+
+  waiter->handle = handle;
+  waiter->ready = &ready;
+}
+
+void EventLoop::resume_fd_waiter( const SlotKey key, const bool ready )
+{
+  FDWaiter* waiter = _fd_waiters.find( key );
+  if ( not waiter or not waiter->handle ) {
+    return;
+  }
+
+  *waiter->ready = ready;
+  const auto handle = exchange( waiter->handle, {} );
+  if ( not ready ) {
+    // the loop is retiring the rule
+    release_fd_waiter( key );
+    handle.resume();
+    return;
+  }
+
+  // between waits, the rule is disabled (but kept, in case the coroutine waits on the fd again)
+  _rules->set_enabled( waiter->rule, true, false );
+  handle.resume();
+
+  // if nothing waits on the fd any more, retire the rule, so that it doesn't hold the fd open
+  waiter = _fd_waiters.find( key );
+  if ( waiter and not waiter->handle ) {
+    _rules->cancel( waiter->rule, true );
+    release_fd_waiter( key );
+  }
+}
+
+void EventLoop::release_fd_waiter( const SlotKey key )
+{
+  const FDWaiter* waiter = _fd_waiters.find( key );
+  if ( not waiter ) {
+    return;
+  }
+
+  SlotKey& indexed = _fd_waiter_keys.at( waiter->fd_num ).at( static_cast<size_t>( waiter->direction ) );
+  if ( indexed.index == key.index and indexed.generation == key.generation ) {
+    indexed = {};
+  }
+  _fd_waiters.erase( key );
+}
@@ -0,0 +1,208 @@
+#include "eventloop_group.hh"
+
+#include "exception.hh"
+
+#include <iomanip>
+#include <ostream>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// the CPUs this process may run on
+vector<int> allowed_cpus()
+{
+  cpu_set_t set;
+  CPU_ZERO( &set );
+  CheckSystemCall( "sched_getaffinity", sched_getaffinity( 0, sizeof( set ), &set ) );
+
+  vector<int> cpus;
+  for ( int cpu = 0; cpu < CPU_SETSIZE; ++cpu ) {
+    if ( CPU_ISSET( cpu, &set ) ) {
+      cpus.push_back( cpu );
+    }
+  }
+  return cpus;
+}
+
+} // namespace
+
+EventLoopGroup::Shard::Shard( EventLoop::Backend backend, int s_cpu )
+  : loop( backend )
+  , wakeup( CheckSystemCall( "eventfd", eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) ) // NOLINT(*-signed-bitwise)
+  , cpu( s_cpu )
+{}
+
+EventLoopGroup::EventLoopGroup( size_t loops, EventLoop::Backend backend, bool pin_threads )
+{
+  const vector<int> cpus = allowed_cpus();
+  if ( loops == 0 ) {
+    loops = max( cpus.size(), size_t { 1 } );
+  }
+
+  for ( size_t i = 0; i < loops; ++i ) {
+    const int cpu = ( pin_threads and not cpus.empty() ) ? cpus.at( i % cpus.size() ) : -1;
+    auto& shard = *_shards.emplace_back( make_unique<Shard>( backend, cpu ) );
+
+    // the wake-up rule just drains the eventfd; the thread checks _stopping after every iteration
+    shard.loop.add_rule( "group wake-up", shard.wakeup, Direction::In, [&shard] {
+      string buffer;
+      shard.wakeup.read( buffer );
+    } );
+  }
+}
+
+EventLoopGroup::~EventLoopGroup()
+{
+  stop();
+  for ( auto& shard : _shards ) {
+    if ( shard->thread.joinable() ) {
+      shard->thread.join();
+    }
+  }
+}
+
+Address EventLoopGroup::listen( const Address& address, AcceptT on_accept, int backlog )
+{
+  auto handler = make_shared<AcceptT>( move( on_accept ) );
+
+  optional<Address> bound;
+  for ( auto& shard_ptr : _shards ) {
+    Shard& shard = *shard_ptr;
+    auto listener = make_shared<TCPSocket>();
+    listener->set_reuseaddr();
+    listener->set_reuseport();
+    // with port 0, the first socket picks the port and the rest join it
+    listener->bind( bound.value_or( address ) );
+    listener->listen( backlog );
+    listener->set_blocking( false );
+    if ( not bound ) {
+      bound = listener->local_address();
+    }
+
+    shard.loop.add_rule( "group accept", *listener, Direction::In, [&shard, listener, handler] {
+      auto connection = listener->try_accept();
+      if ( connection ) {
+        shard.connections.fetch_add( 1, memory_order_relaxed );
+        ( *handler )( shard.loop, move( *connection ) );
+      }
+    } );
+  }
+
+  return bound.value();
+}
+
+void EventLoopGroup::start()
+{
+  for ( auto& shard : _shards ) {
+    if ( shard->thread.joinable() ) {
+      throw runtime_error( "EventLoopGroup: already started" );
+    }
+    shard->thread = thread( [this, &shard = *shard] { run( shard ); } );
+  }
+}
+
+void EventLoopGroup::stop()
+{
+  _stopping.store( true );
+  for ( const auto& shard : _shards ) {
+    const uint64_t one = 1;
+    CheckSystemCall( "write", ::write( shard->wakeup.fd_num(), &one, sizeof( one ) ) );
+  }
+}
+
+void EventLoopGroup::join()
+{
+  for ( auto& shard : _shards ) {
+    if ( shard->thread.joinable() ) {
+      shard->thread.join();
+    }
+  }
+
+  const scoped_lock lock { _exception_mutex };
+  if ( _exception ) {
+    rethrow_exception( exchange( _exception, nullptr ) );
+  }
+}
+
+void EventLoopGroup::run( Shard& shard )
+{
+  {
+    const scoped_lock lock { shard.thread_mutex };
+    if ( shard.cpu >= 0 ) {
+      cpu_set_t set;
+      CPU_ZERO( &set );
+      CPU_SET( shard.cpu, &set );
+      // a restricted cpuset can refuse the pin; the loop then runs wherever the scheduler puts it
+      if ( pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) != 0 ) {
+        shard.cpu = -1;
+      }
+    }
+    pthread_getcpuclockid( pthread_self(), &shard.cpu_clock );
+    shard.running = true;
+  }
+
+  try {
+    while ( not _stopping.load( memory_order_relaxed ) ) {
+      const auto result = shard.loop.wait_next_event( -1 );
+      if ( result == EventLoop::Result::Exit ) {
+        break;
+      }
+      if ( result == EventLoop::Result::Success ) {
+        shard.events.fetch_add( 1, memory_order_relaxed );
+      }
+    }
+  } catch ( ... ) {
+    {
+      const scoped_lock lock { _exception_mutex };
+      if ( not _exception ) {
+        _exception = current_exception();
+      }
+    }
+    stop();
+  }
+
+  timespec used {};
+  clock_gettime( CLOCK_THREAD_CPUTIME_ID, &used );
+  const scoped_lock lock { shard.thread_mutex };
+  shard.cpu_time = chrono::seconds { used.tv_sec } + chrono::nanoseconds { used.tv_nsec };
+  shard.running = false;
+}
+
+vector<EventLoopGroup::LoopLoad> EventLoopGroup::load() const
+{
+  vector<LoopLoad> loads;
+  for ( const auto& shard : _shards ) {
+    LoopLoad& load = loads.emplace_back();
+    load.connections = shard->connections.load( memory_order_relaxed );
+    load.events = shard->events.load( memory_order_relaxed );
+
+    const scoped_lock lock { shard->thread_mutex };
+    load.cpu = shard->cpu;
+    load.cpu_time = shard->cpu_time;
+    timespec used {};
+    if ( shard->running and clock_gettime( shard->cpu_clock, &used ) == 0 ) {
+      load.cpu_time = chrono::seconds { used.tv_sec } + chrono::nanoseconds { used.tv_nsec };
+    }
+  }
+  return loads;
+}
+
+void EventLoopGroup::dump_load( ostream& out ) const
+{
+  out << setw( 6 ) << "loop" << setw( 6 ) << "cpu" << setw( 14 ) << "connections" << setw( 14 ) << "events"
+      << setw( 14 ) << "cpu ms" << "\n";
+
+  const auto loads = load();
+  for ( size_t i = 0; i < loads.size(); ++i ) {
+    out << setw( 6 ) << i << setw( 6 ) << loads[i].cpu << setw( 14 ) << loads[i].connections << setw( 14 )
+        << loads[i].events << setw( 14 ) << chrono::duration_cast<chrono::milliseconds>( loads[i].cpu_time ).count()
+        << "\n";
+  }
+}
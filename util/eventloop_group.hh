@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "address.hh"
+#include "eventloop.hh"
+#include "socket.hh"
+
+//! Runs one EventLoop per thread, each thread pinned to its own CPU.
+//! \details A listening address is sharded between the loops (see EventLoopGroup::listen): every
+//! loop has its own listening socket, and the kernel spreads incoming connections between them, so
+//! there is no shared accept queue or lock. A connection stays on the loop that accepted it.
+class EventLoopGroup
+{
+public:
+  //! Called on the accepting loop's thread with each new connection.
+  using AcceptT = std::function<void( EventLoop& loop, TCPSocket connection )>;
+
+  //! One loop's share of the work so far.
+  struct LoopLoad
+  {
+    int cpu {};                           //!< the CPU the loop's thread is pinned to (-1 if not pinned)
+    uint64_t connections {};              //!< connections accepted
+    uint64_t events {};                   //!< calls to wait_next_event that ran a rule or a timer
+    std::chrono::nanoseconds cpu_time {}; //!< CPU time used by the loop's thread
+  };
+
+  //! \param[in] loops is the number of loops (by default, one per CPU the process may run on)
+  //! \param[in] pin_threads is whether to pin each loop's thread to a CPU (round-robin over those allowed)
+  explicit EventLoopGroup( size_t loops = 0,
+                           EventLoop::Backend backend = EventLoop::Backend::Epoll,
+                           bool pin_threads = true );
+
+  //! Stops the loops and waits for their threads.
+  ~EventLoopGroup();
+
+  EventLoopGroup( const EventLoopGroup& other ) = delete;
+  EventLoopGroup& operator=( const EventLoopGroup& other ) = delete;
+  EventLoopGroup( EventLoopGroup&& other ) = delete;
+  EventLoopGroup& operator=( EventLoopGroup&& other ) = delete;
+
+  size_t size() const { return _shards.size(); }
+
+  //! A loop of the group, e.g. to add rules before start() (once started, a loop may only be used from
+  //! its own thread, i.e. from its rules' callbacks).
+  EventLoop& loop( size_t index ) { return _shards.at( index )->loop; }
+
+  //! Listen on `address` from every loop, with one SO_REUSEPORT socket per loop, and call `on_accept`
+  //! with each connection. Call before start(). Returns the address listened on (useful with port 0).
+  Address listen( const Address& address, AcceptT on_accept, int backlog = 128 );
+
+  //! Start a thread for each loop. Each runs its loop until stop().
+  void start();
+
+  //! Ask every loop to stop after its current iteration. Safe to call from any thread.
+  void stop();
+
+  //! Wait for the threads to finish (after a stop()), rethrowing the first exception any of them threw.
+  void join();
+
+  //! The load on each loop. Safe to call from any thread.
+  std::vector<LoopLoad> load() const;
+
+  //! Write a table of the loops' load.
+  void dump_load( std::ostream& out ) const;
+
+private:
+  struct Shard
+  {
+    EventLoop loop;
+    FileDescriptor wakeup; //!< an eventfd, written to interrupt the loop's wait
+    int cpu { -1 };        //!< (guarded by thread_mutex once started)
+
+    std::atomic<uint64_t> connections {};
+    std::atomic<uint64_t> events {};
+
+    mutable std::mutex thread_mutex {};
+    std::thread thread {};
+    bool running {};                      //!< (guarded by thread_mutex) the thread is in its loop
+    clockid_t cpu_clock {};               //!< (guarded by thread_mutex) the thread's CPU-time clock
+    std::chrono::nanoseconds cpu_time {}; //!< (guarded by thread_mutex) CPU time used, once the thread is done
+
+    Shard( EventLoop::Backend backend, int s_cpu );
+  };
+
+  std::vector<std::unique_ptr<Shard>> _shards {};
+  std::atomic<bool> _stopping {};
+  std::mutex _exception_mutex {};
+  std::exception_ptr _exception {};
+
+  void run( Shard& shard );
+};
@@ -0,0 +1,201 @@
+#include "eventloop.hh"
+
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+#include <ostream>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+size_t histogram_bucket( EventLoop::Clock::duration elapsed )
+{
+  const auto ns = static_cast<uint64_t>( max<int64_t>( duration_cast<nanoseconds>( elapsed ).count(), 1 ) );
+  return min<size_t>( bit_width( ns ) - 1, EventLoop::CategoryStats::kHistogramBuckets - 1 );
+}
+
+double as_ms( EventLoop::Clock::duration elapsed )
+{
+  return duration_cast<duration<double, milli>>( elapsed ).count();
+}
+
+double as_us( EventLoop::Clock::duration elapsed )
+{
+  return duration_cast<duration<double, micro>>( elapsed ).count();
+}
+
+} // namespace
+
+EventLoop::Clock::duration EventLoop::CategoryStats::callback_quantile( const double p ) const
+{
+  if ( callbacks == 0 ) {
+    return {};
+  }
+
+  const auto rank = static_cast<uint64_t>( p * static_cast<double>( callbacks - 1 ) );
+  uint64_t seen = 0;
+  for ( size_t bucket = 0; bucket < kHistogramBuckets; ++bucket ) {
+    seen += callback_histogram.at( bucket );
+    if ( seen > rank ) {
+      return min<Clock::duration>( nanoseconds { uint64_t { 2 } << bucket }, max_callback_time );
+    }
+  }
+  return max_callback_time;
+}
+
+bool EventLoop::check_interest( BasicRule& rule )
+{
+  if ( rule.explicit_interest ) {
+    return rule.enabled;
+  }
+
+  if ( not _stats_enabled ) {
+    return rule.interest();
+  }
+
+  const auto start = Clock::now();
+  const bool result = rule.interest();
+  _rule_categories[rule.category_id].stats.interest_time += Clock::now() - start;
+  return result;
+}
+
+void EventLoop::run_callback( BasicRule& rule )
+{
+  if ( not _stats_enabled and not Tracer::enabled() and _stall_budget == Clock::duration::zero() ) {
+    rule.callback();
+    return;
+  }
+
+  const auto start = Clock::now();
+  if ( _stall_watchdog ) {
+    _stall_watchdog->callback_started( start );
+    try {
+      rule.callback();
+    } catch ( ... ) {
+      _stall_watchdog->callback_finished();
+      throw;
+    }
+  } else {
+    rule.callback();
+  }
+  const auto end = Clock::now();
+  const auto elapsed = end - start;
+
+  RuleCategory& category = _rule_categories[rule.category_id];
+  Tracer::record( Tracer::Kind::Callback, category.trace_name, start, end );
+  if ( _stall_budget > Clock::duration::zero() ) {
+    check_stall( rule, start, end );
+  }
+  if ( not _stats_enabled ) {
+    return;
+  }
+
+  CategoryStats& stats = category.stats;
+  ++stats.callbacks;
+  stats.callback_time += elapsed;
+  stats.max_callback_time = max( stats.max_callback_time, elapsed );
+  ++stats.callback_histogram.at( histogram_bucket( elapsed ) );
+}
+
+void EventLoop::set_stall_budget( const Clock::duration budget, const bool sample_backtraces )
+{
+  if ( budget < Clock::duration::zero() ) {
+    throw out_of_range( "EventLoop: negative stall budget" );
+  }
+  _stall_budget = budget;
+  _stall_watchdog.reset();
+  if ( sample_backtraces and budget > Clock::duration::zero() ) {
+    _stall_watchdog = make_unique<StallWatchdog>( budget );
+  }
+}
+
+// (after a callback, while watching for stalls) record it if it ran over budget
+void EventLoop::check_stall( const BasicRule& rule, const Clock::time_point start, const Clock::time_point end )
+{
+  vector<string> backtrace = _stall_watchdog ? _stall_watchdog->callback_finished() : vector<string> {};
+  if ( end - start <= _stall_budget ) {
+    return;
+  }
+
+  ++_rule_categories[rule.category_id].stats.stalls;
+  if ( _recent_stalls.size() == kRecentStalls ) {
+    _recent_stalls.pop_front();
+  }
+  _recent_stalls.push_back( { rule.category_id, start, end - start, move( backtrace ) } );
+  if ( _stall_handler ) {
+    _stall_handler( _recent_stalls.back() );
+  }
+}
+
+void EventLoop::wait_finished( const Clock::time_point started )
+{
+  if ( started == Clock::time_point {} ) {
+    return;
+  }
+
+  const auto now = Clock::now();
+  if ( _stats_enabled ) {
+    _poll_wait_time += now - started;
+  }
+  Tracer::record( Tracer::Kind::Wait, _wait_trace_name, started, now );
+}
+
+void EventLoop::not_serviced( const BasicRule& rule )
+{
+  if ( _stats_enabled ) {
+    ++_rule_categories[rule.category_id].stats.ready_not_serviced;
+  }
+}
+
+void EventLoop::reset_stats()
+{
+  for ( auto& category : _rule_categories ) {
+    category.stats = {};
+  }
+  _poll_wait_time = {};
+  _busy_poll_stats = {};
+}
+
+void EventLoop::dump_stats( ostream& out ) const
+{
+  vector<const RuleCategory*> categories;
+  for ( const auto& category : _rule_categories ) {
+    categories.push_back( &category );
+  }
+  ranges::stable_sort( categories, []( const RuleCategory* a, const RuleCategory* b ) {
+    return a->stats.callback_time + a->stats.interest_time > b->stats.callback_time + b->stats.interest_time;
+  } );
+
+  const auto flags = out.flags();
+  out << "EventLoop stats (" << fixed << setprecision( 3 ) << as_ms( _poll_wait_time )
+      << " ms waiting in the kernel";
+  if ( _spin_budget > Clock::duration::zero() ) {
+    out << "; busy poll spent " << as_ms( _busy_poll_stats.spin_time ) << " ms spinning and "
+        << as_ms( _busy_poll_stats.sleep_time ) << " ms sleeping";
+  }
+  out << "):\n";
+  out << "  " << left << setw( 32 ) << "category" << right << setw( 10 ) << "callbacks" << setw( 12 ) << "total ms"
+      << setw( 12 ) << "max us" << setw( 12 ) << "p50 us" << setw( 12 ) << "p99 us" << setw( 13 ) << "interest ms"
+      << setw( 14 ) << "not serviced" << setw( 8 ) << "stalls" << "\n";
+  for ( const RuleCategory* category : categories ) {
+    const CategoryStats& stats = category->stats;
+    out << "  " << left << setw( 32 ) << category->name.substr( 0, 31 ) << right << setw( 10 ) << stats.callbacks
+        << setw( 12 ) << as_ms( stats.callback_time ) << setw( 12 ) << as_us( stats.max_callback_time )
+        << setw( 12 ) << as_us( stats.callback_quantile( 0.5 ) ) << setw( 12 )
+        << as_us( stats.callback_quantile( 0.99 ) ) << setw( 13 ) << as_ms( stats.interest_time ) << setw( 14 )
+        << stats.ready_not_serviced << setw( 8 ) << stats.stalls << "\n";
+  }
+  out.flags( flags );
+}
+
+void EventLoop::dump_stats_every( const Clock::duration interval, ostream& out )
+{
+  _stats_dump_interval = interval;
+  _stats_dump_output = &out;
+  _next_stats_dump = Clock::now() + interval;
+  if ( interval > Clock::duration::zero() ) {
+    enable_stats();
+  }
+}
@@ -0,0 +1,406 @@
+#include "eventloop_uring.hh"
+
+#include "exception.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// NOLINTBEGIN(*-signed-bitwise)
+
+namespace {
+
+// gives a registered buffer (if any) back to the free list on leaving scope, including by an exception
+class BufferReturn
+{
+  vector<uint16_t>& free_buffers_;
+  int buffer_;
+
+public:
+  BufferReturn( vector<uint16_t>& free_buffers, const int buffer ) : free_buffers_( free_buffers ), buffer_( buffer )
+  {}
+
+  // (the free list has room for every buffer, so this doesn't allocate)
+  ~BufferReturn()
+  {
+    if ( buffer_ >= 0 ) {
+      free_buffers_.push_back( static_cast<uint16_t>( buffer_ ) );
+    }
+  }
+
+  BufferReturn( const BufferReturn& other ) = delete;
+  BufferReturn& operator=( const BufferReturn& other ) = delete;
+  BufferReturn( BufferReturn&& other ) = delete;
+  BufferReturn& operator=( BufferReturn&& other ) = delete;
+};
+
+} // namespace
+
+EventLoop::UringState::UringState()
+  : buffers( make_unique<char[]>( kBufferSize * kBufferCount ) ) // NOLINT(*-avoid-c-arrays)
+  , ring( kRingEntries )
+{
+  vector<iovec> iovecs;
+  for ( size_t i = 0; i < kBufferCount; ++i ) {
+    iovecs.push_back( { buffer( static_cast<int>( i ) ), kBufferSize } );
+    free_buffers.push_back( static_cast<uint16_t>( kBufferCount - 1 - i ) );
+  }
+
+  // without registration (e.g. over RLIMIT_MEMLOCK), the same buffers are used with plain reads and writes
+  buffers_registered = ring.register_buffers( iovecs );
+}
+
+uint32_t EventLoop::UringState::add_operation( Operation&& operation )
+{
+  if ( free_operations.empty() ) {
+    operations.push_back( move( operation ) );
+    return static_cast<uint32_t>( operations.size() - 1 );
+  }
+
+  const uint32_t index = free_operations.back();
+  free_operations.pop_back();
+  operations.at( index ) = move( operation );
+  return index;
+}
+
+EventLoop::UringState::Operation EventLoop::UringState::take_operation( uint32_t index )
+{
+  Operation operation = move( operations.at( index ) );
+  operations.at( index ) = {};
+  free_operations.push_back( index );
+  return operation;
+}
+
+void EventLoop::UringState::queue_poll( uint32_t index, int fd_num, uint32_t events, bool multishot )
+{
+  io_uring_sqe* sqe = ring.get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd_num;
+  sqe->poll32_events = events;
+  sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+  sqe->user_data = index;
+}
+
+// change the events of the rule's request in flight
+void EventLoop::UringState::update_poll( const FDRule& rule, uint32_t events, bool multishot )
+{
+  io_uring_sqe* sqe = ring.get_sqe();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->len = IORING_POLL_UPDATE_EVENTS | ( multishot ? IORING_POLL_ADD_MULTI : 0 ); // (or it becomes one-shot)
+  sqe->addr = rule.poll_operation;
+  sqe->poll32_events = events;
+  sqe->user_data = kIgnored;
+}
+
+// cancel the rule's request in flight (its completion comes with -ECANCELED)
+void EventLoop::UringState::remove_poll( FDRule& rule )
+{
+  if ( rule.registered and not rule.poll_removing ) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = rule.poll_operation;
+    sqe->user_data = kIgnored;
+    rule.poll_removing = true;
+  }
+}
+
+// queue a read or write; `after_poll` first waits for the fd to be ready (after an EAGAIN)
+void EventLoop::UringState::queue_io( uint32_t index, bool after_poll )
+{
+  const Operation& operation = operations.at( index );
+  const bool read = operation.kind == Operation::Kind::Read;
+  const int fd_num = operation.fd->fd_num();
+
+  if ( after_poll ) {
+    ring.reserve( 2 ); // (the poll and the read or write it is linked to go to the kernel together)
+    io_uring_sqe* poll = ring.get_sqe();
+    poll->opcode = IORING_OP_POLL_ADD;
+    poll->fd = fd_num;
+    poll->poll32_events = read ? POLLIN : POLLOUT;
+    poll->flags = IOSQE_IO_LINK;
+    poll->user_data = kIgnored;
+  }
+
+  io_uring_sqe* sqe = ring.get_sqe();
+  sqe->fd = fd_num;
+  sqe->off = UINT64_MAX; // the file's current position (ignored for sockets and pipes)
+  sqe->len = operation.length;
+  sqe->user_data = index;
+  if ( operation.buffer >= 0 ) {
+    sqe->addr = reinterpret_cast<uint64_t>( buffer( operation.buffer ) ); // NOLINT(*-reinterpret-cast)
+    if ( buffers_registered ) {
+      sqe->opcode = read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+      sqe->buf_index = static_cast<uint16_t>( operation.buffer );
+    } else {
+      sqe->opcode = read ? IORING_OP_READ : IORING_OP_WRITE;
+    }
+  } else {
+    sqe->opcode = read ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->addr = reinterpret_cast<uint64_t>( operation.owned->data() ); // NOLINT(*-reinterpret-cast)
+  }
+}
+
+void EventLoop::submit_read( const FileDescriptor& fd, CompletionT completion )
+{
+  if ( not _uring ) {
+    throw runtime_error( "EventLoop: async reads need the io_uring backend" );
+  }
+
+  UringState::Operation operation;
+  operation.kind = UringState::Operation::Kind::Read;
+  operation.fd.emplace( fd.duplicate() );
+  operation.completion = move( completion );
+  operation.length = UringState::kBufferSize;
+  if ( _uring->free_buffers.empty() ) {
+    operation.owned = make_unique<string>( UringState::kBufferSize, '\0' );
+  } else {
+    operation.buffer = _uring->free_buffers.back();
+    _uring->free_buffers.pop_back();
+  }
+
+  _uring->queue_io( _uring->add_operation( move( operation ) ), false );
+  ++_uring->io_in_flight;
+}
+
+void EventLoop::submit_write( const FileDescriptor& fd, string data, CompletionT completion )
+{
+  if ( not _uring ) {
+    throw runtime_error( "EventLoop: async writes need the io_uring backend" );
+  }
+
+  UringState::Operation operation;
+  operation.kind = UringState::Operation::Kind::Write;
+  operation.fd.emplace( fd.duplicate() );
+  operation.completion = move( completion );
+  operation.length = static_cast<uint32_t>( min<size_t>( data.size(), UINT32_MAX ) );
+  if ( data.size() <= UringState::kBufferSize and not _uring->free_buffers.empty() ) {
+    operation.buffer = _uring->free_buffers.back();
+    _uring->free_buffers.pop_back();
+    memcpy( _uring->buffer( operation.buffer ), data.data(), data.size() );
+  } else {
+    operation.owned = make_unique<string>( move( data ) );
+  }
+
+  _uring->queue_io( _uring->add_operation( move( operation ) ), false );
+  ++_uring->io_in_flight;
+}
+
+// index a new rule by its fd number. A rule whose fd was closed outside its callback isn't retired until
+// the loop looks at it again, and meanwhile its poll request holds the file open: once the number is
+// reused, cancel that request and retire the rule.
+void EventLoop::uring_track( FDRule& rule )
+{
+  auto& rules = _uring->rules_by_fd[rule.fd.fd_num()];
+  size_t kept = 0;
+  for ( FDRule* other : rules ) {
+    if ( other->fd.closed() ) {
+      _uring->remove_poll( *other );
+      queue_changed( *other );
+    } else {
+      rules[kept++] = other;
+    }
+  }
+  rules.resize( kept );
+  rules.push_back( &rule );
+}
+
+void EventLoop::uring_untrack( const FDRule& rule )
+{
+  const auto it = _uring->rules_by_fd.find( rule.fd.fd_num() );
+  if ( it == _uring->rules_by_fd.end() ) {
+    return;
+  }
+  if ( const auto found = ranges::find( it->second, &rule ); found != it->second.end() ) {
+    it->second.erase( found );
+  }
+  if ( it->second.empty() ) {
+    _uring->rules_by_fd.erase( it );
+  }
+}
+
+EventLoop::Result EventLoop::wait_uring( const int timeout_ms )
+{
+  const auto poll_events = []( const FDRule& rule ) -> uint32_t {
+    return interested_now( rule ) ? ( rule.direction == Direction::In ? POLLIN : POLLOUT ) : 0;
+  };
+
+  const bool multishot = _trigger == Trigger::Edge;
+
+  // retire the rule if it is finished, or else arm (or update) its poll request
+  // (returns whether the rule is still there)
+  const auto sync = [&]( FDRule& rule, const SlotKey key ) {
+    if ( rule.cancel_requested or ( rule.direction == Direction::In && rule.fd.eof() ) or rule.fd.closed() ) {
+      if ( not rule.cancel_requested ) {
+        rule.cancel();
+      }
+      _uring->remove_poll( rule );
+      _explicit_interested -= counts_as_interested( rule ) ? 1 : 0;
+      uring_untrack( rule );
+      _rules->fd.erase( key );
+      return false;
+    }
+
+    const bool interested = check_interest( rule );
+    _explicit_interested -= counts_as_interested( rule ) ? 1 : 0;
+    if ( not rule.registered ) {
+      rule.registered = true;
+      rule.registered_interest = interested;
+      rule.poll_removing = false;
+      rule.poll_operation = _uring->add_operation( { .kind = UringState::Operation::Kind::Poll, .rule = key } );
+      _uring->queue_poll( rule.poll_operation, rule.fd.fd_num(), poll_events( rule ), multishot );
+    } else if ( interested != rule.registered_interest ) {
+      rule.registered_interest = interested;
+      _uring->update_poll( rule, poll_events( rule ), multishot );
+    }
+    _explicit_interested += counts_as_interested( rule ) ? 1 : 0;
+    return true;
+  };
+
+  // A completion may turn out to need nothing from the caller (e.g. a poll request that went
+  // stale when its rule's interest changed); if that is all there was, go round again, waiting only
+  // for what is left of the timeout.
+  const auto deadline = Clock::now() + chrono::milliseconds { max( timeout_ms, 0 ) };
+  while ( true ) {
+    bool something_to_poll = false;
+
+    // retire finished rules, and arm (or update) the poll requests: for every rule with an interest
+    // function, and for the explicit-interest rules that changed
+    auto& fd_rules = _rules->fd;
+    auto& walked = _rules->fd_walked;
+    size_t kept = 0;
+    for ( size_t i = 0; i < walked.size(); ++i ) {
+      const SlotKey key = walked[i];
+      FDRule* rule = fd_rules.find( key );
+      if ( rule and sync( *rule, key ) ) {
+        walked[kept++] = key;
+        something_to_poll |= rule->registered_interest and keeps_loop_alive( *rule );
+      }
+    }
+    walked.resize( kept );
+
+    while ( take_changed_rules() ) {
+      for ( const SlotKey key : _changed_rules ) {
+        if ( FDRule* rule = fd_rules.find( key ) ) {
+          sync( *rule, key );
+        }
+      }
+    }
+    something_to_poll |= _explicit_interested > 0;
+
+    // quit if there is nothing left to poll, or to complete
+    if ( not something_to_poll and _uring->io_in_flight == 0 ) {
+      return Result::Exit;
+    }
+
+    // (edge-triggered) serve the rules left ready first, as the kernel won't report them again
+    bool served_rule = false;
+    if ( not _edge_ready.empty() and serve_edge_ready() ) {
+      if ( _dispatch == Dispatch::OneRule ) {
+        return Result::Success;
+      }
+      served_rule = true;
+    }
+
+    // submit everything queued since the last iteration, and wait for a completion
+    int wait_ms = served_rule or not _edge_ready.empty() or ready_queued() ? 0 : timeout_ms;
+    if ( wait_ms > 0 ) {
+      const auto left = chrono::ceil<chrono::milliseconds>( deadline - Clock::now() );
+      wait_ms = static_cast<int>( max( left, chrono::milliseconds::zero() ).count() );
+    }
+    const auto wait_start = wait_started();
+    _uring->ring.submit_and_wait( wait_ms == 0 ? 0 : 1, wait_ms );
+    wait_finished( wait_start );
+    _kernel_calls += _uring->ring.enter_count() - _uring->enters_counted;
+    _uring->enters_counted = _uring->ring.enter_count();
+
+    bool something_completed = false;
+    bool something_happened = served_rule;
+    IoUring::Completion completion {};
+    while ( _uring->ring.pop_completion( completion ) ) {
+      if ( completion.user_data == UringState::kIgnored ) {
+        continue;
+      }
+      something_completed = true;
+
+      const auto index = static_cast<uint32_t>( completion.user_data );
+      if ( _uring->operations.at( index ).kind == UringState::Operation::Kind::Poll ) {
+        // a multishot request that stays armed says so; otherwise the request is finished
+        const bool armed = completion.flags & IORING_CQE_F_MORE;
+        const SlotKey key = armed ? _uring->operations.at( index ).rule : _uring->take_operation( index ).rule;
+        FDRule* rule = fd_rules.find( key );
+        if ( not rule ) {
+          continue; // the rule was retired while its poll request was in flight
+        }
+        if ( not armed ) {
+          rule->registered = false;
+          queue_changed( *rule ); // to arm a new poll request
+        }
+        if ( completion.result < 0 or rule->cancel_requested or rule->poll_removing ) {
+          continue;
+        }
+        if ( served_rule and _dispatch == Dispatch::OneRule ) {
+          // a ready fd that isn't served now is polled again (and found ready) next time, except with
+          // edge-triggered waits, which only report it once
+          not_serviced( *rule );
+          if ( _trigger == Trigger::Edge ) {
+            defer_edge_ready( *rule );
+          }
+          continue;
+        }
+
+        const auto events = static_cast<int16_t>( poll_events( *rule ) );
+        if ( _prioritized ) {
+          queue_ready( *rule, events, static_cast<int16_t>( completion.result ) );
+          continue;
+        }
+        switch ( service_fd_rule( *rule, events, static_cast<int16_t>( completion.result ) ) ) {
+          case FDOutcome::Cancelled:
+            rule->cancel_requested = true; // already cancelled, so the next pass just removes it
+            queue_changed( *rule );
+            something_happened = true;
+            break;
+          case FDOutcome::Served:
+            served_rule = true; /* only serve one rule on each iteration */
+            something_happened = true;
+            break;
+          case FDOutcome::Idle:
+            break;
+        }
+        continue;
+      }
+
+      // a non-blocking fd that wasn't ready: try again once it is
+      if ( completion.result == -EAGAIN ) {
+        _uring->queue_io( index, true );
+        continue;
+      }
+
+      auto operation = _uring->take_operation( index );
+      --_uring->io_in_flight;
+      something_happened = true;
+
+      const BufferReturn buffer_return { _uring->free_buffers, operation.buffer }; // (the completion may throw)
+      const char* data = operation.buffer >= 0 ? _uring->buffer( operation.buffer ) : operation.owned->data();
+      const auto length = operation.kind == UringState::Operation::Kind::Read ? max( completion.result, 0 ) : 0;
+      operation.completion( completion.result, { data, static_cast<size_t>( length ) } );
+    }
+
+    if ( _prioritized and serve_prioritized() ) {
+      something_happened = true;
+    }
+    if ( something_happened ) {
+      return Result::Success;
+    }
+    if ( not something_completed and _uring->ring.queued() == 0 ) {
+      return Result::Timeout;
+    }
+    if ( timeout_ms > 0 and Clock::now() >= deadline ) {
+      return Result::Timeout;
+    }
+  }
+}
+
+// NOLINTEND(*-signed-bitwise)
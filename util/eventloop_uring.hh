@@ -0,0 +1,66 @@
+#pragma once
+
+// The io_uring backend's state; private to EventLoop's implementation.
+
+#include "eventloop.hh"
+#include "io_uring.hh"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct EventLoop::UringState
+{
+  static constexpr unsigned kRingEntries = 256;
+  static constexpr size_t kBufferSize = 16384;
+  static constexpr size_t kBufferCount = 64;
+  static constexpr uint64_t kIgnored = UINT64_MAX; // user_data of requests whose completions don't matter
+
+  struct Operation
+  {
+    enum class Kind : uint8_t
+    {
+      Poll,
+      Read,
+      Write
+    };
+
+    Kind kind {};
+    SlotKey rule {};                        // (poll) the rule waiting for its fd
+    std::optional<FileDescriptor> fd {};    // (read/write) kept open until the operation completes
+    CompletionT completion {};              // (read/write)
+    int buffer { -1 };                      // (read/write) the registered buffer in use, if any
+    std::unique_ptr<std::string> owned {};  // (read/write) the bytes, when no registered buffer was free
+    uint32_t length {};                     // (read/write) bytes requested
+  };
+
+  // the buffers are declared before the ring, so they outlive the kernel's use of them
+  std::unique_ptr<char[]> buffers; // NOLINT(*-avoid-c-arrays)
+  std::vector<uint16_t> free_buffers {};
+  bool buffers_registered {};
+  IoUring ring;
+
+  // the fd rules, by fd number (to find those left on a closed fd once its number is reused)
+  std::unordered_map<int, std::vector<FDRule*>> rules_by_fd {};
+
+  std::vector<Operation> operations {};
+  std::vector<uint32_t> free_operations {};
+  size_t io_in_flight {};   // reads and writes not yet completed
+  uint64_t enters_counted {}; // io_uring_enter calls already added to EventLoop::_kernel_calls
+
+  UringState();
+
+  char* buffer( int index ) const { return buffers.get() + static_cast<size_t>( index ) * kBufferSize; }
+
+  uint32_t add_operation( Operation&& operation );
+  Operation take_operation( uint32_t index );
+
+  // a multishot poll request stays armed, and completes each time the fd becomes ready
+  void queue_poll( uint32_t index, int fd_num, uint32_t events, bool multishot = false );
+  void update_poll( const FDRule& rule, uint32_t events, bool multishot );
+  void remove_poll( FDRule& rule );
+  void queue_io( uint32_t index, bool after_poll );
+};
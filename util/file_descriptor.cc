@@ -1,10 +1,15 @@
 #include "file_descriptor.hh"
 
+#include "eventloop.hh"
 #include "exception.hh"
 
+#include <algorithm>
+#include <array>
 #include <fcntl.h>
 #include <iostream>
 #include <stdexcept>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
@@ -93,7 +98,7 @@ void FileDescriptor::read( string& buffer )
     throw unix_error { "read" };
   }
 
-  register_read();
+  register_read( static_cast<size_t>( bytes_read ) );
 
   if ( bytes_read == 0 ) {
     internal_fd_->eof_ = true;
@@ -106,6 +111,38 @@ void FileDescriptor::read( string& buffer )
   buffer.resize( bytes_read );
 }
 
+BufferPool& FileDescriptor::read_buffer_pool()
+{
+  static BufferPool pool { kReadBufferSize };
+  return pool;
+}
+
+PooledBuffer FileDescriptor::read()
+{
+  return read( read_buffer_pool() );
+}
+
+PooledBuffer FileDescriptor::read( BufferPool& pool )
+{
+  PooledBuffer buffer = pool.acquire();
+  const ssize_t bytes_read = ::read( fd_num(), buffer.data(), buffer.capacity() );
+  if ( bytes_read < 0 ) {
+    if ( internal_fd_->non_blocking_ and ( errno == EAGAIN or errno == EINPROGRESS ) ) {
+      return buffer;
+    }
+    throw unix_error { "read" };
+  }
+
+  register_read( static_cast<size_t>( bytes_read ) );
+
+  if ( bytes_read == 0 ) {
+    internal_fd_->eof_ = true;
+  }
+
+  buffer.resize( bytes_read );
+  return buffer;
+}
+
 void FileDescriptor::read( vector<string>& buffers )
 {
   if ( buffers.empty() ) {
@@ -132,7 +169,7 @@ void FileDescriptor::read( vector<string>& buffers )
     throw unix_error { "read" };
   }
 
-  register_read();
+  register_read( static_cast<size_t>( bytes_read ) );
 
   if ( bytes_read > static_cast<ssize_t>( total_size ) ) {
     throw runtime_error( "read() read more than requested" );
@@ -151,7 +188,23 @@ void FileDescriptor::read( vector<string>& buffers )
 
 size_t FileDescriptor::write( string_view buffer )
 {
-  return write( vector<string_view> { buffer } );
+  // a single buffer needs no iovec array (and so no allocation)
+  const ssize_t result = ::write( fd_num(), buffer.data(), buffer.size() );
+  if ( result < 0 and internal_fd_->non_blocking_ and errno == EAGAIN ) {
+    return 0; // not writable: nothing written
+  }
+  const ssize_t bytes_written = CheckSystemCall( "write", result );
+  register_write( static_cast<size_t>( bytes_written ) );
+
+  if ( bytes_written == 0 and not buffer.empty() ) {
+    throw runtime_error( "write returned 0 given non-empty input buffer" );
+  }
+
+  if ( bytes_written > static_cast<ssize_t>( buffer.size() ) ) {
+    throw runtime_error( "write wrote more than length of input buffer" );
+  }
+
+  return bytes_written;
 }
 
 size_t FileDescriptor::write( const vector<Ref<string>>& buffers )
@@ -174,9 +227,12 @@ size_t FileDescriptor::write( const vector<string_view>& buffers )
     total_size += x.size();
   }
 
-  const ssize_t bytes_written
-    = CheckSystemCall( "writev", ::writev( fd_num(), iovecs.data(), static_cast<int>( iovecs.size() ) ) );
-  register_write();
+  const ssize_t result = ::writev( fd_num(), iovecs.data(), static_cast<int>( iovecs.size() ) );
+  if ( result < 0 and internal_fd_->non_blocking_ and errno == EAGAIN ) {
+    return 0; // not writable: nothing written
+  }
+  const ssize_t bytes_written = CheckSystemCall( "writev", result );
+  register_write( static_cast<size_t>( bytes_written ) );
 
   if ( bytes_written == 0 and total_size != 0 ) {
     throw runtime_error( "write returned 0 given non-empty input buffer" );
@@ -189,6 +245,108 @@ size_t FileDescriptor::write( const vector<string_view>& buffers )
   return bytes_written;
 }
 
+// after a zero-copy transfer of `result` bytes (or a failure) from `in` to `out`
+size_t FileDescriptor::transferred( string_view s_attempt, ssize_t result, size_t count, FileDescriptor& out )
+{
+  if ( result < 0 and errno == EAGAIN ) {
+    return 0; // one end wasn't ready: nothing moved
+  }
+  const auto bytes = static_cast<size_t>( CheckSystemCall( s_attempt, result ) );
+  register_read( bytes );
+  out.register_write( bytes );
+  if ( bytes == 0 and count > 0 ) {
+    set_eof();
+  }
+  return bytes;
+}
+
+size_t FileDescriptor::sendfile_to( FileDescriptor& out, size_t count )
+{
+  return transferred( "sendfile", ::sendfile( out.fd_num(), fd_num(), nullptr, count ), count, out );
+}
+
+size_t FileDescriptor::splice_to( FileDescriptor& out, size_t count )
+{
+  const ssize_t result
+    = ::splice( fd_num(), nullptr, out.fd_num(), nullptr, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK ); // NOLINT
+  return transferred( "splice", result, count, out );
+}
+
+size_t FileDescriptor::tee_to( FileDescriptor& out, size_t count )
+{
+  return transferred( "tee", ::tee( fd_num(), out.fd_num(), count, SPLICE_F_NONBLOCK ), count, out );
+}
+
+pair<FileDescriptor, FileDescriptor> FileDescriptor::make_pipe()
+{
+  array<int, 2> fds {};
+  ::CheckSystemCall( "pipe2", ::pipe2( fds.data(), O_NONBLOCK | O_CLOEXEC ) ); // NOLINT(*-signed-bitwise)
+  return { FileDescriptor { fds[0] }, FileDescriptor { fds[1] } };
+}
+
+void FileDescriptor::async_read( EventLoop& loop, function<void( string_view )> callback )
+{
+  loop.submit_read( *this, [wrapper = internal_fd_, callback = move( callback )]( int result, string_view data ) {
+    if ( result < 0 ) {
+      throw unix_error { "async read", -result };
+    }
+    ++wrapper->read_count_;
+    if ( result == 0 ) {
+      wrapper->eof_ = true;
+    }
+    callback( data );
+  } );
+}
+
+Task<size_t> FileDescriptor::read_some( string& buffer )
+{
+  while ( true ) {
+    const size_t capacity = max( buffer.capacity(), kReadBufferSize );
+    buffer.resize( capacity );
+    read( buffer );
+    if ( not buffer.empty() or eof() ) {
+      co_return buffer.size();
+    }
+    if ( not co_await EventLoop::FDAwaiter { nullptr, *this, EventLoop::Direction::In } ) {
+      buffer.clear();
+      co_return 0;
+    }
+  }
+}
+
+Task<size_t> FileDescriptor::write_some( string_view buffer )
+{
+  if ( buffer.empty() ) {
+    co_return 0;
+  }
+
+  while ( true ) {
+    const size_t written = write( buffer );
+    if ( written > 0 ) {
+      co_return written;
+    }
+    if ( not co_await EventLoop::FDAwaiter { nullptr, *this, EventLoop::Direction::Out } ) {
+      co_return 0;
+    }
+  }
+}
+
+void FileDescriptor::async_write( EventLoop& loop, string data, function<void( size_t )> callback )
+{
+  const bool empty = data.empty();
+  loop.submit_write(
+    *this, move( data ), [wrapper = internal_fd_, empty, callback = move( callback )]( int result, string_view ) {
+      if ( result < 0 ) {
+        throw unix_error { "async write", -result };
+      }
+      ++wrapper->write_count_;
+      if ( result == 0 and not empty ) {
+        throw runtime_error( "write returned 0 given non-empty input buffer" );
+      }
+      callback( static_cast<size_t>( result ) );
+    } );
+}
+
 void FileDescriptor::set_blocking( bool blocking )
 {
   int flags = CheckSystemCall( "fcntl", fcntl( fd_num(), F_GETFL ) ); // NOLINT(*-vararg)
@@ -202,3 +360,11 @@ void FileDescriptor::set_blocking( bool blocking )
 
   internal_fd_->non_blocking_ = not blocking;
 }
+
+off_t FileDescriptor::size() const
+{
+  struct stat file_info
+  {};
+  CheckSystemCall( "fstat", fstat( fd_num(), &file_info ) );
+  return file_info.st_size;
+}
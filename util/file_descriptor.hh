@@ -1,10 +1,18 @@
 #pragma once
 
+#include "buffer_pool.hh"
 #include "ref.hh"
+#include "task.hh"
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+class EventLoop;
+
 // A reference-counted handle to a file descriptor
 class FileDescriptor
 {
@@ -19,6 +27,8 @@ class FileDescriptor
     bool non_blocking_ = false; // Flag indicating whether FDWrapper::fd_ is non-blocking
     unsigned read_count_ = 0;   // The number of times FDWrapper::fd_ has been read
     unsigned write_count_ = 0;  // The numberof times FDWrapper::fd_ has been written
+    uint64_t bytes_read_ = 0;    // The number of bytes read from FDWrapper::fd_
+    uint64_t bytes_written_ = 0; // The number of bytes written to FDWrapper::fd_
 
     // Construct from a file descriptor number returned by the kernel
     explicit FDWrapper( int fd );
@@ -48,12 +58,24 @@ protected:
   static constexpr size_t kReadBufferSize = 16384;
 
   void set_eof() { internal_fd_->eof_ = true; }
-  void register_read() { ++internal_fd_->read_count_; }   // increment read count
-  void register_write() { ++internal_fd_->write_count_; } // increment write count
+  // increment read (or write) count, and add to the bytes read (or written)
+  void register_read( size_t bytes = 0 )
+  {
+    ++internal_fd_->read_count_;
+    internal_fd_->bytes_read_ += bytes;
+  }
+  void register_write( size_t bytes = 0 )
+  {
+    ++internal_fd_->write_count_;
+    internal_fd_->bytes_written_ += bytes;
+  }
 
   template<typename T>
   T CheckSystemCall( std::string_view s_attempt, T return_value ) const;
 
+  // account for a zero-copy transfer to `out` (see sendfile_to)
+  size_t transferred( std::string_view s_attempt, ssize_t result, size_t count, FileDescriptor& out );
+
 public:
   // Construct from a file descriptor number returned by the kernel
   explicit FileDescriptor( int fd );
@@ -65,12 +87,49 @@ public:
   void read( std::string& buffer );
   void read( std::vector<std::string>& buffers );
 
+  // Read into a buffer from `pool` (by default, a process-wide pool of kReadBufferSize buffers), and
+  // return it: empty if nothing was read (at EOF, or if a non-blocking fd had nothing to read). Once
+  // the pool has enough buffers, a read allocates nothing, and nothing is zero-filled.
+  PooledBuffer read();
+  PooledBuffer read( BufferPool& pool );
+
+  // The pool read() takes buffers from
+  static BufferPool& read_buffer_pool();
+
   // Attempt to write a buffer
-  // returns number of bytes written
+  // returns number of bytes written (0 if a non-blocking fd isn't writable)
   size_t write( std::string_view buffer );
   size_t write( const std::vector<std::string_view>& buffers );
   size_t write( const std::vector<Ref<std::string>>& buffers );
 
+  // Zero-copy transfers from this fd to `out`, which move up to `count` bytes within the kernel and
+  // return the number moved: 0 if a non-blocking end wasn't ready, or at the end of the input (which
+  // sets eof()). Each counts as a read of this fd and a write of `out`, so an EventLoop rule can
+  // serve either fd with them (e.g. a Direction::Out rule on a socket that calls sendfile_to).
+  //   sendfile_to: from a file, at (and advancing) its offset, to any fd
+  //   splice_to: between a pipe and any fd (either end may be the pipe)
+  //   tee_to: from a pipe to another pipe, copying the data without consuming it
+  size_t sendfile_to( FileDescriptor& out, size_t count );
+  size_t splice_to( FileDescriptor& out, size_t count );
+  size_t tee_to( FileDescriptor& out, size_t count );
+
+  // A non-blocking pipe, e.g. to splice through: its read end, and its write end
+  static std::pair<FileDescriptor, FileDescriptor> make_pipe();
+
+  // Completion-based reads and writes through an EventLoop with the io_uring backend. The callback
+  // runs from a later EventLoop::wait_next_event: for a read, with the bytes read (empty at EOF, and
+  // valid only during the call); for a write, with the number of bytes written.
+  void async_read( EventLoop& loop, std::function<void( std::string_view )> callback );
+  void async_write( EventLoop& loop, std::string data, std::function<void( size_t )> callback );
+
+  // Coroutine reads and writes, for a Task running on an EventLoop (see EventLoop::spawn). Each
+  // tries the system call first, and only if the (non-blocking) fd isn't ready waits for the loop
+  // to report it ready. read_some reads into `buffer`, growing it to at least kReadBufferSize, and
+  // returns the number of bytes read (0 at EOF); write_some returns the number of bytes written
+  // (0 if the fd can no longer be written).
+  Task<size_t> read_some( std::string& buffer );
+  Task<size_t> write_some( std::string_view buffer );
+
   // Close the underlying file descriptor
   void close() { internal_fd_->close(); }
 
@@ -89,6 +148,8 @@ public:
   bool closed() const { return internal_fd_->closed_; }                   // closed flag state
   unsigned int read_count() const { return internal_fd_->read_count_; }   // number of reads
   unsigned int write_count() const { return internal_fd_->write_count_; } // number of writes
+  uint64_t bytes_read() const { return internal_fd_->bytes_read_; }       // number of bytes read
+  uint64_t bytes_written() const { return internal_fd_->bytes_written_; } // number of bytes written
 
   // Copy/move constructor/assignment operators
   // FileDescriptor can be moved, but cannot be copied implicitly (see duplicate())
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * A move-only std::function that keeps its target inline: any callable of at most `Capacity`
+ * bytes (e.g. a lambda capturing up to four pointers or references, or a std::function) is stored
+ * in the object itself, without a heap allocation. Larger callables, or ones that might throw
+ * when moved, are stored on the heap instead.
+ */
+template<typename Signature, size_t Capacity = 32>
+class InlineFunction;
+
+template<typename R, typename... Args, size_t Capacity>
+class InlineFunction<R( Args... ), Capacity>
+{
+public:
+  InlineFunction() = default;
+  InlineFunction( std::nullptr_t ) {} // NOLINT(*-explicit-*)
+
+  template<typename F>
+    requires( not std::is_same_v<std::remove_cvref_t<F>, InlineFunction>
+              and std::is_invocable_r_v<R, std::decay_t<F>&, Args...> )
+  InlineFunction( F&& f ) // NOLINT(*-explicit-*, *-forwarding-reference-overload)
+  {
+    using Target = std::decay_t<F>;
+    if constexpr ( nullable<std::remove_cvref_t<F>> ) {
+      if ( f == nullptr ) {
+        return; // an empty std::function (or a null pointer) makes an empty InlineFunction
+      }
+    }
+
+    if constexpr ( stored_inline<Target> ) {
+      ::new ( storage_ ) Target( std::forward<F>( f ) );
+      invoke_ = []( void* storage, Args&&... args ) -> R {
+        return std::invoke( *std::launder( static_cast<Target*>( storage ) ), std::forward<Args>( args )... );
+      };
+      manage_ = []( void* storage, void* destination ) noexcept {
+        auto* target = std::launder( static_cast<Target*>( storage ) );
+        if ( destination ) {
+          ::new ( destination ) Target( std::move( *target ) );
+        }
+        target->~Target();
+      };
+    } else {
+      ::new ( storage_ ) Target*( new Target( std::forward<F>( f ) ) );
+      invoke_ = []( void* storage, Args&&... args ) -> R {
+        return std::invoke( **std::launder( static_cast<Target**>( storage ) ), std::forward<Args>( args )... );
+      };
+      manage_ = []( void* storage, void* destination ) noexcept {
+        Target* target = *std::launder( static_cast<Target**>( storage ) );
+        if ( destination ) {
+          ::new ( destination ) Target*( target );
+        } else {
+          delete target;
+        }
+      };
+    }
+  }
+
+  InlineFunction( InlineFunction&& other ) noexcept { take( other ); }
+
+  InlineFunction& operator=( InlineFunction&& other ) noexcept
+  {
+    if ( this != &other ) {
+      reset();
+      take( other );
+    }
+    return *this;
+  }
+
+  InlineFunction( const InlineFunction& other ) = delete;
+  InlineFunction& operator=( const InlineFunction& other ) = delete;
+
+  ~InlineFunction() { reset(); }
+
+  R operator()( Args... args ) const
+  {
+    if ( not invoke_ ) {
+      throw std::bad_function_call();
+    }
+    return invoke_( storage_, std::forward<Args>( args )... );
+  }
+
+  explicit operator bool() const { return invoke_ != nullptr; }
+
+private:
+  template<typename T>
+  struct is_std_function : std::false_type
+  {};
+  template<typename S>
+  struct is_std_function<std::function<S>> : std::true_type
+  {};
+
+  template<typename Target>
+  static constexpr bool nullable
+    = std::is_pointer_v<Target> or std::is_member_pointer_v<Target> or is_std_function<Target>::value;
+
+  template<typename Target>
+  static constexpr bool stored_inline = sizeof( Target ) <= Capacity
+                                        and alignof( Target ) <= alignof( std::max_align_t )
+                                        and std::is_nothrow_move_constructible_v<Target>;
+
+  using InvokeT = R ( * )( void* storage, Args&&... args );
+  using ManageT = void ( * )( void* storage, void* destination ) noexcept; // move to destination, or destroy
+
+  alignas( std::max_align_t ) mutable std::byte storage_[Capacity] {}; // NOLINT(*-avoid-c-arrays)
+  InvokeT invoke_ {};
+  ManageT manage_ {};
+
+  void reset()
+  {
+    if ( manage_ ) {
+      manage_( storage_, nullptr );
+    }
+    invoke_ = nullptr;
+    manage_ = nullptr;
+  }
+
+  void take( InlineFunction& other )
+  {
+    if ( other.manage_ ) {
+      other.manage_( other.storage_, storage_ );
+    }
+    invoke_ = std::exchange( other.invoke_, nullptr );
+    manage_ = std::exchange( other.manage_, nullptr );
+  }
+};
@@ -0,0 +1,166 @@
+#include "io_uring.hh"
+
+#include "exception.hh"
+
+#include <atomic>
+#include <cstring>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+int io_uring_setup( unsigned entries, io_uring_params* params )
+{
+  return static_cast<int>( syscall( __NR_io_uring_setup, entries, params ) );
+}
+
+template<typename T>
+T* ring_field( void* ring, uint32_t offset )
+{
+  return reinterpret_cast<T*>( static_cast<char*>( ring ) + offset ); // NOLINT(*-reinterpret-cast)
+}
+
+void* map_ring( int fd, size_t size, off_t offset )
+{
+  void* ring = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset );
+  if ( ring == MAP_FAILED ) { // NOLINT(*-cstyle-cast)
+    throw unix_error { "mmap io_uring" };
+  }
+  return ring;
+}
+
+} // namespace
+
+IoUring::IoUring( unsigned entries )
+  : ring_fd_( CheckSystemCall( "io_uring_setup", io_uring_setup( entries, &params_ ) ) )
+{
+  if ( not( params_.features & IORING_FEAT_EXT_ARG ) ) {
+    throw runtime_error( "io_uring: kernel lacks IORING_FEAT_EXT_ARG (needs Linux 5.11)" );
+  }
+
+  sq_ring_size_ = params_.sq_off.array + params_.sq_entries * sizeof( unsigned );
+  cq_ring_size_ = params_.cq_off.cqes + params_.cq_entries * sizeof( io_uring_cqe );
+  if ( params_.features & IORING_FEAT_SINGLE_MMAP ) {
+    sq_ring_size_ = cq_ring_size_ = max( sq_ring_size_, cq_ring_size_ );
+  }
+
+  sq_ring_ = map_ring( ring_fd_.fd_num(), sq_ring_size_, IORING_OFF_SQ_RING );
+  cq_ring_ = ( params_.features & IORING_FEAT_SINGLE_MMAP )
+               ? sq_ring_
+               : map_ring( ring_fd_.fd_num(), cq_ring_size_, IORING_OFF_CQ_RING );
+  sqes_size_ = params_.sq_entries * sizeof( io_uring_sqe );
+  sqes_ = static_cast<io_uring_sqe*>( map_ring( ring_fd_.fd_num(), sqes_size_, IORING_OFF_SQES ) );
+
+  sq_head_ = ring_field<unsigned>( sq_ring_, params_.sq_off.head );
+  sq_tail_ = ring_field<unsigned>( sq_ring_, params_.sq_off.tail );
+  sq_array_ = ring_field<unsigned>( sq_ring_, params_.sq_off.array );
+  sq_mask_ = *ring_field<unsigned>( sq_ring_, params_.sq_off.ring_mask );
+  cq_head_ = ring_field<unsigned>( cq_ring_, params_.cq_off.head );
+  cq_tail_ = ring_field<unsigned>( cq_ring_, params_.cq_off.tail );
+  cqes_ = ring_field<io_uring_cqe>( cq_ring_, params_.cq_off.cqes );
+  cq_mask_ = *ring_field<unsigned>( cq_ring_, params_.cq_off.ring_mask );
+
+  // the submission array is an identity map: entry i of the ring is always sqes_[i]
+  for ( unsigned i = 0; i < params_.sq_entries; ++i ) {
+    sq_array_[i] = i; // NOLINT(*-pointer-arithmetic)
+  }
+}
+
+IoUring::~IoUring()
+{
+  munmap( sqes_, sqes_size_ );
+  if ( cq_ring_ != sq_ring_ ) {
+    munmap( cq_ring_, cq_ring_size_ );
+  }
+  munmap( sq_ring_, sq_ring_size_ );
+}
+
+void IoUring::reserve( const unsigned count )
+{
+  if ( queued() + count > params_.sq_entries ) {
+    flush_queue();
+    enter( queued(), 0, 0 );
+  }
+}
+
+io_uring_sqe* IoUring::get_sqe()
+{
+  reserve( 1 );
+
+  io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_]; // NOLINT(*-pointer-arithmetic)
+  ++sqe_tail_;
+  memset( sqe, 0, sizeof( *sqe ) );
+  return sqe;
+}
+
+// publish the filled-in entries to the kernel's submission ring
+void IoUring::flush_queue()
+{
+  atomic_ref<unsigned>( *sq_tail_ ).store( sqe_tail_, memory_order_release );
+}
+
+void IoUring::enter( unsigned to_submit, unsigned wait_for, int timeout_ms )
+{
+  __kernel_timespec timeout {};
+  io_uring_getevents_arg arg {};
+  unsigned flags = IORING_ENTER_EXT_ARG;
+  if ( wait_for > 0 ) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+  if ( timeout_ms >= 0 ) {
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = static_cast<long long>( timeout_ms % 1000 ) * 1000000;
+    arg.ts = reinterpret_cast<uint64_t>( &timeout ); // NOLINT(*-reinterpret-cast)
+  }
+
+  ++enter_count_;
+  const long ret = syscall( __NR_io_uring_enter, ring_fd_.fd_num(), to_submit, wait_for, flags, &arg, sizeof( arg ) );
+  if ( ret < 0 and errno != ETIME and errno != EINTR and errno != EBUSY ) {
+    throw unix_error { "io_uring_enter" };
+  }
+
+  sqe_head_ = atomic_ref<unsigned>( *sq_head_ ).load( memory_order_acquire );
+}
+
+void IoUring::submit_and_wait( unsigned wait_for, int timeout_ms )
+{
+  flush_queue();
+  const unsigned to_submit = queued();
+  if ( to_submit == 0 and wait_for == 0 ) {
+    return;
+  }
+
+  // completions may already be waiting, in which case there's no need to block
+  if ( wait_for > 0 and atomic_ref<unsigned>( *cq_tail_ ).load( memory_order_acquire ) != *cq_head_ ) {
+    wait_for = 0;
+    if ( to_submit == 0 ) {
+      return;
+    }
+  }
+
+  enter( to_submit, wait_for, timeout_ms );
+}
+
+bool IoUring::pop_completion( Completion& completion )
+{
+  const unsigned head = *cq_head_;
+  if ( head == atomic_ref<unsigned>( *cq_tail_ ).load( memory_order_acquire ) ) {
+    return false;
+  }
+
+  const io_uring_cqe& cqe = cqes_[head & cq_mask_]; // NOLINT(*-pointer-arithmetic)
+  completion = { cqe.user_data, cqe.res, cqe.flags };
+  atomic_ref<unsigned>( *cq_head_ ).store( head + 1, memory_order_release );
+  return true;
+}
+
+bool IoUring::register_buffers( span<const iovec> buffers )
+{
+  return 0
+         == syscall(
+           __NR_io_uring_register, ring_fd_.fd_num(), IORING_REGISTER_BUFFERS, buffers.data(), buffers.size() );
+}
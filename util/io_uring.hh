@@ -0,0 +1,78 @@
+#pragma once
+
+#include "file_descriptor.hh"
+
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <span>
+#include <sys/uio.h>
+
+// A minimal [io_uring(7)](\ref man7::io_uring) instance: a submission queue that is filled in
+// user space and handed to the kernel in batches, and a completion queue that is read back
+// without any system call.
+class IoUring
+{
+public:
+  explicit IoUring( unsigned entries );
+  ~IoUring();
+
+  // Get a blank submission queue entry. If the queue is full, the queued entries are submitted first.
+  io_uring_sqe* get_sqe();
+
+  // Make room for `count` entries, submitting the queued ones first if there isn't, so that the next
+  // `count` calls to get_sqe() don't submit (e.g. to keep entries linked with IOSQE_IO_LINK together).
+  void reserve( unsigned count );
+
+  // Submit every queued entry, and wait until at least `wait_for` completions are ready
+  // (or `timeout_ms` passes; a negative timeout waits indefinitely).
+  void submit_and_wait( unsigned wait_for, int timeout_ms );
+
+  struct Completion
+  {
+    uint64_t user_data;
+    int32_t result;
+    uint32_t flags;
+  };
+
+  // Take the next completion, if there is one.
+  bool pop_completion( Completion& completion );
+
+  // Register buffers with the kernel for IORING_OP_READ_FIXED/WRITE_FIXED. Returns false if refused.
+  bool register_buffers( std::span<const iovec> buffers );
+
+  unsigned queued() const { return sqe_tail_ - sqe_head_; } // entries not yet submitted
+  uint64_t enter_count() const { return enter_count_; }    // calls to io_uring_enter(2)
+
+  IoUring( const IoUring& other ) = delete;
+  IoUring& operator=( const IoUring& other ) = delete;
+  IoUring( IoUring&& other ) = delete;
+  IoUring& operator=( IoUring&& other ) = delete;
+
+private:
+  io_uring_params params_ {}; // filled in by io_uring_setup, so declared before ring_fd_
+  FileDescriptor ring_fd_;
+
+  void* sq_ring_ {};
+  size_t sq_ring_size_ {};
+  void* cq_ring_ {};
+  size_t cq_ring_size_ {};
+  io_uring_sqe* sqes_ {};
+  size_t sqes_size_ {};
+
+  // pointers into the shared rings
+  unsigned* sq_head_ {};
+  unsigned* sq_tail_ {};
+  unsigned* sq_array_ {};
+  unsigned sq_mask_ {};
+  unsigned* cq_head_ {};
+  unsigned* cq_tail_ {};
+  io_uring_cqe* cqes_ {};
+  unsigned cq_mask_ {};
+
+  unsigned sqe_head_ {}; // entries handed to the kernel's ring so far
+  unsigned sqe_tail_ {}; // entries filled in so far
+  uint64_t enter_count_ {};
+
+  void flush_queue();
+  void enter( unsigned to_submit, unsigned wait_for, int timeout_ms );
+};
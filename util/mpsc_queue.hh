@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <optional>
+#include <utility>
+
+/*
+ * A lock-free queue with many producers and one consumer.
+ *
+ * Producers push onto an atomic singly-linked stack with a compare-and-swap. The consumer
+ * never pops one value at a time: it takes the whole stack with a single exchange and reverses
+ * it into a Batch, oldest first. Because only the consumer removes nodes, and it removes all of
+ * them at once, there is no ABA problem.
+ *
+ * push() reports whether the queue was empty, so a producer can wake the consumer only on the
+ * first push after a take_all(): later pushes find the wake-up already on its way.
+ */
+template<typename T>
+class MPSCQueue
+{
+  struct Node
+  {
+    T value;
+    Node* next;
+  };
+
+public:
+  // Values taken from the queue, oldest first. Whatever isn't popped is freed with the batch.
+  class Batch
+  {
+    Node* first_ {};
+
+  public:
+    Batch() = default;
+    explicit Batch( Node* first ) : first_( first ) {}
+
+    bool empty() const { return first_ == nullptr; }
+
+    std::optional<T> pop()
+    {
+      if ( not first_ ) {
+        return {};
+      }
+      Node* node = std::exchange( first_, first_->next );
+      std::optional<T> value { std::move( node->value ) };
+      delete node;
+      return value;
+    }
+
+    ~Batch() { free( first_ ); }
+
+    Batch( const Batch& other ) = delete;
+    Batch& operator=( const Batch& other ) = delete;
+    Batch( Batch&& other ) noexcept : first_( std::exchange( other.first_, nullptr ) ) {}
+    Batch& operator=( Batch&& other ) noexcept
+    {
+      free( std::exchange( first_, std::exchange( other.first_, nullptr ) ) );
+      return *this;
+    }
+  };
+
+  MPSCQueue() = default;
+  ~MPSCQueue() { free( head_.load( std::memory_order_acquire ) ); }
+
+  MPSCQueue( const MPSCQueue& other ) = delete;
+  MPSCQueue& operator=( const MPSCQueue& other ) = delete;
+  MPSCQueue( MPSCQueue&& other ) = delete;
+  MPSCQueue& operator=( MPSCQueue&& other ) = delete;
+
+  // Add a value (from any thread). Returns true if the queue was empty.
+  bool push( T value )
+  {
+    Node* node = new Node { std::move( value ), head_.load( std::memory_order_relaxed ) };
+    Node* previous = node->next;
+    // once published, the node belongs to the consumer: don't look at it again
+    while ( not head_.compare_exchange_weak( previous, node, std::memory_order_release, std::memory_order_relaxed ) ) {
+      node->next = previous;
+    }
+    return previous == nullptr;
+  }
+
+  // Take every value pushed so far (from the consumer's thread).
+  Batch take_all()
+  {
+    Node* node = head_.exchange( nullptr, std::memory_order_acquire );
+    Node* reversed = nullptr;
+    while ( node ) {
+      reversed = std::exchange( node, std::exchange( node->next, reversed ) );
+    }
+    return Batch { reversed };
+  }
+
+  bool empty() const { return head_.load( std::memory_order_relaxed ) == nullptr; }
+
+private:
+  std::atomic<Node*> head_ {};
+
+  static void free( Node* node )
+  {
+    while ( node ) {
+      delete std::exchange( node, node->next );
+    }
+  }
+};
@@ -0,0 +1,78 @@
+#include "process_fd.hh"
+
+#include "exception.hh"
+
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+sigset_t signal_set( initializer_list<int> signals )
+{
+  sigset_t set {};
+  sigemptyset( &set );
+  for ( const int signal : signals ) {
+    CheckSystemCall( "sigaddset", sigaddset( &set, signal ) );
+  }
+  return set;
+}
+
+int open_signalfd( const sigset_t& set )
+{
+  const int error = pthread_sigmask( SIG_BLOCK, &set, nullptr );
+  if ( error ) {
+    throw unix_error { "pthread_sigmask", error };
+  }
+  return CheckSystemCall( "signalfd", signalfd( -1, &set, SFD_NONBLOCK | SFD_CLOEXEC ) ); // NOLINT(*-signed-bitwise)
+}
+
+// (by system call number: some C libraries' <sys/pidfd.h> lacks C linkage, or is missing)
+int pidfd_open( pid_t pid )
+{
+  return static_cast<int>( syscall( SYS_pidfd_open, pid, 0 ) ); // NOLINT(*-vararg)
+}
+
+} // namespace
+
+SignalFD::SignalFD( initializer_list<int> signals ) : FileDescriptor( open_signalfd( signal_set( signals ) ) ) {}
+
+optional<signalfd_siginfo> SignalFD::read_signal()
+{
+  signalfd_siginfo info {};
+  const ssize_t bytes_read = ::read( fd_num(), &info, sizeof( info ) );
+  if ( bytes_read < 0 ) {
+    if ( errno == EAGAIN ) {
+      return {};
+    }
+    throw unix_error { "read" };
+  }
+  register_read( static_cast<size_t>( bytes_read ) );
+  return info;
+}
+
+PidFD::PidFD( const pid_t pid ) : FileDescriptor( ::CheckSystemCall( "pidfd_open", pidfd_open( pid ) ) ), pid_( pid )
+{}
+
+optional<siginfo_t> PidFD::try_wait()
+{
+  siginfo_t info {};
+  ::CheckSystemCall( "waitid", waitid( static_cast<idtype_t>( P_PIDFD ), fd_num(), &info, WEXITED | WNOHANG ) );
+  register_read(); // (the loop sees the readable pidfd as served)
+  if ( info.si_pid == 0 ) {
+    return {}; // still running
+  }
+  return info;
+}
+
+void PidFD::send_signal( const int signal ) const
+{
+  if ( closed() ) {
+    throw runtime_error( "PidFD: send_signal on a closed pidfd" );
+  }
+  const long result = syscall( SYS_pidfd_send_signal, fd_num(), signal, nullptr, 0 ); // NOLINT(*-vararg)
+  ::CheckSystemCall( "pidfd_send_signal", static_cast<int>( result ) );
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "file_descriptor.hh"
+
+#include <csignal>
+#include <initializer_list>
+#include <optional>
+#include <sys/signalfd.h>
+#include <sys/types.h>
+
+//! \brief A [signalfd(2)](\ref man2::signalfd): signals read from an fd, instead of delivered to a handler
+//! \details The constructor blocks the signals in the calling thread, so that they stay pending for the
+//! fd to read. The fd reads signals pending for the process or for the thread that reads it, so block
+//! them in every thread: make the SignalFD before starting other threads, which inherit the mask.
+class SignalFD : public FileDescriptor
+{
+  explicit SignalFD( FileDescriptor&& fd ) : FileDescriptor( std::move( fd ) ) {}
+
+public:
+  //! Block `signals` and read them from a new non-blocking signalfd
+  explicit SignalFD( std::initializer_list<int> signals );
+
+  //! Take one pending signal, if there is one
+  std::optional<signalfd_siginfo> read_signal();
+
+  //! Another handle on the same signalfd
+  SignalFD duplicate() const { return SignalFD { FileDescriptor::duplicate() }; }
+};
+
+//! \brief A [pidfd](\ref man2::pidfd_open) for a child process, which becomes readable once the child exits
+//! \details Unlike a pid, a pidfd can't come to name another process once the child is reaped, so
+//! send_signal() is safe at any time while the pidfd is open.
+class PidFD : public FileDescriptor
+{
+  pid_t pid_;
+
+  PidFD( FileDescriptor&& fd, pid_t pid ) : FileDescriptor( std::move( fd ) ), pid_( pid ) {}
+
+public:
+  //! Open a pidfd for `pid` (a child of this process, to be reaped with try_wait)
+  explicit PidFD( pid_t pid );
+
+  pid_t pid() const { return pid_; }
+
+  //! Reap the child, if it has exited (without blocking): its status, as from [waitid(2)](\ref man2::waitid)
+  std::optional<siginfo_t> try_wait();
+
+  //! Send the child a signal with [pidfd_send_signal(2)](\ref man2::pidfd_send_signal)
+  //! (throws once the pidfd is closed, as its number may since have been reused)
+  void send_signal( int signal ) const;
+
+  //! Another handle on the same pidfd
+  PidFD duplicate() const { return PidFD { FileDescriptor::duplicate(), pid_ }; }
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+/*
+ * A container addressed by generational keys. A key refers to its value until the value is
+ * erased, and to nothing afterwards, even once the slot has been reused.
+ *
+ * Values live in chunks of `ChunkSize` contiguous slots, so they are packed together in memory
+ * but never move: a reference stays valid while other values are added or erased. Erased slots
+ * are reused (most recent first) before the map grows.
+ */
+// Identifies a value in a SlotMap.
+struct SlotKey
+{
+  uint32_t index { UINT32_MAX };
+  uint32_t generation {};
+};
+
+template<typename T, size_t ChunkSize = 64>
+class SlotMap
+{
+public:
+  using Key = SlotKey;
+
+  template<typename... Args>
+  Key emplace( Args&&... args )
+  {
+    uint32_t index {};
+    if ( free_.empty() ) {
+      index = static_cast<uint32_t>( slots_ );
+      if ( slots_ % ChunkSize == 0 ) {
+        chunks_.push_back( std::make_unique<Chunk>() );
+      }
+      ++slots_;
+    } else {
+      index = free_.back();
+      free_.pop_back();
+    }
+
+    Slot& slot = slot_at( index );
+    slot.value.emplace( std::forward<Args>( args )... );
+    ++size_;
+    return { index, slot.generation };
+  }
+
+  // The value for `key`, or nullptr if it has been erased.
+  T* find( Key key )
+  {
+    if ( key.index >= slots_ ) {
+      return nullptr;
+    }
+    Slot& slot = slot_at( key.index );
+    return ( slot.generation == key.generation and slot.value.has_value() ) ? &*slot.value : nullptr;
+  }
+
+  bool erase( Key key )
+  {
+    if ( not find( key ) ) {
+      return false;
+    }
+    erase_at( key.index );
+    return true;
+  }
+
+  // By slot, for walking the map: slots() is one past the last slot ever used, and at() is
+  // nullptr for an empty slot.
+  size_t slots() const { return slots_; }
+  T* at( size_t index )
+  {
+    std::optional<T>& value = slot_at( index ).value;
+    return value.has_value() ? &*value : nullptr;
+  }
+  Key key_at( size_t index ) { return { static_cast<uint32_t>( index ), slot_at( index ).generation }; }
+
+  void erase_at( size_t index )
+  {
+    Slot& slot = slot_at( index );
+    slot.value.reset();
+    ++slot.generation;
+    free_.push_back( static_cast<uint32_t>( index ) );
+    --size_;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+private:
+  struct Slot
+  {
+    std::optional<T> value {};
+    uint32_t generation {};
+  };
+  using Chunk = std::array<Slot, ChunkSize>;
+
+  std::vector<std::unique_ptr<Chunk>> chunks_ {};
+  std::vector<uint32_t> free_ {};
+  size_t slots_ {};
+  size_t size_ {};
+
+  Slot& slot_at( size_t index ) { return ( *chunks_[index / ChunkSize] )[index % ChunkSize]; }
+};
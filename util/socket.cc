@@ -129,22 +129,22 @@ void DatagramSocket::recv( Address& source_address, string& payload )
     throw runtime_error( "recvfrom (oversized datagram)" );
   }
 
-  register_read();
+  register_read( static_cast<size_t>( recv_len ) );
   source_address = { datagram_source_address, fromlen };
   payload.resize( recv_len );
 }
 
 void DatagramSocket::sendto( const Address& destination, const string_view payload )
 {
-  CheckSystemCall(
+  const ssize_t bytes_sent = CheckSystemCall(
     "sendto", ::sendto( fd_num(), payload.data(), payload.length(), 0, destination.raw(), destination.size() ) );
-  register_write();
+  register_write( static_cast<size_t>( bytes_sent ) );
 }
 
 void DatagramSocket::send( const string_view payload )
 {
-  CheckSystemCall( "send", ::send( fd_num(), payload.data(), payload.length(), 0 ) );
-  register_write();
+  const ssize_t bytes_sent = CheckSystemCall( "send", ::send( fd_num(), payload.data(), payload.length(), 0 ) );
+  register_write( static_cast<size_t>( bytes_sent ) );
 }
 
 // mark the socket as listening for incoming connections
@@ -163,6 +163,22 @@ TCPSocket TCPSocket::accept()
   return TCPSocket( FileDescriptor( CheckSystemCall( "accept", ::accept( fd_num(), nullptr, nullptr ) ) ) );
 }
 
+// accept a new incoming connection without blocking
+//! \returns a new TCPSocket connected to the peer, or nothing if no connection was waiting
+//! (or the one waiting was reset before it could be accepted)
+optional<TCPSocket> TCPSocket::try_accept()
+{
+  register_read();
+  const int fd = ::accept( fd_num(), nullptr, nullptr );
+  if ( fd < 0 ) {
+    if ( errno == EAGAIN or errno == ECONNABORTED ) {
+      return {};
+    }
+    throw unix_error { "accept" };
+  }
+  return TCPSocket( FileDescriptor( fd ) );
+}
+
 // get socket option
 template<typename option_type>
 socklen_t Socket::getsockopt( const int level, const int option, option_type& option_value ) const
@@ -196,6 +212,12 @@ void Socket::set_reuseaddr()
   setsockopt( SOL_SOCKET, SO_REUSEADDR, int { true } );
 }
 
+// share the local address with other sockets of the same user that also set SO_REUSEPORT
+void Socket::set_reuseport()
+{
+  setsockopt( SOL_SOCKET, SO_REUSEPORT, int { true } );
+}
+
 void Socket::throw_if_error() const
 {
   int socket_error = 0;
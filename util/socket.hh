@@ -4,6 +4,7 @@
 #include "file_descriptor.hh"
 
 #include <functional>
+#include <optional>
 #include <sys/socket.h>
 
 //! \brief Base class for network sockets (TCP, UDP, etc.)
@@ -53,6 +54,10 @@ public:
   //! Allow local address to be reused sooner via [SO_REUSEADDR](\ref man7::socket)
   void set_reuseaddr();
 
+  //! Let several sockets bind the same address, with the kernel spreading incoming connections (or
+  //! datagrams) between them, via [SO_REUSEPORT](\ref man7::socket)
+  void set_reuseport();
+
   //! Check for errors (will be seen on non-blocking sockets)
   void throw_if_error() const;
 };
@@ -106,6 +111,9 @@ public:
 
   //! Accept a new incoming connection
   TCPSocket accept();
+
+  //! Accept a new incoming connection if one is waiting (for a non-blocking listening socket)
+  std::optional<TCPSocket> try_accept();
 };
 
 //! A wrapper around [packet sockets](\ref man7:packet)
@@ -0,0 +1,111 @@
+#include "stall_watchdog.hh"
+
+#include "exception.hh"
+
+#include <csignal>
+#include <cstdlib>
+#include <execinfo.h>
+#include <memory>
+
+using namespace std;
+
+namespace {
+
+// the watchdog of the callback running on this thread, for the signal handler
+thread_local StallWatchdog* this_thread_watchdog = nullptr; // NOLINT(*-avoid-non-const-global-variables)
+
+void handle_signal( int /* signal */ )
+{
+  if ( StallWatchdog* watchdog = this_thread_watchdog ) {
+    watchdog->sample();
+  }
+}
+
+void install_handler()
+{
+  static once_flag installed;
+  call_once( installed, [] {
+    // backtrace() loads libgcc on its first call, which isn't safe in a signal handler
+    array<void*, 1> warm_up {};
+    backtrace( warm_up.data(), warm_up.size() );
+
+    struct sigaction action {};
+    action.sa_handler = handle_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset( &action.sa_mask );
+    CheckSystemCall( "sigaction", sigaction( StallWatchdog::signal_number(), &action, nullptr ) );
+  } );
+}
+
+} // namespace
+
+int StallWatchdog::signal_number()
+{
+  return SIGRTMIN + 2;
+}
+
+StallWatchdog::StallWatchdog( const Clock::duration budget ) : budget_( budget )
+{
+  install_handler();
+  watcher_ = thread { [this] { watch(); } };
+}
+
+StallWatchdog::~StallWatchdog()
+{
+  {
+    const lock_guard lock { mutex_ };
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  watcher_.join();
+}
+
+void StallWatchdog::callback_started( const Clock::time_point start ) noexcept
+{
+  this_thread_watchdog = this;
+  thread_.store( pthread_self(), memory_order_relaxed );
+  generation_.fetch_add( 1, memory_order_relaxed );
+  started_.store( start.time_since_epoch().count(), memory_order_release );
+}
+
+vector<string> StallWatchdog::callback_finished()
+{
+  started_.store( 0, memory_order_release );
+  if ( sampled_generation_.load( memory_order_acquire ) != generation_.load( memory_order_relaxed ) ) {
+    return {};
+  }
+  sampled_generation_.store( 0, memory_order_relaxed );
+
+  vector<string> lines;
+  const unique_ptr<char*, decltype( &free )> symbols { backtrace_symbols( frames_.data(), depth_ ), &free };
+  for ( int i = 0; symbols and i < depth_; ++i ) {
+    lines.emplace_back( symbols.get()[i] ); // NOLINT(*-pointer-arithmetic)
+  }
+  return lines;
+}
+
+// (in the signal handler) record the stack of the callback that has run too long
+void StallWatchdog::sample() noexcept
+{
+  if ( started_.load( memory_order_acquire ) == 0 ) {
+    return; // it finished after all
+  }
+  depth_ = backtrace( frames_.data(), static_cast<int>( frames_.size() ) );
+  sampled_generation_.store( generation_.load( memory_order_relaxed ), memory_order_release );
+}
+
+void StallWatchdog::watch()
+{
+  unique_lock lock { mutex_ };
+  while ( not wake_.wait_for( lock, budget_ / 2, [this] { return stopping_; } ) ) {
+    const uint64_t generation = generation_.load( memory_order_acquire );
+    const Clock::rep started = started_.load( memory_order_acquire );
+    if ( started == 0 or generation != generation_.load( memory_order_acquire ) // (a new callback started)
+         or generation == signalled_generation_
+         or Clock::now() - Clock::time_point { Clock::duration { started } } <= budget_ ) {
+      continue;
+    }
+    signalled_generation_ = generation; // (once per callback)
+    pthread_kill( thread_.load( memory_order_relaxed ), signal_number() );
+  }
+}
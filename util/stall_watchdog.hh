@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Samples the stack of a callback that runs over its budget, while it is still running.
+//
+// The thread running callbacks marks each one's start and end in atomics (no system call, and no
+// lock). A watchdog thread wakes every half budget, and if it finds a callback running for longer
+// than the budget, sends its thread a signal (kSignal, which the watchdog installs a handler for):
+// the handler records the stack, which callback_finished() then symbolizes.
+//
+// A callback blocked in a system call when the signal comes may see it fail with EINTR, if the
+// call can't be restarted (e.g. poll or epoll_wait); reads and writes are restarted (SA_RESTART).
+class StallWatchdog
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr size_t kMaxFrames = 32;
+
+  // The signal used to interrupt a stalled thread (a real-time signal).
+  static int signal_number();
+
+  explicit StallWatchdog( Clock::duration budget );
+  ~StallWatchdog();
+
+  StallWatchdog( const StallWatchdog& other ) = delete;
+  StallWatchdog& operator=( const StallWatchdog& other ) = delete;
+  StallWatchdog( StallWatchdog&& other ) = delete;
+  StallWatchdog& operator=( StallWatchdog&& other ) = delete;
+
+  // Mark the start of a callback on the calling thread (at `start`).
+  void callback_started( Clock::time_point start ) noexcept;
+
+  // Mark the end of the callback, and return the stack sampled while it ran, if any (one line per frame).
+  std::vector<std::string> callback_finished();
+
+  // Called by the signal handler, on the stalled thread.
+  void sample() noexcept;
+
+private:
+  Clock::duration budget_;
+
+  std::atomic<Clock::rep> started_ {}; // when the running callback started (zero while none is)
+  std::atomic<uint64_t> generation_ {};
+  std::atomic<pthread_t> thread_ {};
+  uint64_t signalled_generation_ {}; // (watchdog thread) the last callback it signalled about
+
+  std::array<void*, kMaxFrames> frames_ {};
+  int depth_ {};
+  std::atomic<uint64_t> sampled_generation_ {}; // the callback whose stack is in frames_
+
+  std::mutex mutex_ {};
+  std::condition_variable wake_ {};
+  bool stopping_ {};
+  std::thread watcher_ {};
+
+  void watch();
+};
@@ -0,0 +1,89 @@
+#include "task.hh"
+
+#include "eventloop.hh"
+
+#include <array>
+#include <new>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t kGranule = 64;
+constexpr size_t kSizeClasses = task_detail::kMaxPooledFrame / kGranule;
+constexpr size_t kMaxFreePerClass = 256;
+
+struct FreeFrame
+{
+  FreeFrame* next;
+};
+
+// each thread's recycled frames, by size class (rounded up to the granule)
+struct FramePool
+{
+  array<FreeFrame*, kSizeClasses> free {};
+  array<size_t, kSizeClasses> count {};
+
+  FramePool() = default;
+  ~FramePool();
+  FramePool( const FramePool& other ) = delete;
+  FramePool& operator=( const FramePool& other ) = delete;
+  FramePool( FramePool&& other ) = delete;
+  FramePool& operator=( FramePool&& other ) = delete;
+};
+
+thread_local FramePool pool;
+thread_local bool pool_destroyed = false; // frames freed during thread exit go straight back to the heap
+
+FramePool::~FramePool()
+{
+  pool_destroyed = true;
+  for ( FreeFrame* head : free ) {
+    while ( head ) {
+      ::operator delete( exchange( head, head->next ) );
+    }
+  }
+}
+
+} // namespace
+
+void* task_detail::allocate_frame( size_t size )
+{
+  const size_t size_class = ( size + kGranule - 1 ) / kGranule - 1;
+  if ( size_class >= kSizeClasses or pool_destroyed ) {
+    return ::operator new( size );
+  }
+
+  FreeFrame*& head = pool.free.at( size_class );
+  if ( head ) {
+    --pool.count.at( size_class );
+    return exchange( head, head->next );
+  }
+  return ::operator new( ( size_class + 1 ) * kGranule );
+}
+
+void task_detail::deallocate_frame( void* frame, size_t size ) noexcept
+{
+  const size_t size_class = ( size + kGranule - 1 ) / kGranule - 1;
+  if ( size_class >= kSizeClasses or pool_destroyed or pool.count[size_class] >= kMaxFreePerClass ) {
+    ::operator delete( frame );
+    return;
+  }
+
+  pool.free[size_class] = new ( frame ) FreeFrame { pool.free[size_class] };
+  ++pool.count[size_class];
+}
+
+void task_detail::PromiseBase::finish_detached( EventLoop* loop, exception_ptr exception ) noexcept
+{
+  if ( not exception ) {
+    return;
+  }
+
+  // the task's own stack is gone by now; surface the exception from the loop
+  try {
+    loop->post( [exception] { rethrow_exception( exception ); } );
+  } catch ( ... ) {
+    terminate();
+  }
+}
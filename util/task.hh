@@ -0,0 +1,177 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+class EventLoop;
+
+/*
+ * A lazily started coroutine that produces a T.
+ *
+ * A Task runs when it is awaited (co_await task), and the awaiting coroutine resumes as soon as it
+ * finishes, by symmetric transfer. A Task<void> can also be handed to EventLoop::spawn, which starts
+ * it and lets it run on its own. Coroutines suspend on the loop's awaitables (EventLoop::readable,
+ * writable and sleep, or FileDescriptor::read_some and write_some), and the loop resumes them
+ * directly from its dispatch.
+ *
+ * Coroutine frames come from a per-thread pool of recycled blocks, so a coroutine that is called
+ * over and over (e.g. read_some in a protocol loop) costs no heap allocation once the pool is warm.
+ */
+template<typename T = void>
+class Task;
+
+namespace task_detail {
+
+// Frames of up to kMaxPooledFrame bytes are recycled per thread; larger ones use operator new.
+static constexpr size_t kMaxPooledFrame = 2048;
+void* allocate_frame( size_t size );
+void deallocate_frame( void* frame, size_t size ) noexcept;
+
+struct PromiseBase
+{
+  std::coroutine_handle<> continuation {}; // the coroutine awaiting this one
+  EventLoop* loop {};                       // the loop the task runs on, passed down to the tasks it awaits
+  std::exception_ptr exception {};
+  bool detached {}; // started by EventLoop::spawn: nothing awaits it, and it frees itself
+
+  static void* operator new( size_t size ) { return allocate_frame( size ); }
+  static void operator delete( void* frame, size_t size ) noexcept { deallocate_frame( frame, size ); }
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  // resume the awaiting coroutine, or else free a spawned task
+  struct FinalAwaiter
+  {
+    bool await_ready() const noexcept { return false; }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend( std::coroutine_handle<Promise> handle ) noexcept
+    {
+      PromiseBase& promise = handle.promise();
+      if ( promise.detached ) {
+        finish_detached( promise.loop, std::move( promise.exception ) );
+        handle.destroy();
+        return std::noop_coroutine();
+      }
+      return promise.continuation ? promise.continuation : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+  // a spawned task's exception is rethrown from the loop's next wait_next_event
+  static void finish_detached( EventLoop* loop, std::exception_ptr exception ) noexcept;
+};
+
+template<typename T>
+struct Promise : PromiseBase
+{
+  std::optional<T> value {};
+
+  Task<T> get_return_object();
+
+  template<typename U>
+  void return_value( U&& result )
+  {
+    value.emplace( std::forward<U>( result ) );
+  }
+};
+
+template<>
+struct Promise<void> : PromiseBase
+{
+  Task<void> get_return_object();
+  void return_void() noexcept {}
+};
+
+} // namespace task_detail
+
+template<typename T>
+class Task
+{
+public:
+  using promise_type = task_detail::Promise<T>;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  explicit Task( Handle handle ) : handle_( handle ) {}
+  ~Task()
+  {
+    if ( handle_ ) {
+      handle_.destroy();
+    }
+  }
+
+  Task( const Task& other ) = delete;
+  Task& operator=( const Task& other ) = delete;
+  Task( Task&& other ) noexcept : handle_( std::exchange( other.handle_, nullptr ) ) {}
+  Task& operator=( Task&& other ) noexcept
+  {
+    if ( this != &other ) {
+      if ( handle_ ) {
+        handle_.destroy();
+      }
+      handle_ = std::exchange( other.handle_, nullptr );
+    }
+    return *this;
+  }
+
+  // Give up ownership of the coroutine (see EventLoop::spawn).
+  Handle release() { return std::exchange( handle_, nullptr ); }
+
+  bool done() const { return not handle_ or handle_.done(); }
+
+  // Awaiting a Task starts it, and resumes the awaiting coroutine with its result.
+  class Awaiter
+  {
+    Handle handle_;
+
+  public:
+    explicit Awaiter( Handle handle ) : handle_( handle ) {}
+
+    bool await_ready() const noexcept { return not handle_ or handle_.done(); }
+
+    template<typename Promise>
+    std::coroutine_handle<> await_suspend( std::coroutine_handle<Promise> awaiting ) noexcept
+    {
+      handle_.promise().continuation = awaiting;
+      if constexpr ( std::is_base_of_v<task_detail::PromiseBase, Promise> ) {
+        handle_.promise().loop = awaiting.promise().loop;
+      }
+      return handle_;
+    }
+
+    T await_resume()
+    {
+      auto& promise = handle_.promise();
+      if ( promise.exception ) {
+        std::rethrow_exception( promise.exception );
+      }
+      if constexpr ( not std::is_void_v<T> ) {
+        return std::move( *promise.value );
+      }
+    }
+  };
+
+  Awaiter operator co_await() && noexcept { return Awaiter { handle_ }; }
+
+private:
+  Handle handle_;
+};
+
+template<typename T>
+Task<T> task_detail::Promise<T>::get_return_object()
+{
+  return Task<T> { Task<T>::Handle::from_promise( *this ) };
+}
+
+inline Task<void> task_detail::Promise<void>::get_return_object()
+{
+  return Task<void> { Task<void>::Handle::from_promise( *this ) };
+}
@@ -0,0 +1,305 @@
+#include "timer_wheel.hh"
+
+#include <bit>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+
+TimerWheel::TimerWheel( const Clock::time_point start ) : start_( start )
+{
+  heads_.fill( kNone );
+  tails_.fill( kNone );
+}
+
+// the first tick that begins at or after `time` (a timer for `time` is due once this tick is reached)
+uint64_t TimerWheel::tick_at_or_after( const Clock::time_point time ) const
+{
+  if ( time <= start_ ) {
+    return 0;
+  }
+  return static_cast<uint64_t>( ( time - start_ + kTick - Clock::duration { 1 } ) / kTick );
+}
+
+// the last tick that begins at or before `time`
+uint64_t TimerWheel::tick_before( const Clock::time_point time ) const
+{
+  if ( time <= start_ ) {
+    return 0;
+  }
+  return static_cast<uint64_t>( ( time - start_ ) / kTick );
+}
+
+void TimerWheel::link( const uint32_t index, const uint16_t list )
+{
+  Timer& timer = timers_[index];
+  timer.list = list;
+  timer.prev = tails_.at( list );
+  timer.next = kNone;
+  if ( timer.prev != kNone ) {
+    timers_[timer.prev].next = index;
+  } else {
+    heads_.at( list ) = index;
+  }
+  tails_.at( list ) = index;
+
+  if ( list < kDueList ) {
+    occupied_.at( list / kSlots ).at( list % kSlots / 64 ) |= uint64_t { 1 } << ( list % 64 );
+  }
+}
+
+void TimerWheel::unlink( const uint32_t index )
+{
+  Timer& timer = timers_[index];
+  if ( timer.prev != kNone ) {
+    timers_[timer.prev].next = timer.next;
+  } else {
+    heads_.at( timer.list ) = timer.next;
+  }
+  if ( timer.next != kNone ) {
+    timers_[timer.next].prev = timer.prev;
+  } else {
+    tails_.at( timer.list ) = timer.prev;
+  }
+
+  if ( timer.list < kDueList and heads_.at( timer.list ) == kNone ) {
+    occupied_.at( timer.list / kSlots ).at( timer.list % kSlots / 64 ) &= ~( uint64_t { 1 } << ( timer.list % 64 ) );
+  }
+  timer.list = kNoList;
+}
+
+// A timer goes in the finest level whose current span contains its expiry: level L if the expiry
+// and now_ differ only in the digits of levels L and below.
+void TimerWheel::place( const uint32_t index )
+{
+  const uint64_t expiry = timers_[index].expiry;
+  if ( expiry <= now_ ) {
+    link( index, kDueList );
+    return;
+  }
+
+  for ( unsigned level = 0; level < kLevels; ++level ) {
+    const unsigned shift = kSlotBits * ( level + 1 );
+    if ( ( expiry >> shift ) == ( now_ >> shift ) ) {
+      const auto slot = static_cast<unsigned>( ( expiry >> ( kSlotBits * level ) ) % kSlots );
+      link( index, static_cast<uint16_t>( level * kSlots + slot ) );
+      return;
+    }
+  }
+
+  link( index, kOverflowList );
+}
+
+void TimerWheel::release( const uint32_t index )
+{
+  Timer& timer = timers_[index];
+  timer.callback = nullptr;
+  ++timer.generation;
+  free_timers_.push_back( index );
+  --armed_;
+}
+
+TimerWheel::TimerId TimerWheel::add( const Clock::time_point deadline, CallbackT callback )
+{
+  if ( not callback ) {
+    throw invalid_argument( "TimerWheel: empty callback" );
+  }
+
+  uint32_t index {};
+  if ( free_timers_.empty() ) {
+    if ( timers_.size() >= kNone ) {
+      throw runtime_error( "TimerWheel: too many timers" );
+    }
+    index = static_cast<uint32_t>( timers_.size() );
+    timers_.emplace_back();
+  } else {
+    index = free_timers_.back();
+    free_timers_.pop_back();
+  }
+
+  Timer& timer = timers_[index];
+  timer.expiry = tick_at_or_after( deadline );
+  timer.callback = move( callback );
+  place( index );
+  ++armed_;
+
+  return { index, timer.generation };
+}
+
+bool TimerWheel::cancel( const TimerId id )
+{
+  if ( id.index >= timers_.size() ) {
+    return false;
+  }
+  Timer& timer = timers_[id.index];
+  if ( timer.generation != id.generation or timer.list == kNoList ) {
+    return false;
+  }
+
+  unlink( id.index );
+  release( id.index );
+  return true;
+}
+
+// The earliest tick after now_ at which a slot must be run (level 0) or moved down (higher levels).
+// Timers at level L sit in slots after now_'s own level-L digit, so the first occupied slot past
+// that digit, at the finest level that has one, is the answer.
+optional<uint64_t> TimerWheel::next_event() const
+{
+  for ( unsigned level = 0; level < kLevels; ++level ) {
+    const unsigned shift = kSlotBits * level;
+    const auto current = static_cast<unsigned>( ( now_ >> shift ) % kSlots );
+    const auto& bits = occupied_.at( level );
+
+    for ( unsigned slot = current + 1; slot < kSlots; ) {
+      const uint64_t word = bits.at( slot / 64 ) >> ( slot % 64 );
+      if ( word ) {
+        slot += static_cast<unsigned>( countr_zero( word ) );
+        const uint64_t span_start = ( now_ >> ( shift + kSlotBits ) ) << ( shift + kSlotBits );
+        return span_start + ( static_cast<uint64_t>( slot ) << shift );
+      }
+      slot = ( slot / 64 + 1 ) * 64;
+    }
+  }
+
+  if ( heads_.at( kOverflowList ) != kNone ) {
+    constexpr unsigned wheel_bits = kSlotBits * kLevels;
+    return ( ( now_ >> wheel_bits ) + 1 ) << wheel_bits;
+  }
+
+  return nullopt;
+}
+
+// take every timer off a list (a higher-level slot, or the overflow list) and place it afresh
+void TimerWheel::requeue( const uint16_t list )
+{
+  uint32_t index = exchange( heads_.at( list ), kNone );
+  tails_.at( list ) = kNone;
+  if ( list < kDueList ) {
+    occupied_.at( list / kSlots ).at( list % kSlots / 64 ) &= ~( uint64_t { 1 } << ( list % 64 ) );
+  }
+
+  while ( index != kNone ) {
+    const uint32_t next = timers_[index].next;
+    if ( timers_[index].expiry == now_ ) {
+      link( index, static_cast<uint16_t>( now_ % kSlots ) ); // about to be run
+    } else {
+      place( index );
+    }
+    index = next;
+  }
+}
+
+// (a callback threw) put the timers left on a list back at the front of the due list, in order, so
+// that the next expire() runs them first
+void TimerWheel::return_to_due( const uint16_t list )
+{
+  const uint32_t head = exchange( heads_.at( list ), kNone );
+  const uint32_t tail = exchange( tails_.at( list ), kNone );
+  if ( head == kNone ) {
+    return;
+  }
+  if ( list < kDueList ) {
+    occupied_.at( list / kSlots ).at( list % kSlots / 64 ) &= ~( uint64_t { 1 } << ( list % 64 ) );
+  }
+
+  for ( uint32_t index = head; index != kNone; index = timers_[index].next ) {
+    timers_[index].list = kDueList;
+  }
+  timers_[tail].next = heads_.at( kDueList );
+  if ( heads_.at( kDueList ) != kNone ) {
+    timers_[heads_.at( kDueList )].prev = tail;
+  } else {
+    tails_.at( kDueList ) = tail;
+  }
+  heads_.at( kDueList ) = head;
+}
+
+// take a timer off its list and run its callback
+void TimerWheel::run( const uint32_t index )
+{
+  unlink( index );
+  const CallbackT callback = move( timers_[index].callback );
+  release( index );
+  callback();
+}
+
+// Move now_ forward to `tick`, jumping straight between the ticks where something happens, and
+// run the timers of each level-0 slot as it is reached. Returns how many ran.
+size_t TimerWheel::advance( const uint64_t tick )
+{
+  size_t count = 0;
+  while ( now_ < tick ) {
+    const optional<uint64_t> next = next_event();
+    if ( not next.has_value() or *next > tick ) {
+      now_ = tick;
+      break;
+    }
+    now_ = *next;
+
+    constexpr unsigned wheel_bits = kSlotBits * kLevels;
+    if ( now_ % ( uint64_t { 1 } << wheel_bits ) == 0 ) {
+      requeue( kOverflowList );
+    }
+
+    // from the coarsest level down, so that timers cascaded into a finer slot starting now move on in turn
+    for ( unsigned level = kLevels - 1; level > 0; --level ) {
+      if ( now_ % ( uint64_t { 1 } << ( kSlotBits * level ) ) == 0 ) {
+        const auto slot = static_cast<unsigned>( ( now_ >> ( kSlotBits * level ) ) % kSlots );
+        requeue( static_cast<uint16_t>( level * kSlots + slot ) );
+      }
+    }
+
+    // callbacks can't add to this slot: a timer armed for now_ goes on the due list
+    const auto slot = static_cast<uint16_t>( now_ % kSlots );
+    try {
+      while ( heads_.at( slot ) != kNone ) {
+        run( heads_.at( slot ) );
+        ++count;
+      }
+    } catch ( ... ) {
+      return_to_due( slot ); // (now_ has passed the slot)
+      throw;
+    }
+  }
+  return count;
+}
+
+size_t TimerWheel::expire( const Clock::time_point now )
+{
+  // first the timers that were armed already due; any that these callbacks arm wait for the next call
+  heads_.at( kFiringList ) = exchange( heads_.at( kDueList ), kNone );
+  tails_.at( kFiringList ) = exchange( tails_.at( kDueList ), kNone );
+  for ( uint32_t index = heads_.at( kFiringList ); index != kNone; index = timers_[index].next ) {
+    timers_[index].list = kFiringList;
+  }
+  size_t count = 0;
+  try {
+    while ( heads_.at( kFiringList ) != kNone ) {
+      run( heads_.at( kFiringList ) );
+      ++count;
+    }
+  } catch ( ... ) {
+    return_to_due( kFiringList );
+    throw;
+  }
+
+  return count + advance( tick_before( now ) );
+}
+
+optional<TimerWheel::Clock::duration> TimerWheel::time_until_next( const Clock::time_point now ) const
+{
+  if ( armed_ == 0 ) {
+    return nullopt;
+  }
+  if ( heads_.at( kDueList ) != kNone ) {
+    return Clock::duration::zero();
+  }
+
+  const optional<uint64_t> next = next_event();
+  if ( not next.has_value() ) {
+    return nullopt; // every armed timer is being run
+  }
+  const Clock::time_point when = start_ + kTick * static_cast<Clock::rep>( *next );
+  return when > now ? when - now : Clock::duration::zero();
+}
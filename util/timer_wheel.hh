@@ -0,0 +1,98 @@
+#pragma once
+
+#include "inline_function.hh"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// A hierarchical timing wheel: timers with O(1) arm and cancel, and expiry whose cost depends on
+// the number of timers that fire.
+//
+// Time is counted in ticks of kTick from the wheel's start. There are four levels of 256 slots:
+// level L holds timers due within the current 256^(L+1)-tick span, in the slot for their level-L
+// digit. When the wheel reaches the start of a slot at level L > 0, that slot's timers move down
+// to finer levels. Timers further away than the whole wheel wait in an overflow list.
+class TimerWheel
+{
+public:
+  using Clock = std::chrono::steady_clock;
+  using CallbackT = InlineFunction<void( void )>;
+
+  static constexpr Clock::duration kTick = std::chrono::milliseconds { 1 };
+
+  // Identifies a timer; stays safe to cancel after the timer has fired or been cancelled.
+  struct TimerId
+  {
+    uint32_t index {};
+    uint32_t generation {};
+  };
+
+  explicit TimerWheel( Clock::time_point start = Clock::now() );
+
+  // Arm a timer to run `callback` (from expire) once `deadline` has passed.
+  TimerId add( Clock::time_point deadline, CallbackT callback );
+
+  // Disarm a timer. Returns false if it already fired or was cancelled.
+  bool cancel( TimerId id );
+
+  // Run the callbacks of every timer due by `now`, in deadline order (after any armed with a
+  // deadline already past), and return how many ran. Callbacks may add or cancel timers (but not
+  // call expire); new timers that are already due run on the next call.
+  size_t expire( Clock::time_point now );
+
+  // How long from `now` until expire() may next have work to do (at or before the next deadline),
+  // or nullopt if no timer is armed.
+  std::optional<Clock::duration> time_until_next( Clock::time_point now ) const;
+
+  size_t size() const { return armed_; }
+  bool empty() const { return armed_ == 0; }
+
+private:
+  static constexpr unsigned kLevels = 4;
+  static constexpr unsigned kSlotBits = 8;
+  static constexpr unsigned kSlots = 1U << kSlotBits;
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  // list heads: the wheel's slots, then timers armed already due, timers beyond the wheel, and timers being run
+  static constexpr uint16_t kDueList = kLevels * kSlots;
+  static constexpr uint16_t kOverflowList = kDueList + 1;
+  static constexpr uint16_t kFiringList = kDueList + 2;
+  static constexpr uint16_t kNoList = kDueList + 3;
+
+  struct Timer
+  {
+    uint64_t expiry {}; // tick
+    uint32_t prev { kNone };
+    uint32_t next { kNone };
+    uint32_t generation {};
+    uint16_t list { kNoList };
+    CallbackT callback {};
+  };
+
+  Clock::time_point start_;
+  uint64_t now_ {}; // every timer due by this tick has run (or, if armed since, is on the due list)
+  size_t armed_ {};
+
+  std::vector<Timer> timers_ {};
+  std::vector<uint32_t> free_timers_ {};
+  std::array<uint32_t, kFiringList + 1> heads_ {}; // each list runs in the order its timers joined it
+  std::array<uint32_t, kFiringList + 1> tails_ {};
+  std::array<std::array<uint64_t, kSlots / 64>, kLevels> occupied_ {}; // one bit per non-empty slot
+
+  uint64_t tick_at_or_after( Clock::time_point time ) const;
+  uint64_t tick_before( Clock::time_point time ) const;
+
+  void link( uint32_t index, uint16_t list );
+  void unlink( uint32_t index );
+  void place( uint32_t index ); // put a timer in the list for its expiry, relative to now_
+  void release( uint32_t index );
+
+  std::optional<uint64_t> next_event() const; // the next tick with timers to run or move down
+  size_t advance( uint64_t tick );
+  void run( uint32_t index );
+  void requeue( uint16_t list );
+  void return_to_due( uint16_t list );
+};
@@ -0,0 +1,268 @@
+#include "tracer.hh"
+
+#include <array>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+
+constexpr auto kFlushInterval = milliseconds { 10 };
+
+struct Record
+{
+  Tracer::Clock::time_point start {};
+  Tracer::Clock::duration duration {};
+  uint32_t name {};
+  Tracer::Kind kind {};
+};
+
+// One thread's records: the thread pushes, and the flusher pops (a single-producer, single-consumer ring).
+class Ring
+{
+  vector<Record> records_ = vector<Record>( Tracer::kRingRecords );
+  atomic<uint64_t> head_ {}; // the next record to push (written by the thread)
+  atomic<uint64_t> tail_ {}; // the next record to pop (written by the flusher)
+
+public:
+  int tid { static_cast<int>( gettid() ) };
+  string thread_name {};
+  bool announced {}; // (flusher) the thread's name has been written to the trace
+
+  Ring()
+  {
+    array<char, 16> name {};
+    if ( pthread_getname_np( pthread_self(), name.data(), name.size() ) == 0 ) {
+      thread_name = name.data();
+    }
+  }
+
+  bool push( const Record& record )
+  {
+    const uint64_t head = head_.load( memory_order_relaxed );
+    if ( head - tail_.load( memory_order_acquire ) == records_.size() ) {
+      return false;
+    }
+    records_[head % records_.size()] = record;
+    head_.store( head + 1, memory_order_release );
+    return true;
+  }
+
+  template<typename F>
+  void drain( F&& visit )
+  {
+    const uint64_t head = head_.load( memory_order_acquire );
+    uint64_t tail = tail_.load( memory_order_relaxed );
+    for ( ; tail != head; ++tail ) {
+      visit( records_[tail % records_.size()] );
+    }
+    tail_.store( tail, memory_order_release );
+  }
+};
+
+struct State
+{
+  mutex lock {}; // guards everything here but the rings' records
+  vector<shared_ptr<Ring>> rings {};
+  vector<string> names {};
+  unordered_map<string, uint32_t> name_ids {};
+
+  ofstream out {};
+  bool first_event {};
+  Tracer::Clock::time_point origin {};
+  string buffer {};
+
+  thread flusher {};
+  condition_variable wake {};
+  bool stopping {};
+
+  atomic<uint64_t> dropped {};
+};
+
+State& state()
+{
+  static State s;
+  return s;
+}
+
+thread_local shared_ptr<Ring> this_thread_ring; // NOLINT(*-avoid-non-const-global-variables)
+
+void append_json_string( string& out, string_view text )
+{
+  out += '"';
+  for ( const char c : text ) {
+    if ( c == '"' or c == '\\' ) {
+      out += '\\';
+      out += c;
+    } else if ( static_cast<unsigned char>( c ) < 0x20 ) {
+      array<char, 8> escaped {};
+      snprintf( escaped.data(), escaped.size(), "\\u%04x", c );
+      out += escaped.data();
+    } else {
+      out += c;
+    }
+  }
+  out += '"';
+}
+
+const char* kind_name( Tracer::Kind kind )
+{
+  switch ( kind ) {
+    case Tracer::Kind::Wait:
+      return "wait";
+    case Tracer::Kind::Dispatch:
+      return "dispatch";
+    case Tracer::Kind::Callback:
+      break;
+  }
+  return "callback";
+}
+
+// write out every record in the rings, and forget the rings of threads that have exited (with the lock held)
+void flush( State& s )
+{
+  const int pid = getpid();
+  auto& out = s.buffer;
+  out.clear();
+
+  const auto begin_event = [&] {
+    out += s.first_event ? "\n" : ",\n";
+    s.first_event = false;
+  };
+
+  for ( auto& ring : s.rings ) {
+    if ( not ring->announced ) {
+      ring->announced = true;
+      begin_event();
+      out += R"({"name":"thread_name","ph":"M","pid":)" + to_string( pid ) + R"(,"tid":)" + to_string( ring->tid )
+             + R"(,"args":{"name":)";
+      append_json_string( out, ring->thread_name.empty() ? "thread " + to_string( ring->tid ) : ring->thread_name );
+      out += "}}";
+    }
+
+    ring->drain( [&]( const Record& record ) {
+      array<char, 128> numbers {};
+      snprintf( numbers.data(),
+                numbers.size(),
+                R"(,"ph":"X","ts":%.3f,"dur":%.3f,"pid":%d,"tid":%d})",
+                duration<double, micro>( record.start - s.origin ).count(),
+                duration<double, micro>( record.duration ).count(),
+                pid,
+                ring->tid );
+      begin_event();
+      out += R"({"name":)";
+      append_json_string( out, s.names.at( record.name ) );
+      out += R"(,"cat":")";
+      out += kind_name( record.kind );
+      out += '"';
+      out += numbers.data();
+    } );
+  }
+
+  // a ring that only the list still holds belongs to a thread that has exited, and has been drained
+  erase_if( s.rings, []( const shared_ptr<Ring>& ring ) { return ring.use_count() == 1; } );
+
+  s.out << out;
+  s.out.flush();
+}
+
+} // namespace
+
+void Tracer::start( const string& path )
+{
+  State& s = state();
+  const lock_guard lock { s.lock };
+  if ( s.out.is_open() ) {
+    throw runtime_error( "Tracer: a trace is already being written" );
+  }
+
+  s.out.open( path, ios::trunc );
+  if ( not s.out ) {
+    throw runtime_error( "Tracer: could not open " + path );
+  }
+  s.out << R"({"displayTimeUnit":"ns","traceEvents":[)";
+  s.first_event = true;
+  s.origin = Clock::now();
+
+  // records left from an earlier trace are stale
+  for ( auto& ring : s.rings ) {
+    ring->drain( []( const Record& ) {} );
+    ring->announced = false;
+  }
+
+  s.stopping = false;
+  s.flusher = thread { [&s] {
+    unique_lock flusher_lock { s.lock };
+    while ( not s.stopping ) {
+      s.wake.wait_for( flusher_lock, kFlushInterval );
+      flush( s );
+    }
+  } };
+  enabled_.store( true, memory_order_relaxed );
+}
+
+void Tracer::stop()
+{
+  State& s = state();
+  enabled_.store( false, memory_order_relaxed );
+  {
+    const lock_guard lock { s.lock };
+    if ( not s.out.is_open() ) {
+      return;
+    }
+    s.stopping = true;
+  }
+  s.wake.notify_one();
+  s.flusher.join();
+
+  const lock_guard lock { s.lock };
+  flush( s );
+  s.out << "\n]}\n";
+  s.out.close();
+}
+
+uint32_t Tracer::intern( string_view name )
+{
+  State& s = state();
+  const lock_guard lock { s.lock };
+  const auto [it, added] = s.name_ids.try_emplace( string { name }, static_cast<uint32_t>( s.names.size() ) );
+  if ( added ) {
+    s.names.emplace_back( name );
+  }
+  return it->second;
+}
+
+void Tracer::record( const Kind kind, const uint32_t name, const Clock::time_point start, const Clock::time_point end )
+{
+  if ( not enabled() ) {
+    return;
+  }
+
+  if ( not this_thread_ring ) {
+    auto ring = make_shared<Ring>();
+    State& s = state();
+    const lock_guard lock { s.lock };
+    s.rings.push_back( ring );
+    this_thread_ring = move( ring );
+  }
+
+  if ( not this_thread_ring->push( { start, end - start, name, kind } ) ) {
+    state().dropped.fetch_add( 1, memory_order_relaxed );
+  }
+}
+
+uint64_t Tracer::dropped()
+{
+  return state().dropped.load( memory_order_relaxed );
+}
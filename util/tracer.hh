@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// A process-wide timeline of spans (e.g. an EventLoop's waits, dispatches and callbacks), written
+// in the Chrome trace event format, which chrome://tracing and Perfetto (ui.perfetto.dev) open.
+//
+// Each thread records spans as fixed-size binary records into a ring buffer of its own, with no
+// lock and no allocation; a background thread drains the rings every few milliseconds and writes
+// the JSON. A full ring drops new records (see dropped()) rather than make its thread wait.
+// Span names are interned once (intern()), so records carry a number, not a string.
+//
+// While no trace is being written, recording a span costs a single branch on enabled().
+class Tracer
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // What a span is: shown as its category ("cat") in the trace, while its name is interned (see intern).
+  enum class Kind : uint8_t
+  {
+    Wait,     // blocked in the kernel, waiting for events
+    Dispatch, // one turn of an event loop
+    Callback  // a callback
+  };
+
+  static constexpr size_t kRingRecords = size_t { 1 } << 16; // per thread
+
+  // Start writing a trace to `path` (truncating it). Throws if a trace is already being written.
+  static void start( const std::string& path );
+
+  // Write out every span recorded so far, finish the file, and stop tracing.
+  static void stop();
+
+  static bool enabled() { return enabled_.load( std::memory_order_relaxed ); }
+
+  // The number for a span name (the same name always gets the same number). Takes a lock.
+  static uint32_t intern( std::string_view name );
+
+  // Record a span on the calling thread's ring (if tracing is enabled).
+  static void record( Kind kind, uint32_t name, Clock::time_point start, Clock::time_point end );
+
+  // Spans dropped because their thread's ring was full, since the process started.
+  static uint64_t dropped();
+
+  // Records a span from its construction to its destruction (when tracing was enabled at construction).
+  class Span
+  {
+    Kind kind_;
+    uint32_t name_;
+    Clock::time_point start_;
+
+  public:
+    Span( Kind kind, uint32_t name )
+      : kind_( kind ), name_( name ), start_( enabled() ? Clock::now() : Clock::time_point {} )
+    {}
+    ~Span()
+    {
+      if ( start_ != Clock::time_point {} ) {
+        record( kind_, name_, start_, Clock::now() );
+      }
+    }
+
+    Span( const Span& other ) = delete;
+    Span& operator=( const Span& other ) = delete;
+    Span( Span&& other ) = delete;
+    Span& operator=( Span&& other ) = delete;
+  };
+
+private:
+  static inline std::atomic<bool> enabled_ {};
+};